@@ -16,6 +16,17 @@
 #include "dbg.h"
 using namespace common;
 
+// pin a pipeline stage to one cpu core, cpu < 0 keeps the default scheduling
+static void setThreadAffinity(std::thread &thread, const int &cpu)
+{
+    if (cpu < 0) return;
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    CPU_SET(cpu, &cpu_set);
+    if (pthread_setaffinity_np(thread.native_handle(), sizeof(cpu_set_t), &cpu_set) != 0)
+        printf("[estimator] fail to set the affinity of a pipeline thread to cpu %d\n", cpu);
+}
+
 Estimator::Estimator()
 {
     ROS_INFO("init begins");
@@ -25,14 +36,21 @@ Estimator::Estimator()
 
 Estimator::~Estimator()
 {
-    delete[] para_pose_;
-    delete[] para_td_;
-    delete[] para_ex_pose_;
     if (MULTIPLE_THREAD)
     {
+        {
+            std::lock_guard<std::mutex> lock(m_pipeline_);
+            b_pipeline_stop_ = true;
+        }
+        cv_cloud_.notify_all();
+        cv_feature_.notify_all();
+        extract_thread_.join();
         process_thread_.join();
         printf("join thread \n");
     }
+    delete[] para_pose_;
+    delete[] para_td_;
+    delete[] para_ex_pose_;
 }
 
 void Estimator::setParameter()
@@ -83,21 +101,32 @@ void Estimator::setParameter()
         pose_local_[i].resize(WINDOW_SIZE + 1);
     }
 
-    surf_points_local_map_.resize(NUM_OF_LASER);
+    surf_voxel_map_.resize(NUM_OF_LASER);
+    corner_voxel_map_.resize(NUM_OF_LASER);
     surf_points_local_map_filtered_.resize(NUM_OF_LASER);
     surf_points_pivot_map_.resize(NUM_OF_LASER);
-    corner_points_local_map_.resize(NUM_OF_LASER);
     corner_points_local_map_filtered_.resize(NUM_OF_LASER);
     corner_points_pivot_map_.resize(NUM_OF_LASER);
 
     cumu_surf_map_features_.resize(NUM_OF_LASER);
     cumu_corner_map_features_.resize(NUM_OF_LASER);
 
+    feature_frame_pool_.resize(NUM_OF_LASER);
+
     printf("MULTIPLE_THREAD is %d\n", MULTIPLE_THREAD);
+    if (!init_thread_flag_)
+    {
+        // the queues can only be resized before the stages are running
+        cloud_queue_.reset(PIPELINE_QUEUE_SIZE);
+        feature_queue_.reset(PIPELINE_QUEUE_SIZE);
+    }
     if (MULTIPLE_THREAD && !init_thread_flag_)
     {
         init_thread_flag_ = true;
+        extract_thread_ = std::thread(&Estimator::extractMeasurements, this);
         process_thread_ = std::thread(&Estimator::processMeasurements, this);
+        setThreadAffinity(extract_thread_, EXTRACT_THREAD_CPU);
+        setThreadAffinity(process_thread_, PROCESS_THREAD_CPU);
     }
 
     para_pose_ = new double *[OPT_WINDOW_SIZE + 1];
@@ -111,6 +140,7 @@ void Estimator::setParameter()
         para_ex_pose_[i] = new double[SIZE_POSE];
     }
     para_td_ = new double[NUM_OF_LASER];
+    setupOdomProblem();
 
     eig_thre_ = Eigen::VectorXd::Constant(OPT_WINDOW_SIZE + 1 + NUM_OF_LASER, 1, LAMBDA_INITIAL);
     dbg(eig_thre_);
@@ -123,7 +153,9 @@ void Estimator::setParameter()
     pose_calib_.resize(NUM_OF_LASER);
     calib_converge_.resize(NUM_OF_LASER, false);
 
-    img_segment_.setParameter(N_SCANS, HORIZON_SCAN, MIN_CLUSTER_SIZE, SEGMENT_VALID_POINT_NUM, SEGMENT_VALID_LINE_NUM);
+    img_segment_.resize(NUM_OF_LASER);
+    for (size_t i = 0; i < NUM_OF_LASER; i++)
+        img_segment_[i].setParameter(N_SCANS, HORIZON_SCAN, MIN_CLUSTER_SIZE, SEGMENT_VALID_POINT_NUM, SEGMENT_VALID_LINE_NUM);
     v_laser_path_.resize(NUM_OF_LASER);
 
     m_process_.unlock();
@@ -166,10 +198,10 @@ void Estimator::clearState()
     corner_points_stack_.clear();
     corner_points_stack_size_.clear();
 
-    surf_points_local_map_.clear();
+    surf_voxel_map_.clear();
+    corner_voxel_map_.clear();
     surf_points_local_map_filtered_.clear();
     surf_points_pivot_map_.clear();
-    corner_points_local_map_.clear();
     corner_points_local_map_filtered_.clear();
     corner_points_pivot_map_.clear();
 
@@ -184,6 +216,7 @@ void Estimator::clearState()
     pose_local_.clear();
 
     last_marginalization_info_ = nullptr;
+    odom_arena_.release();
 
     d_factor_calib_.clear();
     cur_eig_calib_.clear();
@@ -218,173 +251,184 @@ void Estimator::changeSensorType(int use_imu, int use_stereo)
 void Estimator::inputCloud(const double &t, const std::vector<PointCloud> &v_laser_cloud_in)
 {
     assert(v_laser_cloud_in.size() == NUM_OF_LASER);
- 
+
+    common::timing::Timer ingest_timer("odom_ingest");
+    std::vector<PointICloud> v_laser_cloud(NUM_OF_LASER);
+    #pragma omp parallel for num_threads(NUM_OF_LASER)
+    for (size_t i = 0; i < v_laser_cloud_in.size(); i++)
+    {
+        f_extract_.calTimestamp(v_laser_cloud_in[i], v_laser_cloud[i]); //laser_cloud：每个点的强度是在一帧中的时间比例
+    }
+    ingest_timer.Stop();
+    inputMeasurement(t, v_laser_cloud);
+}
+
+void Estimator::inputCloud(const double &t, const std::vector<PointITimeCloud> &v_laser_cloud_in)
+{
+    assert(v_laser_cloud_in.size() == NUM_OF_LASER);
+
+    common::timing::Timer ingest_timer("odom_ingest");
+    std::vector<PointICloud> v_laser_cloud(NUM_OF_LASER);
+    #pragma omp parallel for num_threads(NUM_OF_LASER)
+    for (size_t i = 0; i < v_laser_cloud_in.size(); i++)
+    {
+        f_extract_.calTimestamp(v_laser_cloud_in[i], v_laser_cloud[i]);
+    }
+    ingest_timer.Stop();
+    inputMeasurement(t, v_laser_cloud);
+}
+
+void Estimator::inputMeasurement(const double &t, std::vector<PointICloud> &v_laser_cloud)
+{
+    if (!MULTIPLE_THREAD)
+    {
+        feature_queue_.tryPush(make_pair(t, extractFeature(v_laser_cloud)));
+        processMeasurements();
+        return;
+    }
+    // hand the clouds over to the extraction stage
+    size_t drop_cnt = cloud_queue_.pushDropOldest(make_pair(t, std::move(v_laser_cloud)));
+    if (drop_cnt != 0)
+    {
+        cloud_drop_cnt_ += drop_cnt;
+        std::cout << common::GREEN << "drop the oldest lidar frame before feature extraction for real time performance"
+                  << common::RESET << std::endl;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_pipeline_);
+        cloud_push_cnt_++;
+    }
+    cv_cloud_.notify_one();
+}
+
+std::vector<FeatureFramePtr> Estimator::extractFeature(const std::vector<PointICloud> &v_laser_cloud)
+{
     common::timing::Timer mea_pre_timer("odom_mea_pre");
-    std::vector<cloudFeature> feature_frame(NUM_OF_LASER);
+    std::vector<FeatureFramePtr> feature_frame(NUM_OF_LASER);
 
     if (NUM_OF_LASER == 1)
     {
-        PointICloud laser_cloud;
-        f_extract_.calTimestamp(v_laser_cloud_in[0], laser_cloud);
-
-        PointICloud laser_cloud_segment, laser_cloud_outlier;
+        // segment directly into the recycled buffers of the frame
+        feature_frame[0] = feature_frame_pool_[0].acquire();
         ScanInfo scan_info(N_SCANS, SEGMENT_CLOUD);
         if (ESTIMATE_EXTRINSIC != 0) scan_info.segment_flag_ = false;
-        img_segment_.segmentCloud(laser_cloud, laser_cloud_segment, laser_cloud_outlier, scan_info);
-
-        f_extract_.extractCloud(laser_cloud_segment, scan_info, feature_frame[0]);
-        feature_frame[0].insert(pair<std::string, PointICloud>("laser_cloud_outlier", laser_cloud_outlier));
-        total_corner_feature_ += feature_frame[0]["corner_points_less_sharp"].size();
-        total_surf_feature_ += feature_frame[0]["surf_points_less_flat"].size();
-
-        // PointICloud laser_cloud_segment, laser_cloud_outlier;
-        // ScanInfo scan_info(N_SCANS, SEGMENT_CLOUD);
-        // if (ESTIMATE_EXTRINSIC != 0) scan_info.segment_flag_ = false;
-        // img_segment_.segmentCloud(laser_cloud, laser_cloud_segment, laser_cloud_outlier, scan_info);
-
-        // f_extract_.extractCloud_aloam(laser_cloud, scan_info, feature_frame[0]);
-        // laser_cloud_outlier.push_back(laser_cloud[0]);
-        // feature_frame[0].insert(pair<std::string, PointICloud>("laser_cloud_outlier", laser_cloud_outlier));
-        // total_corner_feature_ += feature_frame[0]["corner_points_less_sharp"].size();
-        // total_surf_feature_ += feature_frame[0]["surf_points_less_flat"].size();        
+        img_segment_[0].segmentCloud(v_laser_cloud[0], 
+                                  feature_frame[0]->cloud_[LASER_CLOUD], 
+                                  feature_frame[0]->cloud_[LASER_CLOUD_OUTLIER], 
+                                  scan_info);
+
+        f_extract_.extractCloud(scan_info, *feature_frame[0]);
     } 
     else 
     {
-        std::vector<cloudFeature *> feature_frame_ptr(NUM_OF_LASER);
         #pragma omp parallel for num_threads(NUM_OF_LASER)
-        for (size_t i = 0; i < v_laser_cloud_in.size(); i++)
+        for (size_t i = 0; i < NUM_OF_LASER; i++)
         {
-            PointICloud laser_cloud;
-            f_extract_.calTimestamp(v_laser_cloud_in[i], laser_cloud); //laser_cloud：每个点的强度是在一帧中的时间比例
-
-            PointICloud laser_cloud_segment, laser_cloud_outlier;
+            feature_frame[i] = feature_frame_pool_[i].acquire();
             ScanInfo scan_info(N_SCANS, SEGMENT_CLOUD); //16*1
             if (ESTIMATE_EXTRINSIC != 0) scan_info.segment_flag_ = false; //TODO(jxl):当需要对外参提纯或者估计外参时，不移除没有聚类的点
-            img_segment_.segmentCloud(laser_cloud, laser_cloud_segment, laser_cloud_outlier, scan_info);
+            img_segment_[i].segmentCloud(v_laser_cloud[i], 
+                                      feature_frame[i]->cloud_[LASER_CLOUD], 
+                                      feature_frame[i]->cloud_[LASER_CLOUD_OUTLIER], 
+                                      scan_info);
             //laser_cloud_outlier: 没有形成聚类的points
             //对点云进行聚类，把没有聚类的点移除； 点的强度为：线号(最底下线束为0，最上面线束最大)+时间比例
 
-            feature_frame_ptr[i] = new cloudFeature;
-            f_extract_.extractCloud(laser_cloud_segment, scan_info, *feature_frame_ptr[i]);
+            f_extract_.extractCloud(scan_info, *feature_frame[i]);
             //依次对一帧的scan提取corner sharp, less corner sharp, surf flat, less surf flat
-
-            feature_frame_ptr[i]->insert(pair<std::string, PointICloud>("laser_cloud_outlier", laser_cloud_outlier));
         }
+    }
 
-        for (size_t i = 0; i < NUM_OF_LASER; i++) 
-        {
-            feature_frame[i] = *feature_frame_ptr[i];
-            total_corner_feature_ += feature_frame[i]["corner_points_less_sharp"].size();
-            total_surf_feature_ += feature_frame[i]["surf_points_less_flat"].size();
-        }
-        for (auto &frame_ptr : feature_frame_ptr) delete frame_ptr;    
+    for (size_t i = 0; i < NUM_OF_LASER; i++) 
+    {
+        total_corner_feature_ += feature_frame[i]->cloud_[CORNER_POINTS_LESS_SHARP].size();
+        total_surf_feature_ += feature_frame[i]->cloud_[SURF_POINTS_LESS_FLAT].size();
     }
 
     double mea_pre_time = mea_pre_timer.Stop();
-    printf("meaPre time: %fms (%lu*%fms)\n", mea_pre_time * 1000, v_laser_cloud_in.size(), 
-                                             mea_pre_time * 1000 / v_laser_cloud_in.size());
-    // dbg(mea_pre_time * 1000, v_laser_cloud_in.size());
-
-    m_buf_.lock();
-    feature_buf_.push(make_pair(t, feature_frame)); //把每帧的features压入到队列中
-    m_buf_.unlock();
-    if (!MULTIPLE_THREAD) processMeasurements();
+    printf("meaPre time: %fms (%lu*%fms)\n", mea_pre_time * 1000, v_laser_cloud.size(), 
+                                             mea_pre_time * 1000 / v_laser_cloud.size());
+    return feature_frame;
 }
 
-void Estimator::inputCloud(const double &t, const std::vector<PointITimeCloud> &v_laser_cloud_in)
+// stage 2: segmentation and feature extraction of frame k+1 while frame k is optimized
+// sleeps until inputMeasurement() pushes a frame (no polling)
+void Estimator::extractMeasurements()
 {
-    assert(v_laser_cloud_in.size() == NUM_OF_LASER);
-
-    common::timing::Timer mea_pre_timer("odom_mea_pre");
-    std::vector<cloudFeature> feature_frame(NUM_OF_LASER);
-
-    if (NUM_OF_LASER == 1)
-    {
-        PointICloud laser_cloud;
-        f_extract_.calTimestamp(v_laser_cloud_in[0], laser_cloud);
-
-        PointICloud laser_cloud_segment, laser_cloud_outlier;
-        ScanInfo scan_info(N_SCANS, SEGMENT_CLOUD);
-        if (ESTIMATE_EXTRINSIC != 0) scan_info.segment_flag_ = false;
-        img_segment_.segmentCloud(laser_cloud, laser_cloud_segment, laser_cloud_outlier, scan_info);
-
-        f_extract_.extractCloud(laser_cloud_segment, scan_info, feature_frame[0]);
-        feature_frame[0].insert(pair<std::string, PointICloud>("laser_cloud_outlier", laser_cloud_outlier));
-        total_corner_feature_ += feature_frame[0]["corner_points_less_sharp"].size();
-        total_surf_feature_ += feature_frame[0]["surf_points_less_flat"].size();
-    } 
-    else
+    size_t num_push_seen = 0;
+    std::pair<double, std::vector<PointICloud> > cloud_meas;
+    while (true)
     {
-        std::vector<cloudFeature *> feature_frame_ptr(NUM_OF_LASER);
-        #pragma omp parallel for num_threads(NUM_OF_LASER)
-        for (size_t i = 0; i < v_laser_cloud_in.size(); i++)
         {
-            PointICloud laser_cloud;
-            f_extract_.calTimestamp(v_laser_cloud_in[i], laser_cloud);
-
-            PointICloud laser_cloud_segment, laser_cloud_outlier;
-            ScanInfo scan_info(N_SCANS, SEGMENT_CLOUD);
-            if (ESTIMATE_EXTRINSIC != 0) scan_info.segment_flag_ = false;
-            img_segment_.segmentCloud(laser_cloud, laser_cloud_segment, laser_cloud_outlier, scan_info);
-
-            feature_frame_ptr[i] = new cloudFeature;
-            f_extract_.extractCloud(laser_cloud_segment, scan_info, *feature_frame_ptr[i]);
-            feature_frame_ptr[i]->insert(pair<std::string, PointICloud>("laser_cloud_outlier", laser_cloud_outlier));
+            std::unique_lock<std::mutex> lock(m_pipeline_);
+            cv_cloud_.wait(lock, [&] { return b_pipeline_stop_ || (cloud_push_cnt_ != num_push_seen); });
+            if (b_pipeline_stop_) break;
+            num_push_seen = cloud_push_cnt_;
         }
-
-        for (size_t i = 0; i < NUM_OF_LASER; i++)
+        while (cloud_queue_.tryPop(cloud_meas))
         {
-            feature_frame[i] = *feature_frame_ptr[i];
-            total_corner_feature_ += feature_frame[i]["corner_points_less_sharp"].size();
-            total_surf_feature_ += feature_frame[i]["surf_points_less_flat"].size();
+            std::vector<FeatureFramePtr> feature_frame = extractFeature(cloud_meas.second);
+            size_t drop_cnt = feature_queue_.pushDropOldest(make_pair(cloud_meas.first, std::move(feature_frame))); //把每帧的features压入到队列中
+            if (drop_cnt != 0)
+            {
+                feature_drop_cnt_ += drop_cnt;
+                std::cout << common::GREEN << "drop the oldest feature frame before tracking for real time performance"
+                          << common::RESET << std::endl;
+            }
+            {
+                std::lock_guard<std::mutex> lock(m_pipeline_);
+                feature_push_cnt_++;
+            }
+            cv_feature_.notify_one();
         }
-        for (auto &frame_ptr : feature_frame_ptr) delete frame_ptr;
     }
-
-    double mea_pre_time = mea_pre_timer.Stop();
-    printf("meaPre time: %fms (%lu*%fms)\n", mea_pre_time * 1000, v_laser_cloud_in.size(), 
-                                             mea_pre_time * 1000 / v_laser_cloud_in.size());
-    // dbg(mea_pre_time * 1000, v_laser_cloud_in.size());
-
-    m_buf_.lock();
-    feature_buf_.push(make_pair(t, feature_frame));
-    m_buf_.unlock();
-    if (!MULTIPLE_THREAD) processMeasurements();
 }
 
+// stage 3: tracking, local map and window optimization
+// these run on one thread since the tracker of frame k+1 starts from the optimized pose of frame k
+// sleeps until extractMeasurements() pushes a frame, without MULTIPLE_THREAD only processes the pushed frame
 void Estimator::processMeasurements()
 {
-    while (1)
+    if (!MULTIPLE_THREAD)
+    {
+        if (feature_queue_.tryPop(cur_feature_)) processFeature();
+        return;
+    }
+    size_t num_push_seen = 0;
+    while (true)
     {
-        if (!feature_buf_.empty())
         {
-            cur_feature_ = feature_buf_.front();
-            cur_time_ = cur_feature_.first + td_; //td_ = 0
-            assert(cur_feature_.second.size() == NUM_OF_LASER);
+            std::unique_lock<std::mutex> lock(m_pipeline_);
+            cv_feature_.wait(lock, [&] { return b_pipeline_stop_ || (feature_push_cnt_ != num_push_seen); });
+            if (b_pipeline_stop_) break;
+            num_push_seen = feature_push_cnt_;
+        }
+        while (!b_pipeline_stop_ && feature_queue_.tryPop(cur_feature_)) processFeature(); //only the frame pointers are moved, not the clouds
+    }
+}
 
-            m_buf_.lock();
-            feature_buf_.pop(); //处理一帧，pop一次
-            m_buf_.unlock();
+void Estimator::processFeature()
+{
+    cur_time_ = cur_feature_.first + td_; //td_ = 0
+    assert(cur_feature_.second.size() == NUM_OF_LASER);
 
-            m_process_.lock();
-            common::timing::Timer odom_process_timer("odom_process");
+    m_process_.lock();
+    common::timing::Timer odom_process_timer("odom_process");
 
-            process(); //前端里程计模块
+    process(); //前端里程计模块
 
-            double time_process = odom_process_timer.Stop() * 1000;
-            std::cout << common::RED << "frame: " << frame_cnt_
-                      << ", odom process time: " << time_process << "ms" << common::RESET << std::endl << std::endl;
-            LOG_EVERY_N(INFO, 20) << "odom process time: " << time_process << "ms";
+    double time_process = odom_process_timer.Stop() * 1000;
+    std::cout << common::RED << "frame: " << frame_cnt_
+              << ", odom process time: " << time_process << "ms" 
+              << ", queued: " << cloud_queue_.size() << "/" << feature_queue_.size()
+              << ", dropped: " << cloud_drop_cnt_ << "/" << feature_drop_cnt_ << common::RESET << std::endl << std::endl;
+    LOG_EVERY_N(INFO, 20) << "odom process time: " << time_process << "ms";
 
-            // printStatistics(*this, 0);
-            pubOdometry(*this, cur_time_);
-            if (frame_cnt_ % SKIP_NUM_ODOM_PUB == 0) pubPointCloud(*this, cur_time_); 
-            frame_cnt_++;
-            m_process_.unlock();
-        }
-        if (!MULTIPLE_THREAD) break;
-        std::this_thread::sleep_for(std::chrono::milliseconds(2));
-    }
+    // printStatistics(*this, 0);
+    pubOdometry(*this, cur_time_);
+    if (frame_cnt_ % SKIP_NUM_ODOM_PUB == 0) pubPointCloud(*this, cur_time_); 
+    frame_cnt_++;
+    m_process_.unlock();
 }
 
 void Estimator::undistortMeasurements(const std::vector<Pose> &pose_undist)
@@ -393,33 +437,28 @@ void Estimator::undistortMeasurements(const std::vector<Pose> &pose_undist)
     {
         if (ESTIMATE_EXTRINSIC == 2) // initialization
         {
-            // for (PointI &point : cur_feature_.second[n]["corner_points_sharp"]) TransformToEnd(point, point, pose_undist[n], true, SCAN_PERIOD);
-            // for (PointI &point : cur_feature_.second[n]["surf_points_flat"]) TransformToEnd(point, point, pose_undist[n], true, SCAN_PERIOD);
-            for (PointI &point : cur_feature_.second[n]["corner_points_less_sharp"]) TransformToEnd(point, point, pose_undist[n], true, SCAN_PERIOD);
-            for (PointI &point : cur_feature_.second[n]["surf_points_less_flat"]) TransformToEnd(point, point, pose_undist[n], true, SCAN_PERIOD);
-			for (PointI &point : cur_feature_.second[n]["laser_cloud"]) TransformToEnd(point, point, pose_undist[n], true, SCAN_PERIOD);
+            deskewer_.setMotion(pose_undist[n], SCAN_PERIOD);
         } else
         if (ESTIMATE_EXTRINSIC == 1) // online calibration
         {
             if (n != IDX_REF) continue;
-            // for (PointI &point : cur_feature_.second[n]["corner_points_sharp"]) TransformToEnd(point, point, pose_undist[n], true, SCAN_PERIOD);
-            // for (PointI &point : cur_feature_.second[n]["surf_points_flat"]) TransformToEnd(point, point, pose_undist[n], true, SCAN_PERIOD);
-            for (PointI &point : cur_feature_.second[n]["corner_points_less_sharp"]) TransformToEnd(point, point, pose_undist[n], true, SCAN_PERIOD);
-            for (PointI &point : cur_feature_.second[n]["surf_points_less_flat"]) TransformToEnd(point, point, pose_undist[n], true, SCAN_PERIOD);
-			for (PointI &point : cur_feature_.second[n]["laser_cloud"]) TransformToEnd(point, point, pose_undist[n], true, SCAN_PERIOD);
+            deskewer_.setMotion(pose_undist[n], SCAN_PERIOD);
         } else
         if (ESTIMATE_EXTRINSIC == 0) // pure odometry with accurate extrinsics
         {
             // Pose pose_ext(qbl_[n], tbl_[n]);
             // Pose pose_undist = pose_ext.inverse() * pose_rlt_[IDX_REF] * pose_ext;
-            // for (PointI &point : cur_feature_.second[n]["corner_points_sharp"]) TransformToEnd(point, point, pose_undist, true, SCAN_PERIOD);
-            // for (PointI &point : cur_feature_.second[n]["surf_points_flat"]) TransformToEnd(point, point, pose_undist, true, SCAN_PERIOD);
 
-            //把当前帧的feature points转换到当前帧的end下  //TODO(jxl): pose_undist[n]，作者还没测试 https://github.com/gogojjh/M-LOAM/issues/6
-            for (PointI &point : cur_feature_.second[n]["corner_points_less_sharp"]) TransformToEnd(point, point, pose_undist[IDX_REF], true, SCAN_PERIOD);
-            for (PointI &point : cur_feature_.second[n]["surf_points_less_flat"]) TransformToEnd(point, point, pose_undist[IDX_REF], true, SCAN_PERIOD);
-			for (PointI &point : cur_feature_.second[n]["laser_cloud"]) TransformToEnd(point, point, pose_undist[IDX_REF], true, SCAN_PERIOD);
+            //TODO(jxl): pose_undist[n]，作者还没测试 https://github.com/gogojjh/M-LOAM/issues/6
+            deskewer_.setMotion(pose_undist[IDX_REF], SCAN_PERIOD);
+        } else
+        {
+            continue;
         }
+        //把当前帧的feature points转换到当前帧的end下, 同TransformToEnd
+        deskewer_.apply(cur_feature_.second[n]->cloud_[CORNER_POINTS_LESS_SHARP]);
+        deskewer_.apply(cur_feature_.second[n]->cloud_[SURF_POINTS_LESS_FLAT]);
+        deskewer_.apply(cur_feature_.second[n]->cloud_[LASER_CLOUD]);
     }
 }
 
@@ -440,8 +479,8 @@ void Estimator::process()
             #pragma omp parallel for num_threads(NUM_OF_LASER)
             for (size_t n = 0; n < NUM_OF_LASER; n++)
             {
-                cloudFeature &cur_cloud_feature = cur_feature_.second[n];
-                cloudFeature &prev_cloud_feature = prev_feature_.second[n];
+                const FeatureFrame &cur_cloud_feature = *cur_feature_.second[n];
+                const FeatureFrame &prev_cloud_feature = *prev_feature_.second[n];
                 pose_rlt_[n] = lidar_tracker_.trackCloud(prev_cloud_feature, cur_cloud_feature, pose_rlt_[n]); 
                 //在n雷达之前相邻两帧delta_T基础上，用n雷达curr和prev相邻两帧scan(点到平面，点到直线)匹配，计算delta_T
 
@@ -487,8 +526,8 @@ void Estimator::process()
         }
         else if (ESTIMATE_EXTRINSIC != 2)
         {
-            cloudFeature &cur_cloud_feature = cur_feature_.second[IDX_REF]; //k+1帧主雷达features，当前帧的points还是在当前帧各个时刻下采集的points
-            cloudFeature &prev_cloud_feature = prev_feature_.second[IDX_REF]; //k帧主雷达features，在上一个周期末尾已经转换到了k帧end下
+            const FeatureFrame &cur_cloud_feature = *cur_feature_.second[IDX_REF]; //k+1帧主雷达features，当前帧的points还是在当前帧各个时刻下采集的points
+            const FeatureFrame &prev_cloud_feature = *prev_feature_.second[IDX_REF]; //k帧主雷达features，在上一个周期末尾已经转换到了k帧end下
             pose_rlt_[IDX_REF] = lidar_tracker_.trackCloud(prev_cloud_feature, cur_cloud_feature, pose_rlt_[IDX_REF]);
             //在之前主雷达相邻两scan的delta_T初值基础上，用主雷达当前帧scan和主雷达上一帧scan，计算delta_T，作为返回值返回
             //没有用副雷达的feature points
@@ -510,12 +549,12 @@ void Estimator::process()
     Header_[cir_buf_cnt_].stamp = ros::Time(cur_feature_.first);
     for (size_t n = 0; n < NUM_OF_LASER; n++)
     {
-        PointICloud &corner_points = cur_feature_.second[n]["corner_points_less_sharp"];
+        PointICloud &corner_points = cur_feature_.second[n]->cloud_[CORNER_POINTS_LESS_SHARP];
         down_size_filter_corner_.setInputCloud(boost::make_shared<PointICloud>(corner_points));
         down_size_filter_corner_.filter(corner_points_stack_[n][cir_buf_cnt_]); //raw curr feature points(没有畸变的)
         corner_points_stack_size_[n][cir_buf_cnt_] = corner_points_stack_[n][cir_buf_cnt_].size();
 
-        PointICloud &surf_points = cur_feature_.second[n]["surf_points_less_flat"];
+        PointICloud &surf_points = cur_feature_.second[n]->cloud_[SURF_POINTS_LESS_FLAT];
         down_size_filter_surf_.setInputCloud(boost::make_shared<PointICloud>(surf_points));
         down_size_filter_surf_.filter(surf_points_stack_[n][cir_buf_cnt_]); //raw curr feature points(没有畸变的)
         surf_points_stack_size_[n][cir_buf_cnt_] = surf_points_stack_[n][cir_buf_cnt_].size();
@@ -555,6 +594,7 @@ void Estimator::process()
             } 
 
             slideWindow();
+            odom_arena_.release(); // factors of optimizeMap()
 
             if (ESTIMATE_EXTRINSIC) evalCalib();
 
@@ -565,14 +605,28 @@ void Estimator::process()
     // pass cur_feature to prev_feature
     prev_time_ = cur_time_;
     prev_feature_.first = prev_time_;
-    prev_feature_.second.clear();
-    prev_feature_.second.resize(NUM_OF_LASER);
+    if (DISTORTION)
+    {
+        // cur_feature_ is undistorted in place below but prev_feature_ keeps the raw points,
+        // so copy the two less-feature clouds into a recycled frame
+        prev_feature_.second.resize(NUM_OF_LASER);
+        for (size_t n = 0; n < NUM_OF_LASER; n++)
+        {
+            FeatureFramePtr prev_frame = feature_frame_pool_[n].acquire();
+            prev_frame->cloud_[CORNER_POINTS_LESS_SHARP] = cur_feature_.second[n]->cloud_[CORNER_POINTS_LESS_SHARP];
+            prev_frame->cloud_[SURF_POINTS_LESS_FLAT] = cur_feature_.second[n]->cloud_[SURF_POINTS_LESS_FLAT];
+            prev_feature_.second[n] = prev_frame;
+        }
+    } 
+    else
+    {
+        prev_feature_.second = cur_feature_.second; // share the frames without copying
+    }
+    // the tracker of the next frame searches these frames, build their KD-trees once here
+    #pragma omp parallel for num_threads(NUM_OF_LASER)
     for (size_t n = 0; n < NUM_OF_LASER; n++)
     {
-        prev_feature_.second[n].insert(make_pair("corner_points_less_sharp", 
-            cur_feature_.second[n].find("corner_points_less_sharp")->second));
-        prev_feature_.second[n].insert(make_pair("surf_points_less_flat", 
-            cur_feature_.second[n].find("surf_points_less_flat")->second));
+        if ((ESTIMATE_EXTRINSIC == 2) || (n == IDX_REF)) prev_feature_.second[n]->buildKdTree();
     }
 
     if (DISTORTION)
@@ -602,7 +656,7 @@ void Estimator::process()
         // {
         //     stringstream ss;
         //     ss << "/tmp/raw_pc_" << n << ".pcd";
-        //     pcl::io::savePCDFileASCII(ss.str(), cur_feature_.second[n]["laser_cloud"]);
+        //     pcl::io::savePCDFileASCII(ss.str(), cur_feature_.second[n]->cloud_[LASER_CLOUD]);
         // }
 
         for (size_t n = 0; n < NUM_OF_LASER; n++)
@@ -619,7 +673,7 @@ void Estimator::process()
         // {
         //     stringstream ss;
         //     ss << "/tmp/undistort_raw_pc_" << n << ".pcd";
-        //     pcl::io::savePCDFileASCII(ss.str(), cur_feature_.second[n]["laser_cloud"]);
+        //     pcl::io::savePCDFileASCII(ss.str(), cur_feature_.second[n]->cloud_[LASER_CLOUD]);
         // }
 
         pose_laser_prev_ = pose_laser_cur;
@@ -628,16 +682,69 @@ void Estimator::process()
     }
 }
 
+// called whenever para_pose_ and para_ex_pose_ are (re)allocated
+void Estimator::setupOdomProblem()
+{
+    ceres::Problem::Options problem_options;
+    problem_options.cost_function_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
+    problem_options.loss_function_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
+    problem_options.local_parameterization_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
+    problem_options.enable_fast_removal = true; // the residual blocks are removed at the end of every frame
+    odom_problem_.reset(new ceres::Problem(problem_options));
+
+    // loss_function = new ceres::GemanMcClureLoss(1.0);
+    odom_loss_function_.reset(new ceres::HuberLoss(1.0));
+    // loss_function = new ceres::CauchyLoss(1.0);
+
+    odom_local_param_.clear();
+    for (size_t i = 0; i < OPT_WINDOW_SIZE + 1; i++)
+    {
+        odom_local_param_.emplace_back(new PoseLocalParameterization());
+        odom_problem_->AddParameterBlock(para_pose_[i], SIZE_POSE, odom_local_param_.back().get());
+    }
+    for (size_t i = 0; i < NUM_OF_LASER; i++)
+    {
+        odom_local_param_.emplace_back(new PoseLocalParameterization());
+        odom_problem_->AddParameterBlock(para_ex_pose_[i], SIZE_POSE, odom_local_param_.back().get());
+    }
+}
+
+// b_marg: skip the invalid corners as the marginalization of the single-feature factors does
+FeatureBatch Estimator::packPureOdomFeatures(const size_t &n, const size_t &i, const bool &b_marg) const
+{
+    FeatureBatch feature_batch(1.0); // HuberLoss(1.0) of optimizeMap()
+    const std::vector<PointPlaneFeature, Eigen::aligned_allocator<PointPlaneFeature> > &surf_features = surf_map_features_[n][i];
+    const std::vector<PointPlaneFeature, Eigen::aligned_allocator<PointPlaneFeature> > &corner_features = corner_map_features_[n][i];
+    if (ESTIMATE_EXTRINSIC == 1) // all features of the reference lidar
+    {
+        if (POINT_PLANE_FACTOR)
+            for (const PointPlaneFeature &feature : surf_features) feature_batch.addSurf(feature);
+        if (POINT_EDGE_FACTOR)
+            for (const PointPlaneFeature &feature : corner_features) feature_batch.addCorner(feature);
+    }
+    else // the selected good features
+    {
+        if (POINT_PLANE_FACTOR)
+            for (const size_t &fid : sel_surf_feature_idx_[n][i]) feature_batch.addSurf(surf_features[fid]);
+        if (POINT_EDGE_FACTOR)
+        {
+            for (const size_t &fid : sel_corner_feature_idx_[n][i])
+            {
+                if (b_marg && (corner_features[fid].type_ == 'n')) continue;
+                feature_batch.addCorner(corner_features[fid]);
+            }
+        }
+    }
+    return feature_batch;
+}
+
 void Estimator::optimizeMap()
 {
     int pivot_idx = WINDOW_SIZE - OPT_WINDOW_SIZE; //2
 
-    ceres::Problem problem;
+    ceres::Problem &problem = *odom_problem_;
     ceres::Solver::Summary summary;
-    ceres::LossFunction *loss_function;
-    // loss_function = new ceres::GemanMcClureLoss(1.0);
-    loss_function = new ceres::HuberLoss(1.0);
-    // loss_function = new ceres::CauchyLoss(1.0);
+    ceres::LossFunction *loss_function = odom_loss_function_.get();
     // ceres: set options and solve the non-linear equation
     ceres::Solver::Options options;
     options.linear_solver_type = ceres::DENSE_SCHUR;
@@ -655,27 +762,27 @@ void Estimator::optimizeMap()
 
     // ceres: add parameter block
     std::vector<double *> para_ids;
+    // the parameter blocks are added in setupOdomProblem(), only reset their states here
     std::vector<PoseLocalParameterization *> local_param_ids;
+    for (size_t i = 0; i < OPT_WINDOW_SIZE + 1 + NUM_OF_LASER; i++)
+    {
+        odom_local_param_[i]->setParameter();
+        local_param_ids.push_back(odom_local_param_[i].get());
+    }
     for (size_t i = 0; i < OPT_WINDOW_SIZE + 1; i++)
     {
-        PoseLocalParameterization *local_parameterization = new PoseLocalParameterization();
-        local_parameterization->setParameter();
-        problem.AddParameterBlock(para_pose_[i], SIZE_POSE, local_parameterization);
-        local_param_ids.push_back(local_parameterization);
         para_ids.push_back(para_pose_[i]);
+        if (i == 0) problem.SetParameterBlockConstant(para_pose_[i]); //主雷达在poivot_idx + 1 处为固定值
+               else problem.SetParameterBlockVariable(para_pose_[i]);
     }
-    problem.SetParameterBlockConstant(para_pose_[0]); //主雷达在poivot_idx + 1 处为固定值
 
     for (size_t i = 0; i < NUM_OF_LASER; i++)
     {
-        PoseLocalParameterization *local_parameterization = new PoseLocalParameterization();
-        local_parameterization->setParameter();
-        problem.AddParameterBlock(para_ex_pose_[i], SIZE_POSE, local_parameterization);
-        local_param_ids.push_back(local_parameterization);
         para_ids.push_back(para_ex_pose_[i]);
-        if (ESTIMATE_EXTRINSIC == 0) problem.SetParameterBlockConstant(para_ex_pose_[i]);
+        //主雷达到主雷达的外参为const value
+        if ((ESTIMATE_EXTRINSIC == 0) || (i == IDX_REF)) problem.SetParameterBlockConstant(para_ex_pose_[i]);
+                                                    else problem.SetParameterBlockVariable(para_ex_pose_[i]);
     }
-    problem.SetParameterBlockConstant(para_ex_pose_[IDX_REF]); //主雷达到主雷达的外参为const value
 
     // for (size_t i = 0; i < NUM_OF_LASER; i++)
     // {
@@ -693,7 +800,7 @@ void Estimator::optimizeMap()
     std::vector<ceres::internal::ResidualBlock *> res_ids_marg;
     if ((MARGINALIZATION_FACTOR) && (last_marginalization_info_))
     {
-        MarginalizationFactor *marginalization_factor = new MarginalizationFactor(last_marginalization_info_);
+        MarginalizationFactor *marginalization_factor = odom_arena_.create<MarginalizationFactor>(last_marginalization_info_);
         ceres::internal::ResidualBlock *res_id_marg = problem.AddResidualBlock(marginalization_factor,
                                                                                NULL,
                                                                                last_marginalization_parameter_blocks_);
@@ -716,7 +823,7 @@ void Estimator::optimizeMap()
         {
             for (size_t n = 0; n < NUM_OF_LASER; n++)
             {
-                PriorFactor *f = new PriorFactor(tbl_[n], qbl_[n], PRIOR_FACTOR_POS, PRIOR_FACTOR_ROT);
+                PriorFactor *f = odom_arena_.create<PriorFactor>(tbl_[n], qbl_[n], PRIOR_FACTOR_POS, PRIOR_FACTOR_ROT);
                 ceres::internal::ResidualBlock *res_id = problem.AddResidualBlock(f,
                                                                                   NULL,
                                                                                   para_ex_pose_[n]);
@@ -724,34 +831,53 @@ void Estimator::optimizeMap()
             }
         }
 
+        if (BATCH_MAP_FACTOR) // the features of one frame of one lidar in a single block
+        {
+            for (size_t i = pivot_idx + 1; i < WINDOW_SIZE + 1; i++)
+            {
+                FeatureBatch feature_batch = packPureOdomFeatures(IDX_REF, i, false);
+                if (feature_batch.numSurf() + feature_batch.numCorner() == 0) continue;
+                LidarPureOdomBatchFactor *f = odom_arena_.create<LidarPureOdomBatchFactor>(std::move(feature_batch));
+                ceres::internal::ResidualBlock *res_id = problem.AddResidualBlock(f,
+                                                                                  NULL, // huber loss inside the factor
+                                                                                  para_pose_[0],
+                                                                                  para_pose_[i - pivot_idx],
+                                                                                  para_ex_pose_[IDX_REF]);
+                res_ids_proj.push_back(res_id);
+            }
+        }
+
         if (POINT_PLANE_FACTOR)
         {
             CHECK_JACOBIAN = 0;  //default  //TODO(jxl): check jacobians
             // CHECK_JACOBIAN = 1;
-            for (size_t i = pivot_idx + 1; i < WINDOW_SIZE + 1; i++)//i =3,4
+            if (!BATCH_MAP_FACTOR)
             {
-                std::vector<PointPlaneFeature> &features_frame = surf_map_features_[IDX_REF][i];
-                for (const PointPlaneFeature &feature : features_frame)
+                for (size_t i = pivot_idx + 1; i < WINDOW_SIZE + 1; i++)//i =3,4
                 {
-                    LidarPureOdomPlaneNormFactor *f = new LidarPureOdomPlaneNormFactor(
-                                         feature.point_,  //主雷达在滑窗中对应帧下的surf point
-                                         feature.coeffs_, //该点在主雷达pivot下的local surf map中的correspondances形成的平面方程
-                                         1.0);
-                    
-                    ceres::internal::ResidualBlock *res_id = problem.AddResidualBlock(f,
-                                                                                      loss_function,
-                                                                                      para_pose_[0], //主雷达pivot pose, Xv[0]
-                                                                                      para_pose_[i - pivot_idx], //主雷达依次在Xv[]中除了pivot帧pose
-                                                                                      para_ex_pose_[IDX_REF]); //主雷达到主雷达的外参，const value
-                    res_ids_proj.push_back(res_id); //对应论文中pure odometry：见笔记红色约束
-                    if (CHECK_JACOBIAN)
+                    std::vector<PointPlaneFeature, Eigen::aligned_allocator<PointPlaneFeature> > &features_frame = surf_map_features_[IDX_REF][i];
+                    for (const PointPlaneFeature &feature : features_frame)
                     {
-                        double **tmp_param = new double *[3];
-                        tmp_param[0] = para_pose_[0];
-                        tmp_param[1] = para_pose_[i - pivot_idx];
-                        tmp_param[2] = para_ex_pose_[IDX_REF];
-                        f->check(tmp_param);
-                        CHECK_JACOBIAN = 0;
+                        LidarPureOdomPlaneNormFactor *f = odom_arena_.create<LidarPureOdomPlaneNormFactor>(
+                                             feature.point_,  //主雷达在滑窗中对应帧下的surf point
+                                             feature.coeffs_.head<4>(), //该点在主雷达pivot下的local surf map中的correspondances形成的平面方程
+                                             1.0);
+                    
+                        ceres::internal::ResidualBlock *res_id = problem.AddResidualBlock(f,
+                                                                                          loss_function,
+                                                                                          para_pose_[0], //主雷达pivot pose, Xv[0]
+                                                                                          para_pose_[i - pivot_idx], //主雷达依次在Xv[]中除了pivot帧pose
+                                                                                          para_ex_pose_[IDX_REF]); //主雷达到主雷达的外参，const value
+                        res_ids_proj.push_back(res_id); //对应论文中pure odometry：见笔记红色约束
+                        if (CHECK_JACOBIAN)
+                        {
+                            double **tmp_param = new double *[3];
+                            tmp_param[0] = para_pose_[0];
+                            tmp_param[1] = para_pose_[i - pivot_idx];
+                            tmp_param[2] = para_ex_pose_[IDX_REF];
+                            f->check(tmp_param);
+                            CHECK_JACOBIAN = 0;
+                        }
                     }
                 }
             }
@@ -771,9 +897,9 @@ void Estimator::optimizeMap()
                     if (n == IDX_REF) continue; //忽略主雷达
                     for (const PointPlaneFeature &feature : cumu_surf_map_features_[n])
                     {
-                        LidarOnlineCalibPlaneNormFactor *f = new LidarOnlineCalibPlaneNormFactor(
+                        LidarOnlineCalibPlaneNormFactor *f = odom_arena_.create<LidarOnlineCalibPlaneNormFactor>(
                                             feature.point_,  //n雷达在pivot帧下的点 
-                                            feature.coeffs_, //n雷达在pivot帧下的点,在自己local map下的correspondances形成的平面方程；
+                                            feature.coeffs_.head<4>(), //n雷达在pivot帧下的点,在自己local map下的correspondances形成的平面方程；
                                             1.0);
                         ceres::internal::ResidualBlock *res_id = problem.AddResidualBlock(f,
                                                                                           loss_function,
@@ -783,29 +909,31 @@ void Estimator::optimizeMap()
                 }
                 if (!MARGINALIZATION_FACTOR)
                 {
-                    cumu_surf_map_features_.clear();
-                    cumu_surf_map_features_.resize(NUM_OF_LASER);
+                    for (std::vector<PointPlaneFeature, Eigen::aligned_allocator<PointPlaneFeature> > &features : cumu_surf_map_features_) features.clear();
                 }
             }
         }
 
         if (POINT_EDGE_FACTOR)
         {
-            for (size_t i = pivot_idx + 1; i < WINDOW_SIZE + 1; i++)
+            if (!BATCH_MAP_FACTOR)
             {
-                std::vector<PointPlaneFeature> &features_frame = corner_map_features_[IDX_REF][i];
-                for (const PointPlaneFeature &feature : features_frame)
+                for (size_t i = pivot_idx + 1; i < WINDOW_SIZE + 1; i++)
                 {
-                    LidarPureOdomEdgeFactor *f = new LidarPureOdomEdgeFactor(feature.point_, feature.coeffs_, 1.0);
-                    // ceres::CostFunction *f = LidarPureOdomEdgeFactor::Create(feature.point_, feature.coeffs_, 1.0);
-                    ceres::internal::ResidualBlock *res_id = problem.AddResidualBlock(f,
-                                                                                      loss_function,
-                                                                                      para_pose_[0], //主雷达pivot pose, Xv[0]
-                                                                                      para_pose_[i - pivot_idx], //主雷达依次在Xv[]中除了pivot帧pose
-                                                                                      para_ex_pose_[IDX_REF]); //主雷达到主雷达的外参，const value
-                    res_ids_proj.push_back(res_id);
-                }
-            }            
+                    std::vector<PointPlaneFeature, Eigen::aligned_allocator<PointPlaneFeature> > &features_frame = corner_map_features_[IDX_REF][i];
+                    for (const PointPlaneFeature &feature : features_frame)
+                    {
+                        LidarPureOdomEdgeFactor *f = odom_arena_.create<LidarPureOdomEdgeFactor>(feature.point_, feature.coeffs_, 1.0);
+                        // ceres::CostFunction *f = LidarPureOdomEdgeFactor::Create(feature.point_, feature.coeffs_, 1.0);
+                        ceres::internal::ResidualBlock *res_id = problem.AddResidualBlock(f,
+                                                                                          loss_function,
+                                                                                          para_pose_[0], //主雷达pivot pose, Xv[0]
+                                                                                          para_pose_[i - pivot_idx], //主雷达依次在Xv[]中除了pivot帧pose
+                                                                                          para_ex_pose_[IDX_REF]); //主雷达到主雷达的外参，const value
+                        res_ids_proj.push_back(res_id);
+                    }
+                }            
+            }
 
             for (size_t n = 0; n < NUM_OF_LASER; n++) 
             {
@@ -821,7 +949,7 @@ void Estimator::optimizeMap()
                     if (n == IDX_REF) continue; //忽略主雷达
                     for (const PointPlaneFeature &feature : cumu_corner_map_features_[n])
                     {
-                        LidarOnlineCalibEdgeFactor *f = new LidarOnlineCalibEdgeFactor(
+                        LidarOnlineCalibEdgeFactor *f = odom_arena_.create<LidarOnlineCalibEdgeFactor>(
                             feature.point_,  //n雷达在pivot帧下的点 
                             feature.coeffs_, //n雷达在pivot帧下的点,在自己local map下的correspondances
                             1.0);
@@ -831,8 +959,7 @@ void Estimator::optimizeMap()
                 }
                 if (!MARGINALIZATION_FACTOR)
                 {
-                    cumu_corner_map_features_.clear();
-                    cumu_corner_map_features_.resize(NUM_OF_LASER);
+                    for (std::vector<PointPlaneFeature, Eigen::aligned_allocator<PointPlaneFeature> > &features : cumu_corner_map_features_) features.clear();
                 }
             }
         }
@@ -842,7 +969,25 @@ void Estimator::optimizeMap()
         buildLocalMap();
         std::cout << common::YELLOW << "optimization with pure odometry" << common::RESET << std::endl;
 
-        if (POINT_PLANE_FACTOR)
+        if (BATCH_MAP_FACTOR) // the features of one frame of one lidar in a single block
+        {
+            for (size_t n = 0; n < NUM_OF_LASER; n++)
+            {
+                for (size_t i = pivot_idx + 1; i < WINDOW_SIZE + 1; i++)
+                {
+                    FeatureBatch feature_batch = packPureOdomFeatures(n, i, false);
+                    if (feature_batch.numSurf() + feature_batch.numCorner() == 0) continue;
+                    LidarPureOdomBatchFactor *f = odom_arena_.create<LidarPureOdomBatchFactor>(std::move(feature_batch));
+                    ceres::internal::ResidualBlock *res_id = problem.AddResidualBlock(f,
+                                                                                      NULL, // huber loss inside the factor
+                                                                                      para_pose_[0],
+                                                                                      para_pose_[i - pivot_idx],
+                                                                                      para_ex_pose_[n]);
+                    res_ids_proj.push_back(res_id);
+                }
+            }
+        }
+        else if (POINT_PLANE_FACTOR)
         {
             for (size_t n = 0; n < NUM_OF_LASER; n++)
             {
@@ -852,7 +997,7 @@ void Estimator::optimizeMap()
                     {
                         const PointPlaneFeature &feature = surf_map_features_[n][i][fid];
                         // if (feature.type_ == 'n') continue;
-                        LidarPureOdomPlaneNormFactor *f = new LidarPureOdomPlaneNormFactor(feature.point_, feature.coeffs_, 1.0);
+                        LidarPureOdomPlaneNormFactor *f = odom_arena_.create<LidarPureOdomPlaneNormFactor>(feature.point_, feature.coeffs_.head<4>(), 1.0);
                         ceres::internal::ResidualBlock *res_id = problem.AddResidualBlock(f,
                                                                                           loss_function,
                                                                                           para_pose_[0], //主雷达pivot pose, Xv[0]
@@ -866,7 +1011,7 @@ void Estimator::optimizeMap()
 
         CHECK_JACOBIAN = 0; //default: 0
         
-        if (POINT_EDGE_FACTOR)
+        if ((POINT_EDGE_FACTOR) && (!BATCH_MAP_FACTOR))
         {
             for (size_t n = 0; n < NUM_OF_LASER; n++)
             {
@@ -876,7 +1021,7 @@ void Estimator::optimizeMap()
                     {
                         const PointPlaneFeature &feature = corner_map_features_[n][i][fid];
                         // if (feature.type_ == 'n') continue;
-                        LidarPureOdomEdgeFactor *f = new LidarPureOdomEdgeFactor(feature.point_, feature.coeffs_, 1.0);
+                        LidarPureOdomEdgeFactor *f = odom_arena_.create<LidarPureOdomEdgeFactor>(feature.point_, feature.coeffs_, 1.0);
                         // ceres::CostFunction *f = LidarPureOdomEdgeFactor::Create(feature.point_, feature.coeffs_, 1.0);
                         ceres::internal::ResidualBlock *res_id = problem.AddResidualBlock(f,
                                                                                           loss_function,
@@ -919,6 +1064,10 @@ void Estimator::optimizeMap()
     // std::cout << para_ex_pose_[1][0]<<" " << para_ex_pose_[1][1]<<" " << para_ex_pose_[1][2] <<" "<<para_ex_pose_[1][3] <<std::endl; //输出外参
     double2Vector();
 
+    // the problem is reused by the next frame, its cost functions are released with odom_arena_
+    for (ceres::internal::ResidualBlock *res_id : res_ids_marg) problem.RemoveResidualBlock(res_id);
+    for (ceres::internal::ResidualBlock *res_id : res_ids_proj) problem.RemoveResidualBlock(res_id);
+
     // **************************************************** marginalization
     // ceres: marginalization of current parameter block
     // prepare all the residuals, jacobians, and dropped parameter blocks to construct marginalization prior 
@@ -937,8 +1086,8 @@ void Estimator::optimizeMap()
                 // indicate the dropped pose to calculate the related residuals
                 if (last_marginalization_parameter_blocks_[i] == para_pose_[0]) drop_set.push_back(i);
             }
-            MarginalizationFactor *marginalization_factor = new MarginalizationFactor(last_marginalization_info_);
-            ResidualBlockInfo *residual_block_info = new ResidualBlockInfo(marginalization_factor, 
+            MarginalizationFactor *marginalization_factor = odom_arena_.create<MarginalizationFactor>(last_marginalization_info_);
+            ResidualBlockInfo *residual_block_info = odom_arena_.create<ResidualBlockInfo>(marginalization_factor, 
                                                                            NULL,
                                                                            last_marginalization_parameter_blocks_, 
                                                                            drop_set); //!@第一类
@@ -949,8 +1098,8 @@ void Estimator::optimizeMap()
         {
             for (size_t n = 0; n < NUM_OF_LASER; n++)
             {
-                PriorFactor *f = new PriorFactor(tbl_[n], qbl_[n], PRIOR_FACTOR_POS, PRIOR_FACTOR_ROT);
-                ResidualBlockInfo *residual_block_info = new ResidualBlockInfo(f, 
+                PriorFactor *f = odom_arena_.create<PriorFactor>(tbl_[n], qbl_[n], PRIOR_FACTOR_POS, PRIOR_FACTOR_ROT);
+                ResidualBlockInfo *residual_block_info = odom_arena_.create<ResidualBlockInfo>(f, 
                                                                                NULL,
                                                                                std::vector<double *>{para_ex_pose_[n]}, //主雷达到n雷达的外参
                                                                                std::vector<int>{}); //!@第二类
@@ -960,21 +1109,41 @@ void Estimator::optimizeMap()
 
         if (ESTIMATE_EXTRINSIC == 1)
         {
-            if (POINT_PLANE_FACTOR)
+            if (BATCH_MAP_FACTOR)
             {
                 for (size_t i = pivot_idx + 1; i < WINDOW_SIZE + 1; i++)
                 {
-                    std::vector<PointPlaneFeature> &features_frame = surf_map_features_[IDX_REF][i];
-                    for (const PointPlaneFeature &feature: features_frame)
+                    FeatureBatch feature_batch = packPureOdomFeatures(IDX_REF, i, true);
+                    if (feature_batch.numSurf() + feature_batch.numCorner() == 0) continue;
+                    LidarPureOdomBatchFactor *f = odom_arena_.create<LidarPureOdomBatchFactor>(std::move(feature_batch));
+                    ResidualBlockInfo *residual_block_info = odom_arena_.create<ResidualBlockInfo>(f,
+                                                                                                   NULL,
+                                                                                                   std::vector<double *>{para_pose_[0],
+                                                                                                                         para_pose_[i - pivot_idx],
+                                                                                                                         para_ex_pose_[IDX_REF]},
+                                                                                                   std::vector<int>{0}); //!@第三类
+                    marginalization_info->addResidualBlockInfo(residual_block_info);
+                }
+            }
+
+            if (POINT_PLANE_FACTOR)
+            {
+                if (!BATCH_MAP_FACTOR)
+                {
+                    for (size_t i = pivot_idx + 1; i < WINDOW_SIZE + 1; i++)
                     {
-                        LidarPureOdomPlaneNormFactor *f = new LidarPureOdomPlaneNormFactor(feature.point_, feature.coeffs_, 1.0);
-                        ResidualBlockInfo *residual_block_info = new ResidualBlockInfo(f,
-                                                                                       loss_function,
-                                                                                       std::vector<double *>{para_pose_[0], //主雷达pivot pose, Xv[0]
-                                                                                                             para_pose_[i - pivot_idx], //主雷达依次在Xv[]中除了pivot帧pose
-                                                                                                             para_ex_pose_[IDX_REF]}, //主雷达到主雷达的外参
-                                                                                       std::vector<int>{0}); //!@第三类                      
-                        marginalization_info->addResidualBlockInfo(residual_block_info);
+                        std::vector<PointPlaneFeature, Eigen::aligned_allocator<PointPlaneFeature> > &features_frame = surf_map_features_[IDX_REF][i];
+                        for (const PointPlaneFeature &feature: features_frame)
+                        {
+                            LidarPureOdomPlaneNormFactor *f = odom_arena_.create<LidarPureOdomPlaneNormFactor>(feature.point_, feature.coeffs_.head<4>(), 1.0);
+                            ResidualBlockInfo *residual_block_info = odom_arena_.create<ResidualBlockInfo>(f,
+                                                                                           loss_function,
+                                                                                           std::vector<double *>{para_pose_[0], //主雷达pivot pose, Xv[0]
+                                                                                                                 para_pose_[i - pivot_idx], //主雷达依次在Xv[]中除了pivot帧pose
+                                                                                                                 para_ex_pose_[IDX_REF]}, //主雷达到主雷达的外参
+                                                                                           std::vector<int>{0}); //!@第三类                      
+                            marginalization_info->addResidualBlockInfo(residual_block_info);
+                        }
                     }
                 }
 
@@ -985,37 +1154,39 @@ void Estimator::optimizeMap()
                         if (n == IDX_REF) continue;
                         for (const PointPlaneFeature &feature : cumu_surf_map_features_[n])
                         {
-                            LidarOnlineCalibPlaneNormFactor *f = new LidarOnlineCalibPlaneNormFactor(feature.point_, feature.coeffs_, 1.0);
-                            ResidualBlockInfo *residual_block_info = new ResidualBlockInfo(f,
+                            LidarOnlineCalibPlaneNormFactor *f = odom_arena_.create<LidarOnlineCalibPlaneNormFactor>(feature.point_, feature.coeffs_.head<4>(), 1.0);
+                            ResidualBlockInfo *residual_block_info = odom_arena_.create<ResidualBlockInfo>(f,
                                                                                            loss_function,
                                                                                            std::vector<double *>{para_ex_pose_[n]}, //主雷达到每个副雷达的外参
                                                                                            std::vector<int>{}); //!@第四类  
                             marginalization_info->addResidualBlockInfo(residual_block_info);
                         }
                     }
-                    cumu_surf_map_features_.clear();
-                    cumu_surf_map_features_.resize(NUM_OF_LASER);
+                    for (std::vector<PointPlaneFeature, Eigen::aligned_allocator<PointPlaneFeature> > &features : cumu_surf_map_features_) features.clear();
                 }
             }
 
             if (POINT_EDGE_FACTOR)
             {
-                for (size_t i = pivot_idx + 1; i < WINDOW_SIZE + 1; i++)
+                if (!BATCH_MAP_FACTOR)
                 {
-                    std::vector<PointPlaneFeature> &features_frame = corner_map_features_[IDX_REF][i];
-                    for (const PointPlaneFeature &feature: features_frame)
+                    for (size_t i = pivot_idx + 1; i < WINDOW_SIZE + 1; i++)
                     {
-                        // if (feature.type_ == 'n') continue;
-                        LidarPureOdomEdgeFactor *f = new LidarPureOdomEdgeFactor(feature.point_, feature.coeffs_, 1.0);
-                        ResidualBlockInfo *residual_block_info = new ResidualBlockInfo(f,
-                                                                                       loss_function,
-                                                                                       std::vector<double *>{para_pose_[0], //主雷达pivot pose, Xv[0]
-                                                                                                             para_pose_[i - pivot_idx], //主雷达依次在Xv[]中除了pivot帧pose
-                                                                                                             para_ex_pose_[IDX_REF]}, //主雷达到主雷达的外参
-                                                                                       std::vector<int>{0}); //!@第三类 
-                        marginalization_info->addResidualBlockInfo(residual_block_info);
-                    }
-                }                
+                        std::vector<PointPlaneFeature, Eigen::aligned_allocator<PointPlaneFeature> > &features_frame = corner_map_features_[IDX_REF][i];
+                        for (const PointPlaneFeature &feature: features_frame)
+                        {
+                            // if (feature.type_ == 'n') continue;
+                            LidarPureOdomEdgeFactor *f = odom_arena_.create<LidarPureOdomEdgeFactor>(feature.point_, feature.coeffs_, 1.0);
+                            ResidualBlockInfo *residual_block_info = odom_arena_.create<ResidualBlockInfo>(f,
+                                                                                           loss_function,
+                                                                                           std::vector<double *>{para_pose_[0], //主雷达pivot pose, Xv[0]
+                                                                                                                 para_pose_[i - pivot_idx], //主雷达依次在Xv[]中除了pivot帧pose
+                                                                                                                 para_ex_pose_[IDX_REF]}, //主雷达到主雷达的外参
+                                                                                           std::vector<int>{0}); //!@第三类 
+                            marginalization_info->addResidualBlockInfo(residual_block_info);
+                        }
+                    }                
+                }
                 
                 if (frame_cnt_ % N_CUMU_FEATURE == 0)
                 {
@@ -1024,22 +1195,40 @@ void Estimator::optimizeMap()
                         if (n == IDX_REF) continue;
                         for (const PointPlaneFeature &feature : cumu_corner_map_features_[n])
                         {
-                            LidarOnlineCalibEdgeFactor *f = new LidarOnlineCalibEdgeFactor(feature.point_, feature.coeffs_, 1.0);
-                            ResidualBlockInfo *residual_block_info = new ResidualBlockInfo(f,
+                            LidarOnlineCalibEdgeFactor *f = odom_arena_.create<LidarOnlineCalibEdgeFactor>(feature.point_, feature.coeffs_, 1.0);
+                            ResidualBlockInfo *residual_block_info = odom_arena_.create<ResidualBlockInfo>(f,
                                                                                            loss_function,
                                                                                            std::vector<double *>{para_ex_pose_[n]}, //主雷达到每个副雷达的外参
                                                                                            std::vector<int>{}); //!@第四类 
                             marginalization_info->addResidualBlockInfo(residual_block_info);
                         }
                     }
-                    cumu_corner_map_features_.clear();
-                    cumu_corner_map_features_.resize(NUM_OF_LASER);
+                    for (std::vector<PointPlaneFeature, Eigen::aligned_allocator<PointPlaneFeature> > &features : cumu_corner_map_features_) features.clear();
                 }
             }
         }
         else if (ESTIMATE_EXTRINSIC == 0)
         {
-            if (POINT_PLANE_FACTOR)
+            if (BATCH_MAP_FACTOR)
+            {
+                for (size_t n = 0; n < NUM_OF_LASER; n++)
+                {
+                    for (size_t i = pivot_idx + 1; i < WINDOW_SIZE + 1; i++)
+                    {
+                        FeatureBatch feature_batch = packPureOdomFeatures(n, i, true);
+                        if (feature_batch.numSurf() + feature_batch.numCorner() == 0) continue;
+                        LidarPureOdomBatchFactor *f = odom_arena_.create<LidarPureOdomBatchFactor>(std::move(feature_batch));
+                        ResidualBlockInfo *residual_block_info = odom_arena_.create<ResidualBlockInfo>(f,
+                                                                                                       NULL,
+                                                                                                       std::vector<double *>{para_pose_[0],
+                                                                                                                             para_pose_[i - pivot_idx],
+                                                                                                                             para_ex_pose_[n]},
+                                                                                                       std::vector<int>{0}); //!@第三类
+                        marginalization_info->addResidualBlockInfo(residual_block_info);
+                    }
+                }
+            }
+            else if (POINT_PLANE_FACTOR)
             {
                 for (size_t n = 0; n < NUM_OF_LASER; n++)
                 {
@@ -1049,8 +1238,8 @@ void Estimator::optimizeMap()
                         {
                             const PointPlaneFeature &feature = surf_map_features_[n][i][fid];
                             // if (feature.type_ == 'n') continue;
-                            LidarPureOdomPlaneNormFactor *f = new LidarPureOdomPlaneNormFactor(feature.point_, feature.coeffs_, 1.0);
-                            ResidualBlockInfo *residual_block_info = new ResidualBlockInfo(f,
+                            LidarPureOdomPlaneNormFactor *f = odom_arena_.create<LidarPureOdomPlaneNormFactor>(feature.point_, feature.coeffs_.head<4>(), 1.0);
+                            ResidualBlockInfo *residual_block_info = odom_arena_.create<ResidualBlockInfo>(f,
                                                                                            loss_function,
                                                                                            vector<double *>{para_pose_[0], //主雷达pivot pose, Xv[0]
                                                                                                             para_pose_[i - pivot_idx], //主雷达依次在Xv[]中除了pivot帧pose
@@ -1061,7 +1250,7 @@ void Estimator::optimizeMap()
                     }
                 }
             }
-            if (POINT_EDGE_FACTOR)
+            if ((POINT_EDGE_FACTOR) && (!BATCH_MAP_FACTOR))
             {
                 for (size_t n = 0; n < NUM_OF_LASER; n++)
                 {
@@ -1071,9 +1260,9 @@ void Estimator::optimizeMap()
                         {
                             const PointPlaneFeature &feature = corner_map_features_[n][i][fid];
                             if (feature.type_ == 'n') continue;
-                            LidarPureOdomEdgeFactor *f = new LidarPureOdomEdgeFactor(feature.point_, feature.coeffs_, 1.0);
+                            LidarPureOdomEdgeFactor *f = odom_arena_.create<LidarPureOdomEdgeFactor>(feature.point_, feature.coeffs_, 1.0);
                             // ceres::CostFunction *f = LidarPureOdomEdgeFactor::Create(feature.point_, feature.coeffs_, 1.0);
-                            ResidualBlockInfo *residual_block_info = new ResidualBlockInfo(f,
+                            ResidualBlockInfo *residual_block_info = odom_arena_.create<ResidualBlockInfo>(f,
                                                                                            loss_function,
                                                                                            vector<double *>{para_pose_[0], //主雷达pivot pose, Xv[0]
                                                                                                             para_pose_[i - pivot_idx], //主雷达依次在Xv[]中除了pivot帧pose
@@ -1095,6 +1284,7 @@ void Estimator::optimizeMap()
 
         // marginalize some states and keep the remaining states with prior residuals
         marginalization_info->marginalize(); // compute linear residuals and jacobian
+        marginalization_info->factors.clear(); // only the linearized prior is kept, the factors belong to odom_arena_
         
 
         //! indicate shared memory of parameter blocks except for the dropped state
@@ -1129,16 +1319,9 @@ void Estimator::buildCalibMap()
     int pivot_idx = WINDOW_SIZE - OPT_WINDOW_SIZE;
     Pose pose_pivot(Qs_[pivot_idx], Ts_[pivot_idx]); //pivot pose: Xv[0]
     // build the whole local map using all poses except the newest pose
-    surf_points_local_map_.clear();
-    surf_points_local_map_.resize(NUM_OF_LASER);
-    surf_points_local_map_filtered_.clear();
-    surf_points_local_map_filtered_.resize(NUM_OF_LASER); //surf_points_local_map_[n]: n号雷达在主雷达pivot下的local surf map
-    corner_points_local_map_.clear(); 
-    corner_points_local_map_.resize(NUM_OF_LASER);
-    corner_points_local_map_filtered_.clear(); 
-    corner_points_local_map_filtered_.resize(NUM_OF_LASER);//corner_points_local_map_[n]: n号雷达在主雷达pivot下的local corner map
+    surf_points_local_map_filtered_.resize(NUM_OF_LASER); //surf_points_local_map_filtered_[n]: n号雷达在主雷达pivot下的local surf map
+    corner_points_local_map_filtered_.resize(NUM_OF_LASER);//corner_points_local_map_filtered_[n]: n号雷达在主雷达pivot下的local corner map
 
-    // #pragma omp parallel for num_threads(NUM_OF_LASER)
     for (size_t n = 0; n < NUM_OF_LASER; n++)
     {
         Pose pose_ext = Pose(qbl_[n], tbl_[n]);
@@ -1146,80 +1329,115 @@ void Estimator::buildCalibMap()
         {
             Pose pose_i(Qs_[i], Ts_[i]);
             pose_local_[n][i] = Pose(pose_pivot.T_.inverse() * pose_i.T_ * pose_ext.T_); //主雷达pivot到各雷达n(包括自己)i帧的变换
-            PointICloud surf_points_trans, corner_points_trans;
-            if (i == WINDOW_SIZE) continue;
-            // if ((n != IDX_REF) && (i > pivot_idx)) continue;
-            
-            //此处正确，因为buildCalibMap()函数是在ESTIMATE_EXTRINSIC == 1时调用的；
-            //副雷达的local map是用主雷达在窗口内的所有帧构建的，后面只对副雷达pivot帧下的points在local map中找correspondances.
-            //`ESTIMATE_EXTRINSIC == 0`, which calls  `buildLocalMap(); 在该函数中用的是副雷达的所有帧构建的副雷达的local map.
-            //https://github.com/gogojjh/M-LOAM/issues/7
-            pcl::transformPointCloud(surf_points_stack_[IDX_REF][i], surf_points_trans, pose_local_[IDX_REF][i].T_.cast<float>());
-            // for (auto &p: surf_points_trans.points) p.intensity = i;
-            surf_points_local_map_[n] += surf_points_trans;
-
-            pcl::transformPointCloud(corner_points_stack_[IDX_REF][i], corner_points_trans, pose_local_[IDX_REF][i].T_.cast<float>());
-            // for (auto &p: corner_points_trans.points) p.intensity = i;
-            corner_points_local_map_[n] += corner_points_trans;
         }
-        float ratio = (n == IDX_REF ? 0.4 : 0.2);
-        pcl::VoxelGrid<PointI> down_size_filter;
-        down_size_filter.setLeafSize(ratio, ratio, ratio);
-        down_size_filter.setInputCloud(boost::make_shared<PointICloud>(surf_points_local_map_[n]));
-        down_size_filter.filter(surf_points_local_map_filtered_[n]);
-        down_size_filter.setInputCloud(boost::make_shared<PointICloud>(corner_points_local_map_[n]));
-        down_size_filter.filter(corner_points_local_map_filtered_[n]);
     }
 
-    // calculate features and correspondences from p+1 to j
-    surf_map_features_.clear(); 
-    surf_map_features_.resize(NUM_OF_LASER);
-    corner_map_features_.clear(); 
-    corner_map_features_.resize(NUM_OF_LASER);
-    for (size_t n = 0; n < NUM_OF_LASER; n++)
+    //此处正确，因为buildCalibMap()函数是在ESTIMATE_EXTRINSIC == 1时调用的；
+    //副雷达的local map是用主雷达在窗口内的所有帧构建的，后面只对副雷达pivot帧下的points在local map中找correspondances.
+    //`ESTIMATE_EXTRINSIC == 0`, which calls  `buildLocalMap(); 在该函数中用的是副雷达的所有帧构建的副雷达的local map.
+    //https://github.com/gogojjh/M-LOAM/issues/7
+    // one task per lidar and feature type: each one only touches its own voxel map, local map and kdtree
+    Pose pose_ext_ref = Pose(qbl_[IDX_REF], tbl_[IDX_REF]);
+    std::vector<pcl::KdTreeFLANN<PointI>::Ptr> kdtree_surf_points_local_map(NUM_OF_LASER);
+    std::vector<pcl::KdTreeFLANN<PointI>::Ptr> kdtree_corner_points_local_map(NUM_OF_LASER);
+    #pragma omp parallel for num_threads(ODOM_NUM_THREADS) schedule(dynamic)
+    for (size_t k = 0; k < 2 * NUM_OF_LASER; k++)
     {
-        surf_map_features_[n].resize(WINDOW_SIZE + 1);
-        corner_map_features_[n].resize(WINDOW_SIZE + 1);
+        size_t n = k / 2;
+        float ratio = (n == IDX_REF ? 0.4 : 0.2);
+        if (k % 2 == 0)
+        {
+            surf_voxel_map_[n].setLeafSize(ratio);
+            updateVoxelMap(surf_voxel_map_[n], surf_points_stack_[IDX_REF], pose_ext_ref, pose_pivot, surf_points_local_map_filtered_[n]);
+            if (calib_converge_[n]) continue;
+            kdtree_surf_points_local_map[n].reset(new pcl::KdTreeFLANN<PointI>());
+            kdtree_surf_points_local_map[n]->setInputCloud(boost::make_shared<PointICloud>(surf_points_local_map_filtered_[n]));
+        }
+        else
+        {
+            corner_voxel_map_[n].setLeafSize(ratio);
+            updateVoxelMap(corner_voxel_map_[n], corner_points_stack_[IDX_REF], pose_ext_ref, pose_pivot, corner_points_local_map_filtered_[n]);
+            if (calib_converge_[n]) continue;
+            kdtree_corner_points_local_map[n].reset(new pcl::KdTreeFLANN<PointI>());
+            kdtree_corner_points_local_map[n]->setInputCloud(boost::make_shared<PointICloud>(corner_points_local_map_filtered_[n]));
+        }
     }
 
-    // #pragma omp parallel for num_threads(NUM_OF_LASER)
-    pcl::KdTreeFLANN<PointI>::Ptr kdtree_surf_points_local_map(new pcl::KdTreeFLANN<PointI>());
-    pcl::KdTreeFLANN<PointI>::Ptr kdtree_corner_points_local_map(new pcl::KdTreeFLANN<PointI>());
+    // calculate features and correspondences from p+1 to j
+    surf_map_features_.reset(NUM_OF_LASER, WINDOW_SIZE + 1);
+    corner_map_features_.reset(NUM_OF_LASER, WINDOW_SIZE + 1);
+
+    // one task per (lidar, frame), the results are written into their own slots
+    std::vector<std::pair<size_t, size_t> > match_tasks;
     for (size_t n = 0; n < NUM_OF_LASER; n++)
     {
         if (calib_converge_[n]) continue;
-        kdtree_surf_points_local_map->setInputCloud(boost::make_shared<PointICloud>(surf_points_local_map_filtered_[n]));
-        kdtree_corner_points_local_map->setInputCloud(boost::make_shared<PointICloud>(corner_points_local_map_filtered_[n]));
         for (size_t i = pivot_idx; i < WINDOW_SIZE + 1; i++)//i=2,3,4
         {
             if (((n == IDX_REF) && (i == pivot_idx))
              || ((n != IDX_REF) && (i != pivot_idx))) continue; 
              //忽略主雷达的pivot帧
              //忽略副雷达不是pivot帧的所有帧，即只考虑副雷达的pivot帧。对于副雷达只找在pivot帧在local map下的correspondances,其他帧不管。
-
-            int n_neigh = (n == IDX_REF ? 5:10);
-            f_extract_.matchSurfFromMap(kdtree_surf_points_local_map, //n号雷达在主雷达pivot下的local surf map kdtree
-                                        surf_points_local_map_filtered_[n], //n号雷达在主雷达pivot下的local surf map
-                                        surf_points_stack_[n][i], //n号雷达在i帧下的surf points
-                                        pose_local_[n][i], //主雷达pivot到各雷达n(包括自己)的变换
-                                        surf_map_features_[n][i], //[out]：在“n号雷达在主雷达pivot下的local surf map”中找“n号雷达在i帧下的surf points”的correspondances
-                                        n_neigh, //在local map kdtree中找最近点的个数，要对它们构成的cov valid分析
-                                        true); //FOV检测
-            f_extract_.matchCornerFromMap(kdtree_corner_points_local_map, //类似
-                                          corner_points_local_map_filtered_[n],
-                                          corner_points_stack_[n][i],
-                                          pose_local_[n][i],
-                                          corner_map_features_[n][i],//[out]
-                                          n_neigh,
-                                          true);
+            match_tasks.push_back(std::make_pair(n, i));
         }
     }
+
+    #pragma omp parallel for num_threads(ODOM_NUM_THREADS) schedule(dynamic)
+    for (size_t k = 0; k < match_tasks.size(); k++)
+    {
+        size_t n = match_tasks[k].first;
+        size_t i = match_tasks[k].second;
+        int n_neigh = (n == IDX_REF ? 5:10);
+        f_extract_.matchSurfFromMap(kdtree_surf_points_local_map[n], //n号雷达在主雷达pivot下的local surf map kdtree
+                                    surf_points_local_map_filtered_[n], //n号雷达在主雷达pivot下的local surf map
+                                    surf_points_stack_[n][i], //n号雷达在i帧下的surf points
+                                    pose_local_[n][i], //主雷达pivot到各雷达n(包括自己)的变换
+                                    surf_map_features_[n][i], //[out]：在“n号雷达在主雷达pivot下的local surf map”中找“n号雷达在i帧下的surf points”的correspondances
+                                    n_neigh, //在local map kdtree中找最近点的个数，要对它们构成的cov valid分析
+                                    true); //FOV检测
+        f_extract_.matchCornerFromMap(kdtree_corner_points_local_map[n], //类似
+                                      corner_points_local_map_filtered_[n],
+                                      corner_points_stack_[n][i],
+                                      pose_local_[n][i],
+                                      corner_map_features_[n][i],//[out]
+                                      n_neigh,
+                                      true);
+    }
     // LOG_EVERY_N(INFO, 20) << "build map(extract map): " << t_build_map.toc() << "ms("
     //                       << t_extract_map.toc() << ")ms";
     printf("build map: %fms\n", build_map_timer.Stop() * 1000);
     // if (PCL_VIEWER) visualizePCL();
 }
 
+// keep the frames whose poses are fixed (up to the pivot) in the voxel map, and merge the frames
+// which are still optimized (after the pivot, except the newest one) with their current poses
+void Estimator::updateVoxelMap(VoxelLocalMap &voxel_map,
+                               const CircularBuffer<PointICloud> &cloud_stack,
+                               const Pose &pose_ext,
+                               const Pose &pose_pivot,
+                               PointICloud &map_out)
+{
+    int pivot_idx = WINDOW_SIZE - OPT_WINDOW_SIZE;
+    if (voxel_map.newestStamp() > Header_[WINDOW_SIZE].stamp.toSec()) voxel_map.clear(); // time goes backwards
+    voxel_map.removeFramesBefore(Header_[0].stamp.toSec()); // frames which have slided out of the window
+
+    for (int i = 0; i <= pivot_idx; i++)
+    {
+        double stamp = Header_[i].stamp.toSec();
+        if (stamp > voxel_map.newestStamp())
+            voxel_map.insertFrame(stamp, cloud_stack[i], Pose(Qs_[i], Ts_[i]) * pose_ext);
+    }
+
+    std::vector<const PointICloud *> active_cloud;
+    std::vector<Pose> active_pose;
+    for (int i = pivot_idx + 1; i < WINDOW_SIZE; i++)
+    {
+        active_cloud.push_back(&cloud_stack[i]);
+        active_pose.push_back(Pose(Qs_[i], Ts_[i]) * pose_ext);
+    }
+    voxel_map.getMap(pose_pivot, active_cloud, active_pose, map_out);
+}
+
 //ESTIMATE_EXTRINSIC == 0
 void Estimator::buildLocalMap()
 {
@@ -1227,16 +1445,8 @@ void Estimator::buildLocalMap()
     int pivot_idx = WINDOW_SIZE - OPT_WINDOW_SIZE; //4-2
     Pose pose_pivot(Qs_[pivot_idx], Ts_[pivot_idx]);
 
-    // build the whole local map using all poses except the newest pose
-    for (size_t n = 0; n < NUM_OF_LASER; n++)
-    {
-        surf_points_local_map_[n].clear();
-        surf_points_local_map_filtered_[n].clear();
-        corner_points_local_map_[n].clear();
-        corner_points_local_map_filtered_[n].clear();
-    }
-
-    // #pragma omp parallel for num_threads(NUM_OF_LASER)
+    // the local map is updated incrementally instead of transforming and filtering the whole window
+    float ratio = 0.4 * std::min(2.0, std::max(0.75, 1.0 / 192 * float(N_SCANS * NUM_OF_LASER * WINDOW_SIZE)));
     for (size_t n = 0; n < NUM_OF_LASER; n++)
     {
         Pose pose_ext = Pose(qbl_[n], tbl_[n]);
@@ -1244,89 +1454,77 @@ void Estimator::buildLocalMap()
         {
             Pose pose_i(Qs_[i], Ts_[i]);
             pose_local_[n][i] = Pose(pose_pivot.T_.inverse() * pose_i.T_ * pose_ext.T_); //主雷达pivot到各雷达n(包括自己)i帧的变换
-            if (i == WINDOW_SIZE) continue;
-            PointICloud surf_points_trans, corner_points_trans;
-
-            pcl::transformPointCloud(surf_points_stack_[n][i], surf_points_trans, pose_local_[n][i].T_.cast<float>());
-            // for (auto &p: surf_points_trans.points) p.intensity = i;
-            surf_points_local_map_[n] += surf_points_trans;
-
-            pcl::transformPointCloud(corner_points_stack_[n][i], corner_points_trans, pose_local_[n][i].T_.cast<float>());
-            // for (auto &p: surf_points_trans.points) p.intensity = i;
-            corner_points_local_map_[n] += corner_points_trans;
         }
-
-        float ratio;
-        pcl::VoxelGrid<PointI> down_size_filter;
-        ratio = 0.4 * std::min(2.0, std::max(0.75, 1.0 / 192 * float(N_SCANS * NUM_OF_LASER * WINDOW_SIZE)));
-        down_size_filter.setLeafSize(ratio, ratio, ratio);
-        down_size_filter.setInputCloud(boost::make_shared<PointICloud>(surf_points_local_map_[n]));
-        down_size_filter.filter(surf_points_local_map_filtered_[n]);
-        ratio = 0.4 * std::min(2.0, std::max(0.75, 1.0 / 192 * float(N_SCANS * NUM_OF_LASER * WINDOW_SIZE)));
-        down_size_filter.setLeafSize(ratio, ratio, ratio);
-        down_size_filter.setInputCloud(boost::make_shared<PointICloud>(corner_points_local_map_[n]));
-        down_size_filter.filter(corner_points_local_map_filtered_[n]);
     }
 
-    // calculate features and correspondences from p+1 to j
-    surf_map_features_.clear();
-    surf_map_features_.resize(NUM_OF_LASER);
-    corner_map_features_.clear();
-    corner_map_features_.resize(NUM_OF_LASER);
-    for (size_t n = 0; n < NUM_OF_LASER; n++)
+    // one task per lidar and feature type: each one only touches its own voxel map, local map and kdtree
+    std::vector<pcl::KdTreeFLANN<PointI>::Ptr> kdtree_surf_points_local_map(NUM_OF_LASER);
+    std::vector<pcl::KdTreeFLANN<PointI>::Ptr> kdtree_corner_points_local_map(NUM_OF_LASER);
+    #pragma omp parallel for num_threads(ODOM_NUM_THREADS) schedule(dynamic)
+    for (size_t k = 0; k < 2 * NUM_OF_LASER; k++)
     {
-        surf_map_features_[n].resize(WINDOW_SIZE + 1);
-        corner_map_features_[n].resize(WINDOW_SIZE + 1);
+        size_t n = k / 2;
+        Pose pose_ext = Pose(qbl_[n], tbl_[n]);
+        if (k % 2 == 0)
+        {
+            surf_voxel_map_[n].setLeafSize(ratio);
+            updateVoxelMap(surf_voxel_map_[n], surf_points_stack_[n], pose_ext, pose_pivot, surf_points_local_map_filtered_[n]);
+            kdtree_surf_points_local_map[n].reset(new pcl::KdTreeFLANN<PointI>());
+            kdtree_surf_points_local_map[n]->setInputCloud(boost::make_shared<PointICloud>(surf_points_local_map_filtered_[n]));
+        }
+        else
+        {
+            corner_voxel_map_[n].setLeafSize(ratio);
+            updateVoxelMap(corner_voxel_map_[n], corner_points_stack_[n], pose_ext, pose_pivot, corner_points_local_map_filtered_[n]);
+            kdtree_corner_points_local_map[n].reset(new pcl::KdTreeFLANN<PointI>());
+            kdtree_corner_points_local_map[n]->setInputCloud(boost::make_shared<PointICloud>(corner_points_local_map_filtered_[n]));
+        }
     }
 
-    sel_surf_feature_idx_.clear();
-    sel_surf_feature_idx_.resize(NUM_OF_LASER);
-    sel_corner_feature_idx_.clear();
-    sel_corner_feature_idx_.resize(NUM_OF_LASER);
-    for (size_t n = 0; n < NUM_OF_LASER; n++)
-    {
-        sel_surf_feature_idx_[n].resize(WINDOW_SIZE + 1);
-        sel_corner_feature_idx_[n].resize(WINDOW_SIZE + 1);
-    }
+    // calculate features and correspondences from p+1 to j
+    surf_map_features_.reset(NUM_OF_LASER, WINDOW_SIZE + 1);
+    corner_map_features_.reset(NUM_OF_LASER, WINDOW_SIZE + 1);
+    sel_surf_feature_idx_.reset(NUM_OF_LASER, WINDOW_SIZE + 1);
+    sel_corner_feature_idx_.reset(NUM_OF_LASER, WINDOW_SIZE + 1);
 
-    // #pragma omp parallel for num_threads(NUM_OF_LASER)
+    // one task per (lidar, frame), the results are written into their own slots
+    std::vector<std::pair<size_t, size_t> > match_tasks;
     for (size_t n = 0; n < NUM_OF_LASER; n++)
+        for (size_t i = pivot_idx + 1; i < WINDOW_SIZE + 1; i++) //Xv[]中除过Xv[0]
+            match_tasks.push_back(std::make_pair(n, i));
+
+    #pragma omp parallel for num_threads(ODOM_NUM_THREADS) schedule(dynamic)
+    for (size_t k = 0; k < match_tasks.size(); k++)
     {
-        pcl::KdTreeFLANN<PointI>::Ptr kdtree_surf_points_local_map(new pcl::KdTreeFLANN<PointI>());
-        kdtree_surf_points_local_map->setInputCloud(boost::make_shared<PointICloud>(surf_points_local_map_filtered_[n]));
-        pcl::KdTreeFLANN<PointI>::Ptr kdtree_corner_points_local_map(new pcl::KdTreeFLANN<PointI>());
-        kdtree_corner_points_local_map->setInputCloud(boost::make_shared<PointICloud>(corner_points_local_map_filtered_[n]));
+        size_t n = match_tasks[k].first;
+        size_t i = match_tasks[k].second;
         Pose pose_ext = Pose(qbl_[n], tbl_[n]);
-        int n_neigh = 5;
-        for (size_t i = pivot_idx + 1; i < WINDOW_SIZE + 1; i++) //Xv[]中除过Xv[0]
+        Pose pose_i(Qs_[i], Ts_[i]);
+        if (POINT_PLANE_FACTOR)
         {
-            Pose pose_i(Qs_[i], Ts_[i]);
-            if (POINT_PLANE_FACTOR)
-            {
-                goodFeatureMatching(kdtree_surf_points_local_map, //n号雷达在主雷达pivot下的local surf map kdtree
-                                    surf_points_local_map_filtered_[n], //n号雷达在主雷达pivot下的local surf map
-                                    surf_points_stack_[n][i], //n号雷达在i帧下的surf points
-                                    surf_map_features_[n][i], //[out]：在“n号雷达在主雷达pivot下的local surf map”中找“n号雷达在i帧下的surf points”的correspondances
-                                    sel_surf_feature_idx_[n][i], //[out]: 挑选出第j个好point在自己点云帧下的index放进sel_surf_feature_idx_[n][i][j]
-                                    's',
-                                    pose_pivot, //主雷达pivot帧pose
-                                    pose_i, //主雷达i帧的pose
-                                    pose_ext, //主雷达到n雷达的外参
-                                    ODOM_GF_RATIO); //0.8
-            }
-            if (POINT_EDGE_FACTOR)
-            {
-                goodFeatureMatching(kdtree_corner_points_local_map,
-                                    corner_points_local_map_filtered_[n],
-                                    corner_points_stack_[n][i],
-                                    corner_map_features_[n][i],
-                                    sel_corner_feature_idx_[n][i],
-                                    'c',
-                                    pose_pivot,
-                                    pose_i,
-                                    pose_ext,
-                                    ODOM_GF_RATIO);
-            }
+            goodFeatureMatching(kdtree_surf_points_local_map[n], //n号雷达在主雷达pivot下的local surf map kdtree
+                                surf_points_local_map_filtered_[n], //n号雷达在主雷达pivot下的local surf map
+                                surf_points_stack_[n][i], //n号雷达在i帧下的surf points
+                                surf_map_features_[n][i], //[out]：在“n号雷达在主雷达pivot下的local surf map”中找“n号雷达在i帧下的surf points”的correspondances
+                                sel_surf_feature_idx_[n][i], //[out]: 挑选出第j个好point在自己点云帧下的index放进sel_surf_feature_idx_[n][i][j]
+                                's',
+                                pose_pivot, //主雷达pivot帧pose
+                                pose_i, //主雷达i帧的pose
+                                pose_ext, //主雷达到n雷达的外参
+                                ODOM_GF_RATIO); //0.8
+        }
+        if (POINT_EDGE_FACTOR)
+        {
+            goodFeatureMatching(kdtree_corner_points_local_map[n],
+                                corner_points_local_map_filtered_[n],
+                                corner_points_stack_[n][i],
+                                corner_map_features_[n][i],
+                                sel_corner_feature_idx_[n][i],
+                                'c',
+                                pose_pivot,
+                                pose_i,
+                                pose_ext,
+                                ODOM_GF_RATIO);
         }
     }
     // LOG_EVERY_N(INFO, 20) << "build map(extract map): " << t_build_map.toc() << "ms("
@@ -1342,11 +1540,12 @@ void Estimator::evaluateFeatJacobian(const Pose &pose_pivot, //主雷达pivot帧
 {
     if (feature.type_ == 's')
     {
-        LidarPureOdomPlaneNormFactor f(feature.point_, feature.coeffs_, 1.0);
+        LidarPureOdomPlaneNormFactor f(feature.point_, feature.coeffs_.head<4>(), 1.0);
 
-        double **param = new double *[3];
+        // the buffers are on the stack: evaluated for every feature of the window
+        double param_buf[3][SIZE_POSE];
+        double *param[3] = {param_buf[0], param_buf[1], param_buf[2]};
 
-        param[0] = new double[SIZE_POSE];
         param[0][0] = pose_pivot.t_(0); //tp, p: pivot
         param[0][1] = pose_pivot.t_(1);
         param[0][2] = pose_pivot.t_(2);
@@ -1355,7 +1554,6 @@ void Estimator::evaluateFeatJacobian(const Pose &pose_pivot, //主雷达pivot帧
         param[0][5] = pose_pivot.q_.z();
         param[0][6] = pose_pivot.q_.w();
 
-        param[1] = new double[SIZE_POSE];
         param[1][0] = pose_i.t_(0); //ti
         param[1][1] = pose_i.t_(1);
         param[1][2] = pose_i.t_(2);
@@ -1364,7 +1562,6 @@ void Estimator::evaluateFeatJacobian(const Pose &pose_pivot, //主雷达pivot帧
         param[1][5] = pose_i.q_.z();
         param[1][6] = pose_i.q_.w();
 
-        param[2] = new double[SIZE_POSE];
         param[2][0] = pose_ext.t_(0); //delta_t, 外参
         param[2][1] = pose_ext.t_(1);
         param[2][2] = pose_ext.t_(2);
@@ -1373,11 +1570,9 @@ void Estimator::evaluateFeatJacobian(const Pose &pose_pivot, //主雷达pivot帧
         param[2][5] = pose_ext.q_.z();
         param[2][6] = pose_ext.q_.w();
 
-        double *res = new double[1];
-        double **jaco = new double *[3];
-        jaco[0] = new double[1 * 7];
-        jaco[1] = new double[1 * 7];
-        jaco[2] = new double[1 * 7];
+        double res[1];
+        double jaco_buf[3][1 * 7];
+        double *jaco[3] = {jaco_buf[0], jaco_buf[1], jaco_buf[2]};
         f.Evaluate(param, res, jaco); //计算jacobian
 
         // Eigen::Map<Eigen::Matrix<double, 1, 7, Eigen::RowMajor>> mat_jacobian_1(jaco[0]);
@@ -1391,16 +1586,6 @@ void Estimator::evaluateFeatJacobian(const Pose &pose_pivot, //主雷达pivot帧
 
         Eigen::Map<Eigen::Matrix<double, 1, 7, Eigen::RowMajor>> mat_jacobian(jaco[1]);
         feature.jaco_ = mat_jacobian.topLeftCorner<1, 6>();
-
-        delete[] jaco[0];
-        delete[] jaco[1];
-        delete[] jaco[2];
-        delete[] jaco;
-        delete[] res;
-        delete[] param[0];
-        delete[] param[1];
-        delete[] param[2];
-        delete[] param;
     } 
     else if (feature.type_ == 'c') //TODO(jxl): 对于corner point，为何不计算jacobian
     {                              //https://github.com/gogojjh/M-LOAM/issues/9
@@ -1412,7 +1597,7 @@ void Estimator::evaluateFeatJacobian(const Pose &pose_pivot, //主雷达pivot帧
 void Estimator::goodFeatureMatching(const pcl::KdTreeFLANN<PointI>::Ptr &kdtree_from_map,
                                     const PointICloud &laser_map,
                                     const PointICloud &laser_cloud,
-                                    std::vector<PointPlaneFeature> &all_features, //[out]
+                                    std::vector<PointPlaneFeature, Eigen::aligned_allocator<PointPlaneFeature> > &all_features, //[out]
                                     std::vector<size_t> &sel_feature_idx,  //[out]
                                     const char feature_type,
                                     const Pose &pose_pivot,
@@ -1423,180 +1608,72 @@ void Estimator::goodFeatureMatching(const pcl::KdTreeFLANN<PointI>::Ptr &kdtree_
     Pose pose_local(pose_pivot.T_.inverse() * pose_i.T_ * pose_ext.T_); //主雷达pivot到副雷达i的变换
 
     size_t num_all_features = laser_cloud.size();
-    all_features.resize(num_all_features);
-    std::vector<size_t> all_feature_idx(num_all_features);
-    std::vector<int> feature_visited(num_all_features, -1); //-1: 还未用过该feature
-    std::iota(all_feature_idx.begin(), all_feature_idx.end(), 0); //初始化为0,1，2，...
-    
-    size_t num_use_features;
-    num_use_features = static_cast<size_t>(num_all_features * gf_ratio);
-    sel_feature_idx.resize(num_use_features);
-
-    //假设有100个points， gf_ratio =0.2，  num_use_features =50个, size_rnd_subset = 5
-    //all_feature_idx:  0  1  2  3 ... 99
-    //feature_visited: -1 -1 -1 -1 ... -1
+    size_t num_use_features = static_cast<size_t>(num_all_features * gf_ratio);
+    size_t n_neigh = 5;
 
-    size_t size_rnd_subset = static_cast<size_t>(1.0 * num_all_features / num_use_features);
-    Eigen::Matrix<double, 6, 6> sub_mat_H = Eigen::Matrix<double, 6, 6>::Identity() * 1e-6;
-    size_t num_sel_features = 0; //正在挑选出第几个好point
+    // correspondance of the que_idx-th point in the local map, and its jacobian for the selection
+    auto match_func = [&](const size_t &que_idx, PointPlaneFeature &feature)
+    {
+        bool b_match = false;
+        if (feature_type == 's')
+        {
+            b_match = f_extract_.matchSurfPointFromMap(kdtree_from_map, //n号雷达在主雷达pivot下的local surf map kdtree
+                                                       laser_map, //n号雷达在主雷达pivot下的local surf map
+                                                       laser_cloud.points[que_idx], //n号雷达在i帧下的surf points[que_idx]
+                                                       pose_local, //主雷达pivot到副雷达i的变换
+                                                       feature, //[out]: correspondances
+                                                       que_idx,
+                                                       n_neigh,
+                                                       false);
+        }
+        else if (feature_type == 'c')
+        {
+            b_match = f_extract_.matchCornerPointFromMap(kdtree_from_map,
+                                                         laser_map,
+                                                         laser_cloud.points[que_idx],
+                                                         pose_local,
+                                                         feature,
+                                                         que_idx,
+                                                         n_neigh,
+                                                         false);
+        }
+        return b_match;
+    };
 
     common::timing::Timer gfm_timer("odom_match_feat");
-
-    size_t n_neigh = 5;
-    bool b_match;  
-    size_t num_rnd_que;
     if (gf_ratio == 1.0)
     {
-        for (size_t j = 0; j < all_feature_idx.size(); j++)
+        all_features.resize(num_all_features);
+        sel_feature_idx.clear();
+        for (size_t que_idx = 0; que_idx < num_all_features; que_idx++)
         {
-            size_t que_idx = all_feature_idx[j];
-            b_match = false;
-            if (feature_type == 's')
-            {
-                b_match = f_extract_.matchSurfPointFromMap(kdtree_from_map,
-                                                           laser_map,
-                                                           laser_cloud.points[que_idx],
-                                                           pose_local,
-                                                           all_features[que_idx], 
-                                                           que_idx,
-                                                           n_neigh,
-                                                           false);
-            }
-            else if (feature_type == 'c')
-            {
-                b_match = f_extract_.matchCornerPointFromMap(kdtree_from_map,
-                                                             laser_map,
-                                                             laser_cloud.points[que_idx],
-                                                             pose_local,
-                                                             all_features[que_idx],
-                                                             que_idx,
-                                                             n_neigh,
-                                                             false);
-            }
-            if (b_match)
-            {
-                sel_feature_idx[num_sel_features] = que_idx;
-                num_sel_features++;
-            }
+            if (match_func(que_idx, all_features[que_idx])) sel_feature_idx.push_back(que_idx);
         }
     } 
     else
     {
-        while (true)
+        // lazy greedy on logdet(sub_mat_H), the budget is GF_SELECT_EVAL_RATIO * num_use_features evaluations,
+        // or MAX_FEATURE_SELECT_TIME if GF_SELECT_EVAL_RATIO = 0
+        Eigen::Matrix<double, 6, 6> sub_mat_H = Eigen::Matrix<double, 6, 6>::Identity() * 1e-6;
+        GoodFeatureSelector selector(static_cast<size_t>(GF_SELECT_EVAL_RATIO * num_use_features), MAX_FEATURE_SELECT_TIME);
+        selector.select(num_all_features,
+                        num_use_features,
+                        [&](const size_t &que_idx, PointPlaneFeature &feature)
+                        {
+                            if (!match_func(que_idx, feature)) return false;
+                            evaluateFeatJacobian(pose_pivot, pose_i, pose_ext, feature); //计算残差(点到面，点到线)对point i的jacobian，维数：1*6
+                            return true;
+                        },
+                        all_features,
+                        sel_feature_idx, //[out]: 按挑选顺序, 第j个好point在自己点云帧下的index
+                        sub_mat_H);
+        if (selector.earlyTermination())
         {
-            if ((num_sel_features >= num_use_features) ||
-                (all_feature_idx.size() == 0) ||
-                (gfm_timer.GetCountTime() * 1000 > MAX_FEATURE_SELECT_TIME)) //const 7ms //TODO(jxl): 作者为了实时性，可能会忽略某些point，实际运行时间得验证。
-                    break;
-
-            std::priority_queue<FeatureWithScore, 
-                                std::vector<FeatureWithScore>, 
-                                std::less<FeatureWithScore>> heap_subset; //分数从大到小，优先级由高到低，所以FeatureWithScore需要重载operator < 
-            //在每次循环挑选每个好point时，heap_subset会重新定义，即初始内容为空
-
-            while (true)
-            {
-                if (all_feature_idx.size() == 0) break;
-                num_rnd_que = 0;
-                size_t j;
-                while (num_rnd_que < MAX_RANDOM_QUEUE_TIME)//const 10
-                {
-                    j = rgi_.geneRandUniform(0, all_feature_idx.size() - 1);
-                    if (feature_visited[j] < int(num_sel_features))
-                    {
-                        feature_visited[j] = int(num_sel_features); //feature_visited[j, l, m] = n, 意思是：在挑选第n个好point时，<j, l, m>构成了heap_subset[]的集合
-                        break;
-                    }
-                    num_rnd_que++;
-                }
-                if (num_rnd_que >= MAX_RANDOM_QUEUE_TIME || gfm_timer.GetCountTime() * 1000 > MAX_FEATURE_SELECT_TIME) //TODO(jxl): 作者为了实时性，可能会忽略某些point，实际运行时间得验证。
-                    break;
-
-                size_t que_idx = all_feature_idx[j];
-
-                //在本次挑选第i个好point时，即使挑选到之前曾经处理过的point，也不会重复计算jacobian.
-                //因为PointPlaneFeature的构造函数默认type为‘n’，如果之前处理过该point，类型就变为‘s’,或者‘c’。
-                //如果没有correspondance, 早已经在之前循环中从all_feature_idx[]中移除了,本次不会选到
-                if (all_features[que_idx].type_ == 'n') //这句妙啊！
-                {
-                    b_match = false;
-                    if (feature_type == 's')
-                    {
-                        b_match = f_extract_.matchSurfPointFromMap(kdtree_from_map, //n号雷达在主雷达pivot下的local surf map kdtree
-                                                                   laser_map, //n号雷达在主雷达pivot下的local surf map
-                                                                   laser_cloud.points[que_idx], //n号雷达在i帧下的surf points[que_idx]
-                                                                   pose_local,  //主雷达pivot到副雷达i的变换
-                                                                   all_features[que_idx], //[out]: n号雷达在i帧下的surf points[que_idx]在local map中的correspondances放置在all_features[que_idx]
-                                                                   que_idx, //que_idx
-                                                                   n_neigh, //5
-                                                                   false); 
-                    }
-                    else if (feature_type == 'c')
-                    {
-                        b_match = f_extract_.matchCornerPointFromMap(kdtree_from_map,
-                                                                     laser_map,
-                                                                     laser_cloud.points[que_idx],
-                                                                     pose_local,
-                                                                     all_features[que_idx],
-                                                                     que_idx,
-                                                                     n_neigh,
-                                                                     false);
-                    }
-                    if (b_match) //是否找到了在local map中对应的correspondances
-                    {
-                        evaluateFeatJacobian(pose_pivot,
-                                             pose_i,
-                                             pose_ext,
-                                             all_features[que_idx]); //计算残差(点到面，点到线)对point i的jacobian，维数：1*6
-                    } 
-                    else //没有找到correspondances
-                    {
-                        all_feature_idx.erase(all_feature_idx.begin() + j);
-                        feature_visited.erase(feature_visited.begin() + j);
-                        continue;
-                    }
-                }
-
-                const Eigen::MatrixXd &jaco = all_features[que_idx].jaco_;
-                double cur_det = common::logDet(sub_mat_H + jaco.transpose() * jaco, //sub_mat_H: 当前时刻之前，所有好points的J^T*J
-                                                true); 
-                //TODO(jxl): J^T*J分解，这块打分的依据是什么？ https://github.com/gogojjh/M-LOAM/issues/10
-
-                //按照分数从最大到最小排序，挑出最好的point，累加好points的J^T*J, 把好point在点云中的idx放到sel_feature_idx[]
-                //同时从all_feature_idx[], feature_visited[]中移除
-                heap_subset.push(FeatureWithScore(que_idx, cur_det, jaco));
-                if (heap_subset.size() >= size_rnd_subset)
-                {
-                    const FeatureWithScore &fws = heap_subset.top();
-                    std::vector<size_t>::iterator iter = std::find(all_feature_idx.begin(), all_feature_idx.end(), fws.idx_);
-                    if (iter == all_feature_idx.end())
-                    {
-                        std::cerr << "odometry [goodFeatureMatching]: not exist feature idx !" << std::endl;
-                        break;
-                    }
-                    sub_mat_H += fws.jaco_.transpose() * fws.jaco_; //每挑选出一个好point, sub_mat_H累加所有好points的J^T*J
-
-                    size_t position = iter - all_feature_idx.begin();
-                    all_feature_idx.erase(all_feature_idx.begin() + position);
-                    feature_visited.erase(feature_visited.begin() + position);
-                    sel_feature_idx[num_sel_features] = fws.idx_; //把挑选出第i个好point在自己点云帧下的index放进sel_feature_idx[i]
-                    num_sel_features++;
-                    // printf("position: %lu, num: %lu\n", position, num_rnd_que);
-                    break;
-                }
-                if (num_rnd_que >= MAX_RANDOM_QUEUE_TIME || gfm_timer.GetCountTime() * 1000 > MAX_FEATURE_SELECT_TIME) //TODO(jxl): 作者为了实时性，可能会忽略某些point，实际运行时间得验证。
-                    break;
-            }
-            if (num_rnd_que >= MAX_RANDOM_QUEUE_TIME || gfm_timer.GetCountTime() * 1000 > MAX_FEATURE_SELECT_TIME) //TODO(jxl): 作者为了实时性，可能会忽略某些point，实际运行时间得验证。
-            {
-                std::cout << "odometry [goodFeatureMatching]: early termination!" << std::endl;
-                LOG(INFO) << "early termination: feature_type " << feature_type << ", " << num_rnd_que << ", " << gfm_timer.GetCountTime() * 1000;
-            }
+            LOG(INFO) << "odometry [goodFeatureMatching]: budget spent, feature_type " << feature_type
+                      << ", evaluations " << selector.numEvals() << ", " << gfm_timer.GetCountTime() * 1000 << "ms";
         }
     }
     gfm_timer.Stop();
-    sel_feature_idx.resize(num_sel_features);
-    // printf("num of all features: %lu, selected features: %lu\n", num_all_features, num_use_features);
 }
 
 // push new state and measurements in the sliding window
@@ -1857,6 +1934,12 @@ void Estimator::evalCalib()
                 log_extrinsics_.push_back(pose_mean);
             }
             // ini_fixed_local_map_ = false; // reconstruct new optimized map
+            // the local maps change from the frames of the reference lidar to the frames of each lidar with new extrinsics
+            for (size_t n = 0; n < NUM_OF_LASER; n++)
+            {
+                surf_voxel_map_[n].clear();
+                corner_voxel_map_[n].clear();
+            }
 
             //online refine阶段结束，进入 ESTIMATE_EXTRINSIC = 0阶段，所以丢弃在本次滑窗末尾计算的边缘化残差
             if (last_marginalization_info_ != nullptr) delete last_marginalization_info_;
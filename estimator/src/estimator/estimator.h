@@ -15,8 +15,12 @@
 
 #include <thread>
 #include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <pthread.h>
 #include <unordered_map>
 #include <queue>
+#include <memory>
 
 #include <omp.h>
 #include <time.h>
@@ -43,16 +47,23 @@
 #include "common/random_generator.hpp"
 
 #include "parameters.h"
+#include "voxel_local_map.h"
 #include "../imageSegmenter/image_segmenter.hpp"
 #include "../featureExtract/feature_extract.hpp"
+#include "../featureExtract/good_feature_selector.hpp"
 #include "../lidarTracker/lidar_tracker.h"
 #include "../initial/initial_extrinsics.h"
 #include "../utility/utility.h"
 #include "../utility/cloud_visualizer.h"
 #include "../utility/tic_toc.h"
 #include "../utility/CircularBuffer.h"
+#include "../utility/bounded_queue.hpp"
+#include "../utility/object_arena.hpp"
+#include "../utility/window_table.hpp"
+#include "../utility/deskew.hpp"
 #include "../factor/lidar_online_calib_factor.hpp"
 #include "../factor/lidar_pure_odom_factor.hpp"
+#include "../factor/lidar_map_batch_factor.hpp"
 #include "../factor/pose_local_parameterization.h"
 #include "../factor/marginalization_factor.h"
 #include "../factor/prior_factor.hpp"
@@ -60,7 +71,6 @@
 #include "mloam_pcl/point_with_time.hpp"
 
 #define MAX_FEATURE_SELECT_TIME 7 // 7ms  
-#define MAX_RANDOM_QUEUE_TIME 10
 
 class Estimator
 {
@@ -75,16 +85,29 @@ class Estimator
     void inputCloud(const double &t, const std::vector<common::PointITimeCloud> &v_laser_cloud_in);
     void inputCloud(const double &t, const common::PointCloud &laser_cloud_in);  //not defined
 
+    // pipeline: ingest (caller of inputCloud) -> extractMeasurements() -> processMeasurements()
+    void inputMeasurement(const double &t, std::vector<common::PointICloud> &v_laser_cloud);
+    std::vector<FeatureFramePtr> extractFeature(const std::vector<common::PointICloud> &v_laser_cloud);
+    void extractMeasurements();
+
     // process measurements
     void processMeasurements();
+    void processFeature();
     void undistortMeasurements(const std::vector<Pose> &pose_undist);
     void process();
 
     // build global map (for online calibration) and local map (for local optimization)
     void buildCalibMap();
     void buildLocalMap();
+    void updateVoxelMap(VoxelLocalMap &voxel_map,
+                        const CircularBuffer<common::PointICloud> &cloud_stack,
+                        const Pose &pose_ext,
+                        const Pose &pose_pivot,
+                        common::PointICloud &map_out);
 
     // process localmap optimization
+    void setupOdomProblem();
+    FeatureBatch packPureOdomFeatures(const size_t &n, const size_t &i, const bool &b_marg) const;
     void optimizeMap();
 
     // apply good feature
@@ -96,7 +119,7 @@ class Estimator
     void goodFeatureMatching(const pcl::KdTreeFLANN<PointI>::Ptr &kdtree_from_map,
                              const PointICloud &laser_map,
                              const PointICloud &laser_cloud,
-                             std::vector<PointPlaneFeature> &all_features,
+                             std::vector<PointPlaneFeature, Eigen::aligned_allocator<PointPlaneFeature> > &all_features,
                              std::vector<size_t> &sel_feature_idx,
                              const char feature_type,
                              const Pose &pose_pivot,
@@ -136,10 +159,15 @@ class Estimator
     };
 
     std::mutex m_process_;
-    std::mutex m_buf_;
 
     std::thread track_thread_;
+    std::thread extract_thread_;
     std::thread process_thread_;
+    std::atomic<bool> b_pipeline_stop_{false};
+    // wake the stages up when a frame is pushed into their queue
+    std::mutex m_pipeline_;
+    std::condition_variable cv_cloud_, cv_feature_;
+    size_t cloud_push_cnt_{0}, feature_push_cnt_{0};
 
     omp_lock_t omp_lock_{};
 
@@ -180,13 +208,15 @@ class Estimator
 
     pcl::VoxelGrid<PointI> down_size_filter_corner_, down_size_filter_surf_;
 
-    std::vector<common::PointICloud> surf_points_local_map_, surf_points_local_map_filtered_; //2个， 
-    //surf_points_local_map_[n]: n号雷达在主雷达pivot下的local surf map， 把n号雷达在滑窗内的所有帧surf points都转换到主雷达pivot帧下
+    std::vector<VoxelLocalMap> surf_voxel_map_, corner_voxel_map_; //2个， 滑窗内n号雷达的local map, 在世界系下增量维护
+
+    std::vector<common::PointICloud> surf_points_local_map_filtered_; //2个， 
+    //surf_points_local_map_filtered_[n]: n号雷达在主雷达pivot下的local surf map， 把n号雷达在滑窗内的所有帧surf points都转换到主雷达pivot帧下
 
     std::vector<common::PointICloud> surf_points_pivot_map_;
 
-    std::vector<common::PointICloud> corner_points_local_map_, corner_points_local_map_filtered_; //2个，
-    //corner_points_local_map_[n]: n号雷达在主雷达pivot下的local corner map, 把n号雷达在滑窗内的所有帧corner points都转换到主雷达pivot帧下
+    std::vector<common::PointICloud> corner_points_local_map_filtered_; //2个，
+    //corner_points_local_map_filtered_[n]: n号雷达在主雷达pivot下的local corner map, 把n号雷达在滑窗内的所有帧corner points都转换到主雷达pivot帧下
 
     std::vector<common::PointICloud> corner_points_pivot_map_;
 
@@ -197,26 +227,32 @@ class Estimator
 
     int frame_cnt_{};
 
-    ImageSegmenter img_segment_;
+    std::vector<ImageSegmenter> img_segment_; //NUM_OF_LASER个, 每个雷达的分割器各自持有工作区
     FeatureExtract f_extract_;
     LidarTracker lidar_tracker_;
     InitialExtrinsics initial_extrinsics_;
 
-    std::queue<std::pair<double, std::vector<cloudFeature> > > feature_buf_; //每帧features
+    std::vector<FeatureFramePool> feature_frame_pool_; //NUM_OF_LASER个, 回收每个雷达的FeatureFrame
+    ScanDeskewer deskewer_; //运动补偿的插值表, 每个雷达每帧重新计算
+
+    // bounded queues between the stages, the oldest frame is dropped when a queue is full
+    BoundedQueue<std::pair<double, std::vector<common::PointICloud> > > cloud_queue_; //每帧原始点云
+    BoundedQueue<std::pair<double, std::vector<FeatureFramePtr> > > feature_queue_; //每帧features
+    std::atomic<size_t> cloud_drop_cnt_{0}, feature_drop_cnt_{0};
 
-    pair<double, std::vector<cloudFeature> > prev_feature_, cur_feature_; //k, k+1帧左右雷达features
+    pair<double, std::vector<FeatureFramePtr> > prev_feature_, cur_feature_; //k, k+1帧左右雷达features
 
-    std::vector<std::vector<std::vector<PointPlaneFeature> > > surf_map_features_, corner_map_features_;//2个，每个对象WINDOW_SIZE + 1大小
+    WindowTable<PointPlaneFeature, Eigen::aligned_allocator<PointPlaneFeature> > surf_map_features_, corner_map_features_;//2个，每个对象WINDOW_SIZE + 1大小, 每帧reset后复用
     //surf_map_features_[n][i]: “n号雷达在滑窗中i帧下surf points”在“n号雷达的local surf map”中的correspondances.这些features是在local map下的points
     //corner_map_features_[n][i]: 同理
 
-    std::vector<std::vector<PointPlaneFeature> > cumu_surf_map_features_, cumu_corner_map_features_; //2个， 每个雷达在pivot帧下的points
+    std::vector<std::vector<PointPlaneFeature, Eigen::aligned_allocator<PointPlaneFeature> > > cumu_surf_map_features_, cumu_corner_map_features_; //2个， 每个雷达在pivot帧下的points
     //cumu_surf_map_features_[n]: n号雷达在pivot帧下的surf points在n号雷达的local surf map中的correspondances.
     //cumu_corner_map_features_[n]: 同理
 
     size_t cumu_surf_feature_cnt_, cumu_corner_feature_cnt_;
 
-    std::vector<std::vector<std::vector<size_t> > > sel_surf_feature_idx_, sel_corner_feature_idx_; //2个，每个对象WINDOW_SIZE + 1大小
+    WindowTable<size_t> sel_surf_feature_idx_, sel_corner_feature_idx_; //2个，每个对象WINDOW_SIZE + 1大小
     //ESTIMATE_EXTRINSIC == 0下使用
     //sel_surf_feature_idx_[n][i][j]: 挑选出n号雷达在i帧下的第j个好point在自己点云帧下的index放进 sel_surf_feature_idx_[n][i][j]
     //sel_corner_feature_idx_[n][i][j]: 同理
@@ -241,6 +277,13 @@ class Estimator
     MarginalizationInfo *last_marginalization_info_{};
     vector<double *> last_marginalization_parameter_blocks_;
 
+    // the problem, parameter blocks and local parameterizations are kept across frames,
+    // cost functions and residual infos of one frame are placed in odom_arena_ and released after slideWindow()
+    std::unique_ptr<ceres::Problem> odom_problem_;
+    std::vector<std::unique_ptr<PoseLocalParameterization> > odom_local_param_; //OPT_WINDOW_SIZE + 1 + NUM_OF_LASER
+    std::unique_ptr<ceres::LossFunction> odom_loss_function_;
+    ObjectArena odom_arena_;
+
     PlaneNormalVisualizer plane_normal_vis_;
 
     std::vector<double> total_measurement_pre_time_, total_feat_matching_time_, 
@@ -250,8 +293,6 @@ class Estimator
     std::vector<nav_msgs::Path> v_laser_path_; //2个
 
     pcl::PCDWriter pcd_writer_;
-
-    common::RandomGeneratorInt<size_t> rgi_;
 };
 
 
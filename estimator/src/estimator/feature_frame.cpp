@@ -0,0 +1,75 @@
+/*******************************************************
+ * Copyright (C) 2020, RAM-LAB, Hong Kong University of Science and Technology
+ *
+ * This file is part of M-LOAM (https://ram-lab.com/file/jjiao/m-loam).
+ * If you use this code, please cite the respective publications as
+ * listed on the above websites.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *
+ * Author: Jianhao JIAO (jiaojh1994@gmail.com)
+ *******************************************************/
+
+#include "feature_frame.h"
+
+void FeatureFrame::buildKdTree()
+{
+    if (kdtree_built_) return;
+    // non-owning pointers, the frame outlives the search of its trees
+    kdtree_corner_less_sharp_->setInputCloud(
+        common::PointICloudConstPtr(&cloud_[CORNER_POINTS_LESS_SHARP], [](const common::PointICloud *) {}));
+    kdtree_surf_less_flat_->setInputCloud(
+        common::PointICloudConstPtr(&cloud_[SURF_POINTS_LESS_FLAT], [](const common::PointICloud *) {}));
+    kdtree_built_ = true;
+}
+
+FeatureFramePool::Storage::~Storage()
+{
+    for (FeatureFrame *frame : free_frames_) delete frame;
+    free_frames_.clear();
+}
+
+FeatureFramePool::FeatureFramePool(const size_t &max_free_frames)
+    : storage_(std::make_shared<Storage>())
+{
+    storage_->max_free_frames_ = max_free_frames;
+}
+
+FeatureFramePtr FeatureFramePool::acquire()
+{
+    FeatureFrame *frame = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(storage_->m_free_);
+        if (!storage_->free_frames_.empty())
+        {
+            frame = storage_->free_frames_.back();
+            storage_->free_frames_.pop_back();
+        }
+    }
+    if (!frame) frame = new FeatureFrame();
+    frame->clear();
+
+    std::weak_ptr<Storage> weak_storage = storage_;
+    return FeatureFramePtr(frame, [weak_storage](FeatureFrame *f) {
+        std::shared_ptr<Storage> storage = weak_storage.lock();
+        if (storage)
+        {
+            std::lock_guard<std::mutex> lock(storage->m_free_);
+            if (storage->free_frames_.size() < storage->max_free_frames_)
+            {
+                storage->free_frames_.push_back(f);
+                return;
+            }
+        }
+        delete f;
+    });
+}
+
+size_t FeatureFramePool::numFreeFrames() const
+{
+    std::lock_guard<std::mutex> lock(storage_->m_free_);
+    return storage_->free_frames_.size();
+}
+
+//
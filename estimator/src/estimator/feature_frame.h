@@ -0,0 +1,89 @@
+/*******************************************************
+ * Copyright (C) 2020, RAM-LAB, Hong Kong University of Science and Technology
+ *
+ * This file is part of M-LOAM (https://ram-lab.com/file/jjiao/m-loam).
+ * If you use this code, please cite the respective publications as
+ * listed on the above websites.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *
+ * Author: Jianhao JIAO (jiaojh1994@gmail.com)
+ *******************************************************/
+
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <mutex>
+
+#include <pcl/kdtree/kdtree_flann.h>
+
+#include "common/types/type.h"
+
+// index of each point buffer inside a FeatureFrame
+enum FeatureCloudType
+{
+    LASER_CLOUD = 0,          // whole (segmented) scan
+    LASER_CLOUD_OUTLIER,      // points without a valid cluster
+    CORNER_POINTS_SHARP,      // subset: the most distinctive edge points
+    CORNER_POINTS_LESS_SHARP, // more corner points
+    SURF_POINTS_FLAT,         // subset: the most distinctive planar points
+    SURF_POINTS_LESS_FLAT,    // more planar points
+    NUM_FEATURE_CLOUD
+};
+
+// fixed-layout features of one LiDAR at one frame, replace std::map<std::string, PointICloud>
+class FeatureFrame
+{
+public:
+    FeatureFrame()
+        : kdtree_corner_less_sharp_(new pcl::KdTreeFLANN<common::PointI>()),
+          kdtree_surf_less_flat_(new pcl::KdTreeFLANN<common::PointI>()),
+          kdtree_built_(false) {}
+
+    // keep the capacity of each buffer so that a recycled frame does not reallocate
+    void clear()
+    {
+        for (size_t i = 0; i < NUM_FEATURE_CLOUD; i++) cloud_[i].clear();
+        kdtree_built_ = false;
+    }
+
+    // build the KD-trees of the less sharp/flat clouds once the frame becomes the previous frame of the tracker,
+    // the trees borrow the clouds, so they must not be modified afterwards
+    void buildKdTree();
+
+    common::PointICloud cloud_[NUM_FEATURE_CLOUD];
+
+    pcl::KdTreeFLANN<common::PointI>::Ptr kdtree_corner_less_sharp_, kdtree_surf_less_flat_;
+    bool kdtree_built_;
+};
+
+typedef std::shared_ptr<FeatureFrame> FeatureFramePtr;
+
+// per-laser pool of FeatureFrame: a released frame returns to the pool instead of being deleted
+class FeatureFramePool
+{
+public:
+    FeatureFramePool(const size_t &max_free_frames = 8);
+
+    // the returned frame is empty and goes back to the pool once the last owner releases it
+    FeatureFramePtr acquire();
+
+    size_t numFreeFrames() const;
+
+private:
+    struct Storage
+    {
+        ~Storage();
+
+        std::mutex m_free_;
+        std::vector<FeatureFrame *> free_frames_;
+        size_t max_free_frames_;
+    };
+
+    // frames may outlive the pool (e.g. still queued in the estimator), so they only keep a weak reference
+    std::shared_ptr<Storage> storage_;
+};
+
+//
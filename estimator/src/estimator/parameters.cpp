@@ -25,9 +25,15 @@ std::string EX_CALIB_RESULT_PATH;
 std::string EX_CALIB_EIG_PATH;
 
 int MULTIPLE_THREAD;
+int PIPELINE_QUEUE_SIZE;
+int EXTRACT_THREAD_CPU;
+int PROCESS_THREAD_CPU;
+int ODOM_NUM_THREADS;
 
 double SOLVER_TIME;
 int NUM_ITERATIONS;
+int TRACKER_SOLVER;
+int BATCH_MAP_FACTOR;
 int ESTIMATE_EXTRINSIC;
 int ESTIMATE_TD;
 
@@ -39,6 +45,7 @@ int MIN_LINE_SIZE;
 int SEGMENT_VALID_POINT_NUM;
 int SEGMENT_VALID_LINE_NUM;
 float SEGMENT_THETA;
+int SEGMENT_METHOD;
 
 // LiDAR
 size_t NUM_OF_LASER;
@@ -100,6 +107,13 @@ float MAP_DEG_THRE;
 float DISTANCE_KEYFRAMES;
 float ORIENTATION_KEYFRAMES;
 float SURROUNDING_KF_RADIUS;
+int INCREMENTAL_LOCAL_MAP;
+std::string KEYFRAME_STORE_PATH;
+float KEYFRAME_TILE_SIZE;
+float KEYFRAME_EVICT_RADIUS;
+float GLOBAL_MAP_TILE_SIZE;
+float GLOBAL_MAP_CPU_BUDGET;
+float GF_SELECT_EVAL_RATIO;
 
 float UCT_EXT_RATIO;
 std::vector<Eigen::Matrix<double, 6, 6> > COV_EXT;
@@ -159,10 +173,16 @@ void readParameters(std::string config_file)
     }
 
     MULTIPLE_THREAD = fsSettings["multiple_thread"];
+    PIPELINE_QUEUE_SIZE = fsSettings["pipeline_queue_size"];
+    if (PIPELINE_QUEUE_SIZE < 2) PIPELINE_QUEUE_SIZE = 2;
+    EXTRACT_THREAD_CPU = fsSettings["extract_thread_cpu"].empty() ? -1 : (int)fsSettings["extract_thread_cpu"];
+    PROCESS_THREAD_CPU = fsSettings["process_thread_cpu"].empty() ? -1 : (int)fsSettings["process_thread_cpu"];
 
     int num_of_laser = fsSettings["num_of_laser"];
     assert(num_of_laser >= 0);
     NUM_OF_LASER = (size_t)num_of_laser;
+    ODOM_NUM_THREADS = fsSettings["odom_num_threads"];
+    if (ODOM_NUM_THREADS <= 0) ODOM_NUM_THREADS = std::max(1, num_of_laser); // one worker per lidar
     printf("laser number %lu\n", NUM_OF_LASER);
 
     cv::FileNode node_cloud_topic = fsSettings["cloud_topic"];
@@ -263,6 +283,8 @@ void readParameters(std::string config_file)
     // odometry
     SOLVER_TIME = fsSettings["max_solver_time"];
     NUM_ITERATIONS = fsSettings["max_num_iterations"];
+    TRACKER_SOLVER = fsSettings["tracker_solver"]; // 0: ceres with one block per correspondence, 1: ceres with a batched block, 2: gauss-newton
+    BATCH_MAP_FACTOR = fsSettings["batch_map_factor"]; // 0: one ceres block per feature, 1: the features of one pose in a batched block
 
     ROI_RANGE = fsSettings["roi_range"];
 
@@ -273,6 +295,7 @@ void readParameters(std::string config_file)
     SEGMENT_VALID_POINT_NUM = fsSettings["segment_valid_point_num"];
     SEGMENT_VALID_LINE_NUM = fsSettings["segment_valid_line_num"];
     SEGMENT_THETA = fsSettings["segment_theta"];
+    SEGMENT_METHOD = fsSettings["segment_method"]; // 0: BFS (default), 1: union-find
 
     int idx_ref = fsSettings["idx_ref"];
     assert(idx_ref >= 0);
@@ -326,6 +349,16 @@ void readParameters(std::string config_file)
     ORIENTATION_KEYFRAMES = fsSettings["orientation_keyframes"];
     SURROUNDING_KF_RADIUS = fsSettings["surrounding_kf_radius"];
     printf("map kf radius: %f, kf dis:%f, ori:%f\n", SURROUNDING_KF_RADIUS, DISTANCE_KEYFRAMES, ORIENTATION_KEYFRAMES);
+    INCREMENTAL_LOCAL_MAP = fsSettings["incremental_local_map"]; // 0: rebuild the local map at each keyframe, 1: persistent voxel map
+    fsSettings["keyframe_store_path"] >> KEYFRAME_STORE_PATH; // empty: keep all the keyframes in memory
+    KEYFRAME_TILE_SIZE = fsSettings["keyframe_tile_size"];
+    KEYFRAME_EVICT_RADIUS = fsSettings["keyframe_evict_radius"];
+    printf("keyframe store: %s, tile size: %f, evict radius: %f\n", KEYFRAME_STORE_PATH.c_str(), KEYFRAME_TILE_SIZE, KEYFRAME_EVICT_RADIUS);
+    GLOBAL_MAP_TILE_SIZE = fsSettings["global_map_tile_size"];
+    GLOBAL_MAP_CPU_BUDGET = fsSettings["global_map_cpu_budget"];
+    printf("global map tile size: %f, cpu budget: %f\n", GLOBAL_MAP_TILE_SIZE, GLOBAL_MAP_CPU_BUDGET);
+    GF_SELECT_EVAL_RATIO = fsSettings["gf_select_eval_ratio"]; // 0: the good feature selection is bounded by time instead
+    printf("good feature selection budget: %f evaluations per feature\n", GF_SELECT_EVAL_RATIO);
 
     UCT_EXT_RATIO = fsSettings["uct_ext_ratio"];
     printf("uct ext ratio: %f\n", UCT_EXT_RATIO);
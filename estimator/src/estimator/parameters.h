@@ -39,6 +39,7 @@
 #include "common/timing.hpp"
 
 #include "../estimator/pose.h"
+#include "../estimator/feature_frame.h"
 
 #include "dbg.h"
 using namespace std;
@@ -53,9 +54,15 @@ extern std::string EX_CALIB_RESULT_PATH;
 extern std::string EX_CALIB_EIG_PATH;
 
 extern int MULTIPLE_THREAD;
+extern int PIPELINE_QUEUE_SIZE;
+extern int EXTRACT_THREAD_CPU;
+extern int PROCESS_THREAD_CPU;
+extern int ODOM_NUM_THREADS;
 
 extern double SOLVER_TIME;
 extern int NUM_ITERATIONS;
+extern int TRACKER_SOLVER;
+extern int BATCH_MAP_FACTOR;
 extern int ESTIMATE_EXTRINSIC;
 extern int ESTIMATE_TD;
 
@@ -66,6 +73,7 @@ extern int MIN_LINE_SIZE;
 extern int SEGMENT_VALID_POINT_NUM;
 extern int SEGMENT_VALID_LINE_NUM;
 extern float SEGMENT_THETA;
+extern int SEGMENT_METHOD;
 
 // LiDAR
 extern size_t IDX_REF; //0
@@ -127,6 +135,13 @@ extern float MAP_DEG_THRE;
 extern float DISTANCE_KEYFRAMES;
 extern float ORIENTATION_KEYFRAMES;
 extern float SURROUNDING_KF_RADIUS;
+extern int INCREMENTAL_LOCAL_MAP;
+extern std::string KEYFRAME_STORE_PATH;
+extern float KEYFRAME_TILE_SIZE;
+extern float KEYFRAME_EVICT_RADIUS;
+extern float GLOBAL_MAP_TILE_SIZE;
+extern float GLOBAL_MAP_CPU_BUDGET;
+extern float GF_SELECT_EVAL_RATIO;
 
 extern float UCT_EXT_RATIO;
 extern std::vector<Eigen::Matrix<double, 6, 6> > COV_EXT;
@@ -163,8 +178,6 @@ enum NoiseOrder
     O_GW = 9
 };
 
-typedef std::map<std::string, common::PointICloud> cloudFeature;
-
 class PointPlaneFeature
 {
 public:
@@ -172,29 +185,13 @@ public:
     size_t idx_; //在k+1帧feature points中的index。
     size_t laser_idx_; //属于多少线束号，滑窗local map和后端使用
     Eigen::Vector3d point_; //在k+1帧feature points中的坐标, point i。    p_sel = R_k_k+1 * i + t_k_k+1， 然后在k帧feature kd-tree points中找最近邻points
-    Eigen::VectorXd coeffs_; //corner correspondace(i: j, l)； surf correspondace(i: j, l, m)平面方程系数；
-    Eigen::MatrixXd jaco_; //残差(点到面，点到线)对point i的jacobian, 维数：1*6
+    Eigen::Matrix<double, 6, 1> coeffs_; //corner correspondace(i: j, l)的[lpa, lpb]； surf correspondace(i: j, l, m)平面方程系数[w, d]，后两维为0；
+    Eigen::Matrix<double, 1, 6> jaco_; //残差(点到面，点到线)对point i的jacobian, 维数：1*6
     char type_; //surf point为‘s’, corner point为‘c’，滑窗local map和后端使用
 
     EIGEN_MAKE_ALIGNED_OPERATOR_NEW
 };
 
-class FeatureWithScore
-{
-public:
-    FeatureWithScore(const int &idx, const double &score, const Eigen::MatrixXd &jaco) 
-        : idx_(idx), score_(score), jaco_(jaco) {}
-
-    bool operator < (const FeatureWithScore &fws) const
-    {
-        return this->score_ < fws.score_;
-    }
-    
-    size_t idx_; //点point i在自己帧下的index
-    double score_;
-    Eigen::MatrixXd jaco_; //残差(点到面，点到线)对point i的jacobian
-};
-
 class ScanInfo
 {
 public:
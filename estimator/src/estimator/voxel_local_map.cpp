@@ -0,0 +1,148 @@
+/*******************************************************
+ * Copyright (C) 2020, RAM-LAB, Hong Kong University of Science and Technology
+ *
+ * This file is part of M-LOAM (https://ram-lab.com/file/jjiao/m-loam).
+ * If you use this code, please cite the respective publications as
+ * listed on the above websites.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *
+ * Author: Jianhao JIAO (jiaojh1994@gmail.com)
+ *******************************************************/
+
+#include <cmath>
+#include <utility>
+
+#include "voxel_local_map.h"
+
+using namespace common;
+
+VoxelLocalMap::VoxelLocalMap(const float &leaf_size)
+    : leaf_size_(leaf_size) {}
+
+void VoxelLocalMap::setLeafSize(const float &leaf_size)
+{
+    if (leaf_size == leaf_size_) return;
+    leaf_size_ = leaf_size;
+    clear();
+}
+
+void VoxelLocalMap::clear()
+{
+    voxels_.clear();
+    frames_.clear();
+}
+
+// 21 bits per axis, the grid is centered at the origin of the world frame
+uint64_t VoxelLocalMap::voxelKey(const double &x, const double &y, const double &z) const
+{
+    const int64_t offset = 1 << 20;
+    uint64_t ix = static_cast<uint64_t>(static_cast<int64_t>(std::floor(x / leaf_size_)) + offset) & 0x1FFFFF;
+    uint64_t iy = static_cast<uint64_t>(static_cast<int64_t>(std::floor(y / leaf_size_)) + offset) & 0x1FFFFF;
+    uint64_t iz = static_cast<uint64_t>(static_cast<int64_t>(std::floor(z / leaf_size_)) + offset) & 0x1FFFFF;
+    return (ix << 42) | (iy << 21) | iz;
+}
+
+void VoxelLocalMap::addSum(const VoxelSum &other, VoxelSum &sum)
+{
+    sum.x_ += other.x_;
+    sum.y_ += other.y_;
+    sum.z_ += other.z_;
+    sum.intensity_ += other.intensity_;
+    sum.cnt_ += other.cnt_;
+}
+
+void VoxelLocalMap::accumulate(const PointICloud &cloud, const Pose &pose_w, VoxelHash &voxels) const
+{
+    const Eigen::Matrix3d R = pose_w.q_.toRotationMatrix();
+    const Eigen::Vector3d &t = pose_w.t_;
+    for (const PointI &point : cloud.points)
+    {
+        Eigen::Vector3d p = R * Eigen::Vector3d(point.x, point.y, point.z) + t;
+        VoxelSum &sum = voxels.emplace(voxelKey(p.x(), p.y(), p.z()), VoxelSum{0, 0, 0, 0, 0}).first->second;
+        sum.x_ += p.x();
+        sum.y_ += p.y();
+        sum.z_ += p.z();
+        sum.intensity_ += point.intensity;
+        sum.cnt_++;
+    }
+}
+
+bool VoxelLocalMap::insertFrame(const double &stamp, const PointICloud &cloud, const Pose &pose_w)
+{
+    if (!frames_.empty() && (stamp <= frames_.back().first)) return false;
+    VoxelHash frame_voxels;
+    accumulate(cloud, pose_w, frame_voxels);
+
+    for (const auto &v : frame_voxels)
+        addSum(v.second, voxels_.emplace(v.first, VoxelSum{0, 0, 0, 0, 0}).first->second);
+    frames_.emplace_back(stamp, std::move(frame_voxels));
+    return true;
+}
+
+void VoxelLocalMap::removeFramesBefore(const double &stamp)
+{
+    std::vector<uint64_t> keys;
+    while (!frames_.empty() && (frames_.front().first < stamp))
+    {
+        for (const auto &v : frames_.front().second) keys.push_back(v.first);
+        frames_.pop_front();
+    }
+    // sum the voxels again over the remaining frames in insertion order instead of subtracting the removed ones:
+    // the same sums as if only the remaining frames had been inserted, without rounding drift
+    for (const uint64_t &key : keys)
+    {
+        VoxelSum sum{0, 0, 0, 0, 0};
+        for (const auto &frame : frames_)
+        {
+            auto iter = frame.second.find(key);
+            if (iter != frame.second.end()) addSum(iter->second, sum);
+        }
+        if (sum.cnt_ == 0)
+            voxels_.erase(key);
+        else
+            voxels_[key] = sum;
+    }
+}
+
+void VoxelLocalMap::getMap(const Pose &pose_pivot,
+                           const std::vector<const PointICloud *> &active_cloud,
+                           const std::vector<Pose> &active_pose,
+                           PointICloud &map_out) const
+{
+    VoxelHash active_voxels;
+    for (size_t i = 0; i < active_cloud.size(); i++) accumulate(*active_cloud[i], active_pose[i], active_voxels);
+
+    const Pose pose_pivot_inv = pose_pivot.inverse();
+    const Eigen::Matrix3d R = pose_pivot_inv.q_.toRotationMatrix();
+    const Eigen::Vector3d &t = pose_pivot_inv.t_;
+    auto push_centroid = [&](const VoxelSum &sum) {
+        Eigen::Vector3d p = R * (Eigen::Vector3d(sum.x_, sum.y_, sum.z_) / sum.cnt_) + t;
+        PointI point;
+        point.x = p.x();
+        point.y = p.y();
+        point.z = p.z();
+        point.intensity = sum.intensity_ / sum.cnt_;
+        map_out.push_back(point);
+    };
+
+    map_out.clear();
+    map_out.reserve(voxels_.size() + active_voxels.size());
+    for (const auto &v : voxels_)
+    {
+        auto iter = active_voxels.find(v.first);
+        if (iter == active_voxels.end())
+        {
+            push_centroid(v.second);
+            continue;
+        }
+        VoxelSum sum = v.second;
+        addSum(iter->second, sum);
+        push_centroid(sum);
+        active_voxels.erase(iter);
+    }
+    for (const auto &v : active_voxels) push_centroid(v.second);
+}
+
+//
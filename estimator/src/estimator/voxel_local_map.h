@@ -0,0 +1,68 @@
+/*******************************************************
+ * Copyright (C) 2020, RAM-LAB, Hong Kong University of Science and Technology
+ *
+ * This file is part of M-LOAM (https://ram-lab.com/file/jjiao/m-loam).
+ * If you use this code, please cite the respective publications as
+ * listed on the above websites.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *
+ * Author: Jianhao JIAO (jiaojh1994@gmail.com)
+ *******************************************************/
+
+#pragma once
+
+#include <deque>
+#include <vector>
+#include <unordered_map>
+
+#include "common/types/type.h"
+#include "pose.h"
+
+// voxel-downsampled local map of the sliding window, stored in the world frame
+// a frame is inserted once its pose is fixed and removed when it slides out of the window,
+// each voxel keeps the point sums so that both operations only touch the voxels of that frame;
+// the voxels of a removed frame are summed again from the other frames: the sums do not drift over time
+class VoxelLocalMap
+{
+public:
+    VoxelLocalMap(const float &leaf_size = 0.4);
+
+    // the map is cleared if the leaf size changes
+    void setLeafSize(const float &leaf_size);
+    void clear();
+
+    // frames are identified by their timestamps and must be inserted in time order
+    bool insertFrame(const double &stamp, const common::PointICloud &cloud, const Pose &pose_w);
+    void removeFramesBefore(const double &stamp);
+
+    size_t numFrames() const { return frames_.size(); }
+    double newestStamp() const { return frames_.empty() ? -1.0 : frames_.back().first; }
+    size_t numVoxels() const { return voxels_.size(); }
+
+    // voxel centroids of the inserted frames and of the temporary frames (poses still optimized),
+    // expressed in the frame of pose_pivot; equivalent to pcl::VoxelGrid over the whole window
+    void getMap(const Pose &pose_pivot,
+                const std::vector<const common::PointICloud *> &active_cloud,
+                const std::vector<Pose> &active_pose,
+                common::PointICloud &map_out) const;
+
+private:
+    struct VoxelSum
+    {
+        double x_, y_, z_, intensity_;
+        int cnt_;
+    };
+    typedef std::unordered_map<uint64_t, VoxelSum> VoxelHash;
+
+    static void addSum(const VoxelSum &other, VoxelSum &sum);
+    uint64_t voxelKey(const double &x, const double &y, const double &z) const;
+    void accumulate(const common::PointICloud &cloud, const Pose &pose_w, VoxelHash &voxels) const;
+
+    float leaf_size_;
+    VoxelHash voxels_;
+    std::deque<std::pair<double, VoxelHash> > frames_; // contribution of each frame
+};
+
+//
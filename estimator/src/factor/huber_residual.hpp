@@ -0,0 +1,60 @@
+/*******************************************************
+ * Copyright (C) 2020, RAM-LAB, Hong Kong University of Science and Technology
+ *
+ * This file is part of M-LOAM (https://ram-lab.com/file/jjiao/m-loam).
+ * If you use this code, please cite the respective publications as
+ * listed on the above websites.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *
+ * Author: Jianhao JIAO (jiaojh1994@gmail.com)
+ *******************************************************/
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+// ceres::HuberLoss(delta) of one feature inside a batched residual block, applied as ceres applies the loss of a residual block
+// (ceres/internal/corrector.cc): the residual r of the feature (s = |r|^2) is scaled by residual_scale_, its jacobian J is
+// replaced by sqrt(rho'(s)) (I - alpha_sq_norm_ r r^T) J, so that the gradient and the gauss-newton hessian are the ones of
+// one block per feature with the loss
+// the scaled residual only carries rho'(s) s of the cost rho(s): the rest (cost_rest_) is added by the batch as one more
+// residual with a zero jacobian, then the cost of the batch is the cost of the per-feature blocks
+struct HuberResidual
+{
+    HuberResidual(const double &delta, const double &sq_norm)
+        : residual_scale_(1.0), sqrt_rho1_(1.0), alpha_sq_norm_(0.0), cost_rest_(0.0)
+    {
+        if ((delta <= 0) || (sq_norm <= delta * delta)) return;
+        const double norm = sqrt(sq_norm);
+        double rho[3]; // ceres::HuberLoss::Evaluate
+        rho[0] = 2.0 * delta * norm - delta * delta;
+        rho[1] = std::max(std::numeric_limits<double>::min(), delta / norm);
+        rho[2] = -rho[1] / (2.0 * sq_norm);
+        sqrt_rho1_ = sqrt(rho[1]);
+        if (rho[2] <= 0.0) // always the case of the huber loss
+        {
+            residual_scale_ = sqrt_rho1_;
+        }
+        else
+        {
+            const double alpha = 1.0 - sqrt(1.0 + 2.0 * sq_norm * rho[2] / rho[1]);
+            residual_scale_ = sqrt_rho1_ / (1.0 - alpha);
+            alpha_sq_norm_ = alpha / sq_norm;
+        }
+        cost_rest_ = std::max(0.0, rho[0] - residual_scale_ * residual_scale_ * sq_norm);
+    }
+
+    // scale of the jacobian of a 1-dim residual
+    double jacobianScale(const double &sq_norm) const { return sqrt_rho1_ * (1.0 - alpha_sq_norm_ * sq_norm); }
+
+    double residual_scale_; // sqrt(rho') / (1 - alpha)
+    double sqrt_rho1_;      // sqrt(rho')
+    double alpha_sq_norm_;  // alpha / s
+    double cost_rest_;      // rho(s) - |residual_scale_ r|^2
+};
+
+//
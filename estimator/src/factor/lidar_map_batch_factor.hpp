@@ -0,0 +1,309 @@
+/*******************************************************
+ * Copyright (C) 2020, RAM-LAB, Hong Kong University of Science and Technology
+ *
+ * This file is part of M-LOAM (https://ram-lab.com/file/jjiao/m-loam).
+ * If you use this code, please cite the respective publications as
+ * listed on the above websites.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *
+ * Author: Jianhao JIAO (jiaojh1994@gmail.com)
+ *******************************************************/
+
+#pragma once
+
+#include <cmath>
+#include <utility>
+#include <vector>
+
+#include <ceres/ceres.h>
+
+#include <eigen3/Eigen/Dense>
+
+#include "../estimator/parameters.h"
+#include "../utility/utility.h"
+#include "huber_residual.hpp"
+
+// point-to-plane and point-to-line correspondences of one pose in structure-of-arrays layout,
+// one contiguous array per coordinate so that the transformation of all points is a vectorized loop
+// the huber loss is applied per correspondence inside the batch (HuberResidual): the cost, the gradient and the gauss-newton
+// hessian of the batch are the ones of one block per correspondence with ceres::HuberLoss(huber_delta_)
+class FeatureBatch
+{
+public:
+    explicit FeatureBatch(const double &huber_delta = 0.0) : huber_delta_(huber_delta) {}
+
+    void reserve(const size_t &num_surf, const size_t &num_corner)
+    {
+        for (size_t k = 0; k < 3; k++)
+        {
+            surf_p_[k].reserve(num_surf);
+            surf_w_[k].reserve(num_surf);
+            corner_p_[k].reserve(num_corner);
+            corner_a_[k].reserve(num_corner);
+            corner_b_[k].reserve(num_corner);
+        }
+        surf_d_.reserve(num_surf);
+        surf_sqrt_info_.reserve(num_surf);
+        corner_sqrt_info_.reserve(num_corner);
+    }
+
+    // coeffs_: [w, d] of the plane
+    void addSurf(const PointPlaneFeature &feature, const double &sqrt_info = 1.0)
+    {
+        for (size_t k = 0; k < 3; k++)
+        {
+            surf_p_[k].push_back(feature.point_(k));
+            surf_w_[k].push_back(feature.coeffs_(k));
+        }
+        surf_d_.push_back(feature.coeffs_(3));
+        surf_sqrt_info_.push_back(sqrt_info);
+    }
+
+    // coeffs_: [lpa, lpb] of the line
+    void addCorner(const PointPlaneFeature &feature, const double &sqrt_info = 1.0)
+    {
+        for (size_t k = 0; k < 3; k++)
+        {
+            corner_p_[k].push_back(feature.point_(k));
+            corner_a_[k].push_back(feature.coeffs_(k));
+            corner_b_[k].push_back(feature.coeffs_(k + 3));
+        }
+        corner_sqrt_info_.push_back(sqrt_info);
+    }
+
+    size_t numSurf() const { return surf_sqrt_info_.size(); }
+    size_t numCorner() const { return corner_sqrt_info_.size(); }
+    // 1 row per feature, the last row carries the rest of the huber cost (HuberResidual::cost_rest_)
+    size_t numResiduals() const { return numSurf() + numCorner() + 1; }
+
+    // lp = R * p + t of all points in one pass
+    static void transform(const std::vector<double> *p, const Eigen::Matrix3d &R, const Eigen::Vector3d &t,
+                          Eigen::ArrayXd *lp)
+    {
+        const size_t num = p[0].size();
+        Eigen::Map<const Eigen::ArrayXd> px(p[0].data(), num), py(p[1].data(), num), pz(p[2].data(), num);
+        for (size_t k = 0; k < 3; k++)
+            lp[k] = R(k, 0) * px + R(k, 1) * py + R(k, 2) * pz + t(k);
+    }
+
+    static Eigen::Vector3d column(const std::vector<double> *v, const size_t &i)
+    {
+        return Eigen::Vector3d(v[0][i], v[1][i], v[2][i]);
+    }
+
+    // residual of the feature scaled by the huber loss, the rest of its cost is summed in cost_rest
+    double correct(const double &r, double &cost_rest, double &jacobian_scale) const
+    {
+        const HuberResidual huber(huber_delta_, r * r);
+        cost_rest += huber.cost_rest_;
+        jacobian_scale = huber.jacobianScale(r * r);
+        return huber.residual_scale_ * r;
+    }
+
+    double huber_delta_;
+    std::vector<double> surf_p_[3], surf_w_[3], surf_d_, surf_sqrt_info_;
+    std::vector<double> corner_p_[3], corner_a_[3], corner_b_[3], corner_sqrt_info_;
+};
+
+// all features of one scan against the map in a single residual block, parameter: [T_w_curr]
+// 1 row per point-to-plane and per point-to-line feature, as LidarMapPlaneNormFactor and LidarMapEdgeFactor (lidar_map_factor.hpp)
+class LidarMapBatchFactor : public ceres::CostFunction
+{
+public:
+    LidarMapBatchFactor(FeatureBatch batch) : batch_(std::move(batch))
+    {
+        set_num_residuals(batch_.numResiduals());
+        mutable_parameter_block_sizes()->push_back(SIZE_POSE);
+    }
+
+    // weight of a feature given the covariance of its point, the same as the per-feature factors
+    static double sqrtInfo(const Eigen::Matrix3d &cov_matrix)
+    {
+        double sqrt_info = sqrt(1 / cov_matrix.trace());
+        return sqrt_info >= 3.0 ? 1.0 : sqrt_info / 3.0; // 1 / trace, 20m
+    }
+
+    bool Evaluate(double const *const *param, double *residuals, double **jacobians) const
+    {
+        Eigen::Quaterniond q_w_curr(param[0][6], param[0][3], param[0][4], param[0][5]);
+        Eigen::Vector3d t_w_curr(param[0][0], param[0][1], param[0][2]);
+        const Eigen::Matrix3d R = q_w_curr.toRotationMatrix();
+        double *jaco = (jacobians && jacobians[0]) ? jacobians[0] : nullptr;
+        const size_t num_surf = batch_.numSurf(), num_corner = batch_.numCorner();
+        Eigen::ArrayXd lp[3];
+        double cost_rest = 0.0, scale;
+
+        // point-to-plane: r = w^T (R p + t) + d, J = [w^T, -w^T R [p]x]
+        FeatureBatch::transform(batch_.surf_p_, R, t_w_curr, lp);
+        for (size_t i = 0; i < num_surf; i++)
+        {
+            const Eigen::Vector3d w = FeatureBatch::column(batch_.surf_w_, i);
+            const double sqrt_info = batch_.surf_sqrt_info_[i];
+            double r = sqrt_info * (w(0) * lp[0](i) + w(1) * lp[1](i) + w(2) * lp[2](i) + batch_.surf_d_[i]);
+            residuals[i] = batch_.correct(r, cost_rest, scale);
+            if (jaco)
+            {
+                const Eigen::Vector3d u = R.transpose() * w;
+                setJacobian(jaco, i, scale * sqrt_info * w, scale * sqrt_info * FeatureBatch::column(batch_.surf_p_, i).cross(u));
+            }
+        }
+
+        // point-to-line: r = |(lp - lpa) x (lp - lpb)| / |lpa - lpb|
+        // J = [-eta^T [lpa - lpb]x, eta^T [lpa - lpb]x R [p]x], eta = normalized((lp - lpa) x (lp - lpb)) / |lpa - lpb|
+        FeatureBatch::transform(batch_.corner_p_, R, t_w_curr, lp);
+        for (size_t i = 0; i < num_corner; i++)
+        {
+            const Eigen::Vector3d lpa = FeatureBatch::column(batch_.corner_a_, i);
+            const Eigen::Vector3d lpb = FeatureBatch::column(batch_.corner_b_, i);
+            const Eigen::Vector3d lpi(lp[0](i), lp[1](i), lp[2](i));
+            const Eigen::Vector3d nu = (lpi - lpa).cross(lpi - lpb);
+            const Eigen::Vector3d de = lpa - lpb;
+            const double sqrt_info = batch_.corner_sqrt_info_[i];
+            double r = sqrt_info * nu.norm() / de.norm();
+            residuals[num_surf + i] = batch_.correct(r, cost_rest, scale);
+            if (jaco)
+            {
+                const Eigen::Vector3d c = scale * sqrt_info / de.norm() * nu.normalized().cross(de); // eta^T [lpa - lpb]x
+                setJacobian(jaco, num_surf + i, -c, (R.transpose() * c).cross(FeatureBatch::column(batch_.corner_p_, i)));
+            }
+        }
+
+        residuals[num_surf + num_corner] = sqrt(cost_rest);
+        if (jaco) setJacobian(jaco, num_surf + num_corner, Eigen::Vector3d::Zero(), Eigen::Vector3d::Zero());
+        return true;
+    }
+
+private:
+    // row of the residual: [dr/dt, dr/dq, 0]
+    static void setJacobian(double *jaco, const size_t &row, const Eigen::Vector3d &jt, const Eigen::Vector3d &jq)
+    {
+        Eigen::Map<Eigen::Matrix<double, 1, SIZE_POSE, Eigen::RowMajor> > J(jaco + row * SIZE_POSE);
+        J.leftCols<3>() = jt.transpose();
+        J.segment<3>(3) = jq.transpose();
+        J(6) = 0.0;
+    }
+
+    FeatureBatch batch_;
+};
+
+// all pure odometry features of frame i of one lidar in a single residual block,
+// parameters: [T_pivot, T_i, T_ext], the features are expressed in the lidar frame at i and matched in the pivot frame
+// 1 row per point-to-plane feature (LidarPureOdomPlaneNormFactor), 1 row per point-to-line feature (LidarPureOdomEdgeFactor)
+// the jacobians are the ones of the single-feature factors, including their approximations of T_pivot and T_ext
+// (the TODOs in lidar_pure_odom_factor.hpp, https://github.com/gogojjh/M-LOAM/issues/8), so that the optimization and the
+// marginalization prior are the same with and without BATCH_MAP_FACTOR
+class LidarPureOdomBatchFactor : public ceres::CostFunction
+{
+public:
+    LidarPureOdomBatchFactor(FeatureBatch batch) : batch_(std::move(batch))
+    {
+        set_num_residuals(batch_.numResiduals());
+        mutable_parameter_block_sizes()->push_back(SIZE_POSE);
+        mutable_parameter_block_sizes()->push_back(SIZE_POSE);
+        mutable_parameter_block_sizes()->push_back(SIZE_POSE);
+    }
+
+    bool Evaluate(double const *const *param, double *residuals, double **jacobians) const
+    {
+        Eigen::Quaterniond Q_pivot(param[0][6], param[0][3], param[0][4], param[0][5]);
+        Eigen::Vector3d t_pivot(param[0][0], param[0][1], param[0][2]);
+        Eigen::Quaterniond Q_i(param[1][6], param[1][3], param[1][4], param[1][5]);
+        Eigen::Vector3d t_i(param[1][0], param[1][1], param[1][2]);
+        Eigen::Quaterniond Q_ext(param[2][6], param[2][3], param[2][4], param[2][5]);
+        Eigen::Vector3d t_ext(param[2][0], param[2][1], param[2][2]);
+
+        // composed once for the batch: lp = Rp^T (Ri (Rext p + t_ext) + t_i - t_pivot)
+        const Eigen::Matrix3d Rp = Q_pivot.toRotationMatrix();
+        const Eigen::Matrix3d Ri = Q_i.toRotationMatrix();
+        const Eigen::Matrix3d Rext = Q_ext.toRotationMatrix();
+        const Eigen::Matrix3d R_ext_pi = Rp.transpose() * Ri * Rext;
+        const Eigen::Vector3d t_ext_pi = Rp.transpose() * (Ri * t_ext + t_i - t_pivot);
+
+        bool b_jaco = false;
+        if (jacobians) b_jaco = jacobians[0] || jacobians[1] || jacobians[2];
+        const size_t num_surf = batch_.numSurf(), num_corner = batch_.numCorner();
+        Eigen::ArrayXd lp[3];
+        double cost_rest = 0.0, scale;
+
+        // point-to-plane, the jacobians of LidarPureOdomPlaneNormFactor
+        FeatureBatch::transform(batch_.surf_p_, R_ext_pi, t_ext_pi, lp);
+        for (size_t i = 0; i < num_surf; i++)
+        {
+            const Eigen::Vector3d w = FeatureBatch::column(batch_.surf_w_, i);
+            const double sqrt_info = batch_.surf_sqrt_info_[i];
+            double r = sqrt_info * (w(0) * lp[0](i) + w(1) * lp[1](i) + w(2) * lp[2](i) + batch_.surf_d_[i]);
+            residuals[i] = batch_.correct(r, cost_rest, scale);
+            if (b_jaco)
+            {
+                const Eigen::Vector3d p = FeatureBatch::column(batch_.surf_p_, i);
+                const Eigen::Vector3d lpi(lp[0](i), lp[1](i), lp[2](i));
+                const Eigen::Vector3d v = Rp * (scale * sqrt_info * w); // w^T Rp^T
+                const Eigen::Vector3d u = Ri.transpose() * v; // w^T Rp^T Ri
+                setJacobian(jacobians, i,
+                            -v, v.cross(Rp * lpi), // -w^T Rp^T, w^T Rp^T [Rp lp]x
+                            v, -u.cross(Rext * p + t_ext), // w^T Rp^T, -w^T Rp^T Ri [Rext p + t_ext]x
+                            u, -u.cross(Rext * p)); // w^T Rp^T Ri, -w^T Rp^T Ri [Rext p]x
+            }
+        }
+
+        // point-to-line, the jacobians of LidarPureOdomEdgeFactor: the ones of the point-to-plane with w^T replaced by
+        // m^T = eta^T [lpb - lpa]x
+        FeatureBatch::transform(batch_.corner_p_, R_ext_pi, t_ext_pi, lp);
+        for (size_t i = 0; i < num_corner; i++)
+        {
+            const Eigen::Vector3d lpa = FeatureBatch::column(batch_.corner_a_, i);
+            const Eigen::Vector3d lpb = FeatureBatch::column(batch_.corner_b_, i);
+            const Eigen::Vector3d lpi(lp[0](i), lp[1](i), lp[2](i));
+            const Eigen::Vector3d nu = (lpi - lpa).cross(lpi - lpb);
+            const double sqrt_info = batch_.corner_sqrt_info_[i];
+            const double de_norm = (lpa - lpb).norm();
+            double r = sqrt_info * nu.norm() / de_norm;
+            residuals[num_surf + i] = batch_.correct(r, cost_rest, scale);
+            if (b_jaco)
+            {
+                const Eigen::Vector3d p = FeatureBatch::column(batch_.corner_p_, i);
+                const Eigen::Vector3d eta = nu.normalized() / de_norm;
+                const Eigen::Vector3d m = scale * sqrt_info * eta.cross(lpb - lpa); // eta^T [lpb - lpa]x
+                const Eigen::Vector3d v = Rp * m;
+                const Eigen::Vector3d u = Ri.transpose() * v;
+                setJacobian(jacobians, num_surf + i,
+                            -v, m.cross(lpi), // -m^T Rp^T, m^T [lp]x
+                            v, -u.cross(Rext * p + t_ext), // m^T Rp^T, -m^T Rp^T Ri [Rext p + t_ext]x
+                            u, -(Rext.transpose() * u).cross(p) - u.cross(t_ext)); // m^T Rp^T Ri, -m^T Rp^T Ri (Rext [p]x + [t_ext]x)
+            }
+        }
+
+        residuals[num_surf + num_corner] = sqrt(cost_rest);
+        if (b_jaco)
+        {
+            const Eigen::Vector3d zero = Eigen::Vector3d::Zero();
+            setJacobian(jacobians, num_surf + num_corner, zero, zero, zero, zero, zero, zero);
+        }
+        return true;
+    }
+
+private:
+    // row of the residual: [dr/dt, dr/dq, 0] of each parameter block
+    static void setJacobian(double **jacobians, const size_t &row,
+                            const Eigen::Vector3d &jt_pivot, const Eigen::Vector3d &jq_pivot,
+                            const Eigen::Vector3d &jt_i, const Eigen::Vector3d &jq_i,
+                            const Eigen::Vector3d &jt_ext, const Eigen::Vector3d &jq_ext)
+    {
+        const Eigen::Vector3d *jt[3] = {&jt_pivot, &jt_i, &jt_ext};
+        const Eigen::Vector3d *jq[3] = {&jq_pivot, &jq_i, &jq_ext};
+        for (size_t k = 0; k < 3; k++)
+        {
+            if (!jacobians[k]) continue;
+            Eigen::Map<Eigen::Matrix<double, 1, SIZE_POSE, Eigen::RowMajor> > J(jacobians[k] + row * SIZE_POSE);
+            J.leftCols<3>() = jt[k]->transpose();
+            J.segment<3>(3) = jq[k]->transpose();
+            J(6) = 0.0;
+        }
+    }
+
+    FeatureBatch batch_;
+};
+
+//
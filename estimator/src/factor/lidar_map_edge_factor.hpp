@@ -26,7 +26,7 @@ class LidarMapEdgeFactor : public ceres::SizedCostFunction<3, 7>
 {
 public:
 	LidarMapEdgeFactor(const Eigen::Vector3d &point,
-					   const Eigen::VectorXd &coeff,
+					   const Eigen::Matrix<double, 6, 1> &coeff,
 					   const Eigen::Matrix3d &cov_matrix = Eigen::Matrix3d::Identity())
 		: point_(point),
 		  coeff_(coeff),
@@ -130,6 +130,6 @@ public:
 
 private:
 	const Eigen::Vector3d point_;
-	const Eigen::VectorXd coeff_;
+	const Eigen::Matrix<double, 6, 1> coeff_;
 	const double sqrt_info_;
 };
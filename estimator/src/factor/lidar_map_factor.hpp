@@ -131,7 +131,7 @@ class LidarMapEdgeFactor : public ceres::SizedCostFunction<1, 7>
 {
 public:
     LidarMapEdgeFactor(const Eigen::Vector3d &point,
-                       const Eigen::VectorXd &coeff,
+                       const Eigen::Matrix<double, 6, 1> &coeff,
                        const Eigen::Matrix3d &cov_matrix = Eigen::Matrix3d::Identity())
         : point_(point),
 		  coeff_(coeff),
@@ -230,7 +230,7 @@ public:
 
 private:
     const Eigen::Vector3d point_;
-    const Eigen::VectorXd coeff_;
+    const Eigen::Matrix<double, 6, 1> coeff_;
     double sqrt_info_;
 };
 
@@ -242,7 +242,7 @@ class LidarMapEdgeFactorVector : public ceres::SizedCostFunction<3, 7>
 {
 public:
 	LidarMapEdgeFactorVector(const Eigen::Vector3d &point,
-					   const Eigen::VectorXd &coeff,
+					   const Eigen::Matrix<double, 6, 1> &coeff,
 					   const Eigen::Matrix3d &cov_matrix = Eigen::Matrix3d::Identity())
 		: point_(point),
 		  coeff_(coeff),
@@ -349,6 +349,6 @@ public:
 
 private:
 	const Eigen::Vector3d point_;
-	const Eigen::VectorXd coeff_;
+	const Eigen::Matrix<double, 6, 1> coeff_;
 	double sqrt_info_;
 };
@@ -126,7 +126,7 @@ class LidarOnlineCalibEdgeFactor : public ceres::SizedCostFunction<1, 7>
 {
 public:
     LidarOnlineCalibEdgeFactor(const Eigen::Vector3d &point,
-                               const Eigen::VectorXd &coeff,
+                               const Eigen::Matrix<double, 6, 1> &coeff,
                                const double &sqrt_info = 1.0)
         : point_(point), 
 		  coeff_(coeff), 
@@ -222,7 +222,7 @@ public:
 
 private:
     const Eigen::Vector3d point_;
-    const Eigen::VectorXd coeff_;
+    const Eigen::Matrix<double, 6, 1> coeff_;
     const double sqrt_info_;
 };
 
@@ -232,7 +232,7 @@ class LidarOnlineCalibEdgeFactor_bck : public ceres::SizedCostFunction<3, 7>
 {
 public:
 	LidarOnlineCalibEdgeFactor_bck(const Eigen::Vector3d &point,
-							       const Eigen::VectorXd &coeff,
+							       const Eigen::Matrix<double, 6, 1> &coeff,
 							       const double &sqrt_info = 1.0)
 		: point_(point),
 		  coeff_(coeff),
@@ -333,6 +333,6 @@ public:
 
 private:
 	const Eigen::Vector3d point_;
-	const Eigen::VectorXd coeff_;
+	const Eigen::Matrix<double, 6, 1> coeff_;
 	const double sqrt_info_;
 };
@@ -209,7 +209,7 @@ class LidarPureOdomEdgeFactor : public ceres::SizedCostFunction<1, 7, 7, 7>
 {
 public:
 	LidarPureOdomEdgeFactor(const Eigen::Vector3d &point,
-							const Eigen::VectorXd &coeff,
+							const Eigen::Matrix<double, 6, 1> &coeff,
 							const double &sqrt_info = 1.0)
 		: point_(point), //n雷达在i帧下的点
 		  coeff_(coeff), //n雷达在i帧下的点,在自己local map下的correspondances
@@ -398,7 +398,7 @@ public:
 
 private:
 	const Eigen::Vector3d point_;
-	const Eigen::VectorXd coeff_;
+	const Eigen::Matrix<double, 6, 1> coeff_;
 	const double sqrt_info_;
 };
 
@@ -409,7 +409,7 @@ class LidarPureOdomEdgeFactorAuto
 {
 public:
 	LidarPureOdomEdgeFactorAuto(const Eigen::Vector3d &point,
-							    const Eigen::VectorXd &coeff,
+							    const Eigen::Matrix<double, 6, 1> &coeff,
 							    const double &sqrt_info = 1.0)
 		: point_(point),
 		  coeff_(coeff),
@@ -446,7 +446,7 @@ public:
 	}
 
 	static ceres::CostFunction *Create(const Eigen::Vector3d &point,
-									   const Eigen::VectorXd &coeff,
+									   const Eigen::Matrix<double, 6, 1> &coeff,
 									   const double sqrt_info)
 	{
 		return (new ceres::AutoDiffCostFunction<
@@ -456,7 +456,7 @@ public:
 
 private: 
 	const Eigen::Vector3d point_;
-	const Eigen::VectorXd coeff_;
+	const Eigen::Matrix<double, 6, 1> coeff_;
 	const double sqrt_info_;
 };
 
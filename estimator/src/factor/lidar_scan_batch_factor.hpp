@@ -0,0 +1,130 @@
+/*******************************************************
+ * Copyright (C) 2020, RAM-LAB, Hong Kong University of Science and Technology
+ *
+ * This file is part of M-LOAM (https://ram-lab.com/file/jjiao/m-loam).
+ * If you use this code, please cite the respective publications as
+ * listed on the above websites.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *
+ * Author: Jianhao JIAO (jiaojh1994@gmail.com)
+ *******************************************************/
+
+#pragma once
+
+#include <vector>
+
+#include <ceres/ceres.h>
+
+#include <eigen3/Eigen/Dense>
+
+#include "../estimator/parameters.h"
+#include "../utility/utility.h"
+#include "huber_residual.hpp"
+
+// all scan-to-scan residuals of one frame in a single residual block:
+// 1 row per point-to-plane feature (LidarScanPlaneNormFactor), 3 rows per point-to-line feature (LidarScanEdgeFactorVector)
+// the features are packed column by column, the jacobian is written row-major as [num_residuals x 7] with [t, q] order
+// the huber loss is applied per feature inside the block (HuberResidual), the cost, the gradient and the gauss-newton hessian
+// are the ones of the per-feature blocks, the last row carries the rest of the huber cost
+class LidarScanBatchFactor : public ceres::CostFunction
+{
+public:
+    LidarScanBatchFactor(const std::vector<PointPlaneFeature, Eigen::aligned_allocator<PointPlaneFeature> > &surf_features,
+                         const std::vector<PointPlaneFeature, Eigen::aligned_allocator<PointPlaneFeature> > &corner_features,
+                         const double &huber_delta)
+        : num_surf_(surf_features.size()), num_corner_(corner_features.size()), huber_delta_(huber_delta)
+    {
+        surf_point_.resize(3, num_surf_);
+        surf_coeff_.resize(4, num_surf_);
+        for (size_t i = 0; i < num_surf_; i++)
+        {
+            surf_point_.col(i) = surf_features[i].point_;
+            surf_coeff_.col(i) = surf_features[i].coeffs_.head<4>();
+        }
+        corner_point_.resize(3, num_corner_);
+        corner_lpa_.resize(3, num_corner_);
+        corner_lpb_.resize(3, num_corner_);
+        for (size_t i = 0; i < num_corner_; i++)
+        {
+            corner_point_.col(i) = corner_features[i].point_;
+            corner_lpa_.col(i) = corner_features[i].coeffs_.head<3>();
+            corner_lpb_.col(i) = corner_features[i].coeffs_.segment<3>(3);
+        }
+        set_num_residuals(num_surf_ + 3 * num_corner_ + 1);
+        mutable_parameter_block_sizes()->push_back(SIZE_POSE);
+    }
+
+    bool Evaluate(double const *const *param, double *residuals, double **jacobians) const
+    {
+        Eigen::Map<const Eigen::Vector3d> t(param[0]);
+        Eigen::Quaterniond q(param[0][6], param[0][3], param[0][4], param[0][5]);
+        const Eigen::Matrix3d R = q.toRotationMatrix();
+        double *jaco = (jacobians && jacobians[0]) ? jacobians[0] : nullptr;
+        double cost_rest = 0.0;
+
+        // point-to-plane: r = w^T (R p + t) + d, J = [w^T, -w^T R [p]x]
+        for (size_t i = 0; i < num_surf_; i++)
+        {
+            const Eigen::Vector3d w = surf_coeff_.col(i).head<3>();
+            const Eigen::Vector3d p = surf_point_.col(i);
+            double r = w.dot(R * p + t) + surf_coeff_(3, i);
+            HuberResidual huber(huber_delta_, r * r);
+            residuals[i] = huber.residual_scale_ * r;
+            cost_rest += huber.cost_rest_;
+            if (jaco)
+            {
+                const double scale = huber.jacobianScale(r * r);
+                Eigen::Map<Eigen::Matrix<double, 1, SIZE_POSE, Eigen::RowMajor> > J(jaco + i * SIZE_POSE);
+                J.setZero();
+                J.leftCols<3>() = scale * w.transpose();
+                J.segment<3>(3) = -scale * w.transpose() * R * Utility::skewSymmetric(p);
+            }
+        }
+
+        // point-to-line: r = ((lp - lpa) x (lp - lpb)) / |lpa - lpb|
+        // J = [-[lpa - lpb]x, [lpa - lpb]x R [p]x] / |lpa - lpb|
+        for (size_t i = 0; i < num_corner_; i++)
+        {
+            const Eigen::Vector3d lpa = corner_lpa_.col(i);
+            const Eigen::Vector3d lpb = corner_lpb_.col(i);
+            const Eigen::Vector3d lp = R * corner_point_.col(i) + t;
+            const Eigen::Vector3d de = lpa - lpb;
+            double eta = 1.0 / de.norm();
+            Eigen::Vector3d r = (lp - lpa).cross(lp - lpb) * eta;
+            HuberResidual huber(huber_delta_, r.squaredNorm());
+            Eigen::Map<Eigen::Vector3d>(residuals + num_surf_ + 3 * i) = huber.residual_scale_ * r;
+            cost_rest += huber.cost_rest_;
+            if (jaco)
+            {
+                Eigen::Map<Eigen::Matrix<double, 3, SIZE_POSE, Eigen::RowMajor> > J(jaco + (num_surf_ + 3 * i) * SIZE_POSE);
+                const Eigen::Matrix3d skew_de = eta * Utility::skewSymmetric(de);
+                const Eigen::Matrix3d scale = huber.sqrt_rho1_ * (Eigen::Matrix3d::Identity() - huber.alpha_sq_norm_ * r * r.transpose());
+                J.setZero();
+                J.leftCols<3>() = -scale * skew_de;
+                J.block<3, 3>(0, 3) = scale * skew_de * R * Utility::skewSymmetric(corner_point_.col(i));
+            }
+        }
+
+        residuals[num_surf_ + 3 * num_corner_] = sqrt(cost_rest);
+        if (jaco)
+        {
+            Eigen::Map<Eigen::Matrix<double, 1, SIZE_POSE, Eigen::RowMajor> > J(jaco + (num_surf_ + 3 * num_corner_) * SIZE_POSE);
+            J.setZero();
+        }
+        return true;
+    }
+
+    size_t numSurf() const { return num_surf_; }
+    size_t numCorner() const { return num_corner_; }
+
+private:
+    size_t num_surf_, num_corner_;
+    double huber_delta_;
+    Eigen::Matrix<double, 3, Eigen::Dynamic> surf_point_;
+    Eigen::Matrix<double, 4, Eigen::Dynamic> surf_coeff_;
+    Eigen::Matrix<double, 3, Eigen::Dynamic> corner_point_, corner_lpa_, corner_lpb_;
+};
+
+//
@@ -25,7 +25,7 @@ class LidarScanEdgeFactor : public ceres::SizedCostFunction<3, 7>
 {
 public:
     LidarScanEdgeFactor(const Eigen::Vector3d &point,
-                        const Eigen::VectorXd &coeff,
+                        const Eigen::Matrix<double, 6, 1> &coeff,
                         const double &s = 1.0)
         : point_(point), coeff_(coeff), s_(s) {}
 
@@ -125,6 +125,6 @@ public:
 
 private:
 	const Eigen::Vector3d point_;
-	const Eigen::VectorXd coeff_;
+	const Eigen::Matrix<double, 6, 1> coeff_;
 	const double s_;
 };
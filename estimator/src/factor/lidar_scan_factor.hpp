@@ -133,7 +133,7 @@ class LidarScanEdgeFactor : public ceres::SizedCostFunction<1, 7>
 {
 public:
     LidarScanEdgeFactor(const Eigen::Vector3d &point,
-                        const Eigen::VectorXd &coeff,
+                        const Eigen::Matrix<double, 6, 1> &coeff,
                         const double &s = 1.0)
         : point_(point), coeff_(coeff), s_(s) {}
 
@@ -230,7 +230,7 @@ public:
 
 private:
     const Eigen::Vector3d point_;
-    const Eigen::VectorXd coeff_;
+    const Eigen::Matrix<double, 6, 1> coeff_;
     const double s_;
 };
 
@@ -240,7 +240,7 @@ class LidarScanEdgeFactorVector : public ceres::SizedCostFunction<3, 7>
 {
 public:
     LidarScanEdgeFactorVector(const Eigen::Vector3d &point,
-                              const Eigen::VectorXd &coeff,
+                              const Eigen::Matrix<double, 6, 1> &coeff,
                               const double &s = 1.0)
         : point_(point), coeff_(coeff), s_(s) {}
 
@@ -342,6 +342,6 @@ public:
 
 private:
     const Eigen::Vector3d point_;
-    const Eigen::VectorXd coeff_;
+    const Eigen::Matrix<double, 6, 1> coeff_;
     const double s_; //1
 };
@@ -26,7 +26,7 @@ void ResidualBlockInfo::Evaluate()
     residuals.resize(cost_function->num_residuals());
 
     std::vector<int> block_sizes = cost_function->parameter_block_sizes();
-    raw_jacobians = new double *[block_sizes.size()];
+    raw_jacobians.resize(block_sizes.size());
     jacobians.resize(block_sizes.size());
 
     for (int i = 0; i < static_cast<int>(block_sizes.size()); i++)
@@ -35,7 +35,7 @@ void ResidualBlockInfo::Evaluate()
         raw_jacobians[i] = jacobians[i].data();
         //dim += block_sizes[i] == 7 ? 6 : block_sizes[i];
     }
-    cost_function->Evaluate(parameter_blocks.data(), residuals.data(), raw_jacobians);  //计算每个残差项，以及残差对优化变量的雅克比
+    cost_function->Evaluate(parameter_blocks.data(), residuals.data(), raw_jacobians.data());  //计算每个残差项，以及残差对优化变量的雅克比
 
     //std::vector<int> tmp_idx(block_sizes.size());
     //Eigen::MatrixXd tmp(dim, dim);
@@ -99,11 +99,9 @@ MarginalizationInfo::~MarginalizationInfo()
     for (auto it = parameter_block_data.begin(); it != parameter_block_data.end(); ++it)
         delete it->second;
 
+    // factors allocated outside the heap (e.g. in an ObjectArena) are removed from the list by their owner
     for (int i = 0; i < (int)factors.size(); i++)
     {
-
-        delete[] factors[i]->raw_jacobians;
-
         delete factors[i]->cost_function;
 
         delete factors[i];
@@ -165,37 +163,75 @@ int MarginalizationInfo::globalSize(int size) const
     return size == 6 ? 7 : size;
 }
 
-void* ThreadsConstructA(void* threadsstruct)
+void BlockHessian::reset(const std::vector<int> &size)
+{
+    num_blocks = static_cast<int>(size.size());
+    block_size = size;
+    H_blocks.clear();
+    H_blocks.resize(num_blocks * num_blocks);
+    b_blocks.resize(num_blocks);
+    for (int i = 0; i < num_blocks; i++)
+        b_blocks[i] = Eigen::VectorXd::Zero(block_size[i]);
+}
+
+Eigen::MatrixXd &BlockHessian::block(const int &i, const int &j)
+{
+    Eigen::MatrixXd &blk = H_blocks[i * num_blocks + j];
+    if (blk.size() == 0) blk.setZero(block_size[i], block_size[j]);
+    return blk;
+}
+
+void BlockHessian::addFactor(const ResidualBlockInfo &factor, const int *block_id)
 {
-    ThreadsStruct* p = ((ThreadsStruct*)threadsstruct);
-    for (auto it : p->sub_factors) //每一个残差项
+    for (int i = 0; i < static_cast<int>(factor.parameter_blocks.size()); i++) //每个参数块
     {
-        for (int i = 0; i < static_cast<int>(it->parameter_blocks.size()); i++)
+        int id_i = block_id[i];
+        int size_i = block_size[id_i];
+        const auto jacobian_i = factor.jacobians[i].leftCols(size_i);
+        for (int j = i; j < static_cast<int>(factor.parameter_blocks.size()); j++)
         {
-            int idx_i = p->parameter_block_idx[reinterpret_cast<long>(it->parameter_blocks[i])]; //该参数块的索引
-            int size_i = p->parameter_block_size[reinterpret_cast<long>(it->parameter_blocks[i])]; //该参数块的大小
-            if (size_i == 7)
-                size_i = 6;
-            Eigen::MatrixXd jacobian_i = it->jacobians[i].leftCols(size_i);
-            for (int j = i; j < static_cast<int>(it->parameter_blocks.size()); j++)
-            {
-                int idx_j = p->parameter_block_idx[reinterpret_cast<long>(it->parameter_blocks[j])];
-                int size_j = p->parameter_block_size[reinterpret_cast<long>(it->parameter_blocks[j])];
-                if (size_j == 7)
-                    size_j = 6;
-                Eigen::MatrixXd jacobian_j = it->jacobians[j].leftCols(size_j);
-                if (i == j)
-                    p->A.block(idx_i, idx_j, size_i, size_j) += jacobian_i.transpose() * jacobian_j; //累加
-                else
-                {
-                    p->A.block(idx_i, idx_j, size_i, size_j) += jacobian_i.transpose() * jacobian_j; //累加
-                    p->A.block(idx_j, idx_i, size_j, size_i) = p->A.block(idx_i, idx_j, size_i, size_j).transpose();
-                }
-            }
-            p->b.segment(idx_i, size_i) += jacobian_i.transpose() * it->residuals;  //累加
+            int id_j = block_id[j];
+            int size_j = block_size[id_j];
+            const auto jacobian_j = factor.jacobians[j].leftCols(size_j);
+            if (id_i < id_j)
+                block(id_i, id_j).noalias() += jacobian_i.transpose() * jacobian_j; //累加
+            else if (id_i > id_j)
+                block(id_j, id_i).noalias() += jacobian_j.transpose() * jacobian_i;
+            else if (i == j)
+                block(id_i, id_i).noalias() += jacobian_i.transpose() * jacobian_i;
+            else // the same parameter block is used twice by the residual
+                block(id_i, id_i) += jacobian_i.transpose() * jacobian_j + jacobian_j.transpose() * jacobian_i;
+        }
+        b_blocks[id_i].noalias() += jacobian_i.transpose() * factor.residuals; //累加
+    }
+}
+
+void BlockHessian::addTo(const std::vector<int> &block_idx, Eigen::MatrixXd &A, Eigen::VectorXd &b) const
+{
+    for (int i = 0; i < num_blocks; i++)
+    {
+        for (int j = i; j < num_blocks; j++)
+        {
+            const Eigen::MatrixXd &blk = H_blocks[i * num_blocks + j];
+            if (blk.size() == 0) continue;
+            A.block(block_idx[i], block_idx[j], block_size[i], block_size[j]) += blk;
+            if (i != j) A.block(block_idx[j], block_idx[i], block_size[j], block_size[i]) += blk.transpose();
         }
+        b.segment(block_idx[i], block_size[i]) += b_blocks[i];
     }
-    return threadsstruct;
+}
+
+// X = A^{+} * B with the pivoted LDLT of a symmetric positive semi-definite A = P^T * L * D * L^T * P,
+// the pivots D(i) <= eps are treated as the null space (rank deficiency)
+static Eigen::MatrixXd ldltPseudoSolve(const Eigen::LDLT<Eigen::MatrixXd> &ldlt, const Eigen::MatrixXd &B, const double &eps)
+{
+    Eigen::MatrixXd X = ldlt.transpositionsP() * B;
+    ldlt.matrixL().solveInPlace(X);
+    const Eigen::VectorXd &D = ldlt.vectorD();
+    Eigen::VectorXd D_inv = (D.array() > eps).select(D.array().inverse(), 0);
+    X = D_inv.asDiagonal() * X;
+    ldlt.matrixU().solveInPlace(X);
+    return ldlt.transpositionsP().transpose() * X;
 }
 
 void MarginalizationInfo::marginalize()
@@ -227,100 +263,60 @@ void MarginalizationInfo::marginalize()
         return;
     }
 
-    TicToc t_summing;
-    Eigen::MatrixXd A(pos, pos);
-    Eigen::VectorXd b(pos);
-    A.setZero();
-    b.setZero();
-    /*
-    for (auto it : factors)
+    // flat ids of the parameter blocks, looked up once instead of in every thread
+    std::unordered_map<long, int> block_id;
+    std::vector<int> block_idx, block_size;
+    for (const auto &it : parameter_block_idx)
     {
-        for (int i = 0; i < static_cast<int>(it->parameter_blocks.size()); i++)
-        {
-            int idx_i = parameter_block_idx[reinterpret_cast<long>(it->parameter_blocks[i])];
-            int size_i = localSize(parameter_block_size[reinterpret_cast<long>(it->parameter_blocks[i])]);
-            Eigen::MatrixXd jacobian_i = it->jacobians[i].leftCols(size_i);
-            for (int j = i; j < static_cast<int>(it->parameter_blocks.size()); j++)
-            {
-                int idx_j = parameter_block_idx[reinterpret_cast<long>(it->parameter_blocks[j])];
-                int size_j = localSize(parameter_block_size[reinterpret_cast<long>(it->parameter_blocks[j])]);
-                Eigen::MatrixXd jacobian_j = it->jacobians[j].leftCols(size_j);
-                if (i == j)
-                    A.block(idx_i, idx_j, size_i, size_j) += jacobian_i.transpose() * jacobian_j;
-                else
-                {
-                    A.block(idx_i, idx_j, size_i, size_j) += jacobian_i.transpose() * jacobian_j;
-                    A.block(idx_j, idx_i, size_j, size_i) = A.block(idx_i, idx_j, size_i, size_j).transpose();
-                }
-            }
-            b.segment(idx_i, size_i) += jacobian_i.transpose() * it->residuals;
-        }
+        block_id[it.first] = static_cast<int>(block_idx.size());
+        block_idx.push_back(it.second);
+        block_size.push_back(localSize(parameter_block_size[it.first]));
     }
-    ROS_INFO("summing up costs %f ms", t_summing.toc());
-    */
-    //multi thread
-
-
-    TicToc t_thread_summing;
-    pthread_t tids[NUM_THREADS];
-    ThreadsStruct threadsstruct[NUM_THREADS];
-    int i = 0;
-	
-    for (auto it : factors) //factors: marg对象的所有ResidualBlockInfo //把所有的残差项均匀分到threadsstruct[]数组中
-    {
-        threadsstruct[i].sub_factors.push_back(it);
-        i++;
-        i = i % NUM_THREADS;
-    }
-    for (int i = 0; i < NUM_THREADS; i++)
+    std::vector<int> factor_block_start(factors.size() + 1, 0);
+    std::vector<int> factor_block_id;
+    for (size_t k = 0; k < factors.size(); k++)
     {
-        TicToc zero_matrix;
-        threadsstruct[i].A = Eigen::MatrixXd::Zero(pos,pos);
-        threadsstruct[i].b = Eigen::VectorXd::Zero(pos);
-        threadsstruct[i].parameter_block_size = parameter_block_size; //<每个参数块的地址, 每个参数块的大小>
-        threadsstruct[i].parameter_block_idx = parameter_block_idx;  //<每个参数块的地址, 在矩阵中的id> 
-        int ret = pthread_create( &tids[i], NULL, ThreadsConstructA ,(void*)&(threadsstruct[i]));
-        //对每个threadsstruct[i]创建一个线程，每个线程计算一部分残差
-        if (ret != 0)
-        {
-            ROS_WARN("pthread_create error");
-            ROS_BREAK();
-        }
+        for (double *addr : factors[k]->parameter_blocks)
+            factor_block_id.push_back(block_id[reinterpret_cast<long>(addr)]);
+        factor_block_start[k + 1] = static_cast<int>(factor_block_id.size());
     }
-    for( int i = NUM_THREADS - 1; i >= 0; i--)
+
+    //multi thread: contiguous chunks of residuals per thread (omp keeps its worker pool alive across calls),
+    //the partial sums are added in thread order so that the result does not depend on the scheduling
+    TicToc t_thread_summing;
+    const int num_threads = std::max(1, std::min(NUM_THREADS, static_cast<int>(factors.size())));
+    std::vector<BlockHessian> thread_hessian(num_threads);
+    #pragma omp parallel for num_threads(num_threads) schedule(static)
+    for (int t = 0; t < num_threads; t++)
     {
-        pthread_join( tids[i], NULL );
-        A += threadsstruct[i].A;
-        b += threadsstruct[i].b;
+        thread_hessian[t].reset(block_size);
+        size_t start_k = factors.size() * t / num_threads;
+        size_t end_k = factors.size() * (t + 1) / num_threads;
+        for (size_t k = start_k; k < end_k; k++)
+            thread_hessian[t].addFactor(*factors[k], &factor_block_id[factor_block_start[k]]);
     }
+    Eigen::MatrixXd A = Eigen::MatrixXd::Zero(pos, pos);
+    Eigen::VectorXd b = Eigen::VectorXd::Zero(pos);
+    for (int t = 0; t < num_threads; t++)
+        thread_hessian[t].addTo(block_idx, A, b);
     //ROS_DEBUG("thread summing up costs %f ms", t_thread_summing.toc());
-    //ROS_INFO("A diff %f , b diff %f ", (A - tmp_A).sum(), (b - tmp_b).sum());
-
 
-    //TODO
+    //jxl: 见FEJ(First Estimate Jacobians) paper: Consistency Analysis for Sliding-Window Visual Odometry
+    //舒尔补, 消去X_m，剩下X_(r+n); Amm的伪逆由LDLT分解计算, 主元 <= eps 的方向视为零空间
     Eigen::MatrixXd Amm = 0.5 * (A.block(0, 0, m, m) + A.block(0, 0, m, m).transpose()); //A的左上角矩阵，保证Amm是对称矩阵
-    Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> saes(Amm); //特征值分解计算实对称矩阵的逆
+    Eigen::LDLT<Eigen::MatrixXd> ldlt_mm(Amm);
+    Eigen::MatrixXd rhs(m, n + 1);
+    rhs.leftCols(n) = A.block(0, m, m, n); // Amr
+    rhs.col(n) = b.segment(0, m); // bmm
+    Eigen::MatrixXd Amm_inv_rhs = ldltPseudoSolve(ldlt_mm, rhs, eps);
 
-    //ROS_ASSERT_MSG(saes.eigenvalues().minCoeff() >= -1e-4, "min eigenvalue %f", saes.eigenvalues().minCoeff());
-
-    Eigen::MatrixXd Amm_inv = saes.eigenvectors() * Eigen::VectorXd((saes.eigenvalues().array() > eps).select(saes.eigenvalues().array().inverse(), 0)).asDiagonal() * saes.eigenvectors().transpose();
-    //特征值 > thresh, 取特征值的逆； 否则，取0
-	//printf("error1: %f\n", (Amm * Amm_inv - Eigen::MatrixXd::Identity(m, m)).sum());
-
-    //jxl: 见FEJ(First Estimate Jacobians) paper: Consistency Analysis for Sliding-Window Visual Odometry
-    Eigen::VectorXd bmm = b.segment(0, m); //b最上面m*1
-    Eigen::MatrixXd Amr = A.block(0, m, m, n);
+    // remaining part
     Eigen::MatrixXd Arm = A.block(m, 0, n, m);
     Eigen::MatrixXd Arr = A.block(m, m, n, n);
     Eigen::VectorXd brr = b.segment(m, n);
-	
-    // remaining part
-    A = Arr - Arm * Amm_inv * Amr;
-    b = brr - Arm * Amm_inv * bmm;
+    A = Arr - Arm * Amm_inv_rhs.leftCols(n);
+    b = brr - Arm * Amm_inv_rhs.col(n);
 
-    // decompose A,b as Jacobian using the Eigenvalue decomposition
-	
-	//舒尔补, 消去X_m，剩下X_(r+n) 
     //得到 A * X_(r+n) =  b， 边缘化pivot帧后，得到的对剩余状态的约束方程
     //其中 A = J^T * J, A是一个实对称矩阵。 J = Σ每个残差项ri对X_(r+n)的雅克比
     //其中 b = J^T * r, r = Σ每个残差项。
@@ -334,31 +330,23 @@ void MarginalizationInfo::marginalize()
     //对于状态Xn，残差对Xn的雅克比一直是边缘化时Xn的值带入到雅克比表达式中
     //但是状态Xn每次都在更新，只是说Xn的线性化点是固定不变的。
     //更新后的残差 r_new = r_old + J*dx, dx为Xn当前状态与边缘化时状态量的差.
-   
-
-    //对marg后的H矩阵进行特征值分解:
-    //对A进行特征值分解 A = J^T * J = eigenvectors * eigenvalues.asDiagonal() * eigenvectors.transpose() 
-    //J = sqrt(eigenvalues.asDiagonal()) * eigenvectors.transpose()
-	
-    // A = J^{T}J, b = J^{T}b
-    Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> saes2(A); //实对称矩阵特征值分解 A = V [\] V^T, V.inv() =V.trans() 
-    Eigen::VectorXd S = Eigen::VectorXd((saes2.eigenvalues().array() > eps).select(saes2.eigenvalues().array(), 0));  //特征值
-    Eigen::VectorXd S_inv = Eigen::VectorXd((saes2.eigenvalues().array() > eps).select(saes2.eigenvalues().array().inverse(), 0)); //特征值逆
 
-    Eigen::VectorXd S_sqrt = S.cwiseSqrt();
-    Eigen::VectorXd S_inv_sqrt = S_inv.cwiseSqrt();
+    // decompose A,b as Jacobian using the pivoted LDLT: A = P^T * L * D * L^T * P
+    // J = sqrt(D) * L^T * P, r = sqrt(D)^{-1} * L^{-1} * P * b, so that J^T * J = A, J^T * r = b
+    // the pivots <= eps give zero rows (rank deficiency), as the zero eigenvalues did before
+    A = 0.5 * (A + A.transpose());
+    Eigen::LDLT<Eigen::MatrixXd> ldlt(A);
+    const Eigen::VectorXd &D = ldlt.vectorD();
+    Eigen::VectorXd S_sqrt = (D.array() > eps).select(D.array().sqrt(), 0);
+    Eigen::VectorXd S_inv_sqrt = (D.array() > eps).select(D.array().sqrt().inverse(), 0);
 
     //FEJ,以后计算关于先验的残差和Jacobian都在边缘化的这个线性点展开
-    linearized_jacobians = S_sqrt.asDiagonal() * saes2.eigenvectors().transpose();  
-	//J = [sqrt(λ1)...sqrt(λi)...sqrt(λn)].diag() * V^T , J可逆
-    //边缘化产生的残差r
-    linearized_residuals = S_inv_sqrt.asDiagonal() * saes2.eigenvectors().transpose() * b; 
-	//r = [1/sqrt(λ1) ... 1/sqrt(λi) ... 1/sqrt(λn)].diag() * V^T * b 
-	//r = (J^T).inv() * b
-	
-    //std::cout << A << std::endl
-    //          << std::endl;
-    //std::cout << linearized_jacobians << std::endl;
+    Eigen::MatrixXd L = ldlt.matrixL();
+    linearized_jacobians = (ldlt.transpositionsP().transpose() * (L * S_sqrt.asDiagonal())).transpose();
+    Eigen::VectorXd Pb = ldlt.transpositionsP() * b;
+    ldlt.matrixL().solveInPlace(Pb);
+    linearized_residuals = S_inv_sqrt.asDiagonal() * Pb; //边缘化产生的残差r
+
     //printf("error2: %f %f\n", (linearized_jacobians.transpose() * linearized_jacobians - A).sum(),
     //      (linearized_jacobians.transpose() * linearized_residuals - b).sum());
 }
@@ -16,9 +16,10 @@
 #include <ros/ros.h>
 #include <ros/console.h>
 #include <cstdlib>
-#include <pthread.h>
+#include <algorithm>
 #include <ceres/ceres.h>
 #include <unordered_map>
+#include <vector>
 
 #include "../utility/utility.h"
 #include "../utility/tic_toc.h"
@@ -37,7 +38,7 @@ struct ResidualBlockInfo
     std::vector<double *> parameter_blocks; // parameters to be optimized
     std::vector<int> drop_set; // id of states to be marginalized
 
-    double **raw_jacobians; // Jacobian， //大小：由该残差块有多少个参数块决定；每个存放的是：残差对每个参数块的雅克比
+    std::vector<double *> raw_jacobians; // Jacobian， //大小：由该残差块有多少个参数块决定；每个存放的是：残差对每个参数块的雅克比
     std::vector<Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>> jacobians; //vector形式存放
     Eigen::VectorXd residuals; // 1x1
 
@@ -47,13 +48,20 @@ struct ResidualBlockInfo
     }
 };
 
-struct ThreadsStruct
+// H = J^T * J and b = J^T * r accumulated over the parameter blocks (local size) of the marginalization,
+// only the upper-triangular block pairs which share a residual are allocated, blocks are referred by a flat id
+struct BlockHessian
 {
-    std::vector<ResidualBlockInfo *> sub_factors;
-    Eigen::MatrixXd A;
-    Eigen::VectorXd b;
-    std::unordered_map<long, int> parameter_block_size; //global size
-    std::unordered_map<long, int> parameter_block_idx; //local size
+    void reset(const std::vector<int> &block_size);
+    void addFactor(const ResidualBlockInfo &factor, const int *block_id); // block_id[i]: id of parameter_blocks[i]
+    void addTo(const std::vector<int> &block_idx, Eigen::MatrixXd &A, Eigen::VectorXd &b) const; // block_idx: position in A
+
+    Eigen::MatrixXd &block(const int &i, const int &j);
+
+    int num_blocks;
+    std::vector<int> block_size;
+    std::vector<Eigen::MatrixXd> H_blocks; // [i * num_blocks + j], i <= j
+    std::vector<Eigen::VectorXd> b_blocks;
 };
 
 class MarginalizationInfo
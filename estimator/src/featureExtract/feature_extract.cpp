@@ -17,10 +17,112 @@
 
 using namespace common;
 
-float cloudCurvature[400000];
-int cloudSortInd[400000];
-int cloudNeighborPicked[400000];
-int cloudLabel[400000];
+// downsample by averaging the points inside each voxel,
+// voxels are looked up in a hash map (reused across calls) instead of sorting the points like pcl::VoxelGrid
+class VoxelHashFilter
+{
+public:
+    void filter(const PointICloud &cloud_in, const float &leaf_size, PointICloud &cloud_out)
+    {
+        const float inv_leaf_size = 1.0f / leaf_size;
+        voxel_index_.clear();
+        voxel_sum_.clear();
+        voxel_cnt_.clear();
+        for (const PointI &point : cloud_in)
+        {
+            if (!std::isfinite(point.x) || !std::isfinite(point.y) || !std::isfinite(point.z)) continue;
+            // 21 bits for each axis
+            uint64_t ix = static_cast<uint64_t>(static_cast<int64_t>(std::floor(point.x * inv_leaf_size)) + (1 << 20)) & 0x1FFFFF;
+            uint64_t iy = static_cast<uint64_t>(static_cast<int64_t>(std::floor(point.y * inv_leaf_size)) + (1 << 20)) & 0x1FFFFF;
+            uint64_t iz = static_cast<uint64_t>(static_cast<int64_t>(std::floor(point.z * inv_leaf_size)) + (1 << 20)) & 0x1FFFFF;
+            uint64_t key = ix | (iy << 21) | (iz << 42);
+            auto iter = voxel_index_.find(key);
+            if (iter == voxel_index_.end())
+            {
+                voxel_index_.emplace(key, voxel_sum_.size());
+                voxel_sum_.push_back(Eigen::Vector4f(point.x, point.y, point.z, point.intensity));
+                voxel_cnt_.push_back(1);
+            } 
+            else
+            {
+                voxel_sum_[iter->second] += Eigen::Vector4f(point.x, point.y, point.z, point.intensity);
+                voxel_cnt_[iter->second]++;
+            }
+        }
+
+        cloud_out.resize(voxel_sum_.size());
+        for (size_t i = 0; i < voxel_sum_.size(); i++)
+        {
+            Eigen::Vector4f centroid = voxel_sum_[i] / static_cast<float>(voxel_cnt_[i]);
+            cloud_out.points[i].x = centroid[0];
+            cloud_out.points[i].y = centroid[1];
+            cloud_out.points[i].z = centroid[2];
+            cloud_out.points[i].intensity = centroid[3];
+        }
+    }
+
+private:
+    std::unordered_map<uint64_t, size_t> voxel_index_;
+    std::vector<Eigen::Vector4f, Eigen::aligned_allocator<Eigen::Vector4f> > voxel_sum_;
+    std::vector<int> voxel_cnt_;
+};
+
+// features of one ring, merged into the FeatureFrame after all rings are processed
+struct RingFeature
+{
+    void clear()
+    {
+        corner_points_sharp_.clear();
+        corner_points_less_sharp_.clear();
+        surf_points_flat_.clear();
+        surf_points_less_flat_.clear();
+        surf_points_less_flat_scan_.clear();
+    }
+
+    PointICloud corner_points_sharp_, corner_points_less_sharp_;
+    PointICloud surf_points_flat_, surf_points_less_flat_;
+    PointICloud surf_points_less_flat_scan_; // before downsampling
+    std::vector<int> edge_heap_, surf_heap_;
+    VoxelHashFilter down_size_filter_;
+};
+
+// scratch buffers of extractCloud, kept per calling thread since lidars are processed in parallel
+struct ExtractWorkspace
+{
+    void resize(const size_t &cloud_size, const size_t &n_scans)
+    {
+        x_.resize(cloud_size);
+        y_.resize(cloud_size);
+        z_.resize(cloud_size);
+        curvature_.resize(cloud_size);
+        neighbor_picked_.resize(cloud_size);
+        label_.resize(cloud_size);
+        ring_feature_.resize(n_scans);
+    }
+
+    std::vector<float> x_, y_, z_; // SoA copy of the scan
+    std::vector<float> curvature_;
+    std::vector<int> neighbor_picked_;
+    std::vector<int> label_;
+    std::vector<RingFeature> ring_feature_;
+};
+
+// concatenate one cloud of every ring into cloud_out, the offsets are the prefix sum of the ring sizes
+static void mergeRingCloud(const std::vector<RingFeature> &ring_feature, 
+                           PointICloud RingFeature::*ring_cloud,
+                           PointICloud &cloud_out)
+{
+    std::vector<size_t> offset(ring_feature.size() + 1, 0);
+    for (size_t i = 0; i < ring_feature.size(); i++)
+        offset[i + 1] = offset[i] + (ring_feature[i].*ring_cloud).size();
+    cloud_out.resize(offset.back());
+    #pragma omp parallel for
+    for (size_t i = 0; i < ring_feature.size(); i++)
+    {
+        const PointICloud &cloud = ring_feature[i].*ring_cloud;
+        std::copy(cloud.points.begin(), cloud.points.end(), cloud_out.points.begin() + offset[i]);
+    }
+}
 
 void FeatureExtract::findStartEndTime(const PointITimeCloud &laser_cloud_in,
                                       float &start_time,
@@ -113,75 +215,124 @@ void FeatureExtract::calTimestamp(const PointCloud &laser_cloud_in,
     }
 }
 
-bool comp(int i, int j) { return (cloudCurvature[i] < cloudCurvature[j]); }
+// LOAM curvature on SoA buffers. The 11-tap stencil keeps the summation order of the scalar version,
+// so the values are bit-identical, while the loop over points is vectorized by the compiler
+static void computeCurvature(const float *x, const float *y, const float *z, 
+                             const size_t &cloud_size,
+                             float *curvature)
+{
+    for (size_t i = 5; i + 5 < cloud_size; i++)
+    {
+        float diff_x = x[i - 5] + x[i - 4] + x[i - 3] + x[i - 2] + x[i - 1] - 10 * x[i] + x[i + 1] + x[i + 2] + x[i + 3] + x[i + 4] + x[i + 5];
+        float diff_y = y[i - 5] + y[i - 4] + y[i - 3] + y[i - 2] + y[i - 1] - 10 * y[i] + y[i + 1] + y[i + 2] + y[i + 3] + y[i + 4] + y[i + 5];
+        float diff_z = z[i - 5] + z[i - 4] + z[i - 3] + z[i - 2] + z[i - 1] - 10 * z[i] + z[i + 1] + z[i + 2] + z[i + 3] + z[i + 4] + z[i + 5];
+        curvature[i] = diff_x * diff_x + diff_y * diff_y + diff_z * diff_z;
+    }
+}
+
+// mark the neighbors of ind as picked until a gap larger than sqrt(0.05) occurs
+static void markNeighborPicked(const ExtractWorkspace &ws, const int &ind, int *neighbor_picked)
+{
+    for (int l = 1; l <= 5; l++)
+    {
+        float diff_x = ws.x_[ind + l] - ws.x_[ind + l - 1];
+        float diff_y = ws.y_[ind + l] - ws.y_[ind + l - 1];
+        float diff_z = ws.z_[ind + l] - ws.z_[ind + l - 1];
+        if (diff_x * diff_x + diff_y * diff_y + diff_z * diff_z > 0.05)
+        {
+            break;
+        }
+        neighbor_picked[ind + l] = 1;
+    }
+    for (int l = -1; l >= -5; l--)
+    {
+        float diff_x = ws.x_[ind + l] - ws.x_[ind + l + 1];
+        float diff_y = ws.y_[ind + l] - ws.y_[ind + l + 1];
+        float diff_z = ws.z_[ind + l] - ws.z_[ind + l + 1];
+        if (diff_x * diff_x + diff_y * diff_y + diff_z * diff_z > 0.05)
+        {
+            break;
+        }
+        neighbor_picked[ind + l] = 1;
+    }
+}
 
-void FeatureExtract::extractCloud(const PointICloud &laser_cloud_in,
-                                  const ScanInfo &scan_info,
-                                  cloudFeature &cloud_feature)
+void FeatureExtract::extractCloud(const ScanInfo &scan_info,
+                                  FeatureFrame &feature_frame)
 {
     TicToc t_whole;
 
+    static thread_local ExtractWorkspace ws_local;
+    ExtractWorkspace &ws = ws_local; // the calling thread's buffers, shared with the omp workers below
+
     // compute curvature of each point
-    const PointICloud::Ptr laser_cloud = boost::make_shared<PointICloud>(laser_cloud_in);
-    size_t cloud_size = laser_cloud->size();
+    const PointICloud &laser_cloud = feature_frame.cloud_[LASER_CLOUD];
+    size_t cloud_size = laser_cloud.size();
     // printf("points size %d\n", cloud_size);
 
-    float cloud_curvature[cloud_size];
-    int cloud_sort_ind[cloud_size];
-    int cloud_neighbor_picked[cloud_size];
-    int cloud_label[cloud_size];
-    for (size_t i = 5; i < cloud_size - 5; i++)
+    ws.resize(cloud_size, N_SCANS);
+    for (size_t i = 0; i < cloud_size; i++)
     {
-        float diff_x = laser_cloud->points[i - 5].x + laser_cloud->points[i - 4].x + laser_cloud->points[i - 3].x + laser_cloud->points[i - 2].x + laser_cloud->points[i - 1].x - 10 * laser_cloud->points[i].x + laser_cloud->points[i + 1].x + laser_cloud->points[i + 2].x + laser_cloud->points[i + 3].x + laser_cloud->points[i + 4].x + laser_cloud->points[i + 5].x;
-        float diff_y = laser_cloud->points[i - 5].y + laser_cloud->points[i - 4].y + laser_cloud->points[i - 3].y + laser_cloud->points[i - 2].y + laser_cloud->points[i - 1].y - 10 * laser_cloud->points[i].y + laser_cloud->points[i + 1].y + laser_cloud->points[i + 2].y + laser_cloud->points[i + 3].y + laser_cloud->points[i + 4].y + laser_cloud->points[i + 5].y;
-        float diff_z = laser_cloud->points[i - 5].z + laser_cloud->points[i - 4].z + laser_cloud->points[i - 3].z + laser_cloud->points[i - 2].z + laser_cloud->points[i - 1].z - 10 * laser_cloud->points[i].z + laser_cloud->points[i + 1].z + laser_cloud->points[i + 2].z + laser_cloud->points[i + 3].z + laser_cloud->points[i + 4].z + laser_cloud->points[i + 5].z;
-        cloud_curvature[i] = diff_x * diff_x + diff_y * diff_y + diff_z * diff_z;
-        cloud_sort_ind[i] = i;
-        cloud_neighbor_picked[i] = 0;
-        cloud_label[i] = 0;
+        ws.x_[i] = laser_cloud.points[i].x;
+        ws.y_[i] = laser_cloud.points[i].y;
+        ws.z_[i] = laser_cloud.points[i].z;
     }
+    computeCurvature(ws.x_.data(), ws.y_.data(), ws.z_.data(), cloud_size, ws.curvature_.data());
+    std::fill(ws.neighbor_picked_.begin(), ws.neighbor_picked_.end(), 0);
+    std::fill(ws.label_.begin(), ws.label_.end(), 0);
+
+    const float *cloud_curvature = ws.curvature_.data();
+    int *cloud_neighbor_picked = ws.neighbor_picked_.data();
+    int *cloud_label = ws.label_.data();
 
     // extract edge and planar features using curvature
+    // the neighbors of a picked point never leave its ring (scan_start_ind_ + 5, scan_end_ind_ - 6),
+    // so rings are independent and processed in parallel, each into its own RingFeature
     // TicToc t_pts;
-    PointICloud corner_points_sharp;
-    PointICloud corner_points_less_sharp;
-    PointICloud surf_points_flat;
-    PointICloud surf_points_less_flat;
-    compObject comp_object;
-    comp_object.cloud_curvature = cloud_curvature;
+    compCurvature comp_larger(cloud_curvature);
+    auto comp_smaller = [&comp_larger](const int &i, const int &j) { return comp_larger(j, i); };
+    #pragma omp parallel for schedule(dynamic)
     for (size_t i = 0; i < N_SCANS; i++)
     {
         // printf("extract feature, scans: %lu\n", i);
+        RingFeature &ring = ws.ring_feature_[i];
+        ring.clear();
         if (scan_info.scan_end_ind_[i] - scan_info.scan_start_ind_[i] < 6) continue;
 
-        PointICloud::Ptr surf_points_less_flat_scan(new PointICloud);
         // split the points at each scan into 6 pieces to select features averagely
         for (int j = 0; j < 6; j++)
         {
             int sp = scan_info.scan_start_ind_[i] + (scan_info.scan_end_ind_[i] - scan_info.scan_start_ind_[i]) * j / 6;
             int ep = scan_info.scan_start_ind_[i] + (scan_info.scan_end_ind_[i] - scan_info.scan_start_ind_[i]) * (j + 1) / 6 - 1;
-            std::sort(cloud_sort_ind + sp, cloud_sort_ind + ep + 1, comp_object); // sort from smallest to largest
+            // only a few points of each piece are selected, so heaps are popped lazily instead of sorting the piece
+            ring.edge_heap_.resize(ep - sp + 1);
+            for (int k = sp; k <= ep; k++) ring.edge_heap_[k - sp] = k;
+            ring.surf_heap_ = ring.edge_heap_;
+            std::make_heap(ring.edge_heap_.begin(), ring.edge_heap_.end(), comp_larger); // top: largest curvature
+            std::make_heap(ring.surf_heap_.begin(), ring.surf_heap_.end(), comp_smaller); // top: smallest curvature
 
             // extract edge feature
             int largest_picked_num = 0;
-            for (int k = ep; k >= sp; k--)
+            while (!ring.edge_heap_.empty())
             {
-                int ind = cloud_sort_ind[k];
-                // if (cloud_neighbor_picked[ind] == 0 && cloud_curvature[ind] > 0.1
-                //                                     && !scan_info.ground_flag_[ind])
-                if (cloud_neighbor_picked[ind] == 0 && cloud_curvature[ind] > 0.1)
+                std::pop_heap(ring.edge_heap_.begin(), ring.edge_heap_.end(), comp_larger);
+                int ind = ring.edge_heap_.back();
+                ring.edge_heap_.pop_back();
+                if (cloud_curvature[ind] <= EDGE_THRESHOLD) break; // the remaining points are all smoother
+                // if (cloud_neighbor_picked[ind] == 0 && !scan_info.ground_flag_[ind])
+                if (cloud_neighbor_picked[ind] == 0)
                 {
                     largest_picked_num++;
                     if (largest_picked_num <= 2) // select if and only if existing 2 points with maximum curvature
                     {
                         cloud_label[ind] = 2;
-                        corner_points_sharp.push_back(laser_cloud->points[ind]);
-                        corner_points_less_sharp.push_back(laser_cloud->points[ind]);
+                        ring.corner_points_sharp_.push_back(laser_cloud.points[ind]);
+                        ring.corner_points_less_sharp_.push_back(laser_cloud.points[ind]);
                     }
                     else if (largest_picked_num <= 20)
                     {
                         cloud_label[ind] = 1;
-                        corner_points_less_sharp.push_back(laser_cloud->points[ind]);
+                        ring.corner_points_less_sharp_.push_back(laser_cloud.points[ind]);
                     }
                     else
                     {
@@ -190,40 +341,22 @@ void FeatureExtract::extractCloud(const PointICloud &laser_cloud_in,
                     cloud_neighbor_picked[ind] = 1;
 
                     // remove the neighbor points to make the points distributed at all places
-                    for (int l = 1; l <= 5; l++)
-                    {
-                        float diff_x = laser_cloud->points[ind + l].x - laser_cloud->points[ind + l - 1].x;
-                        float diff_y = laser_cloud->points[ind + l].y - laser_cloud->points[ind + l - 1].y;
-                        float diff_z = laser_cloud->points[ind + l].z - laser_cloud->points[ind + l - 1].z;
-                        if (diff_x * diff_x + diff_y * diff_y + diff_z * diff_z > 0.05)
-                        {
-                            break;
-                        }
-                        cloud_neighbor_picked[ind + l] = 1;
-                    }
-                    for (int l = -1; l >= -5; l--)
-                    {
-                        float diff_x = laser_cloud->points[ind + l].x - laser_cloud->points[ind + l + 1].x;
-                        float diff_y = laser_cloud->points[ind + l].y - laser_cloud->points[ind + l + 1].y;
-                        float diff_z = laser_cloud->points[ind + l].z - laser_cloud->points[ind + l + 1].z;
-                        if (diff_x * diff_x + diff_y * diff_y + diff_z * diff_z > 0.05)
-                        {
-                            break;
-                        }
-                        cloud_neighbor_picked[ind + l] = 1;
-                    }
+                    markNeighborPicked(ws, ind, cloud_neighbor_picked);
                 }
             }
 
             // extract plane feature
             int smallest_picked_num = 0;
-            for (int k = sp; k <= ep; k++)
+            while (!ring.surf_heap_.empty())
             {
-                int ind = cloud_sort_ind[k];
-                if (cloud_neighbor_picked[ind] == 0 && cloud_curvature[ind] < 0.1)
+                std::pop_heap(ring.surf_heap_.begin(), ring.surf_heap_.end(), comp_smaller);
+                int ind = ring.surf_heap_.back();
+                ring.surf_heap_.pop_back();
+                if (cloud_curvature[ind] >= EDGE_THRESHOLD) break;
+                if (cloud_neighbor_picked[ind] == 0)
                 {
                     cloud_label[ind] = -1;
-                    surf_points_flat.push_back(laser_cloud->points[ind]);
+                    ring.surf_points_flat_.push_back(laser_cloud.points[ind]);
                     smallest_picked_num++;
                     if (smallest_picked_num >= 4) // select 4 points with minimum curvature
                     {
@@ -231,28 +364,7 @@ void FeatureExtract::extractCloud(const PointICloud &laser_cloud_in,
                     }
                     cloud_neighbor_picked[ind] = 1;
                     // remove the neighbor points with large curvature to make the points distributed at all direction
-                    for (int l = 1; l <= 5; l++)
-                    {
-                        float diff_x = laser_cloud->points[ind + l].x - laser_cloud->points[ind + l - 1].x;
-                        float diff_y = laser_cloud->points[ind + l].y - laser_cloud->points[ind + l - 1].y;
-                        float diff_z = laser_cloud->points[ind + l].z - laser_cloud->points[ind + l - 1].z;
-                        if (diff_x * diff_x + diff_y * diff_y + diff_z * diff_z > 0.05)
-                        {
-                            break;
-                        }
-                        cloud_neighbor_picked[ind + l] = 1;
-                    }
-                    for (int l = -1; l >= -5; l--)
-                    {
-                        float diff_x = laser_cloud->points[ind + l].x - laser_cloud->points[ind + l + 1].x;
-                        float diff_y = laser_cloud->points[ind + l].y - laser_cloud->points[ind + l + 1].y;
-                        float diff_z = laser_cloud->points[ind + l].z - laser_cloud->points[ind + l + 1].z;
-                        if (diff_x * diff_x + diff_y * diff_y + diff_z * diff_z > 0.05)
-                        {
-                            break;
-                        }
-                        cloud_neighbor_picked[ind + l] = 1;
-                    }
+                    markNeighborPicked(ws, ind, cloud_neighbor_picked);
                 }
             }
 
@@ -260,32 +372,25 @@ void FeatureExtract::extractCloud(const PointICloud &laser_cloud_in,
             {
                 if (cloud_label[k] <= 0)
                 {
-                    surf_points_less_flat_scan->push_back(laser_cloud->points[k]);
+                    ring.surf_points_less_flat_scan_.push_back(laser_cloud.points[k]);
                 }
             }
         }
-        PointICloud surf_points_less_flat_scan_ds;
-        pcl::VoxelGrid<PointI> down_size_filter;
-        down_size_filter.setInputCloud(surf_points_less_flat_scan);
-        down_size_filter.setLeafSize(0.2, 0.2, 0.2);
-        down_size_filter.filter(surf_points_less_flat_scan_ds);
-        surf_points_less_flat += surf_points_less_flat_scan_ds;
+        ring.down_size_filter_.filter(ring.surf_points_less_flat_scan_, 0.2, ring.surf_points_less_flat_);
     }
+
+    // merge the rings in order
+    mergeRingCloud(ws.ring_feature_, &RingFeature::corner_points_sharp_, feature_frame.cloud_[CORNER_POINTS_SHARP]);
+    mergeRingCloud(ws.ring_feature_, &RingFeature::corner_points_less_sharp_, feature_frame.cloud_[CORNER_POINTS_LESS_SHARP]);
+    mergeRingCloud(ws.ring_feature_, &RingFeature::surf_points_flat_, feature_frame.cloud_[SURF_POINTS_FLAT]);
+    mergeRingCloud(ws.ring_feature_, &RingFeature::surf_points_less_flat_, feature_frame.cloud_[SURF_POINTS_LESS_FLAT]);
+
     // printf("seperate points time %fms\n", t_pts.toc());
     // printf("whole scan registration time %fms \n", t_whole.toc());
     if (t_whole.toc() > 100)
         ROS_WARN("whole scan registration process over 100ms");
 
-    cloud_feature.clear();
-    // cloud_feature.find("key")->first/ second
-    // cloud_feature.erase("key")/ cloud_feature.erase(cloud_feature.find("key"))
-    cloud_feature.insert(pair<std::string, PointICloud>("laser_cloud", *laser_cloud)); //一帧整体点云
-    cloud_feature.insert(pair<std::string, PointICloud>("corner_points_sharp", corner_points_sharp)); // subset: the most distinctive edge points
-    cloud_feature.insert(pair<std::string, PointICloud>("corner_points_less_sharp", corner_points_less_sharp)); // more corner points
-    cloud_feature.insert(pair<std::string, PointICloud>("surf_points_flat", surf_points_flat)); // subset: the most distinctive planar points
-    cloud_feature.insert(pair<std::string, PointICloud>("surf_points_less_flat", surf_points_less_flat)); // more planar points
-
-    // std::cout << "feature size: " << laser_cloud->size() << " " 
+    // std::cout << "feature size: " << laser_cloud.size() << " " 
     //           << corner_points_sharp.size() << " " << corner_points_less_sharp.size() << " "
     //           << surf_points_flat.size() << " " << surf_points_less_flat.size() << std::endl;
 
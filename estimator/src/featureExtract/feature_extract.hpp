@@ -21,6 +21,10 @@
 #include <csignal>
 #include <cmath>
 #include <map>
+#include <unordered_map>
+#include <vector>
+#include <algorithm>
+#include <iterator>
 #include <omp.h>
 
 #include <opencv2/opencv.hpp>
@@ -38,18 +42,27 @@
 #include "../estimator/parameters.h"
 #include "../utility/tic_toc.h"
 #include "../utility/utility.h"
+#include "match_cache.hpp"
 
 #include "mloam_pcl/point_with_time.hpp"
 
 #define EDGE_THRESHOLD 0.1
+#define MAX_MATCH_NEIGH 20 // upper bound of N_NEIGH in the map matching, sizes the fixed scratch matrices
+#define MIN_PARALLEL_MATCH_SIZE 256 // smaller clouds are matched on the calling thread
 
 using namespace common;
 
-class compObject
+// order point indices by curvature, ties are broken by the index so that the selection is deterministic
+class compCurvature
 {
 public:
-    float *cloud_curvature;
-    bool operator()(int i, int j) { return (cloud_curvature[i] < cloud_curvature[j]); }
+    compCurvature(const float *cloud_curvature) : cloud_curvature_(cloud_curvature) {}
+    bool operator()(const int &i, const int &j) const 
+    { 
+        return (cloud_curvature_[i] < cloud_curvature_[j]) || ((cloud_curvature_[i] == cloud_curvature_[j]) && (i < j)); 
+    }
+
+    const float *cloud_curvature_;
 };
 
 class FeatureExtract
@@ -71,30 +84,30 @@ public:
     void calTimestamp(const PointITimeCloud &laser_cloud_in,
                       PointICloud &laser_cloud_out);
 
-    void extractCloud(const PointICloud &laser_cloud_in,
-                      const ScanInfo &scan_info,
-                      cloudFeature &cloud_feature);
+    // extract features from feature_frame.cloud_[LASER_CLOUD] into the other buffers of feature_frame
+    void extractCloud(const ScanInfo &scan_info,
+                      FeatureFrame &feature_frame);
 
     template <typename PointType>
     void matchCornerFromScan(const typename pcl::KdTreeFLANN<PointType>::Ptr &kdtree_corner_from_scan,
                              const typename pcl::PointCloud<PointType> &cloud_scan, 
                              const typename pcl::PointCloud<PointType> &cloud_data,
                              const Pose &pose_local,
-                             std::vector<PointPlaneFeature> &features);
+                             std::vector<PointPlaneFeature, Eigen::aligned_allocator<PointPlaneFeature> > &features);
     
     template <typename PointType>
     void matchSurfFromScan(const typename pcl::KdTreeFLANN<PointType>::Ptr &kdtree_surf_from_scan,
                            const typename pcl::PointCloud<PointType> &cloud_scan, 
                            const typename pcl::PointCloud<PointType> &cloud_data,
                            const Pose &pose_local, 
-                           std::vector<PointPlaneFeature> &features);
+                           std::vector<PointPlaneFeature, Eigen::aligned_allocator<PointPlaneFeature> > &features);
     
     template <typename PointType>
     void matchCornerFromMap(const typename pcl::KdTreeFLANN<PointType>::Ptr &kdtree_corner_from_map,
                             const typename pcl::PointCloud<PointType> &cloud_map, 
                             const typename pcl::PointCloud<PointType> &cloud_data,
                             const Pose &pose_local, 
-                            std::vector<PointPlaneFeature> &features,
+                            std::vector<PointPlaneFeature, Eigen::aligned_allocator<PointPlaneFeature> > &features,
                             const size_t &N_NEIGH = 5, 
                             const bool &CHECK_FOV = true);
 
@@ -103,10 +116,11 @@ public:
                           const typename pcl::PointCloud<PointType> &cloud_map,
                           const typename pcl::PointCloud<PointType> &cloud_data,
                           const Pose &pose_local,
-                          std::vector<PointPlaneFeature> &features,
+                          std::vector<PointPlaneFeature, Eigen::aligned_allocator<PointPlaneFeature> > &features,
                           const size_t &N_NEIGH = 5,
                           const bool &CHECK_FOV = true);
 
+    // with a cache, the fit of the point is reused while the transformed point stays in the cached voxel
     template <typename PointType>
     bool matchCornerPointFromMap(const typename pcl::KdTreeFLANN<PointType>::Ptr &kdtree_corner_from_map,
                                  const typename pcl::PointCloud<PointType> &cloud_map,
@@ -115,7 +129,8 @@ public:
                                  PointPlaneFeature &feature,
                                  const size_t &idx,
                                  const size_t &N_NEIGH = 5,
-                                 const bool &CHECK_FOV = true);
+                                 const bool &CHECK_FOV = true,
+                                 MatchCache *cache = nullptr);
 
     template <typename PointType>
     bool matchSurfPointFromMap(const typename pcl::KdTreeFLANN<PointType>::Ptr &kdtree_surf_from_map,
@@ -125,15 +140,66 @@ public:
                                PointPlaneFeature &feature,
                                const size_t &idx,
                                const size_t &N_NEIGH = 5,
-                               const bool &CHECK_FOV = true);
+                               const bool &CHECK_FOV = true,
+                               MatchCache *cache = nullptr);
+
+private:
+    // match every point of a cloud with match_func(idx, feature), the points are sharded in contiguous blocks
+    // across the omp threads and the per-thread results are concatenated in block order (same order as a serial loop)
+    template <typename MatchFunc>
+    void matchFromMapParallel(const size_t &cloud_size,
+                              const MatchFunc &match_func,
+                              std::vector<PointPlaneFeature, Eigen::aligned_allocator<PointPlaneFeature> > &features);
 };
 
+template <typename MatchFunc>
+void FeatureExtract::matchFromMapParallel(const size_t &cloud_size,
+                                          const MatchFunc &match_func,
+                                          std::vector<PointPlaneFeature, Eigen::aligned_allocator<PointPlaneFeature> > &features)
+{
+    features.clear();
+    // nested in the parallel matching of the estimator, or a small cloud: match straight into features,
+    // which keeps its capacity from the previous frames
+    const int max_threads = (cloud_size >= MIN_PARALLEL_MATCH_SIZE && !omp_in_parallel()) ? omp_get_max_threads() : 1;
+    if (max_threads == 1)
+    {
+        PointPlaneFeature feature;
+        for (size_t i = 0; i < cloud_size; i++)
+        {
+            if (match_func(i, feature)) features.push_back(feature);
+        }
+        return;
+    }
+    std::vector<std::vector<PointPlaneFeature, Eigen::aligned_allocator<PointPlaneFeature> > > thread_features(max_threads);
+    #pragma omp parallel num_threads(max_threads)
+    {
+        // the team may be smaller than requested (e.g. nested in another parallel region)
+        const size_t num_threads = omp_get_num_threads();
+        const size_t tid = omp_get_thread_num();
+        const size_t start_idx = cloud_size * tid / num_threads;
+        const size_t end_idx = cloud_size * (tid + 1) / num_threads;
+        std::vector<PointPlaneFeature, Eigen::aligned_allocator<PointPlaneFeature> > &local_features = thread_features[tid];
+        local_features.reserve(end_idx - start_idx);
+        PointPlaneFeature feature;
+        for (size_t i = start_idx; i < end_idx; i++)
+        {
+            if (match_func(i, feature)) local_features.push_back(feature);
+        }
+    }
+
+    size_t num_features = 0;
+    for (const std::vector<PointPlaneFeature, Eigen::aligned_allocator<PointPlaneFeature> > &local_features : thread_features) num_features += local_features.size();
+    features.reserve(num_features);
+    for (std::vector<PointPlaneFeature, Eigen::aligned_allocator<PointPlaneFeature> > &local_features : thread_features)
+        std::move(local_features.begin(), local_features.end(), std::back_inserter(features));
+}
+
 template <typename PointType>
 void FeatureExtract::matchCornerFromScan(const typename pcl::KdTreeFLANN<PointType>::Ptr &kdtree_corner_from_scan,
                                          const typename pcl::PointCloud<PointType> &cloud_scan,
                                          const typename pcl::PointCloud<PointType> &cloud_data,
                                          const Pose &pose_local,
-                                         std::vector<PointPlaneFeature> &features)
+                                         std::vector<PointPlaneFeature, Eigen::aligned_allocator<PointPlaneFeature> > &features)
 {
     if (!pcl::traits::has_field<PointType, pcl::fields::intensity>::value)
     {
@@ -278,7 +344,7 @@ void FeatureExtract::matchSurfFromScan(const typename pcl::KdTreeFLANN<PointType
                                        const typename pcl::PointCloud<PointType> &cloud_scan,
                                        const typename pcl::PointCloud<PointType> &cloud_data,
                                        const Pose &pose_local,
-                                       std::vector<PointPlaneFeature> &features)
+                                       std::vector<PointPlaneFeature, Eigen::aligned_allocator<PointPlaneFeature> > &features)
 {
     if (!pcl::traits::has_field<PointType, pcl::fields::intensity>::value)
     {
@@ -375,7 +441,7 @@ void FeatureExtract::matchSurfFromScan(const typename pcl::KdTreeFLANN<PointType
                 PointPlaneFeature feature;
                 feature.idx_ = i;
                 feature.point_ = Eigen::Vector3d{cloud_data.points[i].x, cloud_data.points[i].y, cloud_data.points[i].z};
-                feature.coeffs_ = coeff;
+                feature.coeffs_ << coeff, 0, 0;
                 feature.type_ = 's'; //在代码一致性方面，或许corner points为默认类型‘n’。但是feature type在计算相邻两帧delta_T时没有用，所以无伤大雅
                 features.push_back(feature);
             }
@@ -388,7 +454,7 @@ void FeatureExtract::matchCornerFromMap(const typename pcl::KdTreeFLANN<PointTyp
                                         const typename pcl::PointCloud<PointType> &cloud_map,
                                         const typename pcl::PointCloud<PointType> &cloud_data,
                                         const Pose &pose_local,
-                                        std::vector<PointPlaneFeature> &features,
+                                        std::vector<PointPlaneFeature, Eigen::aligned_allocator<PointPlaneFeature> > &features,
                                         const size_t &N_NEIGH,
                                         const bool &CHECK_FOV)
 {
@@ -397,152 +463,13 @@ void FeatureExtract::matchCornerFromMap(const typename pcl::KdTreeFLANN<PointTyp
         std::cerr << "[FeatureExtract] Point does not have intensity field!" << std::endl;
         exit(EXIT_FAILURE);
     }
-    features.clear();
-    std::vector<int> point_search_idx(N_NEIGH, 0);
-    std::vector<float> point_search_sq_dis(N_NEIGH, 0);
-
     // extract edge coefficients and correspondences from edge map
-    size_t cloud_size = cloud_data.points.size();
-    features.resize(cloud_size * 2);
-    size_t cloud_cnt = 0;
-    PointType point_ori, point_sel;
-    int num_neighbors = N_NEIGH;
-    for (size_t i = 0; i < cloud_size; i++)
-    {
-        point_ori = cloud_data.points[i];
-        pointAssociateToMap(point_ori, point_sel, pose_local);
-        kdtree_corner_from_map->nearestKSearch(point_sel, num_neighbors, point_search_idx, point_search_sq_dis);
-        if (point_search_sq_dis[num_neighbors - 1] < MIN_MATCH_SQ_DIS)
-        {
-            // calculate the coefficients of edge points
-            std::vector<Eigen::Vector3f> near_corners;
-            Eigen::Vector3f center(0, 0, 0); // mean value
-            for (int j = 0; j < num_neighbors; j++)
-            {
-                Eigen::Vector3f tmp(cloud_map.points[point_search_idx[j]].x,
-                                    cloud_map.points[point_search_idx[j]].y,
-                                    cloud_map.points[point_search_idx[j]].z);
-                center += tmp;
-                near_corners.push_back(tmp);
-            }
-            center /= (1.0 * num_neighbors);
-            Eigen::Matrix3f cov_mat = Eigen::Matrix3f::Zero();
-            for (int j = 0; j < num_neighbors; j++)
-            {
-                Eigen::Vector3f tmp_zero_mean = near_corners[j] - center;
-                cov_mat += tmp_zero_mean * tmp_zero_mean.transpose();
-            }
-            Eigen::SelfAdjointEigenSolver<Eigen::Matrix3f> esolver(cov_mat);
-
-            // if is indeed line feature
-            // note Eigen library sort eigenvalues in increasing order
-            Eigen::Vector3f unit_direction = esolver.eigenvectors().col(2);
-            if (esolver.eigenvalues()[2] > 3 * esolver.eigenvalues()[1])
-            {
-                bool is_in_laser_fov = false;
-                if (CHECK_FOV)
-                {
-                    PointType point_on_z_axis, point_on_z_axis_trans;
-                    point_on_z_axis.x = 0.0;
-                    point_on_z_axis.y = 0.0;
-                    point_on_z_axis.z = 10.0;
-                    pointAssociateToMap(point_on_z_axis, point_on_z_axis_trans, pose_local);
-                    float squared_side1 = sqrSum(pose_local.t_(0) - point_sel.x,
-                                                 pose_local.t_(1) - point_sel.y,
-                                                 pose_local.t_(2) - point_sel.z);
-                    float squared_side2 = sqrSum(point_on_z_axis_trans.x - point_sel.x,
-                                                 point_on_z_axis_trans.y - point_sel.y,
-                                                 point_on_z_axis_trans.z - point_sel.z);
-
-                    float check1 = 100.0f + squared_side1 - squared_side2 - 10.0f * sqrt(3.0f) * sqrt(squared_side1);
-                    float check2 = 100.0f + squared_side1 - squared_side2 + 10.0f * sqrt(3.0f) * sqrt(squared_side1);
-                    // within +-60 degree
-                    if (check1 < 0 && check2 > 0)
-                        is_in_laser_fov = true;
-                }
-                else
-                {
-                    is_in_laser_fov = true;
-                }
-                if (is_in_laser_fov)
-                {
-                    // Eigen::Vector3f X0(point_sel.x, point_sel.y, point_sel.z);
-                    // Eigen::Vector3f point_on_line = center;
-                    // Eigen::Vector3f X1, X2;
-                    // X1 = 0.1 * unit_direction + point_on_line;
-                    // X2 = -0.1 * unit_direction + point_on_line;
-
-                    // Eigen::Vector3f n = (X1 - X0).cross(X2 - X0);
-                    // Eigen::Vector3f w2 = n / n.norm();
-                    // Eigen::Vector3f w1 = w2.cross(X2 - X1);
-                    // w1.normalized();
-
-                    // float ld_1 = n.norm() / (X1 - X2).norm(); // the point-to-edge distance between point to plane
-                    // float ld_2 = 0.0;
-                    // float s = 1 - 0.9f * fabs(ld_1);
-
-                    // float ld_p1 = -w1.dot(X1);
-                    // float ld_p2 = -w2.dot(X1);
-
-                    // float ld_p1 = -(w1.x() * point_sel.x + w1.y() * point_sel.y + w1.z() * point_sel.z - ld_1);
-                    // float ld_p2 = -(w2.x() * point_sel.x + w2.y() * point_sel.y + w2.z() * point_sel.z - ld_2);
-
-                    // Eigen::Vector4d coeff1(w1.x(), w1.y(), w1.z(), ld_p1);
-                    // Eigen::Vector4d coeff2(w2.x(), w2.y(), w2.z(), ld_p2);
-
-                    // PointPlaneFeature feature1, feature2;
-
-                    // feature1.idx_ = i;
-                    // feature1.point_ = Eigen::Vector3d{point_ori.x, point_ori.y, point_ori.z};
-                    // feature1.coeffs_ = coeff1 * 0.5;
-                    // feature1.laser_idx_ = (size_t)point_ori.intensity;
-                    // feature1.type_ = 'c';
-                    // features[cloud_cnt] = feature1;
-                    // cloud_cnt++;
-
-                    // feature2.idx_ = i;
-                    // feature2.point_ = Eigen::Vector3d{point_ori.x, point_ori.y, point_ori.z};
-                    // feature2.coeffs_ = coeff2 * 0.5;
-                    // feature2.laser_idx_ = (size_t)point_ori.intensity;
-                    // feature2.type_ = 'c';
-                    // features[cloud_cnt] = feature2;
-                    // cloud_cnt++;
-
-                    // Eigen::Vector4d coeff(w1.x(), w1.y(), w1.z(), ld_p1);
-                    // PointPlaneFeature feature;
-                    // feature.idx_ = i;
-                    // feature.point_ = Eigen::Vector3d{point_ori.x, point_ori.y, point_ori.z};
-                    // feature.coeffs_ = coeff;
-                    // feature.laser_idx_ = (size_t)point_ori.intensity;
-                    // feature.type_ = 'c';
-                    // features[cloud_cnt] = feature;
-                    // cloud_cnt++;
-
-                    Eigen::Vector3f point_on_line = center;
-                    Eigen::Vector3f X1, X2;
-                    X1 = 0.1 * unit_direction + point_on_line;
-                    X2 = -0.1 * unit_direction + point_on_line;
-
-                    Eigen::Matrix<double, 6, 1> coeff;
-                    coeff(0) = X1.x(),
-                    coeff(1) = X1.y(),
-                    coeff(2) = X1.z();
-                    coeff(3) = X2.x(),
-                    coeff(4) = X2.y(),
-                    coeff(5) = X2.z();
-                    PointPlaneFeature feature;
-                    feature.idx_ = i;
-                    feature.point_ = Eigen::Vector3d{point_ori.x, point_ori.y, point_ori.z};
-                    feature.coeffs_ = coeff;
-                    feature.laser_idx_ = (size_t)point_ori.intensity;
-                    feature.type_ = 'c';
-                    features[cloud_cnt] = feature;
-                    cloud_cnt++;
-                }
-            }
-        }
-    }
-    features.resize(cloud_cnt);
+    matchFromMapParallel(cloud_data.points.size(),
+                         [&](const size_t &i, PointPlaneFeature &feature) {
+                             return matchCornerPointFromMap(kdtree_corner_from_map, cloud_map, cloud_data.points[i],
+                                                            pose_local, feature, i, N_NEIGH, CHECK_FOV);
+                         },
+                         features);
 }
 
 // should be performed once after several gradient descents
@@ -551,7 +478,7 @@ void FeatureExtract::matchSurfFromMap(const typename pcl::KdTreeFLANN<PointType>
                                       const typename pcl::PointCloud<PointType> &cloud_map,
                                       const typename pcl::PointCloud<PointType> &cloud_data,
                                       const Pose &pose_local,
-                                      std::vector<PointPlaneFeature> &features,
+                                      std::vector<PointPlaneFeature, Eigen::aligned_allocator<PointPlaneFeature> > &features,
                                       const size_t &N_NEIGH,
                                       const bool &CHECK_FOV)
 {
@@ -560,94 +487,12 @@ void FeatureExtract::matchSurfFromMap(const typename pcl::KdTreeFLANN<PointType>
         std::cerr << "[FeatureExtract] Point does not have intensity field!" << std::endl;
         exit(EXIT_FAILURE);
     }
-    features.clear();
-    std::vector<int> point_search_idx(N_NEIGH, 0);
-    std::vector<float> point_search_sq_dis(N_NEIGH, 0);
-    Eigen::MatrixXf mat_A = Eigen::MatrixXf::Zero(N_NEIGH, 3);
-    Eigen::MatrixXf mat_B = Eigen::MatrixXf::Constant(N_NEIGH, 1, -1);
-    const int num_neighbors = N_NEIGH;
-
-    size_t cloud_size = cloud_data.points.size();
-    features.resize(cloud_size);
-    size_t cloud_cnt = 0;
-    PointType point_ori, point_sel;
-    for (size_t i = 0; i < cloud_size; i++)
-    {
-        point_ori = cloud_data.points[i];
-        pointAssociateToMap(point_ori, point_sel, pose_local); //n号雷达在i处的surf points, 转换到主雷达pivot下
-        kdtree_surf_from_map->nearestKSearch(point_sel, num_neighbors, point_search_idx, point_search_sq_dis);
-        if (point_search_sq_dis[num_neighbors - 1] < MIN_MATCH_SQ_DIS)
-        {
-            for (int j = 0; j < num_neighbors; j++)
-            {
-                mat_A(j, 0) = cloud_map.points[point_search_idx[j]].x;
-                mat_A(j, 1) = cloud_map.points[point_search_idx[j]].y;
-                mat_A(j, 2) = cloud_map.points[point_search_idx[j]].z;
-            }
-            Eigen::Vector3f norm = mat_A.colPivHouseholderQr().solve(mat_B);
-            float negative_OA_dot_norm = 1 / norm.norm();
-            norm.normalize();
-
-            // check if a plane that coeff * [x, y, z, 1] <= MIN_MATCH_SQ_DIS
-            bool plane_valid = true;
-            for (int j = 0; j < num_neighbors; j++)
-            {
-                if (fabs(norm(0) * cloud_map.points[point_search_idx[j]].x +
-                         norm(1) * cloud_map.points[point_search_idx[j]].y +
-                         norm(2) * cloud_map.points[point_search_idx[j]].z + negative_OA_dot_norm) > MIN_PLANE_DIS)
-                {
-                    plane_valid = false;
-                    break;
-                }
-            }
-
-            if (plane_valid)
-            {
-                bool is_in_laser_fov = false;
-                if (CHECK_FOV) //TODO(jxl): FOV检测的算法原理
-                {
-                    PointType transform_pos;
-                    PointType point_on_z_axis, point_on_z_axis_trans;
-                    point_on_z_axis.x = 0.0;
-                    point_on_z_axis.y = 0.0;
-                    point_on_z_axis.z = 10.0;
-                    pointAssociateToMap(point_on_z_axis, point_on_z_axis_trans, pose_local);
-                    float squared_side1 = sqrSum(pose_local.t_(0) - point_sel.x,
-                                                  pose_local.t_(1) - point_sel.y,
-                                                  pose_local.t_(2) - point_sel.z);
-                    float squared_side2 = sqrSum(point_on_z_axis_trans.x - point_sel.x,
-                                                  point_on_z_axis_trans.y - point_sel.y,
-                                                  point_on_z_axis_trans.z - point_sel.z);
-                    float check1 = 100.0f + squared_side1 - squared_side2 - 10.0f * sqrt(3.0f) * sqrt(squared_side1);
-                    float check2 = 100.0f + squared_side1 - squared_side2 + 10.0f * sqrt(3.0f) * sqrt(squared_side1);
-                    // within +-60 degree
-                    if (check1 < 0 && check2 > 0)
-                        is_in_laser_fov = true;
-                }
-                else
-                {
-                    is_in_laser_fov = true;
-                }
-                if (is_in_laser_fov)
-                {
-                    // pd2 (distance) smaller, s larger
-                    float pd2 = norm(0) * point_sel.x + norm(1) * point_sel.y + norm(2) * point_sel.z + negative_OA_dot_norm;
-                    float s = 1 - 0.9f * fabs(pd2) / sqrt(sqrSum(point_sel.x, point_sel.y, point_sel.z));
-
-                    Eigen::Vector4d coeff(norm(0), norm(1), norm(2), negative_OA_dot_norm);
-                    PointPlaneFeature feature;
-                    feature.idx_ = i; //n号雷达在滑窗中对应帧下的surf points index
-                    feature.point_ = Eigen::Vector3d{point_ori.x, point_ori.y, point_ori.z}; //n号雷达在滑窗中对应帧下的surf point
-                    feature.coeffs_ = coeff; //correspondances形成的平面方程
-                    feature.laser_idx_ = (size_t)point_ori.intensity; //n号雷达在滑窗中对应帧下的surf point的激光线束号
-                    feature.type_ = 's';
-                    features[cloud_cnt] = feature;
-                    cloud_cnt++;
-                }
-            }
-        }
-    }
-    features.resize(cloud_cnt);
+    matchFromMapParallel(cloud_data.points.size(),
+                         [&](const size_t &i, PointPlaneFeature &feature) {
+                             return matchSurfPointFromMap(kdtree_surf_from_map, cloud_map, cloud_data.points[i], //n号雷达在i处的surf points, 转换到主雷达pivot下
+                                                          pose_local, feature, i, N_NEIGH, CHECK_FOV);
+                         },
+                         features);
 }
 
 template <typename PointType>
@@ -658,39 +503,51 @@ bool FeatureExtract::matchCornerPointFromMap(const typename pcl::KdTreeFLANN<Poi
                                              PointPlaneFeature &feature,
                                              const size_t &idx,
                                              const size_t &N_NEIGH,
-                                             const bool &CHECK_FOV)
+                                             const bool &CHECK_FOV,
+                                             MatchCache *cache)
 {
     if (!pcl::traits::has_field<PointType, pcl::fields::intensity>::value)
     {
         LOG(INFO) << "[FeatureExtract] Point does not have intensity field!";
         return false;
     }
-    std::vector<int> point_search_idx(N_NEIGH, 0);
-    std::vector<float> point_search_sq_dis(N_NEIGH, 0);
-    int num_neighbors = N_NEIGH;
+    if (cache)
+    {
+        PointType point_sel;
+        pointAssociateToMap(point_ori, point_sel, pose_local);
+        bool b_match = false;
+        if (cache->find(idx, point_sel, 'c', b_match, feature)) return b_match;
+        b_match = matchCornerPointFromMap(kdtree_corner_from_map, cloud_map, point_ori, pose_local, feature, idx, N_NEIGH, CHECK_FOV);
+        cache->insert(idx, point_sel, 'c', b_match, feature);
+        return b_match;
+    }
+    // per-thread search buffers, the neighbors are kept in a fixed-size matrix
+    static thread_local std::vector<int> point_search_idx;
+    static thread_local std::vector<float> point_search_sq_dis;
+    const int num_neighbors = std::min(N_NEIGH, static_cast<size_t>(MAX_MATCH_NEIGH));
 
     PointType point_sel;
     pointAssociateToMap(point_ori, point_sel, pose_local);
     kdtree_corner_from_map->nearestKSearch(point_sel, num_neighbors, point_search_idx, point_search_sq_dis);
-    if (point_search_sq_dis[num_neighbors - 1] < MIN_MATCH_SQ_DIS)
+    if ((static_cast<int>(point_search_sq_dis.size()) == num_neighbors) &&
+        (point_search_sq_dis[num_neighbors - 1] < MIN_MATCH_SQ_DIS))
     {
         // calculate the coefficients of edge points
-        std::vector<Eigen::Vector3f> near_corners;
+        Eigen::Matrix<float, 3, Eigen::Dynamic, 0, 3, MAX_MATCH_NEIGH> near_corners(3, num_neighbors);
         Eigen::Vector3f center(0, 0, 0); // mean value
         for (int j = 0; j < num_neighbors; j++)
         {
-            Eigen::Vector3f tmp(cloud_map.points[point_search_idx[j]].x,
-                                cloud_map.points[point_search_idx[j]].y,
-                                cloud_map.points[point_search_idx[j]].z);
-            center += tmp;
-            near_corners.push_back(tmp);
+            near_corners.col(j) = Eigen::Vector3f(cloud_map.points[point_search_idx[j]].x,
+                                                  cloud_map.points[point_search_idx[j]].y,
+                                                  cloud_map.points[point_search_idx[j]].z);
+            center += near_corners.col(j);
         }
         center /= (1.0 * num_neighbors);
 
         Eigen::Matrix3f cov_mat = Eigen::Matrix3f::Zero();
         for (int j = 0; j < num_neighbors; j++)
         {
-            Eigen::Vector3f tmp_zero_mean = near_corners[j] - center;
+            Eigen::Vector3f tmp_zero_mean = near_corners.col(j) - center;
             cov_mat += tmp_zero_mean * tmp_zero_mean.transpose();
         }
         Eigen::SelfAdjointEigenSolver<Eigen::Matrix3f> esolver(cov_mat);
@@ -803,25 +660,38 @@ bool FeatureExtract::matchSurfPointFromMap(const typename pcl::KdTreeFLANN<Point
                                            PointPlaneFeature &feature, //n号雷达在i帧下的surf points[que_idx]在local map中的correspondances放置在all_features[que_idx]
                                            const size_t &idx, //que_idx
                                            const size_t &N_NEIGH, //5
-                                           const bool &CHECK_FOV) //false
+                                           const bool &CHECK_FOV, //false
+                                           MatchCache *cache)
 {
     if (!pcl::traits::has_field<PointType, pcl::fields::intensity>::value)
     {
         LOG(INFO) << "[FeatureExtract] Point does not have intensity field!";
         return false;
     }
-    std::vector<int> point_search_idx(N_NEIGH, 0);
-    std::vector<float> point_search_sq_dis(N_NEIGH, 0);
-    Eigen::MatrixXf mat_A = Eigen::MatrixXf::Zero(N_NEIGH, 3);
-    Eigen::MatrixXf mat_B = Eigen::MatrixXf::Constant(N_NEIGH, 1, -1);
-    const int num_neighbors = N_NEIGH;
+    if (cache)
+    {
+        PointType point_sel;
+        pointAssociateToMap(point_ori, point_sel, pose_local);
+        bool b_match = false;
+        if (cache->find(idx, point_sel, 's', b_match, feature)) return b_match;
+        b_match = matchSurfPointFromMap(kdtree_surf_from_map, cloud_map, point_ori, pose_local, feature, idx, N_NEIGH, CHECK_FOV);
+        cache->insert(idx, point_sel, 's', b_match, feature);
+        return b_match;
+    }
+    // per-thread search buffers, the plane fitting uses fixed-size matrices which do not allocate
+    static thread_local std::vector<int> point_search_idx;
+    static thread_local std::vector<float> point_search_sq_dis;
+    const int num_neighbors = std::min(N_NEIGH, static_cast<size_t>(MAX_MATCH_NEIGH));
+    Eigen::Matrix<float, Eigen::Dynamic, 3, 0, MAX_MATCH_NEIGH, 3> mat_A(num_neighbors, 3);
+    Eigen::Matrix<float, Eigen::Dynamic, 1, 0, MAX_MATCH_NEIGH, 1> mat_B =
+        Eigen::Matrix<float, Eigen::Dynamic, 1, 0, MAX_MATCH_NEIGH, 1>::Constant(num_neighbors, -1);
 
     PointType point_sel;
     pointAssociateToMap(point_ori, point_sel, pose_local);
     kdtree_surf_from_map->nearestKSearch(point_sel, num_neighbors, point_search_idx, point_search_sq_dis);
-    if (point_search_sq_dis[num_neighbors - 1] < MIN_MATCH_SQ_DIS)
+    if ((static_cast<int>(point_search_sq_dis.size()) == num_neighbors) &&
+        (point_search_sq_dis[num_neighbors - 1] < MIN_MATCH_SQ_DIS))
     {
-        std::vector<bool> point_select(num_neighbors, true);
         for (int j = 0; j < num_neighbors; j++)
         {
             mat_A(j, 0) = cloud_map.points[point_search_idx[j]].x;
@@ -880,7 +750,7 @@ bool FeatureExtract::matchSurfPointFromMap(const typename pcl::KdTreeFLANN<Point
                 Eigen::Vector4d coeff(norm(0), norm(1), norm(2), negative_OA_dot_norm);
                 feature.idx_ = idx;
                 feature.point_ = Eigen::Vector3d{point_ori.x, point_ori.y, point_ori.z};
-                feature.coeffs_ = coeff;
+                feature.coeffs_ << coeff, 0, 0;
                 feature.laser_idx_ = (size_t)point_ori.intensity;
                 feature.type_ = 's';
                 return true;
@@ -0,0 +1,149 @@
+/*******************************************************
+ * Copyright (C) 2020, RAM-LAB, Hong Kong University of Science and Technology
+ *
+ * This file is part of M-LOAM (https://ram-lab.com/file/jjiao/m-loam).
+ * If you use this code, please cite the respective publications as
+ * listed on the above websites.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *
+ * Author: Jianhao JIAO (jiaojh1994@gmail.com)
+ *******************************************************/
+
+#pragma once
+
+#include <omp.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <vector>
+
+#include <eigen3/Eigen/Dense>
+
+#include "../estimator/parameters.h"
+
+#define MIN_PARALLEL_SELECT_SIZE 256
+#define SELECT_REFRESH_INTERVAL 64 // picks between two inversions of H, against the drift of the rank-one updates
+
+// lazy-greedy maximisation of logdet(H + sum J_i^T * J_i) over the features of one scan
+// gain of a feature: logdet(H + J^T * J) - logdet(H) = log(1 + J * H^-1 * J^T), H^-1 is kept with rank-one updates
+// logdet is submodular: a cached gain is an upper bound of the current one, a feature is only re-evaluated when it
+// reaches the top of the heap, and picked if its gain is still the best (ties: smallest index)
+// the matching and the first gains of all the features are computed in parallel
+// budget: max_evals re-evaluations (reproducible), or max_time (ms) if max_evals == 0 (depends on the load);
+// once it is spent the remaining picks follow the cached gains, so the number of selected features does not drop
+class GoodFeatureSelector
+{
+public:
+    GoodFeatureSelector(const size_t &max_evals, const double &max_time)
+        : max_evals_(max_evals), max_time_(max_time), num_evals_(0), early_termination_(false) {}
+
+    // match_func(idx, feature): correspondence and jacobian (feature.jaco_) of the idx-th point, false if not matched
+    // all_features: [out] all_features[idx] for the matched points, sel_feature_idx: [out] indices in the order of selection
+    // sub_mat_H: [in/out] information of the features selected before, positive definite
+    template <typename MatchFunc>
+    void select(const size_t &num_all_features,
+                const size_t &num_use_features,
+                const MatchFunc &match_func,
+                std::vector<PointPlaneFeature, Eigen::aligned_allocator<PointPlaneFeature> > &all_features,
+                std::vector<size_t> &sel_feature_idx,
+                Eigen::Matrix<double, 6, 6> &sub_mat_H)
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        all_features.resize(num_all_features);
+        sel_feature_idx.clear();
+        num_evals_ = 0;
+        early_termination_ = false;
+
+        Eigen::Matrix<double, 6, 6> inv_H = sub_mat_H.llt().solve(Eigen::Matrix<double, 6, 6>::Identity());
+        std::vector<char> matched(num_all_features, 0);
+        gains_.resize(num_all_features);
+        #pragma omp parallel for schedule(dynamic, 64) if (num_all_features >= MIN_PARALLEL_SELECT_SIZE && !omp_in_parallel())
+        for (size_t i = 0; i < num_all_features; i++)
+        {
+            if (!match_func(i, all_features[i])) continue;
+            matched[i] = 1;
+            gains_[i] = Gain(gain(inv_H, all_features[i].jaco_), i);
+        }
+
+        heap_.clear();
+        for (size_t i = 0; i < num_all_features; i++)
+            if (matched[i]) heap_.push_back(gains_[i]);
+        std::make_heap(heap_.begin(), heap_.end());
+
+        // the round of a gain: number of picks when it was computed
+        std::vector<size_t> round(num_all_features, 0);
+        while (!heap_.empty() && sel_feature_idx.size() < num_use_features)
+        {
+            std::pop_heap(heap_.begin(), heap_.end());
+            Gain top = heap_.back();
+            heap_.pop_back();
+            if (!early_termination_ && round[top.idx_] != sel_feature_idx.size())
+            {
+                early_termination_ = max_evals_ > 0 ? num_evals_ >= max_evals_ : elapsed(start) > max_time_;
+                if (!early_termination_)
+                {
+                    top.gain_ = gain(inv_H, all_features[top.idx_].jaco_);
+                    round[top.idx_] = sel_feature_idx.size();
+                    num_evals_++;
+                    // picked only if still the best, the gains left in the heap are upper bounds
+                    if (!heap_.empty() && top < heap_.front())
+                    {
+                        heap_.push_back(top);
+                        std::push_heap(heap_.begin(), heap_.end());
+                        continue;
+                    }
+                }
+            }
+
+            const Eigen::Matrix<double, 1, 6> &jaco = all_features[top.idx_].jaco_;
+            sub_mat_H += jaco.transpose() * jaco;
+            sel_feature_idx.push_back(top.idx_);
+            if (sel_feature_idx.size() % SELECT_REFRESH_INTERVAL == 0)
+            {
+                inv_H = sub_mat_H.llt().solve(Eigen::Matrix<double, 6, 6>::Identity());
+            }
+            else
+            {
+                Eigen::Matrix<double, 6, 1> v = inv_H * jaco.transpose();
+                inv_H -= v * v.transpose() / (1.0 + jaco.dot(v.transpose()));
+            }
+        }
+    }
+
+    size_t numEvals() const { return num_evals_; }
+    bool earlyTermination() const { return early_termination_; }
+
+private:
+    struct Gain
+    {
+        Gain() : gain_(0), idx_(0) {}
+        Gain(const double &gain, const size_t &idx) : gain_(gain), idx_(idx) {}
+        // priority: the larger gain, then the smaller index
+        bool operator < (const Gain &g) const
+        {
+            return (gain_ < g.gain_) || ((gain_ == g.gain_) && (idx_ > g.idx_));
+        }
+        double gain_;
+        size_t idx_;
+    };
+
+    static double gain(const Eigen::Matrix<double, 6, 6> &inv_H, const Eigen::Matrix<double, 1, 6> &jaco)
+    {
+        return std::log1p(std::max(0.0, (jaco * inv_H * jaco.transpose())(0)));
+    }
+
+    static double elapsed(const std::chrono::steady_clock::time_point &start)
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    size_t max_evals_;
+    double max_time_;
+    size_t num_evals_;
+    bool early_termination_;
+    std::vector<Gain> gains_, heap_;
+};
+
+//
@@ -0,0 +1,95 @@
+/*******************************************************
+ * Copyright (C) 2020, RAM-LAB, Hong Kong University of Science and Technology
+ *
+ * This file is part of M-LOAM (https://ram-lab.com/file/jjiao/m-loam).
+ * If you use this code, please cite the respective publications as
+ * listed on the above websites.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *
+ * Author: Jianhao JIAO (jiaojh1994@gmail.com)
+ *******************************************************/
+
+#pragma once
+
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "../estimator/parameters.h"
+
+// correspondences of the points of one scan against one map, reused across the solver iterations
+// an entry is indexed by the point index in the scan and tagged with the voxel of the transformed point:
+// the plane/line fit is only redone when the point moves to another voxel, or when the map/scan changes (reset)
+// entries of different points may be read and written by different threads
+class MatchCache
+{
+public:
+    MatchCache(const float &voxel_size = 0.1)
+        : voxel_size_(voxel_size), num_hit_(0), num_query_(0) {}
+
+    // call once the scan or the map changes
+    void reset(const size_t &cloud_size)
+    {
+        entries_.clear();
+        entries_.resize(cloud_size);
+        num_hit_.store(0);
+        num_query_.store(0);
+    }
+
+    // type: 's' or 'c', the kind of fit; return true if the result of the point is cached in the voxel of point_sel
+    template <typename PointType>
+    bool find(const size_t &idx, const PointType &point_sel, const char &type, bool &b_match, PointPlaneFeature &feature)
+    {
+        if (idx >= entries_.size()) return false;
+        num_query_.fetch_add(1, std::memory_order_relaxed);
+        const Entry &entry = entries_[idx];
+        if ((entry.type_ != type) || (entry.key_ != voxelKey(point_sel.x, point_sel.y, point_sel.z))) return false;
+        num_hit_.fetch_add(1, std::memory_order_relaxed);
+        b_match = entry.match_;
+        if (b_match) feature = entry.feature_;
+        return true;
+    }
+
+    template <typename PointType>
+    void insert(const size_t &idx, const PointType &point_sel, const char &type, const bool &b_match, const PointPlaneFeature &feature)
+    {
+        if (idx >= entries_.size()) return;
+        Entry &entry = entries_[idx];
+        entry.key_ = voxelKey(point_sel.x, point_sel.y, point_sel.z);
+        entry.type_ = type;
+        entry.match_ = b_match;
+        if (b_match) entry.feature_ = feature;
+    }
+
+    size_t numHit() const { return num_hit_.load(); }
+    size_t numQuery() const { return num_query_.load(); }
+
+private:
+    struct Entry
+    {
+        Entry() : key_(0), type_('n'), match_(false) {}
+        uint64_t key_;
+        char type_; // 'n': empty
+        bool match_;
+        PointPlaneFeature feature_;
+    };
+
+    // 21 bits per axis
+    uint64_t voxelKey(const float &x, const float &y, const float &z) const
+    {
+        const int64_t offset = 1 << 20;
+        uint64_t ix = static_cast<uint64_t>(static_cast<int64_t>(std::floor(x / voxel_size_)) + offset) & 0x1FFFFF;
+        uint64_t iy = static_cast<uint64_t>(static_cast<int64_t>(std::floor(y / voxel_size_)) + offset) & 0x1FFFFF;
+        uint64_t iz = static_cast<uint64_t>(static_cast<int64_t>(std::floor(z / voxel_size_)) + offset) & 0x1FFFFF;
+        return (ix << 42) | (iy << 21) | iz;
+    }
+
+    float voxel_size_;
+    std::vector<Entry> entries_;
+    std::atomic<size_t> num_hit_, num_query_;
+};
+
+//
@@ -60,6 +60,246 @@ void ImageSegmenter::setParameter(const int &vertical_scans,
     }
     printf("[ImageSegmenter param] v_scans:%d, h_scans:%d, c_size:%d\n", 
         vertical_scans, horizon_scans_, min_cluster_size_);
+
+    // allocate the workspace once
+    const size_t num_pixel = vertical_scans_ * horizon_scans_;
+    range_img_.resize(num_pixel);
+    label_img_.resize(num_pixel);
+    point_ind_img_.resize(num_pixel);
+    row_pixel_ind_.resize(vertical_scans_);
+    for (auto &row : row_pixel_ind_) row.reserve(horizon_scans_);
+
+    queue_indx_.resize(num_pixel);
+    queue_indy_.resize(num_pixel);
+    queue_indx_last_negi_.resize(num_pixel);
+    queue_indy_last_negi_.resize(num_pixel);
+    queue_last_dis_.resize(num_pixel);
+    all_pushed_indx_.resize(num_pixel);
+    all_pushed_indy_.resize(num_pixel);
+    line_count_flag_.resize(vertical_scans_);
+
+    if (SEGMENT_METHOD == 1)
+    {
+        uf_parent_.resize(num_pixel);
+        uf_size_.resize(num_pixel);
+        uf_line_count_.resize(num_pixel);
+        uf_last_row_.resize(num_pixel);
+        uf_label_.resize(num_pixel);
+    }
+}
+
+// BFS from each unlabeled pixel to search the neighbors of the same cluster
+void ImageSegmenter::labelClusterBFS()
+{
+    // entries behind the queue tail are also read, start from zeros as a newly allocated buffer
+    std::fill(queue_indy_last_negi_.begin(), queue_indy_last_negi_.end(), 0);
+    std::fill(queue_last_dis_.begin(), queue_last_dis_.end(), 0);
+
+    uint16_t label_count = LABEL_GROUND + 1;
+    for (size_t i = 0; i < vertical_scans_; i++)
+    {
+        for (size_t j = 0; j < horizon_scans_; j++)
+        {
+            if (label_img_[j + i * horizon_scans_] == LABEL_NONE) //非地面点
+            {
+                int row = i;
+                int col = j;
+
+                float d1, d2, alpha, angle, dist;
+                int from_indx, from_indy, this_indx, this_indy;
+                std::fill(line_count_flag_.begin(), line_count_flag_.end(), 0);
+
+                queue_indx_[0] = row;
+                queue_indy_[0] = col;
+                queue_indx_last_negi_[0] = 0;
+                queue_indy_last_negi_[0] = 0;
+                queue_last_dis_[0] = 0;
+                int queue_size = 1;
+                int queue_start_ind = 0;
+                int queue_end_ind = 1;
+
+                all_pushed_indx_[0] = row;
+                all_pushed_indy_[0] = col;
+                int all_pushed_ind_size = 1;
+
+                // find the neighbor connecting clusters in range image, bfs
+                while (queue_size > 0)
+                {
+                    from_indx = queue_indx_[queue_start_ind];
+                    from_indy = queue_indy_[queue_start_ind];
+                    --queue_size;
+                    ++queue_start_ind;
+                    const float from_range = range_img_[from_indy + from_indx * horizon_scans_];
+                    label_img_[from_indy + from_indx * horizon_scans_] = label_count;
+                    for (auto iter = neighbor_iterator_.begin(); iter != neighbor_iterator_.end(); ++iter)
+                    {
+                        this_indx = from_indx + iter->first;
+                        this_indy = from_indy + iter->second;
+                        if (this_indx < 0 || this_indx >= vertical_scans_)
+                            continue;
+                        if (this_indy < 0)
+                            this_indy = horizon_scans_ - 1;
+                        if (this_indy >= horizon_scans_)
+                            this_indy = 0;
+                        const int this_ind = this_indy + this_indx * horizon_scans_;
+                        if (label_img_[this_ind] != LABEL_NONE)
+                            continue;
+
+                        d1 = std::max(from_range, range_img_[this_ind]);
+                        d2 = std::min(from_range, range_img_[this_ind]);
+                        alpha = iter->first == 0 ? segment_alphax_ : alphaY(this_indx);
+                        dist = sqrt(d1 * d1 + d2 * d2 - 2 * d1 * d2 * cos(alpha));
+                        angle = atan2(d2 * sin(alpha), (d1 - d2 * cos(alpha)));
+                        bool connected = false;
+                        if (angle > SEGMENT_THETA)
+                        {
+                            connected = true;
+                        }
+                        else if ((iter->second == 0) && (queue_indy_last_negi_[queue_start_ind] == 0)) // at the same beam
+                        {
+                            float dist_last = queue_last_dis_[queue_start_ind];
+                            if ((dist_last / dist <= 1.2) && ((dist_last / dist >= 0.8))) // inside a plane
+                                connected = true;
+                        }
+
+                        if (connected)
+                        {
+                            queue_indx_[queue_end_ind] = this_indx;
+                            queue_indy_[queue_end_ind] = this_indy;
+                            queue_indx_last_negi_[queue_end_ind] = iter->first;
+                            queue_indy_last_negi_[queue_end_ind] = iter->second;
+                            queue_last_dis_[queue_end_ind] = dist;
+                            queue_size++;
+                            queue_end_ind++;
+
+                            label_img_[this_ind] = label_count;
+                            line_count_flag_[this_indx] = 1;
+
+                            all_pushed_indx_[all_pushed_ind_size] = this_indx;
+                            all_pushed_indy_[all_pushed_ind_size] = this_indy;
+                            all_pushed_ind_size++;
+                        }
+                    }
+                }
+
+                bool feasible_segment = false;
+                if (all_pushed_ind_size >= min_cluster_size_) // cluster_size > min_cluster_size_
+                {
+                    feasible_segment = true;
+                }
+                else if (all_pushed_ind_size >= segment_valid_point_num_) // line_size > line_mini_size
+                {
+                    int line_count = 0;
+                    for (size_t k = 0; k < vertical_scans_; k++)
+                        if (line_count_flag_[k])
+                            line_count++;
+
+                    if (line_count >= segment_valid_line_num_)
+                        feasible_segment = true;
+                }
+
+                if (feasible_segment)
+                {
+                    if (label_count < LABEL_CLUSTER_MAX) label_count++;
+                }
+                else
+                {
+                    for (size_t k = 0; k < all_pushed_ind_size; ++k)
+                    {
+                        label_img_[all_pushed_indy_[k] + all_pushed_indx_[k] * horizon_scans_] = LABEL_OUTLIER;
+                    }
+                }
+            }
+        }
+    }
+}
+
+int ImageSegmenter::findRoot(int ind)
+{
+    while (uf_parent_[ind] != ind)
+    {
+        uf_parent_[ind] = uf_parent_[uf_parent_[ind]]; // path halving
+        ind = uf_parent_[ind];
+    }
+    return ind;
+}
+
+// connected-component labelling with union-find: one row-major pass joins each pixel with its right and upper neighbors,
+// a second pass counts the size and lines of each cluster. Unlike the BFS, the same-beam plane rule is not applied
+void ImageSegmenter::labelClusterUnionFind()
+{
+    const int num_pixel = vertical_scans_ * horizon_scans_;
+    for (int k = 0; k < num_pixel; k++)
+    {
+        uf_parent_[k] = k;
+        uf_size_[k] = 1;
+        uf_line_count_[k] = 0;
+        uf_last_row_[k] = -1;
+        uf_label_[k] = LABEL_NONE;
+    }
+
+    auto connect = [&](const int &ind_a, const int &ind_b, const float &alpha) {
+        if (label_img_[ind_b] != LABEL_NONE) return;
+        float d1 = std::max(range_img_[ind_a], range_img_[ind_b]);
+        float d2 = std::min(range_img_[ind_a], range_img_[ind_b]);
+        float angle = atan2(d2 * sin(alpha), (d1 - d2 * cos(alpha)));
+        if (angle <= SEGMENT_THETA) return;
+        int root_a = findRoot(ind_a);
+        int root_b = findRoot(ind_b);
+        if (root_a == root_b) return;
+        if (uf_size_[root_a] < uf_size_[root_b]) std::swap(root_a, root_b);
+        uf_parent_[root_b] = root_a;
+        uf_size_[root_a] += uf_size_[root_b];
+    };
+
+    for (int i = 0; i < vertical_scans_; i++)
+    {
+        for (int j = 0; j < horizon_scans_; j++)
+        {
+            int ind = j + i * horizon_scans_;
+            if (label_img_[ind] != LABEL_NONE) continue;
+            connect(ind, (j + 1 == horizon_scans_ ? 0 : j + 1) + i * horizon_scans_, segment_alphax_);
+            if (i + 1 < vertical_scans_) connect(ind, j + (i + 1) * horizon_scans_, alphaY(i + 1));
+        }
+    }
+
+    // rows are visited in order, so a cluster enters a new line when its last row changes
+    for (int i = 0; i < vertical_scans_; i++)
+    {
+        for (int j = 0; j < horizon_scans_; j++)
+        {
+            int ind = j + i * horizon_scans_;
+            if (label_img_[ind] != LABEL_NONE) continue;
+            int root = findRoot(ind);
+            if (uf_last_row_[root] != i)
+            {
+                uf_last_row_[root] = i;
+                uf_line_count_[root]++;
+            }
+        }
+    }
+
+    uint16_t label_count = LABEL_GROUND + 1;
+    for (int ind = 0; ind < num_pixel; ind++)
+    {
+        if (label_img_[ind] != LABEL_NONE) continue;
+        int root = findRoot(ind);
+        if (uf_label_[root] == LABEL_NONE)
+        {
+            bool feasible_segment = (uf_size_[root] >= min_cluster_size_) ||
+                                    ((uf_size_[root] >= segment_valid_point_num_) && (uf_line_count_[root] >= segment_valid_line_num_));
+            if (feasible_segment)
+            {
+                uf_label_[root] = label_count;
+                if (label_count < LABEL_CLUSTER_MAX) label_count++;
+            }
+            else
+            {
+                uf_label_[root] = LABEL_OUTLIER;
+            }
+        }
+        label_img_[ind] = uf_label_[root];
+    }
 }
 
 // VLP-16
@@ -21,6 +21,8 @@
 #include <cmath>
 #include <cfloat>
 #include <map>
+#include <vector>
+#include <cstdint>
 
 #include <eigen3/Eigen/Dense>
 
@@ -36,6 +38,16 @@
 class ImageSegmenter
 {
 public:
+    // labels of the range image, 16 bits per pixel
+    enum SegmentLabel : uint16_t
+    {
+        LABEL_NONE = 0,          // not labeled yet
+        LABEL_GROUND = 1,
+        LABEL_CLUSTER_MAX = 0xFFFC, // cluster ids saturate here, only ground/cluster/outlier matter afterwards
+        LABEL_OUTLIER = 0xFFFE,  // belongs to a cluster which is too small
+        LABEL_INVALID = 0xFFFF   // no point projected
+    };
+
     ImageSegmenter()
     {
         // printf("%d, %d, %d, %d\n", min_cluster_size_, min_line_size_, segment_valid_point_num_, segment_valid_line_num_);
@@ -61,11 +73,7 @@ public:
                       const int &segment_valid_line_num);
 
     template <typename PointType>
-    void projectCloud(const typename pcl::PointCloud<PointType> &laser_cloud_in,
-                      typename pcl::PointCloud<PointType> &cloud_matrix,
-                      Eigen::MatrixXf &range_mat,
-                      std::vector<pcl::PointCloud<PointType>> &cloud_scan,
-                      std::vector<int> &cloud_scan_order);
+    void projectCloud(const typename pcl::PointCloud<PointType> &laser_cloud_in);
 
     template <typename PointType>
     void segmentCloud(const typename pcl::PointCloud<PointType> &laser_cloud_in,
@@ -74,29 +82,61 @@ public:
                       ScanInfo &scan_info);
 
 private:
+    // the vertical angle resolution of VLP-64 differs between the upper and lower block
+    inline float alphaY(const int &row_id) const
+    {
+        if ((vertical_scans_ == 64) && (ang_res_y_ == FLT_MAX))
+            return (row_id <= 32) ? 0.333 / 180.0 * M_PI : 0.5 / 180.0 * M_PI;
+        return segment_alphay_;
+    }
+
+    template <typename PointType>
+    void labelGround(const typename pcl::PointCloud<PointType> &laser_cloud_in);
+
+    void labelClusterBFS();
+    void labelClusterUnionFind();
+    int findRoot(int ind);
+
     int vertical_scans_, horizon_scans_;
     int ground_scan_id_;
     int min_cluster_size_, segment_valid_point_num_, segment_valid_line_num_;
     float ang_res_x_, ang_res_y_, ang_bottom_;
     float segment_alphax_, segment_alphay_;
     std::vector<pair<int8_t, int8_t> > neighbor_iterator_;
+
+    // workspace of segmentCloud, allocated in setParameter and reused for every frame
+    // the images are row-major: index = column_id + row_id * horizon_scans_
+    std::vector<float> range_img_; // FLT_MAX: no point
+    std::vector<uint16_t> label_img_;
+    std::vector<int> point_ind_img_; // index in laser_cloud_in of the point projected to each pixel
+    std::vector<std::vector<int> > row_pixel_ind_; // pixels of each row, in the order of laser_cloud_in
+
+    // BFS queues
+    std::vector<uint16_t> queue_indx_, queue_indy_;
+    std::vector<int8_t> queue_indx_last_negi_, queue_indy_last_negi_;
+    std::vector<float> queue_last_dis_;
+    std::vector<uint16_t> all_pushed_indx_, all_pushed_indy_;
+    std::vector<uint8_t> line_count_flag_;
+
+    // union-find forest over pixels
+    std::vector<int> uf_parent_, uf_size_, uf_line_count_, uf_last_row_;
+    std::vector<uint16_t> uf_label_;
 };
 
 // TODO: this part rearrange the point order, which will influence the feature extraction
 // project point cloud onto a range image and rearrange the order
 template <typename PointType>
-void ImageSegmenter::projectCloud(const typename pcl::PointCloud<PointType> &laser_cloud_in,
-                                  typename pcl::PointCloud<PointType> &cloud_matrix,
-                                  Eigen::MatrixXf &range_mat,
-                                  std::vector<pcl::PointCloud<PointType>> &cloud_scan,
-                                  std::vector<int> &cloud_scan_order) 
+void ImageSegmenter::projectCloud(const typename pcl::PointCloud<PointType> &laser_cloud_in) 
 {
+    std::fill(range_img_.begin(), range_img_.end(), FLT_MAX);
+    for (auto &row : row_pixel_ind_) row.clear();
+
     // convert point cloud to a range image
     float vertical_angle, horizon_angle, range;
     int row_id, column_id; //row_id: 线号；row_id=0最低下线束scan，row_id=15最上面线束scan
     for (size_t i = 0; i < laser_cloud_in.size(); i++)
     {
-        PointType point = laser_cloud_in.points[i];
+        const PointType &point = laser_cloud_in.points[i];
         range = sqrt(point.x * point.x + point.y * point.y + point.z * point.z);
         if (range < ROI_RANGE) continue;
 
@@ -125,260 +165,78 @@ void ImageSegmenter::projectCloud(const typename pcl::PointCloud<PointType> &las
             column_id -= horizon_scans_;
         if (column_id < 0 || column_id >= horizon_scans_)
             continue;
-        if (range_mat(row_id, column_id) != FLT_MAX)
-            continue;
-
-        point.intensity += row_id;
         int index = column_id + row_id * horizon_scans_;
-        cloud_matrix.points[index] = point;
-        range_mat(row_id, column_id) = range;
+        if (range_img_[index] != FLT_MAX)
+            continue;
 
-        cloud_scan[row_id].push_back(point); // without changing the point order，依次存放的是前左后右逆时针顺序points
-        cloud_scan_order[index] = cloud_scan[row_id].size() - 1; //点在对应线中的index, 依次按照前左后右逆时针顺序，index从0开始
+        range_img_[index] = range;
+        point_ind_img_[index] = i;
+        row_pixel_ind_[row_id].push_back(index); // without changing the point order，依次存放的是前左后右逆时针顺序points
     }
 }
 
+// label the ground points by the slope between vertically adjacent pixels
 template <typename PointType>
-void ImageSegmenter::segmentCloud(const typename pcl::PointCloud<PointType> &laser_cloud_in,
-                                  typename pcl::PointCloud<PointType> &laser_cloud_out, //[out]
-                                  typename pcl::PointCloud<PointType> &laser_cloud_outlier, //[out]
-                                  ScanInfo &scan_info)
+void ImageSegmenter::labelGround(const typename pcl::PointCloud<PointType> &laser_cloud_in)
 {
-    // set specific parameters
-    Eigen::MatrixXf range_mat = Eigen::MatrixXf::Constant(vertical_scans_, horizon_scans_, FLT_MAX); //16*1800
-    Eigen::MatrixXi label_mat = Eigen::MatrixXi::Zero(vertical_scans_, horizon_scans_);
-
-    pcl::PointCloud<PointType> cloud_matrix;
-    cloud_matrix.resize(vertical_scans_ * horizon_scans_);
-    std::vector<pcl::PointCloud<PointType>> cloud_scan(vertical_scans_);
-    std::vector<int> cloud_scan_order(vertical_scans_ * horizon_scans_);
-    projectCloud(laser_cloud_in, cloud_matrix, range_mat, cloud_scan, cloud_scan_order);
-
-    std::vector<uint16_t> all_pushed_indx(vertical_scans_ * horizon_scans_);
-    std::vector<uint16_t> all_pushed_indy(vertical_scans_ * horizon_scans_);
-
-    std::vector<uint16_t> queue_indx(vertical_scans_ * horizon_scans_);
-    std::vector<uint16_t> queue_indy(vertical_scans_ * horizon_scans_);
-
-    std::vector<int> queue_indx_last_negi(vertical_scans_ * horizon_scans_);
-    std::vector<int> queue_indy_last_negi(vertical_scans_ * horizon_scans_);
-    std::vector<float> queue_last_dis(vertical_scans_ * horizon_scans_);
-
-    // remote FLT_MAX points
-    for (size_t i = 0; i < vertical_scans_; i++)
-        for (size_t j = 0; j < horizon_scans_; j++)
-            if (range_mat(i, j) == FLT_MAX) 
-                label_mat(i, j) = -1; //无效点：-1
-
-    // label ground points
-    int label_count = 1;
-    size_t lower_ind, upper_ind;
+    size_t start_row = (vertical_scans_ == 64) ? ground_scan_id_ : 0;
+    size_t end_row = (vertical_scans_ == 64) ? vertical_scans_ - 1 : ground_scan_id_; // row end_row + 1 is also accessed
     float vertical_angle;
     float diff_x, diff_y, diff_z;
-
-    if (vertical_scans_ == 64)
+    for (size_t i = start_row; i < end_row; i++)
     {
-        for (size_t i = ground_scan_id_; i < vertical_scans_; i++)
-        {
-            for (size_t j = 0; j < horizon_scans_; j++)
-            {
-                if (range_mat(i, j) == FLT_MAX || range_mat(i + 1, j) == FLT_MAX)
-                    continue;
-                lower_ind = j + i * horizon_scans_;
-                upper_ind = j + (i + 1) * horizon_scans_;
-                const PointType &point1 = cloud_matrix.points[lower_ind];
-                const PointType &point2 = cloud_matrix.points[upper_ind];
-                diff_x = point1.x - point2.x;
-                diff_y = point1.y - point2.y;
-                diff_z = point1.z - point2.z;
-                vertical_angle = atan2(diff_z, sqrt(diff_x * diff_x + diff_y * diff_y)) * 180 / M_PI;
-                if (abs(vertical_angle) <= 10) // 10deg
-                {
-                    label_mat(i, j) = label_count;
-                    label_mat(i + 1, j) = label_count;
-                }
-            }
-        }
-    } 
-    else
-    {
-        for (size_t i = 0; i < ground_scan_id_; i++)
+        for (size_t j = 0; j < horizon_scans_; j++)
         {
-            for (size_t j = 0; j < horizon_scans_; j++)
+            size_t lower_ind = j + i * horizon_scans_;
+            size_t upper_ind = j + (i + 1) * horizon_scans_;
+            if (range_img_[lower_ind] == FLT_MAX || range_img_[upper_ind] == FLT_MAX)
+                continue;
+            const PointType &point1 = laser_cloud_in.points[point_ind_img_[lower_ind]];
+            const PointType &point2 = laser_cloud_in.points[point_ind_img_[upper_ind]];
+            diff_x = point1.x - point2.x;
+            diff_y = point1.y - point2.y;
+            diff_z = point1.z - point2.z;
+            vertical_angle = atan2(diff_z, sqrt(diff_x * diff_x + diff_y * diff_y)) * 180 / M_PI;
+            if (abs(vertical_angle) <= 10) // 10deg
             {
-                if (range_mat(i, j) == FLT_MAX || range_mat(i + 1, j) == FLT_MAX)
-                    continue;
-                lower_ind = j + i * horizon_scans_;
-                upper_ind = j + (i + 1) * horizon_scans_;
-                const PointType &point1 = cloud_matrix.points[lower_ind];
-                const PointType &point2 = cloud_matrix.points[upper_ind];
-                diff_x = point1.x - point2.x;
-                diff_y = point1.y - point2.y;
-                diff_z = point1.z - point2.z;
-                vertical_angle = atan2(diff_z, sqrt(diff_x * diff_x + diff_y * diff_y)) * 180 / M_PI;
-                if (abs(vertical_angle) <= 10) // 10deg
-                {
-                    label_mat(i, j) = label_count; //地面点是：1
-                    label_mat(i+1, j) = label_count;
-                }
+                label_img_[lower_ind] = LABEL_GROUND; //地面点是：1
+                label_img_[upper_ind] = LABEL_GROUND;
             }
         }
     }
-    label_count++;
-
-    // BFS to search nearest neighbors
-    for (size_t i = 0; i < vertical_scans_; i++)
-    {
-        for (size_t j = 0; j < horizon_scans_; j++)
-        {
-            if (label_mat(i, j) == 0)//非地面点
-            {
-                int row = i;
-                int col = j;
-
-                float d1, d2, alpha, angle, dist;
-                int from_indx, from_indy, this_indx, this_indy;
-                bool line_count_flag[vertical_scans_] = {false};
-
-                queue_indx[0] = row;
-                queue_indy[0] = col;
-                queue_indx_last_negi[0] = 0;
-                queue_indy_last_negi[0] = 0;
-                queue_last_dis[0] = 0;
-                int queue_size = 1;
-                int queue_start_ind = 0;
-                int queue_end_ind = 1;
-
-                all_pushed_indx[0] = row;
-                all_pushed_indy[0] = col;
-                int all_pushed_ind_size = 1;
-
-                // find the neighbor connecting clusters in range image, bfs
-                while (queue_size > 0)
-                {
-                    from_indx = queue_indx[queue_start_ind];
-                    from_indy = queue_indy[queue_start_ind];
-                    --queue_size;
-                    ++queue_start_ind;
-                    label_mat(from_indx, from_indy) = label_count;
-                    for (auto iter = neighbor_iterator_.begin(); iter != neighbor_iterator_.end(); ++iter)
-                    {
-                        this_indx = from_indx + iter->first;
-                        this_indy = from_indy + iter->second;
-                        if (this_indx < 0 || this_indx >= vertical_scans_)
-                            continue;
-                        if ((vertical_scans_ == 64) && (ang_res_y_ == FLT_MAX))
-                        {
-                            if (this_indx <= 32)
-                                segment_alphay_ = 0.333 / 180.0 * M_PI;
-                            else
-                                segment_alphay_ = 0.5 / 180.0 * M_PI;
-                        }
-                        if (this_indy < 0)
-                            this_indy = horizon_scans_ - 1;
-                        if (this_indy >= horizon_scans_)
-                            this_indy = 0;
-                        if (label_mat(this_indx, this_indy) != 0)
-                            continue;
-
-                        d1 = std::max(range_mat(from_indx, from_indy),
-                                    range_mat(this_indx, this_indy));
-                        d2 = std::min(range_mat(from_indx, from_indy),
-                                    range_mat(this_indx, this_indy));
-                        dist = sqrt(d1 * d1 + d2 * d2 - 2 * d1 * d2 * cos(alpha));
-                        alpha = iter->first == 0 ? segment_alphax_ : segment_alphay_;
-                        angle = atan2(d2 * sin(alpha), (d1 - d2 * cos(alpha)));
-                        if (angle > SEGMENT_THETA)
-                        {
-                            queue_indx[queue_end_ind] = this_indx;
-                            queue_indy[queue_end_ind] = this_indy;
-                            queue_indx_last_negi[queue_end_ind] = iter->first;
-                            queue_indy_last_negi[queue_end_ind] = iter->second;
-                            queue_last_dis[queue_end_ind] = dist;
-                            queue_size++;
-                            queue_end_ind++;
-
-                            label_mat(this_indx, this_indy) = label_count;
-                            line_count_flag[this_indx] = true;
-
-                            all_pushed_indx[all_pushed_ind_size] = this_indx;
-                            all_pushed_indy[all_pushed_ind_size] = this_indy;
-                            all_pushed_ind_size++;
-                        }
-                        else if ((iter->second == 0) && (queue_indy_last_negi[queue_start_ind] == 0)) // at the same beam
-                        {
-                            float dist_last = queue_last_dis[queue_start_ind];
-                            if ((dist_last / dist <= 1.2) && ((dist_last / dist >= 0.8))) // inside a plane
-                            {
-                                queue_indx[queue_end_ind] = this_indx;
-                                queue_indy[queue_end_ind] = this_indy;
-                                queue_indx_last_negi[queue_end_ind] = iter->first;
-                                queue_indy_last_negi[queue_end_ind] = iter->second;
-                                queue_last_dis[queue_end_ind] = dist;
-                                queue_size++;
-                                queue_end_ind++;
-
-                                label_mat(this_indx, this_indy) = label_count;
-                                line_count_flag[this_indx] = true;
+}
 
-                                all_pushed_indx[all_pushed_ind_size] = this_indx;
-                                all_pushed_indy[all_pushed_ind_size] = this_indy;
-                                all_pushed_ind_size++;
-                            }
-                        }
-                    }
-                }
+template <typename PointType>
+void ImageSegmenter::segmentCloud(const typename pcl::PointCloud<PointType> &laser_cloud_in,
+                                  typename pcl::PointCloud<PointType> &laser_cloud_out, //[out]
+                                  typename pcl::PointCloud<PointType> &laser_cloud_outlier, //[out]
+                                  ScanInfo &scan_info)
+{
+    projectCloud(laser_cloud_in);
 
-                bool feasible_segment = false;
-                if (all_pushed_ind_size >= min_cluster_size_) // cluster_size > min_cluster_size_
-                {
-                    feasible_segment = true;
-                }
-                else if (all_pushed_ind_size >= segment_valid_point_num_) // line_size > line_mini_size
-                {
-                    int line_count = 0;
-                    for (size_t i = 0; i < vertical_scans_; i++)
-                        if (line_count_flag[i])
-                            line_count++;
+    // remote FLT_MAX points
+    for (size_t i = 0; i < range_img_.size(); i++)
+        label_img_[i] = (range_img_[i] == FLT_MAX) ? LABEL_INVALID : LABEL_NONE; //无效点
 
-                    if (line_count >= segment_valid_line_num_)
-                        feasible_segment = true;
-                }
+    labelGround(laser_cloud_in);
 
-                if (feasible_segment)
-                {
-                    label_count++;
-                }
-                else
-                {
-                    for (size_t i = 0; i < all_pushed_ind_size; ++i)
-                    {
-                        label_mat(all_pushed_indx[i], all_pushed_indy[i]) = 999999;
-                    }
-                }
-            }
-        }
-    }
+    if (SEGMENT_METHOD == 1)
+        labelClusterUnionFind();
+    else
+        labelClusterBFS();
 
     // filter out outliers from the original point cloud
     laser_cloud_out.clear();
     laser_cloud_outlier.clear();
     if (scan_info.segment_flag_)
     {
-        for (size_t i = 0; i < vertical_scans_; i++)
+        for (size_t index = 0; index < label_img_.size(); index++)
         {
-            for (size_t j = 0; j < horizon_scans_; j++)
+            if ((label_img_[index] == LABEL_OUTLIER) && ((index % horizon_scans_) % 5 == 0)) //每隔5个点存
             {
-                if (label_mat(i, j) > 0) // if non-empty points
-                {
-                    int index = j + i * horizon_scans_;
-                    if (label_mat(i, j) == 999999)
-                    {
-                        cloud_scan[i].erase(cloud_scan[i].begin() + cloud_scan_order[index]); //移除没有聚类的点
-                        if (j % 5 == 0) //每隔5个点存
-                            laser_cloud_outlier.push_back(cloud_matrix.points[index]);
-                    }
-                }
+                PointType point = laser_cloud_in.points[point_ind_img_[index]];
+                point.intensity += index / horizon_scans_;
+                laser_cloud_outlier.push_back(point);
             }
         }
     } 
@@ -386,7 +244,13 @@ void ImageSegmenter::segmentCloud(const typename pcl::PointCloud<PointType> &las
     for (size_t i = 0; i < vertical_scans_; i++)
     {
         scan_info.scan_start_ind_[i] = laser_cloud_out.size() + 5;
-        laser_cloud_out += cloud_scan[i];
+        for (const int &index : row_pixel_ind_[i])
+        {
+            if (scan_info.segment_flag_ && (label_img_[index] == LABEL_OUTLIER)) continue; //移除没有聚类的点
+            PointType point = laser_cloud_in.points[point_ind_img_[index]];
+            point.intensity += i;
+            laser_cloud_out.push_back(point);
+        }
         scan_info.scan_end_ind_[i] = laser_cloud_out.size() - 6;
         // std::cout << i << " " << scan_info.scan_start_ind_[i] << " " << scan_info.scan_end_ind_[i] << std::endl;
     }
@@ -394,4 +258,3 @@ void ImageSegmenter::segmentCloud(const typename pcl::PointCloud<PointType> &las
     // std::cout << laser_cloud_out.size() << std::endl;
 
 }
-
@@ -220,5 +220,41 @@ inline void evalPointUncertainty(const PointType &pi,
     cov_point = Eigen::Matrix4d(G * cov_input * G.transpose()).topLeftCorner<3, 3>(); // 3x3
 }
 
+// the terms of evalPointUncertainty(pi, cov_point, pose) which only depend on the pose, computed once per pose
+// with S = -[T * pi]x and the pose covariance [A, B; B^T, D]:
+// cov_point = A + B * S^T + S * B^T + S * D * S^T + R * COV_MEASUREMENT * R^T
+struct PointUncertaintyTerms
+{
+    explicit PointUncertaintyTerms(const Pose &pose)
+    {
+        R_ = pose.T_.topLeftCorner<3, 3>();
+        t_ = pose.T_.topRightCorner<3, 1>();
+        K_ = pose.cov_.topLeftCorner<3, 3>() + R_ * COV_MEASUREMENT * R_.transpose();
+        B_ = pose.cov_.topRightCorner<3, 3>();
+        D_ = pose.cov_.bottomRightCorner<3, 3>();
+    }
+
+    // p_map: the point already transformed by the pose (T * pi)
+    inline void evalTransformed(const Eigen::Vector3d &p_map, Eigen::Matrix3d &cov_point) const
+    {
+        const Eigen::Matrix3d S = -Utility::skewSymmetric(p_map);
+        const Eigen::Matrix3d BS = B_ * S.transpose();
+        cov_point.noalias() = S * D_ * S.transpose();
+        cov_point += K_ + BS + BS.transpose();
+    }
+
+    Eigen::Matrix3d R_;
+    Eigen::Vector3d t_;
+    Eigen::Matrix3d K_, B_, D_;
+};
+
+template <typename PointType>
+inline void evalPointUncertainty(const PointType &pi,
+                                 Eigen::Matrix3d &cov_point,
+                                 const PointUncertaintyTerms &terms)
+{
+    terms.evalTransformed(terms.R_ * Eigen::Vector3d(pi.x, pi.y, pi.z) + terms.t_, cov_point);
+}
+
 
 
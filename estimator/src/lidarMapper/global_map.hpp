@@ -0,0 +1,261 @@
+/*******************************************************
+ * Copyright (C) 2020, RAM-LAB, Hong Kong University of Science and Technology
+ *
+ * This file is part of M-LOAM (https://ram-lab.com/file/jjiao/m-loam).
+ * If you use this code, please cite the respective publications as
+ * listed on the above websites.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *
+ * Author: Jianhao JIAO (jiaojh1994@gmail.com)
+ *******************************************************/
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "common/types/type.h"
+#include "mloam_pcl/point_with_cov.hpp"
+#include "voxel_map_cov.hpp"
+
+// global map published by the mapper, built incrementally instead of being filtered again at each publication
+// the mapping thread only queues the keyframes: the first keyframe of each kf_res cell, the others are skipped
+// (as the downsampling of the keyframe positions before the global filter);
+// the map thread merges the queued keyframes under a time budget into tiles of tile_size,
+// each tile is a VoxelMapCov with leaf_size voxels, the tiles are aligned on the voxels
+// the tiles changed and the tiles released since the last getDelta form the delta of the map, keyed by the tile index:
+// a subscriber keeps the map up to date by replacing the changed tiles and dropping the released ones
+// the tiles farther than evict_radius (+ one tile, against thrashing) from the last keyframe are released, and rebuilt
+// from their keyframes (in the order they were merged) when they come back within evict_radius
+class GlobalMapBuilder
+{
+public:
+    // kf_cloud: the keyframe cloud in the world frame, evaluated on the map thread, again when a tile is rebuilt
+    typedef std::function<common::PointICovCloud::ConstPtr()> KeyframeCloudFunc;
+    // tile (x, y, z) covers [x, x + 1) * tileSize() along x, the same along y and z
+    typedef std::tuple<int64_t, int64_t, int64_t> TileKey;
+    typedef std::vector<std::pair<TileKey, common::PointICovCloud::ConstPtr> > TileClouds;
+
+    GlobalMapBuilder() : leaf_size_(0.4), tile_voxels_(50), kf_res_(10.0), trace_threshold_(10.0), evict_radius_(0), revision_(0) {}
+
+    // evict_radius: 0 keeps all the tiles
+    void setParameters(const float &leaf_size, const float &tile_size, const float &kf_res, const float &trace_threshold,
+                       const float &evict_radius = 0)
+    {
+        leaf_size_ = leaf_size;
+        tile_voxels_ = std::max(1, static_cast<int>(std::round(tile_size / leaf_size)));
+        kf_res_ = kf_res;
+        trace_threshold_ = trace_threshold;
+        evict_radius_ = evict_radius;
+    }
+
+    // mapping thread, called for every keyframe, false if the cell of the keyframe already has one
+    bool addKeyframe(const common::PointI &position, const KeyframeCloudFunc &kf_cloud)
+    {
+        std::tuple<int, int, int> cell(static_cast<int>(std::floor(position.x / kf_res_)),
+                                       static_cast<int>(std::floor(position.y / kf_res_)),
+                                       static_cast<int>(std::floor(position.z / kf_res_)));
+        std::lock_guard<std::mutex> lock(m_queue_);
+        last_position_ = position;
+        if (!keyframe_cells_.insert(cell).second) return false;
+        queue_.push_back(kf_cloud);
+        return true;
+    }
+
+    common::PointI lastKeyframePosition()
+    {
+        std::lock_guard<std::mutex> lock(m_queue_);
+        return last_position_;
+    }
+
+    size_t numQueued()
+    {
+        std::lock_guard<std::mutex> lock(m_queue_);
+        return queue_.size();
+    }
+
+    // map thread: rebuild the tiles back in range, then merge the queued keyframes, until time_budget (ms) is spent,
+    // return the time spent (ms)
+    double update(const double &time_budget)
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        if (restore_keyframes_.empty()) evictTiles(lastKeyframePosition());
+        double elapsed = 0;
+        while (elapsed < time_budget)
+        {
+            if (!restore_keyframes_.empty())
+            {
+                size_t kf_ind = restore_keyframes_.front();
+                restore_keyframes_.pop_front();
+                insertCloud(*keyframes_[kf_ind](), kf_ind, &restore_tiles_);
+                if (restore_keyframes_.empty()) restore_tiles_.clear();
+            }
+            else
+            {
+                {
+                    std::lock_guard<std::mutex> lock(m_queue_);
+                    if (queue_.empty()) break;
+                    keyframes_.push_back(queue_.front());
+                    queue_.pop_front();
+                }
+                insertCloud(*keyframes_.back()(), keyframes_.size() - 1, nullptr);
+            }
+            elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        }
+        return elapsed;
+    }
+
+    // map thread: the tiles changed since the last call, each tile is complete: it replaces the previous one,
+    // and the tiles released since the last call (sent again in tiles once rebuilt)
+    // the clouds are the ones of the tiles, valid until the next update
+    size_t getDelta(TileClouds &tiles, std::vector<TileKey> &evicted)
+    {
+        tiles.clear();
+        evicted.assign(evicted_delta_.begin(), evicted_delta_.end());
+        for (const TileKey &key : dirty_tiles_) tiles.emplace_back(key, tiles_.at(key).getCloud());
+        dirty_tiles_.clear();
+        evicted_delta_.clear();
+        return tiles.size() + evicted.size();
+    }
+
+    // points of the tiles intersecting the sphere
+    void getMap(const common::PointI &center, const float &radius, common::PointICovCloud &cloud) const
+    {
+        cloud.clear();
+        for (const auto &tile : tiles_)
+            if (sqrDistance(tile.first, center) <= radius * radius) cloud += *tile.second.getCloud();
+    }
+
+    // increased at each change of the map
+    size_t revision() const { return revision_; }
+    size_t numTiles() const { return tiles_.size(); }
+    size_t numEvicted() const { return evicted_tiles_.size(); }
+    float tileSize() const { return static_cast<float>(tile_voxels_) * leaf_size_; }
+
+private:
+    static int64_t floorDiv(const int64_t &a, const int64_t &b) { return (a >= 0) ? a / b : -((-a + b - 1) / b); }
+
+    // same voxel index as VoxelMapCov, so that a voxel is never split by the tiles
+    int64_t tileIndex(const double &x) const
+    {
+        return floorDiv(static_cast<int64_t>(std::floor(x / leaf_size_)), tile_voxels_);
+    }
+
+    TileKey tileKey(const common::PointIWithCov &point) const
+    {
+        return TileKey(tileIndex(point.x), tileIndex(point.y), tileIndex(point.z));
+    }
+
+    // squared distance between a point and the box of a tile
+    double sqrDistance(const TileKey &key, const common::PointI &point) const
+    {
+        const double tile_size = static_cast<double>(tile_voxels_) * leaf_size_;
+        const int64_t k[3] = {std::get<0>(key), std::get<1>(key), std::get<2>(key)};
+        const double p[3] = {point.x, point.y, point.z};
+        double sqr_dis = 0;
+        for (size_t i = 0; i < 3; i++)
+        {
+            double d = std::max(std::max(k[i] * tile_size - p[i], p[i] - (k[i] + 1) * tile_size), 0.0);
+            sqr_dis += d * d;
+        }
+        return sqr_dis;
+    }
+
+    // only_tiles: the points of the other tiles are skipped (rebuild of evicted tiles)
+    // the points of an evicted tile are skipped, the keyframe is kept for its rebuild
+    void insertCloud(const common::PointICovCloud &cloud_w, const size_t &kf_ind, const std::set<TileKey> *only_tiles)
+    {
+        std::map<TileKey, common::PointICovCloud> tile_clouds;
+        for (const common::PointIWithCov &point : cloud_w.points)
+        {
+            TileKey key = tileKey(point);
+            if (only_tiles && !only_tiles->count(key)) continue;
+            tile_clouds[key].push_back(point);
+        }
+        for (const auto &tc : tile_clouds)
+        {
+            if (!only_tiles) tile_keyframes_[tc.first].push_back(kf_ind);
+            if (evicted_tiles_.count(tc.first)) continue;
+            auto iter = tiles_.find(tc.first);
+            if (iter == tiles_.end())
+                iter = tiles_.emplace(std::piecewise_construct, std::forward_as_tuple(tc.first),
+                                      std::forward_as_tuple(leaf_size_, leaf_size_, trace_threshold_)).first;
+            iter->second.insertCloud(tc.second);
+            dirty_tiles_.insert(tc.first);
+            evicted_delta_.erase(tc.first); // released, then rebuilt before the delta
+        }
+        if (!tile_clouds.empty()) revision_++;
+    }
+
+    // release the tiles out of range, queue the rebuild of the evicted tiles back in range
+    void evictTiles(const common::PointI &position)
+    {
+        if (evict_radius_ <= 0) return;
+        const double tile_size = static_cast<double>(tile_voxels_) * leaf_size_;
+        const double sqr_evict_dis = (evict_radius_ + tile_size) * (evict_radius_ + tile_size);
+        for (auto iter = tiles_.begin(); iter != tiles_.end();)
+        {
+            if (sqrDistance(iter->first, position) <= sqr_evict_dis)
+            {
+                ++iter;
+                continue;
+            }
+            evicted_tiles_.insert(iter->first);
+            evicted_delta_.insert(iter->first);
+            dirty_tiles_.erase(iter->first);
+            iter = tiles_.erase(iter);
+            revision_++;
+        }
+
+        std::set<size_t> restore_keyframes;
+        for (auto iter = evicted_tiles_.begin(); iter != evicted_tiles_.end();)
+        {
+            if (sqrDistance(*iter, position) > evict_radius_ * evict_radius_)
+            {
+                ++iter;
+                continue;
+            }
+            const std::vector<size_t> &kf_inds = tile_keyframes_[*iter];
+            restore_keyframes.insert(kf_inds.begin(), kf_inds.end());
+            restore_tiles_.insert(*iter);
+            iter = evicted_tiles_.erase(iter);
+        }
+        restore_keyframes_.assign(restore_keyframes.begin(), restore_keyframes.end());
+    }
+
+    float leaf_size_;
+    int tile_voxels_; // tile size in voxels
+    float kf_res_;
+    float trace_threshold_;
+    float evict_radius_;
+
+    std::mutex m_queue_;
+    std::deque<KeyframeCloudFunc> queue_;
+    std::set<std::tuple<int, int, int> > keyframe_cells_;
+    common::PointI last_position_;
+
+    // map thread only
+    std::vector<KeyframeCloudFunc> keyframes_; // merged keyframes
+    std::map<TileKey, std::vector<size_t> > tile_keyframes_; // merged keyframes with points in each tile
+    std::map<TileKey, VoxelMapCov> tiles_;
+    std::set<TileKey> dirty_tiles_;
+    std::set<TileKey> evicted_tiles_;
+    std::set<TileKey> evicted_delta_; // evicted since the last getDelta
+    std::set<TileKey> restore_tiles_; // evicted tiles being rebuilt
+    std::deque<size_t> restore_keyframes_; // keyframes of restore_tiles_ still to merge, in merge order
+    size_t revision_;
+};
+
+//
@@ -0,0 +1,486 @@
+/*******************************************************
+ * Copyright (C) 2020, RAM-LAB, Hong Kong University of Science and Technology
+ *
+ * This file is part of M-LOAM (https://ram-lab.com/file/jjiao/m-loam).
+ * If you use this code, please cite the respective publications as
+ * listed on the above websites.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *
+ * Author: Jianhao JIAO (jiaojh1994@gmail.com)
+ *******************************************************/
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <boost/filesystem.hpp>
+#include <eigen3/Eigen/Dense>
+
+#include "common/types/type.h"
+#include "mloam_pcl/point_with_cov.hpp"
+
+// on-disk layout of a PointIWithCov: x, y, z, intensity, cov_xx, cov_xy, cov_xz, cov_yy, cov_yz, cov_zz, cov_trace
+#define NUM_FLOAT_POINT_COV 11
+
+inline void packPointCov(const common::PointIWithCov &point, float *data)
+{
+    data[0] = point.x; data[1] = point.y; data[2] = point.z; data[3] = point.intensity;
+    for (size_t i = 0; i < 6; i++) data[4 + i] = point.cov_vec[i];
+    data[10] = point.cov_trace;
+}
+
+inline void unpackPointCov(const float *data, common::PointIWithCov &point)
+{
+    point.x = data[0]; point.y = data[1]; point.z = data[2]; point.intensity = data[3];
+    for (size_t i = 0; i < 6; i++) point.cov_vec[i] = data[4 + i];
+    point.cov_trace = data[10];
+}
+
+// remove the files tile_*.bin written into path by KeyframeStore or MapTileStream, the other files are kept
+inline void removeTileFiles(const std::string &path)
+{
+    std::vector<boost::filesystem::path> tile_files;
+    boost::system::error_code ec;
+    for (boost::filesystem::directory_iterator it(path, ec), end; !ec && (it != end); it.increment(ec))
+    {
+        std::string name = it->path().filename().string();
+        if ((name.compare(0, 5, "tile_") == 0) && (name.size() > 9) && (name.compare(name.size() - 4, 4, ".bin") == 0))
+            tile_files.push_back(it->path());
+    }
+    for (const boost::filesystem::path &tile_file : tile_files) boost::filesystem::remove(tile_file, ec);
+}
+
+// keyframe clouds of the mapper (surf, corner, outlier) in the keyframe frame
+// keyframes farther than evict_radius from the vehicle are released and read back from disk on demand
+// on disk, the keyframes whose positions fall into the same tile_size^3 cell are appended to one binary tile,
+// the index file (one line per keyframe: key_ind tile_x tile_y tile_z offset num_surf num_corner num_outlier) locates them,
+// a keyframe is written once, at its first eviction, and the tiles are memory-mapped for reading
+// an empty path keeps all the keyframes in memory
+// the index is not read back: the mapper does not restore the keyframe poses of a previous run
+// thread-safe
+class KeyframeStore
+{
+public:
+    struct Keyframe
+    {
+        common::PointICovCloud::ConstPtr surf_, corner_, outlier_;
+    };
+
+    typedef std::tuple<int, int, int> Tile;
+
+    KeyframeStore() : tile_size_(100.0), evict_radius_(200.0), has_position_(false) {}
+
+    // start a new store in path, which is created if it does not exist
+    // an existing directory must be empty or be the store of a previous run (with keyframes.index): only the files of the
+    // store (keyframes.index, tile_*.bin) are removed; return false and keep the keyframes in memory for any other path
+    bool setParameters(const std::string &path, const float &tile_size, const float &evict_radius)
+    {
+        std::lock_guard<std::mutex> lock(m_store_);
+        path_ = path;
+        tile_size_ = tile_size;
+        evict_radius_ = evict_radius;
+        if (path_.empty()) return true;
+        boost::system::error_code ec;
+        if (!boost::filesystem::exists(path_, ec))
+        {
+            boost::filesystem::create_directories(path_, ec);
+        }
+        else if (!boost::filesystem::is_directory(path_, ec))
+        {
+            ec = boost::system::errc::make_error_code(boost::system::errc::not_a_directory);
+        }
+        else if (!boost::filesystem::is_empty(path_, ec) && !ec)
+        {
+            if (!boost::filesystem::exists(indexFile()))
+            {
+                printf("[KeyframeStore] %s is not empty and is not a keyframe store, it is not used\n", path_.c_str());
+                path_.clear();
+                return false;
+            }
+            removeTileFiles(path_);
+        }
+        std::ofstream index_file;
+        if (!ec) index_file.open(indexFile(), std::ios::out | std::ios::trunc);
+        if (ec || !index_file)
+        {
+            printf("[KeyframeStore] cannot use %s as a keyframe store\n", path_.c_str());
+            path_.clear();
+            return false;
+        }
+        return true;
+    }
+
+    bool isOutOfCore() const { return !path_.empty(); }
+
+    size_t size()
+    {
+        std::lock_guard<std::mutex> lock(m_store_);
+        return entries_.size();
+    }
+
+    size_t numResident()
+    {
+        std::lock_guard<std::mutex> lock(m_store_);
+        size_t cnt = 0;
+        for (const Entry &entry : entries_) cnt += entry.keyframe_.surf_ ? 1 : 0;
+        return cnt;
+    }
+
+    void add(const int &key_ind, const common::PointI &position, const common::PointICovCloud::ConstPtr &surf,
+             const common::PointICovCloud::ConstPtr &corner, const common::PointICovCloud::ConstPtr &outlier)
+    {
+        std::lock_guard<std::mutex> lock(m_store_);
+        if (key_ind >= static_cast<int>(entries_.size())) entries_.resize(key_ind + 1);
+        Entry &entry = entries_[key_ind];
+        entry.position_ = Eigen::Vector3f(position.x, position.y, position.z);
+        entry.tile_ = tileOf(entry.position_);
+        entry.keyframe_.surf_ = surf;
+        entry.keyframe_.corner_ = corner;
+        entry.keyframe_.outlier_ = outlier;
+        entry.on_disk_ = false;
+    }
+
+    // an evicted keyframe is read from its tile, and kept again if it is close to the vehicle
+    Keyframe get(const int &key_ind)
+    {
+        Entry entry;
+        {
+            std::lock_guard<std::mutex> lock(m_store_);
+            if (entries_[key_ind].keyframe_.surf_) return entries_[key_ind].keyframe_;
+            entry = entries_[key_ind];
+        }
+        Keyframe keyframe = readKeyframe(entry);
+
+        std::lock_guard<std::mutex> lock(m_store_);
+        if (!entries_[key_ind].keyframe_.surf_ && !isFar(entry.position_)) entries_[key_ind].keyframe_ = keyframe;
+        return keyframe;
+    }
+
+    bool isResident(const int &key_ind)
+    {
+        std::lock_guard<std::mutex> lock(m_store_);
+        return (key_ind < static_cast<int>(entries_.size())) && entries_[key_ind].keyframe_.surf_;
+    }
+
+    // release the keyframes farther than evict_radius from the vehicle, return the number of released keyframes
+    size_t evict(const common::PointI &position)
+    {
+        std::lock_guard<std::mutex> lock(m_store_);
+        last_position_ = Eigen::Vector3f(position.x, position.y, position.z);
+        has_position_ = true;
+        if (path_.empty()) return 0;
+        size_t cnt = 0;
+        for (size_t i = 0; i < entries_.size(); i++)
+        {
+            Entry &entry = entries_[i];
+            if (!entry.keyframe_.surf_ || !isFar(entry.position_)) continue;
+            if (!entry.on_disk_) writeKeyframe(i, entry);
+            if (!entry.on_disk_) continue; // the write failed
+            entry.keyframe_ = Keyframe();
+            cnt++;
+        }
+        return cnt;
+    }
+
+    // order the keyframes by tile, so that a pass over them reads each tile in one go
+    void sortByTile(std::vector<int> &key_inds)
+    {
+        std::lock_guard<std::mutex> lock(m_store_);
+        std::stable_sort(key_inds.begin(), key_inds.end(),
+            [this](const int &a, const int &b) { return entries_[a].tile_ < entries_[b].tile_; });
+    }
+
+private:
+    struct Entry
+    {
+        Entry() : offset_(0), num_surf_(0), num_corner_(0), num_outlier_(0), on_disk_(false) {}
+        Eigen::Vector3f position_;
+        Tile tile_;
+        Keyframe keyframe_; // empty if evicted
+        size_t offset_;     // in bytes, in the tile file
+        size_t num_surf_, num_corner_, num_outlier_;
+        bool on_disk_;
+    };
+
+    Tile tileOf(const Eigen::Vector3f &point) const
+    {
+        return Tile(static_cast<int>(std::floor(point.x() / tile_size_)),
+                    static_cast<int>(std::floor(point.y() / tile_size_)),
+                    static_cast<int>(std::floor(point.z() / tile_size_)));
+    }
+
+    bool isFar(const Eigen::Vector3f &point) const
+    {
+        return has_position_ && ((point - last_position_).squaredNorm() > evict_radius_ * evict_radius_);
+    }
+
+    std::string indexFile() const { return path_ + "/keyframes.index"; }
+
+    std::string tileFile(const Tile &tile) const
+    {
+        return path_ + "/tile_" + std::to_string(std::get<0>(tile)) + "_" + std::to_string(std::get<1>(tile)) + "_"
+               + std::to_string(std::get<2>(tile)) + ".bin";
+    }
+
+    void writeKeyframe(const int &key_ind, Entry &entry)
+    {
+        FILE *fp = fopen(tileFile(entry.tile_).c_str(), "ab");
+        if (!fp)
+        {
+            printf("[KeyframeStore] cannot open %s, keyframe %d is kept in memory\n", tileFile(entry.tile_).c_str(), key_ind);
+            return;
+        }
+        fseek(fp, 0, SEEK_END);
+        entry.offset_ = static_cast<size_t>(ftell(fp));
+        entry.num_surf_ = entry.keyframe_.surf_->size();
+        entry.num_corner_ = entry.keyframe_.corner_->size();
+        entry.num_outlier_ = entry.keyframe_.outlier_->size();
+        std::vector<float> data(NUM_FLOAT_POINT_COV * (entry.num_surf_ + entry.num_corner_ + entry.num_outlier_));
+        float *ptr = data.data();
+        for (const common::PointICovCloud::ConstPtr &cloud : {entry.keyframe_.surf_, entry.keyframe_.corner_, entry.keyframe_.outlier_})
+            for (const common::PointIWithCov &point : *cloud)
+            {
+                packPointCov(point, ptr);
+                ptr += NUM_FLOAT_POINT_COV;
+            }
+        size_t num_written = fwrite(data.data(), sizeof(float), data.size(), fp);
+        fclose(fp);
+        if (num_written != data.size())
+        {
+            printf("[KeyframeStore] cannot write keyframe %d, it is kept in memory\n", key_ind);
+            return;
+        }
+
+        std::ofstream index_file(indexFile(), std::ios::out | std::ios::app);
+        index_file << key_ind << " " << std::get<0>(entry.tile_) << " " << std::get<1>(entry.tile_) << " " << std::get<2>(entry.tile_) << " "
+                   << entry.offset_ << " " << entry.num_surf_ << " " << entry.num_corner_ << " " << entry.num_outlier_ << std::endl;
+        entry.on_disk_ = true;
+    }
+
+    Keyframe readKeyframe(const Entry &entry) const
+    {
+        common::PointICovCloud::Ptr surf(new common::PointICovCloud()), corner(new common::PointICovCloud()), outlier(new common::PointICovCloud());
+        Keyframe keyframe;
+        keyframe.surf_ = surf;
+        keyframe.corner_ = corner;
+        keyframe.outlier_ = outlier;
+        size_t num_points = entry.num_surf_ + entry.num_corner_ + entry.num_outlier_;
+        if (num_points == 0) return keyframe;
+
+        int fd = open(tileFile(entry.tile_).c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            printf("[KeyframeStore] cannot open %s\n", tileFile(entry.tile_).c_str());
+            return keyframe;
+        }
+        // mmap needs an offset aligned to the page size
+        size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        size_t map_offset = entry.offset_ / page_size * page_size;
+        size_t map_size = entry.offset_ - map_offset + num_points * NUM_FLOAT_POINT_COV * sizeof(float);
+        void *addr = mmap(nullptr, map_size, PROT_READ, MAP_PRIVATE, fd, static_cast<off_t>(map_offset));
+        close(fd);
+        if (addr == MAP_FAILED)
+        {
+            printf("[KeyframeStore] cannot map %s\n", tileFile(entry.tile_).c_str());
+            return keyframe;
+        }
+        const float *ptr = reinterpret_cast<const float *>(static_cast<const char *>(addr) + (entry.offset_ - map_offset));
+        for (auto &cloud_num : {std::make_pair(surf, entry.num_surf_), std::make_pair(corner, entry.num_corner_),
+                                std::make_pair(outlier, entry.num_outlier_)})
+        {
+            cloud_num.first->resize(cloud_num.second);
+            for (common::PointIWithCov &point : *cloud_num.first)
+            {
+                unpackPointCov(ptr, point);
+                ptr += NUM_FLOAT_POINT_COV;
+            }
+        }
+        munmap(addr, map_size);
+        return keyframe;
+    }
+
+    std::string path_;
+    float tile_size_, evict_radius_;
+    Eigen::Vector3f last_position_;
+    bool has_position_;
+    std::vector<Entry> entries_;
+    std::mutex m_store_;
+};
+
+// binary pcd file of PointIWithCov written chunk by chunk, the point count in the header is filled in by close()
+class PCDCovStreamWriter
+{
+public:
+    PCDCovStreamWriter() : fp_(nullptr), num_points_(0) {}
+    ~PCDCovStreamWriter() { close(); }
+
+    bool open(const std::string &file_name)
+    {
+        close();
+        fp_ = fopen(file_name.c_str(), "wb");
+        num_points_ = 0;
+        if (!fp_) return false;
+        writeHeader();
+        return true;
+    }
+
+    void write(const common::PointICovCloud &cloud)
+    {
+        if (!fp_) return;
+        std::vector<float> data(NUM_FLOAT_POINT_COV * cloud.size());
+        for (size_t i = 0; i < cloud.size(); i++) packPointCov(cloud.points[i], &data[NUM_FLOAT_POINT_COV * i]);
+        fwrite(data.data(), sizeof(float), data.size(), fp_);
+        num_points_ += cloud.size();
+    }
+
+    void close()
+    {
+        if (!fp_) return;
+        fseek(fp_, 0, SEEK_SET);
+        writeHeader();
+        fclose(fp_);
+        fp_ = nullptr;
+    }
+
+    size_t size() const { return num_points_; }
+
+private:
+    // fixed-width counts, so that the header keeps its length when it is rewritten
+    void writeHeader()
+    {
+        fprintf(fp_, "# .PCD v0.7 - Point Cloud Data file format\n"
+                     "VERSION 0.7\n"
+                     "FIELDS x y z intensity cov_xx cov_xy cov_xz cov_yy cov_yz cov_zz cov_trace\n"
+                     "SIZE 4 4 4 4 4 4 4 4 4 4 4\n"
+                     "TYPE F F F F F F F F F F F\n"
+                     "COUNT 1 1 1 1 1 1 1 1 1 1 1\n"
+                     "WIDTH %012lu\n"
+                     "HEIGHT 1\n"
+                     "VIEWPOINT 0 0 0 1 0 0 0\n"
+                     "POINTS %012lu\n"
+                     "DATA binary\n", (unsigned long)num_points_, (unsigned long)num_points_);
+    }
+
+    FILE *fp_;
+    size_t num_points_;
+};
+
+// voxel filtering of a cloud that does not fit into memory:
+// the points are binned into spill files of tiles whose side is an integer number of voxels,
+// so filtering tile by tile gives the same voxels as filtering the whole cloud; the memory is bounded by one tile
+class MapTileStream
+{
+public:
+    MapTileStream(const std::string &spill_path, const float &leaf_size, const float &tile_size)
+        : spill_path_(spill_path), inverse_leaf_size_(1.0f / leaf_size),
+          tile_voxels_(std::max(1, static_cast<int>(std::round(tile_size / leaf_size))))
+    {
+        boost::system::error_code ec;
+        boost::filesystem::create_directories(spill_path_, ec);
+        removeTileFiles(spill_path_);
+    }
+
+    // the directory is only removed if nothing else was put into it
+    ~MapTileStream()
+    {
+        boost::system::error_code ec;
+        removeTileFiles(spill_path_);
+        boost::filesystem::remove(spill_path_, ec);
+    }
+
+    void add(const common::PointICovCloud &cloud)
+    {
+        for (const common::PointIWithCov &point : cloud)
+        {
+            // the same voxel index as VoxelGridCovarianceMLOAM
+            Tile tile(floorDiv(static_cast<int>(floor(point.x * inverse_leaf_size_)), tile_voxels_),
+                      floorDiv(static_cast<int>(floor(point.y * inverse_leaf_size_)), tile_voxels_),
+                      floorDiv(static_cast<int>(floor(point.z * inverse_leaf_size_)), tile_voxels_));
+            std::vector<float> &buffer = buffers_[tile];
+            buffer.resize(buffer.size() + NUM_FLOAT_POINT_COV);
+            packPointCov(point, &buffer[buffer.size() - NUM_FLOAT_POINT_COV]);
+            if (buffer.size() >= MAX_BUFFER_SIZE) spill(tile, buffer);
+        }
+    }
+
+    // filter each tile and append the result to the writers, return the number of filtered points
+    template <typename FilterType>
+    size_t flush(FilterType &filter, const std::vector<PCDCovStreamWriter *> &writers)
+    {
+        for (auto &tile_buffer : buffers_) spill(tile_buffer.first, tile_buffer.second);
+        buffers_.clear();
+        size_t num_points = 0;
+        for (const Tile &tile : tiles_)
+        {
+            common::PointICovCloud::Ptr cloud(new common::PointICovCloud());
+            common::PointICovCloud cloud_ds;
+            std::ifstream file(tileFile(tile), std::ios::in | std::ios::binary | std::ios::ate);
+            std::vector<float> data(static_cast<size_t>(file.tellg()) / sizeof(float));
+            file.seekg(0);
+            file.read(reinterpret_cast<char *>(data.data()), data.size() * sizeof(float));
+            cloud->resize(data.size() / NUM_FLOAT_POINT_COV);
+            for (size_t i = 0; i < cloud->size(); i++) unpackPointCov(&data[NUM_FLOAT_POINT_COV * i], cloud->points[i]);
+            filter.setInputCloud(cloud);
+            filter.filter(cloud_ds);
+            for (PCDCovStreamWriter *writer : writers) writer->write(cloud_ds);
+            num_points += cloud_ds.size();
+            boost::filesystem::remove(tileFile(tile));
+        }
+        tiles_.clear();
+        return num_points;
+    }
+
+private:
+    typedef std::tuple<int, int, int> Tile;
+    static const size_t MAX_BUFFER_SIZE = NUM_FLOAT_POINT_COV * 65536;
+
+    static int floorDiv(const int &a, const int &b) { return (a >= 0) ? a / b : -((-a + b - 1) / b); }
+
+    std::string tileFile(const Tile &tile) const
+    {
+        return spill_path_ + "/tile_" + std::to_string(std::get<0>(tile)) + "_" + std::to_string(std::get<1>(tile)) + "_"
+               + std::to_string(std::get<2>(tile)) + ".bin";
+    }
+
+    void spill(const Tile &tile, std::vector<float> &buffer)
+    {
+        if (buffer.empty()) return;
+        FILE *fp = fopen(tileFile(tile).c_str(), "ab");
+        if (fp)
+        {
+            fwrite(buffer.data(), sizeof(float), buffer.size(), fp);
+            fclose(fp);
+            tiles_.insert(tile);
+        }
+        else
+        {
+            printf("[MapTileStream] cannot open %s\n", tileFile(tile).c_str());
+        }
+        std::vector<float>().swap(buffer);
+    }
+
+    std::string spill_path_;
+    float inverse_leaf_size_;
+    int tile_voxels_;
+    std::map<Tile, std::vector<float> > buffers_;
+    std::set<Tile> tiles_;
+};
+
+//
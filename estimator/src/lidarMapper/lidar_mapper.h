@@ -27,12 +27,17 @@
 #include <iomanip>
 #include <vector>
 #include <map>
+#include <set>
+#include <tuple>
 #include <cassert>
 #include <algorithm>
 #include <utility>
 #include <omp.h>
 #include <signal.h>
 #include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
 
 #include <ros/ros.h>
 #include <sensor_msgs/Imu.h>
@@ -44,6 +49,7 @@
 #include <tf/transform_broadcaster.h>
 
 #include <pcl_conversions/pcl_conversions.h>
+#include <pcl_ros/point_cloud.h>
 #include <pcl/point_cloud.h>
 #include <pcl/point_types.h>
 #include <pcl/filters/voxel_grid.h>
@@ -61,6 +67,7 @@
 
 #include "mloam_msgs/Extrinsics.h"
 #include "mloam_msgs/Keyframes.h"
+#include "mloam_msgs/MapDelta.h"
 
 #include "mloam_pcl/point_with_cov.hpp"
 #include "mloam_pcl/voxel_grid_covariance_mloam.h"
@@ -72,19 +79,31 @@
 #include "../estimator/pose.h"
 #include "../estimator/parameters.h"
 #include "../featureExtract/feature_extract.hpp"
+#include "../featureExtract/good_feature_selector.hpp"
 #include "../factor/lidar_map_factor.hpp"
+#include "../factor/lidar_map_batch_factor.hpp"
 #include "../factor/pose_local_parameterization.h"
 #include "../factor/impl_loss_function.hpp"
 #include "../factor/impl_callback.hpp"
 #include "associate_uct.hpp"
+#include "voxel_map_cov.hpp"
+#include "keyframe_store.hpp"
+#include "global_map.hpp"
 
 #define GLOBALMAP_KF_RADIUS 1000.0
 #define MAX_FEATURE_SELECT_TIME 20  // 10ms
-#define MAX_RANDOM_QUEUE_TIME 20
-
+#define MIN_PARALLEL_UCT_SIZE 1000 // smaller keyframe clouds are propagated on the calling thread
+
+#ifdef MLOAM_COMPOSED
+// defined by the odometry node (rosNodeSR.cpp) in mloam_node_composed
+DECLARE_bool(result_save);
+DECLARE_string(config_file);
+DECLARE_string(output_path);
+#else
 DEFINE_bool(result_save, true, "save or not save the results");
 DEFINE_string(config_file, "config.yaml", "the yaml config file");
 DEFINE_string(output_path, "", "the path ouf saving results");
+#endif
 DEFINE_bool(with_ua, true, "with or without the awareness of uncertainty");
 DEFINE_string(gf_method, "wo-gf", "good feature selection method: rnd, fps, gd-float, gd-fix");
 DEFINE_double(gf_ratio_ini, 1.0, "with or without the good features selection");
@@ -96,6 +115,10 @@ void transformAssociateToMap();
 
 void extractSurroundingKeyFrames();
 
+void updateSurroundingVoxelMap();
+
+void updateSurroundSnapshot();
+
 void downsampleCurrentScan();
 
 void scan2MapOptimization();
@@ -114,10 +137,78 @@ void pubOdometry();
 
 void saveGlobalMap();
 
+void startMapper(ros::NodeHandle &nh);
+
+void stopMapper();
+
 // ****************** other operation
 void cloudUCTAssociateToMap(const PointICovCloud &cloud_local, PointICovCloud &cloud_global,
                             const Pose &pose_global, const vector<Pose> &pose_ext);
 
+// keyframe clouds in the map frame with the propagated uncertainty (cloudUCTAssociateToMap),
+// reused until the keyframe pose or the extrinsics change (e.g. after a loop update)
+// shared by the mapping and the map publishing threads
+class KeyframeUCTCache
+{
+public:
+    // type: 's' (surf), 'c' (corner), 'o' (outlier)
+    PointICovCloud::ConstPtr get(const int &key_ind, const char &type, const PointICovCloud &cloud_local,
+                                 const Pose &pose_global, const std::vector<Pose> &pose_ext)
+    {
+        const std::pair<int, char> key(key_ind, type);
+        {
+            std::lock_guard<std::mutex> lock(m_cache_);
+            auto iter = entries_.find(key);
+            if ((iter != entries_.end()) && samePose(iter->second.pose_global_, pose_global) &&
+                (iter->second.pose_ext_.size() == pose_ext.size()) &&
+                std::equal(pose_ext.begin(), pose_ext.end(), iter->second.pose_ext_.begin(), samePose))
+                return iter->second.cloud_;
+        }
+        PointICovCloud::Ptr cloud_global(new PointICovCloud());
+        cloudUCTAssociateToMap(cloud_local, *cloud_global, pose_global, pose_ext);
+
+        std::lock_guard<std::mutex> lock(m_cache_);
+        Entry &entry = entries_[key];
+        entry.pose_global_ = pose_global;
+        entry.pose_ext_ = pose_ext;
+        entry.cloud_ = cloud_global;
+        return cloud_global;
+    }
+
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(m_cache_);
+        entries_.clear();
+    }
+
+    // drop the clouds of the keyframes with pred(key_ind) == true
+    template <typename Pred>
+    void eraseIf(Pred pred)
+    {
+        std::lock_guard<std::mutex> lock(m_cache_);
+        for (auto iter = entries_.begin(); iter != entries_.end();)
+            iter = pred(iter->first.first) ? entries_.erase(iter) : std::next(iter);
+    }
+
+private:
+    struct Entry
+    {
+        Pose pose_global_;
+        std::vector<Pose> pose_ext_;
+        PointICovCloud::ConstPtr cloud_;
+    };
+
+    static bool samePose(const Pose &pose_1, const Pose &pose_2)
+    {
+        return (pose_1.t_ == pose_2.t_) && (pose_1.q_.coeffs() == pose_2.q_.coeffs()) && (pose_1.cov_ == pose_2.cov_);
+    }
+
+    std::map<std::pair<int, char>, Entry> entries_;
+    std::mutex m_cache_;
+};
+
+PointICovCloud::ConstPtr getKeyframeCloudMap(const int &key_ind, const KeyframeStore::Keyframe &keyframe, const char &type);
+
 void evalHessian(const ceres::CRSMatrix &jaco, Eigen::Matrix<double, 6, 6> &mat_H);
 
 void evalDegenracy(const Eigen::Matrix<double, 6, 6> &mat_H, PoseLocalParameterization *local_parameterization);
@@ -133,8 +224,8 @@ public:
                                       PointPlaneFeature &feature, //source point in curr frame and the correspondances in local map
                                       const Eigen::Matrix3d &cov_matrix)//source point's cov
     {
-        double **param = new double *[1];
-        param[0] = new double [SIZE_POSE];
+        double param_buf[SIZE_POSE];
+        double *param[1] = {param_buf};
         param[0][0] = pose_local.t_(0);
         param[0][1] = pose_local.t_(1);
         param[0][2] = pose_local.t_(2);
@@ -143,12 +234,12 @@ public:
         param[0][5] = pose_local.q_.z();
         param[0][6] = pose_local.q_.w();
 
-        double *res = new double[1];
-        double **jaco = new double *[1];
-        jaco[0] = new double[1 * 7];
+        double res[3] = {0.0, 0.0, 0.0};
+        double jaco_buf[1 * 7];
+        double *jaco[1] = {jaco_buf};
         if (feature.type_ == 's')
         {
-            LidarMapPlaneNormFactor f(feature.point_, feature.coeffs_, cov_matrix);      
+            LidarMapPlaneNormFactor f(feature.point_, feature.coeffs_.head<4>(), cov_matrix);      
             f.Evaluate(param, res, jaco);
         } 
         else if (feature.type_ == 'c')
@@ -157,7 +248,7 @@ public:
             f.Evaluate(param, res, jaco);
         }
 
-        double *rho = new double[3];
+        double rho[3];
         double sqr_error = res[0] * res[0] + res[1] * res[1] + res[0] * res[0]; //TODO(jxl): res[1]不存在， https://github.com/gogojjh/M-LOAM/issues/13
         loss_function_->Evaluate(sqr_error, rho);
 
@@ -166,13 +257,6 @@ public:
         // feature.jaco_ *= sqrt(std::max(0.0, rho[1]));
         // LOG_EVERY_N(INFO, 2000) << "error: " << sqrt(sqr_error) << ", rho_der: " << rho[1] 
         //                         << ", logd: " << common::logDet(feature.jaco_.transpose() * feature.jaco_, true);
-
-        delete[] res;
-        delete[] rho;
-        delete[] jaco[0];
-        delete[] jaco;
-        delete[] param[0];
-        delete[] param;
     }
 
     void evalFullHessian(const pcl::KdTreeFLANN<PointIWithCov>::Ptr &kdtree_from_map, //local map kdtree
@@ -181,10 +265,11 @@ public:
                          const Pose &pose_local, //curr frame's pose in map
                          const char feature_type, //surf: 's', corner: 'c'
                          Eigen::Matrix<double, 6, 6> &mat_H, //hessian matrix
-                         int &feat_num)
+                         int &feat_num,
+                         MatchCache *match_cache = nullptr) //correspondences reused across the iterations
     {
         size_t num_all_features = laser_cloud.size();
-        std::vector<PointPlaneFeature> all_features(num_all_features);
+        std::vector<PointPlaneFeature, Eigen::aligned_allocator<PointPlaneFeature> > all_features(num_all_features);
         // std::vector<Eigen::MatrixXd> v_jaco;
         for (size_t i = 0; i < num_all_features; i++) 
         {
@@ -199,7 +284,8 @@ public:
                                                           all_features[i],
                                                           i,
                                                           n_neigh,
-                                                          false);
+                                                          false,
+                                                          match_cache);
             } else if (feature_type == 'c')
             {
                 b_match = f_extract.matchCornerPointFromMap(kdtree_from_map,
@@ -209,13 +295,14 @@ public:
                                                             all_features[i],
                                                             i,
                                                             n_neigh,
-                                                            false);
+                                                            false,
+                                                            match_cache);
             }
             if (!b_match) continue;
             Eigen::Matrix3d cov_matrix;
             extractCov(laser_cloud.points[i], cov_matrix); //点的cov赋给cov_matrix
             evaluateFeatJacobianMatching(pose_local, all_features[i], cov_matrix); //计算每个点的残差对pose的雅克比
-            const Eigen::MatrixXd &jaco = all_features[i].jaco_;
+            const Eigen::Matrix<double, 1, 6> &jaco = all_features[i].jaco_;
             mat_H = mat_H + jaco.transpose() * jaco;
             // v_jaco.push_back(jaco);
             feat_num++;
@@ -234,12 +321,13 @@ public:
                              const PointICovCloud &laser_map, //local map
                              const PointICovCloud &laser_cloud, //curr frame points
                              const Pose &pose_local, //curr pose
-                             std::vector<PointPlaneFeature> &all_features, //[out], all_features[i]: index = i point对应的correspondance
+                             std::vector<PointPlaneFeature, Eigen::aligned_allocator<PointPlaneFeature> > &all_features, //[out], all_features[i]: index = i point对应的correspondance
                              std::vector<size_t> &sel_feature_idx, //[out], 第i个好point在点云中的idx放到sel_feature_idx[i]
                              const char feature_type,
                              const string gf_method, //挑选好points的方法
                              const double gf_ratio, //good feature比例
-                             Eigen::Matrix<double, 6, 6> &sub_mat_H)//[out], 累加好points的残差对pose的雅克比
+                             Eigen::Matrix<double, 6, 6> &sub_mat_H, //[out], 累加好points的残差对pose的雅克比
+                             MatchCache *match_cache = nullptr)
     {
         size_t num_all_features = laser_cloud.size();
         all_features.resize(num_all_features);
@@ -254,8 +342,6 @@ public:
         size_t num_sel_features = 0;
 
         bool b_match;
-        double cur_det;
-        size_t num_rnd_que;
         TicToc t_sel_feature;
         size_t n_neigh = 5;
         if (gf_method == "wo_gf") //gf_ratio == 1
@@ -273,7 +359,8 @@ public:
                                                               all_features[que_idx], //correspondance
                                                               que_idx,
                                                               n_neigh,
-                                                              false); //计算correspondance
+                                                              false,
+                                                              match_cache); //计算correspondance
                 }
                 else if (feature_type == 'c')
                 {
@@ -284,7 +371,8 @@ public:
                                                                 all_features[que_idx],
                                                                 que_idx,
                                                                 n_neigh,
-                                                                false);
+                                                                false,
+                                                                match_cache);
                 }
                 if (b_match) //找到了correspondance
                 {
@@ -293,7 +381,7 @@ public:
                     evaluateFeatJacobianMatching(pose_local,
                                                  all_features[que_idx],
                                                  cov_matrix); //计算每个点的残差对pose的雅克比
-                    const Eigen::MatrixXd &jaco = all_features[que_idx].jaco_;
+                    const Eigen::Matrix<double, 1, 6> &jaco = all_features[que_idx].jaco_;
                     sub_mat_H += jaco.transpose() * jaco;
 
                     sel_feature_idx[num_sel_features] = que_idx;
@@ -325,7 +413,8 @@ public:
                                                               all_features[que_idx],
                                                               que_idx,
                                                               n_neigh,
-                                                              false);
+                                                              false,
+                                                              match_cache);
                 }
                 else if (feature_type == 'c')
                 {
@@ -336,7 +425,8 @@ public:
                                                                 all_features[que_idx],
                                                                 que_idx,
                                                                 n_neigh,
-                                                                false);
+                                                                false,
+                                                                match_cache);
                 }
                 if (b_match)
                 {
@@ -345,7 +435,7 @@ public:
                     evaluateFeatJacobianMatching(pose_local,
                                                  all_features[que_idx],
                                                  cov_matrix);
-                    const Eigen::MatrixXd &jaco = all_features[que_idx].jaco_;
+                    const Eigen::Matrix<double, 1, 6> &jaco = all_features[que_idx].jaco_;
                     sub_mat_H += jaco.transpose() * jaco;
 
                     sel_feature_idx[num_sel_features] = que_idx; 
@@ -368,7 +458,8 @@ public:
                                                       all_features[k],
                                                       k,
                                                       n_neigh,
-                                                      false);
+                                                      false,
+                                                      match_cache);
             if (b_match)
             {
                 sel_feature_idx[num_sel_features] = k;
@@ -416,7 +507,8 @@ public:
                                                               all_features[que_idx],
                                                               que_idx,
                                                               n_neigh,
-                                                              false);
+                                                              false,
+                                                              match_cache);
                 }
                 else if (feature_type == 'c')
                 {
@@ -427,7 +519,8 @@ public:
                                                                 all_features[que_idx],
                                                                 que_idx,
                                                                 n_neigh,
-                                                                false);
+                                                                false,
+                                                                match_cache);
                 }
                 if (b_match)
                 {
@@ -436,7 +529,7 @@ public:
                     evaluateFeatJacobianMatching(pose_local,
                                                  all_features[que_idx],
                                                  cov_matrix);
-                    const Eigen::MatrixXd &jaco = all_features[que_idx].jaco_;
+                    const Eigen::Matrix<double, 1, 6> &jaco = all_features[que_idx].jaco_;
                     sub_mat_H += jaco.transpose() * jaco; //距离old point最远point的雅克比，即整个雅克比是由距离自己point最远的point的雅克比构成
 
                     sel_feature_idx[num_sel_features] = que_idx;
@@ -446,116 +539,57 @@ public:
         }
         else if (gf_method == "gd_fix" || gf_method == "gd_float") //跟Estimator::goodFeatureMatching()比例不等于1.0时，逻辑完全相同
         {
-            stringstream ss;
-            while (true)
+            // lazy greedy on logdet(sub_mat_H), the budget is GF_SELECT_EVAL_RATIO * num_use_features evaluations,
+            // or MAX_FEATURE_SELECT_TIME if GF_SELECT_EVAL_RATIO = 0
+            GoodFeatureSelector selector(static_cast<size_t>(GF_SELECT_EVAL_RATIO * num_use_features), MAX_FEATURE_SELECT_TIME);
+            selector.select(num_all_features,
+                            num_use_features,
+                            [&](const size_t &que_idx, PointPlaneFeature &feature)
+                            {
+                                bool b_match = false;
+                                if (feature_type == 's')
+                                {
+                                    b_match = f_extract.matchSurfPointFromMap(kdtree_from_map,
+                                                                              laser_map,
+                                                                              laser_cloud.points[que_idx],
+                                                                              pose_local,
+                                                                              feature,
+                                                                              que_idx,
+                                                                              n_neigh,
+                                                                              false,
+                                                                              match_cache);
+                                }
+                                else if (feature_type == 'c')
+                                {
+                                    b_match = f_extract.matchCornerPointFromMap(kdtree_from_map,
+                                                                                laser_map,
+                                                                                laser_cloud.points[que_idx],
+                                                                                pose_local,
+                                                                                feature,
+                                                                                que_idx,
+                                                                                n_neigh,
+                                                                                false,
+                                                                                match_cache);
+                                }
+                                if (!b_match) return false; // not found constraints or outlier constraints
+                                Eigen::Matrix3d cov_matrix;
+                                extractCov(laser_cloud.points[que_idx], cov_matrix);
+                                evaluateFeatJacobianMatching(pose_local, feature, cov_matrix);
+                                return true;
+                            },
+                            all_features,
+                            sel_feature_idx,
+                            sub_mat_H);
+            num_sel_features = sel_feature_idx.size();
+            if (selector.earlyTermination())
             {
-                if ((num_sel_features >= num_use_features) ||
-                    (all_feature_idx.size() == 0) || 
-                    (t_sel_feature.toc() > MAX_FEATURE_SELECT_TIME)) //TODO(jxl): 作者为了实时性，可能会忽略某些point，实际运行时间得验证。
-                    break;
-                // if ((num_sel_features >= num_use_features * 0.8) && 
-                //     (t_sel_feature.toc() > MAX_FEATURE_SELECT_TIME))
-                //     break;
-                // if ((num_sel_features >= num_use_features) ||
-                //     (all_feature_idx.size() == 0))
-                //     break;
-                // 2.3 = log(1\epi)
-                size_t size_rnd_subset = static_cast<size_t>(1.0 * num_all_features / num_use_features); // 1.0/2.3
-                // LOG_EVERY_N(INFO, 20) << "[goodFeatureMatching] size of matrix subset: " << size_rnd_subset;
-                std::priority_queue<FeatureWithScore, std::vector<FeatureWithScore>, std::less<FeatureWithScore>> heap_subset;
-
-                while (true)
-                {
-                    if (all_feature_idx.size() == 0) break;
-                    num_rnd_que = 0;
-                    size_t j;
-                    while (num_rnd_que < MAX_RANDOM_QUEUE_TIME)
-                    {
-                        j = rgi_.geneRandUniform(0, all_feature_idx.size() - 1);
-                        if (feature_visited[j] < int(num_sel_features))
-                        {
-                            feature_visited[j] = int(num_sel_features);
-                            break;
-                        }
-                        num_rnd_que++;
-                    }
-                    if (num_rnd_que >= MAX_RANDOM_QUEUE_TIME || t_sel_feature.toc() > MAX_FEATURE_SELECT_TIME) //TODO(jxl): 作者为了实时性，可能会忽略某些point，实际运行时间得验证。
-                        break;
-
-                    size_t que_idx = all_feature_idx[j];
-                    if (all_features[que_idx].type_ == 'n')
-                    {
-                        b_match = false;
-                        if (feature_type == 's')
-                        {
-                            b_match = f_extract.matchSurfPointFromMap(kdtree_from_map,
-                                                                      laser_map,
-                                                                      laser_cloud.points[que_idx],
-                                                                      pose_local,
-                                                                      all_features[que_idx],
-                                                                      que_idx,
-                                                                      n_neigh,
-                                                                      false);
-                        } 
-                        else if (feature_type == 'c')
-                        {
-                            b_match = f_extract.matchCornerPointFromMap(kdtree_from_map,
-                                                                        laser_map,
-                                                                        laser_cloud.points[que_idx],
-                                                                        pose_local,
-                                                                        all_features[que_idx],
-                                                                        que_idx,
-                                                                        n_neigh,
-                                                                        false);
-                        }
-                        if (b_match) 
-                        {
-                            Eigen::Matrix3d cov_matrix;
-                            extractCov(laser_cloud.points[que_idx], cov_matrix);
-                            evaluateFeatJacobianMatching(pose_local,
-                                                         all_features[que_idx],
-                                                         cov_matrix);
-                        } else // not found constraints or outlier constraints
-                        {
-                            all_feature_idx.erase(all_feature_idx.begin() + j);
-                            feature_visited.erase(feature_visited.begin() + j);
-                            continue;
-                        }
-                    }
-
-                    const Eigen::MatrixXd &jaco = all_features[que_idx].jaco_;
-                    cur_det = common::logDet(sub_mat_H + jaco.transpose() * jaco, true);
-                    //TODO(jxl): J^T*J分解，这块打分的依据是什么？ https://github.com/gogojjh/M-LOAM/issues/10
-
-                    heap_subset.push(FeatureWithScore(que_idx, cur_det, jaco));
-                    if (heap_subset.size() >= size_rnd_subset)
-                    {
-                        const FeatureWithScore &fws = heap_subset.top();
-                        std::vector<size_t>::iterator iter = std::find(all_feature_idx.begin(), all_feature_idx.end(), fws.idx_);
-                        if (iter == all_feature_idx.end())
-                        {
-                            std::cerr << "[goodFeatureMatching]: not exist feature idx !" << std::endl;
-                            break;
-                        }
-                        sub_mat_H += fws.jaco_.transpose() * fws.jaco_;
-
-                        size_t position = iter - all_feature_idx.begin();
-                        all_feature_idx.erase(all_feature_idx.begin() + position);
-                        feature_visited.erase(feature_visited.begin() + position);
-                        sel_feature_idx[num_sel_features] = fws.idx_;
-                        num_sel_features++;
-                        // printf("position: %lu, num: %lu\n", position, num_rnd_que);
-                        break;
-                    }
-                }
-                if (num_rnd_que >= MAX_RANDOM_QUEUE_TIME || t_sel_feature.toc() > MAX_FEATURE_SELECT_TIME) //TODO(jxl): 作者为了实时性，可能会忽略某些point，实际运行时间得验证。
-                    break;
+                LOG_EVERY_N(INFO, 100) << "budget spent: feature_type " << feature_type << ", evaluations " << selector.numEvals() << ", " << t_sel_feature.toc();
             }
         } 
-        if (num_rnd_que >= MAX_RANDOM_QUEUE_TIME || t_sel_feature.toc() > MAX_FEATURE_SELECT_TIME) //TODO(jxl): 作者为了实时性，可能会忽略某些point，实际运行时间得验证。
+        if ((gf_method == "rnd" || gf_method == "fps") && (t_sel_feature.toc() > MAX_FEATURE_SELECT_TIME)) //TODO(jxl): 作者为了实时性，可能会忽略某些point，实际运行时间得验证。
         {
             // std::cerr << "mapping [goodFeatureMatching]: early termination!" << std::endl;
-            LOG_EVERY_N(INFO, 100) << "early termination: feature_type " << feature_type << ", " << num_rnd_que << ", " << t_sel_feature.toc();
+            LOG_EVERY_N(INFO, 100) << "early termination: feature_type " << feature_type << ", " << t_sel_feature.toc();
         }
 
         sel_feature_idx.resize(num_sel_features);
@@ -565,7 +599,7 @@ public:
 
     void writeFeature(const PointICovCloud &laser_cloud,
                     const std::vector<size_t> &sel_feature_idx,
-                    const std::vector<PointPlaneFeature> &surf_map_features)
+                    const std::vector<PointPlaneFeature, Eigen::aligned_allocator<PointPlaneFeature> > &surf_map_features)
     {
         boost::filesystem::create_directory(std::string(OUTPUT_FOLDER + "/gf_pcd").c_str());
         std::string filename1 = OUTPUT_FOLDER + "/gf_pcd/map_feature_" + "origin" + "_" + std::to_string(FLAGS_gf_ratio_ini) + ".pcd";
@@ -592,7 +626,7 @@ public:
 
     void pubFeature(const PointICovCloud &laser_cloud,
                     const std::vector<size_t> &sel_feature_idx,
-                    const std::vector<PointPlaneFeature> &surf_map_features,
+                    const std::vector<PointPlaneFeature, Eigen::aligned_allocator<PointPlaneFeature> > &surf_map_features,
                     const ros::Publisher &pub_laser_cloud,
                     const double &time_laser_odometry)
     {
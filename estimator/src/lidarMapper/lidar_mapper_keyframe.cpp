@@ -30,34 +30,36 @@ double time_laser_odometry = 0;
 double time_ext = 0;
 
 // thread data buffer
-std::queue<sensor_msgs::PointCloud2ConstPtr> surf_last_buf;
-std::queue<sensor_msgs::PointCloud2ConstPtr> corner_last_buf;
-std::queue<sensor_msgs::PointCloud2ConstPtr> full_res_buf;
-std::queue<sensor_msgs::PointCloud2ConstPtr> outlier_buf;
+// the clouds are shared with the odometry (no copy when both run in mloam_node_composed) and must not be modified
+std::queue<PointICloud::ConstPtr> surf_last_buf;
+std::queue<PointICloud::ConstPtr> corner_last_buf;
+std::queue<PointICloud::ConstPtr> full_res_buf;
+std::queue<PointICloud::ConstPtr> outlier_buf;
 std::queue<nav_msgs::Odometry::ConstPtr> odometry_buf; //odom
 std::queue<mloam_msgs::ExtrinsicsConstPtr> ext_buf; //外参
 std::queue<mloam_msgs::KeyframesConstPtr> loop_info_buf; //闭环
 std::mutex m_buf;
 
-PointICloud::Ptr laser_cloud_surf_last(new PointICloud());
-PointICloud::Ptr laser_cloud_corner_last(new PointICloud());
+PointICloud::ConstPtr laser_cloud_surf_last(new PointICloud());
+PointICloud::ConstPtr laser_cloud_corner_last(new PointICloud());
 PointICloud::Ptr laser_cloud_surf_last_ds(new PointICloud());
 PointICloud::Ptr laser_cloud_corner_last_ds(new PointICloud());
-PointICloud::Ptr laser_cloud_full_res(new PointICloud());
-PointICloud::Ptr laser_cloud_outlier(new PointICloud());
+PointICloud::ConstPtr laser_cloud_full_res(new PointICloud());
+PointICloud::ConstPtr laser_cloud_outlier(new PointICloud());
 PointICloud::Ptr laser_cloud_outlier_ds(new PointICloud());
 
 PointICovCloud::Ptr laser_cloud_surf_from_map_cov(new PointICovCloud()); //local surf map
 PointICovCloud::Ptr laser_cloud_corner_from_map_cov(new PointICovCloud()); //local corner map
 PointICovCloud::Ptr laser_cloud_surf_from_map_cov_ds(new PointICovCloud());
 PointICovCloud::Ptr laser_cloud_corner_from_map_cov_ds(new PointICovCloud());
+PointICovCloud::ConstPtr laser_cloud_surround_snapshot; // copy of the surrounding map (surf + corner) for the map thread
+std::mutex m_surround;
 
 PointICovCloud::Ptr laser_cloud_surf_cov(new PointICovCloud());
 PointICovCloud::Ptr laser_cloud_corner_cov(new PointICovCloud());
 PointICovCloud::Ptr laser_cloud_outlier_cov(new PointICovCloud());
 
 pcl::KdTreeFLANN<PointI>::Ptr kdtree_surrounding_keyframes(new pcl::KdTreeFLANN<PointI>());
-pcl::KdTreeFLANN<PointI>::Ptr kdtree_global_map_keyframes(new pcl::KdTreeFLANN<PointI>());
 pcl::KdTreeFLANN<PointIWithCov>::Ptr kdtree_surf_from_map(new pcl::KdTreeFLANN<PointIWithCov>());
 pcl::KdTreeFLANN<PointIWithCov>::Ptr kdtree_corner_from_map(new pcl::KdTreeFLANN<PointIWithCov>());
 
@@ -69,11 +71,15 @@ PointICloud::Ptr global_map_keyframes(new PointICloud());
 PointICloud::Ptr global_map_keyframes_ds(new PointICloud());
 
 std::vector<int> surrounding_existing_keyframes_id; //当期帧周围的关键帧index
-std::vector<PointICovCloud::Ptr> surrounding_surf_cloud_keyframes; //当期帧周围的关键帧 surf points转换到map下，即local surf map
-std::vector<PointICovCloud::Ptr> surrounding_corner_cloud_keyframes; //当期帧周围的关键帧 corner points转换到map下，即local corner map
-std::vector<PointICovCloud::Ptr> surf_cloud_keyframes_cov;  //所有keyframes surf points, points在每个关键帧下
-std::vector<PointICovCloud::Ptr> corner_cloud_keyframes_cov;//所有keyframes corner points
-std::vector<PointICovCloud::Ptr> outlier_cloud_keyframes_cov;//所有keyframes outlier points
+std::vector<PointICovCloud::ConstPtr> surrounding_surf_cloud_keyframes; //当期帧周围的关键帧 surf points转换到map下，即local surf map
+std::vector<PointICovCloud::ConstPtr> surrounding_corner_cloud_keyframes; //当期帧周围的关键帧 corner points转换到map下，即local corner map
+KeyframeStore keyframe_store; //所有keyframes surf, corner, outlier points, points在每个关键帧下, 远离当前位置的关键帧存到磁盘
+KeyframeUCTCache uct_cache; //所有keyframes points转换到map下, 且计算cov
+GlobalMapBuilder global_map; // published global map, built by the map thread
+
+// persistent surrounding map (INCREMENTAL_LOCAL_MAP): keyframes are added/removed when a new keyframe is saved
+VoxelMapCov surf_voxel_map, corner_voxel_map;
+size_t num_keyframes_voxel_map = 0; // number of keyframes at the last update of the voxel maps
 
 // downsampling voxel grid
 pcl::VoxelGridCovarianceMLOAM<PointI> down_size_filter_surf; //见mloam_pcl package
@@ -103,7 +109,7 @@ double para_pose[SIZE_POSE];
 Pose pose_wmap_prev, pose_wmap_curr, pose_wmap_wodom, pose_wodom_curr;
 //主雷达T_map_prev, T_map_curr, T_map_odom, T_odom_curr
 
-ros::Publisher pub_laser_cloud_surrounding, pub_laser_cloud_map;
+ros::Publisher pub_laser_cloud_surrounding, pub_laser_cloud_map, pub_laser_cloud_map_delta;
 ros::Publisher pub_laser_cloud_full_res;
 ros::Publisher pub_laser_cloud_surf_last_res, pub_laser_cloud_corner_last_res;
 ros::Publisher pub_good_surf_feature;
@@ -139,10 +145,23 @@ double lambda = 10.0;
 double gf_ratio_cur;
 
 ActiveFeatureSelection afs;
+ceres::HuberLoss map_loss_function(0.1); // shared by afs and the problems of all iterations, not owned by the problems
+
+// plane/line fits of the current scan, reused by the iterations of scan2MapOptimization
+MatchCache surf_match_cache, corner_match_cache;
 
 std::mutex m_process;
 
+std::vector<ros::Subscriber> sub_mapper;
+std::thread mapping_process, pub_map_process;
+
 // set current pose after odom
+// the stamps of the pcl clouds are in microseconds (truncated): never later than the odometry of the same scan
+double cloudTime(const PointICloud::ConstPtr &cloud)
+{
+    return pcl_conversions::fromPCL(cloud->header.stamp).toSec();
+}
+
 void transformAssociateToMap()
 {
 	// q_w_curr = q_wmap_wodom * q_wodom_curr;
@@ -163,28 +182,28 @@ void transformUpdate()
     //pose_wmap_wodom: 本帧结束末尾，更新T_map_odom，为下一帧做准备
 }
 
-void laserCloudSurfLastHandler(const sensor_msgs::PointCloud2ConstPtr &laser_cloud_surf_last_msg)
+void laserCloudSurfLastHandler(const PointICloud::ConstPtr &laser_cloud_surf_last_msg)
 {
 	m_buf.lock();
 	surf_last_buf.push(laser_cloud_surf_last_msg);
 	m_buf.unlock();
 }
 
-void laserCloudCornerLastHandler(const sensor_msgs::PointCloud2ConstPtr &laser_cloud_corner_last_msg)
+void laserCloudCornerLastHandler(const PointICloud::ConstPtr &laser_cloud_corner_last_msg)
 {
 	m_buf.lock();
 	corner_last_buf.push(laser_cloud_corner_last_msg);
 	m_buf.unlock();
 }
 
-void laserCloudFullResHandler(const sensor_msgs::PointCloud2ConstPtr &laser_cloud_full_res_msg)
+void laserCloudFullResHandler(const PointICloud::ConstPtr &laser_cloud_full_res_msg)
 {
 	m_buf.lock();
 	full_res_buf.push(laser_cloud_full_res_msg);
 	m_buf.unlock();
 }
 
-void laserCloudOutlierResHandler(const sensor_msgs::PointCloud2ConstPtr &laser_cloud_outlier_msg)
+void laserCloudOutlierResHandler(const PointICloud::ConstPtr &laser_cloud_outlier_msg)
 {
     m_buf.lock();
     outlier_buf.push(laser_cloud_outlier_msg);
@@ -258,6 +277,11 @@ void double2Vector()
 void extractSurroundingKeyFrames()
 {
     if (pose_keyframes_6d.size() == 0) return;
+    if (INCREMENTAL_LOCAL_MAP)
+    {
+        updateSurroundingVoxelMap();
+        return;
+    }
     if ((!laser_cloud_surf_from_map_cov_ds->size() == 0) && (!laser_cloud_corner_from_map_cov_ds->size() == 0)) 
     {
         printf("not need to construct the map\n");
@@ -315,15 +339,10 @@ void extractSurroundingKeyFrames()
         {
             int key_ind = (int)surrounding_keyframes->points[i].intensity;
             surrounding_existing_keyframes_id.push_back(key_ind);
-            const Pose &pose_local = pose_keyframes_6d[key_ind].second;
+            KeyframeStore::Keyframe keyframe = keyframe_store.get(key_ind);
 
-            PointICovCloud::Ptr surf_trans(new PointICovCloud());
-            cloudUCTAssociateToMap(*surf_cloud_keyframes_cov[key_ind], *surf_trans, pose_local, pose_ext);
-            surrounding_surf_cloud_keyframes.push_back(surf_trans); //关键帧points转换到map下, 且计算cov, 依次存放起来
-
-            PointICovCloud::Ptr corner_trans(new PointICovCloud());
-            cloudUCTAssociateToMap(*corner_cloud_keyframes_cov[key_ind], *corner_trans, pose_local, pose_ext);
-            surrounding_corner_cloud_keyframes.push_back(corner_trans);
+            surrounding_surf_cloud_keyframes.push_back(getKeyframeCloudMap(key_ind, keyframe, 's')); //关键帧points转换到map下, 且计算cov, 依次存放起来
+            surrounding_corner_cloud_keyframes.push_back(getKeyframeCloudMap(key_ind, keyframe, 'c'));
         }
     }
 
@@ -356,6 +375,76 @@ void extractSurroundingKeyFrames()
            laser_cloud_corner_from_map_cov->size(), laser_cloud_surf_from_map_cov->size(),
            laser_cloud_corner_from_map_cov_ds->size(), laser_cloud_surf_from_map_cov_ds->size());
     printf("filter time: %fms\n", filter_timer.Stop() * 1000); // 10ms
+    updateSurroundSnapshot();
+}
+
+// same keyframe selection as extractSurroundingKeyFrames, but only the keyframes entering/leaving the radius
+// are inserted into/removed from the voxel maps, which are searched in place (no filter and no kdtree rebuild)
+void updateSurroundingVoxelMap()
+{
+    if (pose_keyframes_6d.size() == num_keyframes_voxel_map) return;
+    num_keyframes_voxel_map = pose_keyframes_6d.size();
+
+    common::timing::Timer filter_timer("mapping_filter");
+    pose_point_cur.x = pose_wmap_curr.t_[0];
+    pose_point_cur.y = pose_wmap_curr.t_[1];
+    pose_point_cur.z = pose_wmap_curr.t_[2];
+    kdtree_surrounding_keyframes->setInputCloud(pose_keyframes_3d);
+    kdtree_surrounding_keyframes->radiusSearch(pose_point_cur, SURROUNDING_KF_RADIUS, point_search_ind, point_search_sq_dis, 0);
+
+    // one keyframe per MAP_SUR_KF_RES cell: the one already in the map, otherwise the newest one
+    std::map<std::tuple<int, int, int>, int> cell_keyframe;
+    for (const int &ind : point_search_ind)
+    {
+        const PointI &point = pose_keyframes_3d->points[ind];
+        int key_ind = (int)point.intensity;
+        std::tuple<int, int, int> cell(static_cast<int>(std::floor(point.x / MAP_SUR_KF_RES)),
+                                       static_cast<int>(std::floor(point.y / MAP_SUR_KF_RES)),
+                                       static_cast<int>(std::floor(point.z / MAP_SUR_KF_RES)));
+        auto iter = cell_keyframe.find(cell);
+        if (iter == cell_keyframe.end())
+        {
+            cell_keyframe.emplace(cell, key_ind);
+            continue;
+        }
+        bool in_map = surf_voxel_map.hasKeyframe(key_ind);
+        bool in_map_selected = surf_voxel_map.hasKeyframe(iter->second);
+        if ((in_map && !in_map_selected) || ((in_map == in_map_selected) && (key_ind > iter->second)))
+            iter->second = key_ind;
+    }
+    std::set<int> selected_keyframes_id;
+    for (const auto &c : cell_keyframe) selected_keyframes_id.insert(c.second);
+
+    // evict the keyframes out of the radius
+    for (const int &key_ind : surf_voxel_map.getKeyframeIds())
+    {
+        if (selected_keyframes_id.count(key_ind)) continue;
+        surf_voxel_map.removeKeyframe(key_ind);
+        corner_voxel_map.removeKeyframe(key_ind);
+    }
+    for (const int &key_ind : selected_keyframes_id)
+    {
+        if (surf_voxel_map.hasKeyframe(key_ind)) continue;
+        KeyframeStore::Keyframe keyframe = keyframe_store.get(key_ind);
+        surf_voxel_map.insertKeyframe(key_ind, *getKeyframeCloudMap(key_ind, keyframe, 's'));
+        corner_voxel_map.insertKeyframe(key_ind, *getKeyframeCloudMap(key_ind, keyframe, 'c'));
+    }
+    laser_cloud_surf_from_map_cov_ds = surf_voxel_map.getCloud();
+    laser_cloud_corner_from_map_cov_ds = corner_voxel_map.getCloud();
+    printf("voxel map keyframes: %lu, corner/surf: %lu, %lu\n",
+           surf_voxel_map.numKeyframes(), corner_voxel_map.size(), surf_voxel_map.size());
+    printf("filter time: %fms\n", filter_timer.Stop() * 1000);
+    updateSurroundSnapshot();
+}
+
+// the map thread publishes a copy of the surrounding map: the map itself is changed in place by the mapping thread
+void updateSurroundSnapshot()
+{
+    if (pub_laser_cloud_surrounding.getNumSubscribers() == 0) return;
+    PointICovCloud::Ptr laser_cloud_surround(new PointICovCloud());
+    *laser_cloud_surround = *laser_cloud_surf_from_map_cov_ds + *laser_cloud_corner_from_map_cov_ds;
+    std::lock_guard<std::mutex> lock(m_surround);
+    laser_cloud_surround_snapshot = laser_cloud_surround;
 }
 
 void downsampleCurrentScan()
@@ -373,19 +462,26 @@ void downsampleCurrentScan()
     down_size_filter_outlier.filter(*laser_cloud_outlier_ds); //所有雷达curr帧，转到主雷达下 
 
     // propagate the extrinsic uncertainty on points
+    std::vector<Pose> pose_ext_inv(NUM_OF_LASER);
+    std::vector<PointUncertaintyTerms> ext_uct_terms;
+    for (size_t n = 0; n < NUM_OF_LASER; n++)
+    {
+        pose_ext_inv[n] = pose_ext[n].inverse();
+        ext_uct_terms.emplace_back(pose_ext[n]);
+    }
     laser_cloud_surf_cov->clear(); //所有雷达curr帧，转到主雷达下, 且计算每个点的cov
     laser_cloud_corner_cov->clear();
     laser_cloud_outlier_cov->clear();
 
     for (PointI &point_ori : *laser_cloud_surf_last_ds)
     {
-        int idx = int(point_ori.intensity); // indicate the lidar id， 见visualization.cpp::transformCloudFeature()
+        int idx = int(point_ori.intensity); // indicate the lidar id， 见visualization.cpp::transformFeatureCloud()
         PointI point_sel;
         Eigen::Matrix3d cov_point = Eigen::Matrix3d::Zero();
         if (with_ua_flag)//true
         {
-            pointAssociateToMap(point_ori, point_sel, pose_ext[idx].inverse()); //point_sel: 在n雷达curr帧下
-            evalPointUncertainty(point_sel, cov_point, pose_ext[idx]); 
+            pointAssociateToMap(point_ori, point_sel, pose_ext_inv[idx]); //point_sel: 在n雷达curr帧下
+            evalPointUncertainty(point_sel, cov_point, ext_uct_terms[idx]); 
             //对于points中是在n雷达下观察到的points:
             //把主雷达到n雷达的外参cov和每个点(landmark)测量的cov一起考虑进去，计算得到这些points的cov
             //只有point的cov在阈值内才会被保留下来
@@ -403,8 +499,8 @@ void downsampleCurrentScan()
         Eigen::Matrix3d cov_point = Eigen::Matrix3d::Zero();
         if (with_ua_flag)//true
         {
-            pointAssociateToMap(point_ori, point_sel, pose_ext[idx].inverse());
-            evalPointUncertainty(point_sel, cov_point, pose_ext[idx]);
+            pointAssociateToMap(point_ori, point_sel, pose_ext_inv[idx]);
+            evalPointUncertainty(point_sel, cov_point, ext_uct_terms[idx]);
             if (cov_point.trace() > TRACE_THRESHOLD_MAPPING) continue;
         }
         PointIWithCov point_cov(point_ori, cov_point.cast<float>());
@@ -418,8 +514,8 @@ void downsampleCurrentScan()
         Eigen::Matrix3d cov_point = Eigen::Matrix3d::Zero();
         if (with_ua_flag)//true
         {
-            pointAssociateToMap(point_ori, point_sel, pose_ext[idx].inverse());
-            evalPointUncertainty(point_sel, cov_point, pose_ext[idx]);
+            pointAssociateToMap(point_ori, point_sel, pose_ext_inv[idx]);
+            evalPointUncertainty(point_sel, cov_point, ext_uct_terms[idx]);
             if (cov_point.trace() > TRACE_THRESHOLD_MAPPING) continue;
         }
         PointIWithCov point_cov(point_ori, cov_point.cast<float>());
@@ -438,18 +534,25 @@ void scan2MapOptimization()
     if ((laser_cloud_surf_from_map_num > 50) && (laser_cloud_corner_from_map_num > 10))
     {
         // pose_wmap_prev = pose_wmap_curr;
-        common::timing::Timer t_timer("mapping_kdtree");
-        kdtree_surf_from_map->setInputCloud(laser_cloud_surf_from_map_cov_ds);
-        kdtree_corner_from_map->setInputCloud(laser_cloud_corner_from_map_cov_ds);
-        printf("build time %fms\n", t_timer.Stop() * 1000);
+        if (!INCREMENTAL_LOCAL_MAP) // the voxel maps are searched in place
+        {
+            common::timing::Timer t_timer("mapping_kdtree");
+            kdtree_surf_from_map->setInputCloud(laser_cloud_surf_from_map_cov_ds);
+            kdtree_corner_from_map->setInputCloud(laser_cloud_corner_from_map_cov_ds);
+            printf("build time %fms\n", t_timer.Stop() * 1000);
+        }
         printf("********************************\n");
+        surf_match_cache.reset(laser_cloud_surf_cov->size());
+        corner_match_cache.reset(laser_cloud_corner_cov->size());
 
         // int max_iter = pose_keyframes_6d.size() <= 5 ? 5 : 2; // should have more iterations at the initial stage
         int max_iter = 2;
         for (int iter_cnt = 0; iter_cnt < max_iter; iter_cnt++) //TODO(jxl): 两轮ceres
         {
-            ceres::Problem problem;
-            ceres::LossFunction *loss_function = new ceres::HuberLoss(0.1);
+            ceres::Problem::Options problem_options;
+            problem_options.loss_function_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
+            ceres::Problem problem(problem_options);
+            ceres::LossFunction *loss_function = &map_loss_function;
             afs.loss_function_ = loss_function;
             vector2Double();
 
@@ -470,12 +573,12 @@ void scan2MapOptimization()
                     Eigen::Matrix<double, 6, 6> mat_H = Eigen::Matrix<double, 6, 6>::Identity() * 1e-6;
                     if (POINT_PLANE_FACTOR)
                         afs.evalFullHessian(kdtree_surf_from_map, *laser_cloud_surf_from_map_cov_ds,
-                                            *laser_cloud_surf_cov, pose_wmap_curr, 's', mat_H, total_feat_num);
+                                            *laser_cloud_surf_cov, pose_wmap_curr, 's', mat_H, total_feat_num, &surf_match_cache);
                         //mat_H：累加curr surf points每个点对curr pose的hessian矩阵
 
                     if (POINT_EDGE_FACTOR)
                         afs.evalFullHessian(kdtree_corner_from_map, *laser_cloud_corner_from_map_cov_ds,
-                                            *laser_cloud_corner_cov, pose_wmap_curr, 'c', mat_H, total_feat_num);
+                                            *laser_cloud_corner_cov, pose_wmap_curr, 'c', mat_H, total_feat_num, &corner_match_cache);
                     // std::cout << mat_H << std::endl;
                     // std::cout << common::logDet(mat_H, true) << std::endl;
                     // std::cout << total_feat_num << " " << std::log(1.0 * total_feat_num) << std::endl;
@@ -508,7 +611,7 @@ void scan2MapOptimization()
             }
 
             // ******************************************************
-            std::vector<PointPlaneFeature> all_surf_features, all_corner_features;
+            std::vector<PointPlaneFeature, Eigen::aligned_allocator<PointPlaneFeature> > all_surf_features, all_corner_features;
             std::vector<size_t> sel_surf_feature_idx, sel_corner_feature_idx;
             size_t surf_num = 0, corner_num = 0;
             common::timing::Timer gfs_timer("mapping_match_feat");
@@ -525,7 +628,8 @@ void scan2MapOptimization()
                                         'c',
                                         FLAGS_gf_method,
                                         gf_ratio_cur, 
-                                        sub_mat_H); //累加好points的残差对pose的雅克比
+                                        sub_mat_H, //累加好points的残差对pose的雅克比
+                                        &corner_match_cache);
                 corner_num = sel_corner_feature_idx.size();
             }
             if (POINT_PLANE_FACTOR)
@@ -540,14 +644,19 @@ void scan2MapOptimization()
                                         's',
                                         FLAGS_gf_method,
                                         gf_ratio_cur, 
-                                        sub_mat_H);
+                                        sub_mat_H,
+                                        &surf_match_cache);
                 surf_num = sel_surf_feature_idx.size();
             }
             gf_logdet_H_list.push_back(common::logDet(sub_mat_H, true));
             printf("matching features time: %fms\n", gfs_timer.Stop() * 1000);
+            printf("reused matches: surf %lu/%lu, corner %lu/%lu\n",
+                   surf_match_cache.numHit(), surf_match_cache.numQuery(), corner_match_cache.numHit(), corner_match_cache.numQuery());
             // printf("matching surf & corner num: %lu, %lu\n", surf_num, corner_num);
             
             //把好points的残差加入ceres
+            FeatureBatch feature_batch(0.1); // BATCH_MAP_FACTOR: all features in one block, with the huber loss of the problem
+            if (BATCH_MAP_FACTOR) feature_batch.reserve(sel_surf_feature_idx.size(), sel_corner_feature_idx.size());
             for (const size_t &fid : sel_surf_feature_idx)
             {
                 const PointPlaneFeature &feature = all_surf_features[fid];
@@ -557,7 +666,12 @@ void scan2MapOptimization()
                     extractCov(laser_cloud_surf_cov->points[feature.idx_], cov_matrix);
                 else 
                     cov_matrix = COV_MEASUREMENT;
-                LidarMapPlaneNormFactor *f = new LidarMapPlaneNormFactor(feature.point_, feature.coeffs_, cov_matrix);
+                if (BATCH_MAP_FACTOR)
+                {
+                    feature_batch.addSurf(feature, LidarMapBatchFactor::sqrtInfo(cov_matrix));
+                    continue;
+                }
+                LidarMapPlaneNormFactor *f = new LidarMapPlaneNormFactor(feature.point_, feature.coeffs_.head<4>(), cov_matrix);
                 ceres::internal::ResidualBlock *res_id = problem.AddResidualBlock(f, loss_function, para_pose); //对当前帧在map下的初值进行refine
                 res_ids_proj.push_back(res_id);
             }
@@ -572,6 +686,11 @@ void scan2MapOptimization()
                     extractCov(laser_cloud_corner_cov->points[feature.idx_], cov_matrix);
                 else
                     cov_matrix = COV_MEASUREMENT;
+                if (BATCH_MAP_FACTOR)
+                {
+                    feature_batch.addCorner(feature, LidarMapBatchFactor::sqrtInfo(cov_matrix));
+                    continue;
+                }
                 LidarMapEdgeFactor *f = new LidarMapEdgeFactor(feature.point_, feature.coeffs_, cov_matrix);
                 ceres::internal::ResidualBlock *res_id = problem.AddResidualBlock(f, loss_function, para_pose);
                 res_ids_proj.push_back(res_id);
@@ -583,6 +702,12 @@ void scan2MapOptimization()
                     CHECK_JACOBIAN = 0;
                 }
             }
+            if (BATCH_MAP_FACTOR && (feature_batch.numSurf() + feature_batch.numCorner() > 0))
+            {
+                LidarMapBatchFactor *f = new LidarMapBatchFactor(std::move(feature_batch));
+                ceres::internal::ResidualBlock *res_id = problem.AddResidualBlock(f, NULL, para_pose);
+                res_ids_proj.push_back(res_id);
+            }
             // printf("add constraints: %fms\n", t_add_constraints.toc());
 
             // ******************************************************
@@ -697,10 +822,30 @@ void saveKeyframe()
     pcl::copyPointCloud(*laser_cloud_corner_cov, *corner_keyframe_cov);
     pcl::copyPointCloud(*laser_cloud_outlier_cov, *outlier_keyframe_cov);
 
-    surf_cloud_keyframes_cov.push_back(surf_keyframe_cov);
-    corner_cloud_keyframes_cov.push_back(corner_keyframe_cov);
-    outlier_cloud_keyframes_cov.push_back(outlier_keyframe_cov);
-    printf("current keyframes size: %lu\n", pose_keyframes_3d->size());
+    const int key_ind = pose_keyframes_3d->size() - 1;
+    keyframe_store.add(key_ind, pose_3d, surf_keyframe_cov, corner_keyframe_cov, outlier_keyframe_cov);
+    // the keyframe is transformed and merged into the global map later, by the map thread, with the current pose and extrinsics
+    // its clouds are read from the store, so that an evicted tile of the global map is rebuilt from the tiles on disk
+    const Pose pose_keyframe = pose_wmap_curr;
+    const std::vector<Pose> pose_ext_keyframe = pose_ext;
+    global_map.addKeyframe(pose_3d, [key_ind, pose_keyframe, pose_ext_keyframe]()
+    {
+        KeyframeStore::Keyframe keyframe = keyframe_store.get(key_ind);
+        PointICovCloud::Ptr cloud_map(new PointICovCloud());
+        PointICovCloud cloud_global;
+        for (const PointICovCloud::ConstPtr &cloud_local : {keyframe.surf_, keyframe.corner_, keyframe.outlier_})
+        {
+            cloudUCTAssociateToMap(*cloud_local, cloud_global, pose_keyframe, pose_ext_keyframe);
+            *cloud_map += cloud_global;
+        }
+        return PointICovCloud::ConstPtr(cloud_map);
+    });
+    // keyframes far away are moved to disk, together with their map clouds in the cache
+    size_t num_evicted = keyframe_store.evict(pose_3d);
+    if (keyframe_store.isOutOfCore())
+        uct_cache.eraseIf([](const int &key_ind) { return !keyframe_store.isResident(key_ind); });
+    printf("current keyframes size: %lu, in memory: %lu, evicted: %lu\n",
+           pose_keyframes_3d->size(), keyframe_store.numResident(), num_evicted);
 }
 
 void updateKeyframe()
@@ -708,27 +853,39 @@ void updateKeyframe()
     std::cout << common::YELLOW << "received loop info, need to update all keyframes" << common::RESET << std::endl;  
 }
 
+// append the points of cloud transformed to the map (the subscribed clouds are shared, they are not modified)
+void cloudAssociateToMap(const PointICloud &cloud, PointICloud &cloud_map)
+{
+    size_t offset = cloud_map.size();
+    cloud_map.resize(offset + cloud.size());
+    for (size_t i = 0; i < cloud.size(); i++) pointAssociateToMap(cloud.points[i], cloud_map.points[offset + i], pose_wmap_curr);
+}
+
 void pubPointCloud()
 {
     // publish registrated laser cloud
-    *laser_cloud_full_res += *laser_cloud_outlier;
-    for (PointI &point : *laser_cloud_full_res) pointAssociateToMap(point, point, pose_wmap_curr); //转换到map下
+    PointICloud laser_cloud_full_res_map;
+    laser_cloud_full_res_map.reserve(laser_cloud_full_res->size() + laser_cloud_outlier->size());
+    cloudAssociateToMap(*laser_cloud_full_res, laser_cloud_full_res_map); //转换到map下
+    cloudAssociateToMap(*laser_cloud_outlier, laser_cloud_full_res_map);
     sensor_msgs::PointCloud2 laser_cloud_full_res_msg;
-    pcl::toROSMsg(*laser_cloud_full_res, laser_cloud_full_res_msg);
+    pcl::toROSMsg(laser_cloud_full_res_map, laser_cloud_full_res_msg);
     laser_cloud_full_res_msg.header.stamp = ros::Time().fromSec(time_laser_odometry);
     laser_cloud_full_res_msg.header.frame_id = "/world";
     pub_laser_cloud_full_res.publish(laser_cloud_full_res_msg);
 
-    for (PointI &point : *laser_cloud_surf_last) pointAssociateToMap(point, point, pose_wmap_curr);
+    PointICloud laser_cloud_surf_last_map;
+    cloudAssociateToMap(*laser_cloud_surf_last, laser_cloud_surf_last_map);
     sensor_msgs::PointCloud2 laser_cloud_surf_last_msg;
-    pcl::toROSMsg(*laser_cloud_surf_last, laser_cloud_surf_last_msg);
+    pcl::toROSMsg(laser_cloud_surf_last_map, laser_cloud_surf_last_msg);
     laser_cloud_surf_last_msg.header.stamp = ros::Time().fromSec(time_laser_odometry);
     laser_cloud_surf_last_msg.header.frame_id = "/world";
     pub_laser_cloud_surf_last_res.publish(laser_cloud_surf_last_msg);
 
-    for (PointI &point : *laser_cloud_corner_last) pointAssociateToMap(point, point, pose_wmap_curr);
+    PointICloud laser_cloud_corner_last_map;
+    cloudAssociateToMap(*laser_cloud_corner_last, laser_cloud_corner_last_map);
     sensor_msgs::PointCloud2 laser_cloud_corner_last_msg;
-    pcl::toROSMsg(*laser_cloud_corner_last, laser_cloud_corner_last_msg);
+    pcl::toROSMsg(laser_cloud_corner_last_map, laser_cloud_corner_last_msg);
     laser_cloud_corner_last_msg.header.stamp = ros::Time().fromSec(time_laser_odometry);
     laser_cloud_corner_last_msg.header.frame_id = "/world";
     pub_laser_cloud_corner_last_res.publish(laser_cloud_corner_last_msg);
@@ -798,77 +955,96 @@ void pubOdometry()
     }
 }
 
+// runs at a low priority, without the lock of the mapping thread:
+// publishes the copy of the surrounding map, merges the new keyframes into the global map within GLOBAL_MAP_CPU_BUDGET
+// (fraction of one core, the work is serial),
+// then publishes the changed and the released tiles (/laser_cloud_map_delta) and, at most every 2s, the map around the vehicle
 void pubGlobalMap()
 {
-    ros::Rate rate(0.5);
+    setpriority(PRIO_PROCESS, syscall(SYS_gettid), 19);
+    // the parallel regions started from this thread (OpenMP in cloudUCTAssociateToMap) run on this thread only,
+    // so that the budget of wall time is also the CPU time spent on the global map
+    omp_set_num_threads(1);
+
+    const double period = 0.1;
+    const double time_budget = period * 1000 * GLOBAL_MAP_CPU_BUDGET; // ms per period
+    double time_credit = 0;
+    size_t revision_pub = 0, num_map_subscribers = 0;
+    ros::Time time_pub_surround(0), time_pub_map(0);
+    ros::Rate rate(1.0 / period);
     while (ros::ok())
     {
         rate.sleep();
-        if (pub_laser_cloud_surrounding.getNumSubscribers() != 0)
+        ros::Time time_now = ros::Time::now();
+        if ((pub_laser_cloud_surrounding.getNumSubscribers() != 0) && ((time_now - time_pub_surround).toSec() >= 2.0))
         {
-            sensor_msgs::PointCloud2 laser_cloud_surround_msg;
-            pcl::toROSMsg(*laser_cloud_surf_from_map_cov_ds + *laser_cloud_corner_from_map_cov_ds, laser_cloud_surround_msg);
-            // pcl::toROSMsg(*laser_cloud_surf_from_map_cov_ds, laser_cloud_surround_msg);
-            laser_cloud_surround_msg.header.stamp = ros::Time().fromSec(time_laser_odometry);
-            laser_cloud_surround_msg.header.frame_id = "/world";
-            pub_laser_cloud_surrounding.publish(laser_cloud_surround_msg);
+            PointICovCloud::ConstPtr laser_cloud_surround;
+            {
+                std::lock_guard<std::mutex> lock(m_surround);
+                laser_cloud_surround = laser_cloud_surround_snapshot;
+            }
+            if (laser_cloud_surround)
+            {
+                sensor_msgs::PointCloud2 laser_cloud_surround_msg;
+                pcl::toROSMsg(*laser_cloud_surround, laser_cloud_surround_msg);
+                laser_cloud_surround_msg.header.stamp = ros::Time().fromSec(time_laser_odometry);
+                laser_cloud_surround_msg.header.frame_id = "/world";
+                pub_laser_cloud_surrounding.publish(laser_cloud_surround_msg);
+            }
+            time_pub_surround = time_now;
         }
 
-        if ((pub_laser_cloud_map.getNumSubscribers() != 0) && (!pose_keyframes_3d->points.empty()))
-        {
-            global_map_keyframes->clear();
-            global_map_keyframes_ds->clear();
-
-            std::vector<int> point_search_ind;
-            std::vector<float> point_search_sq_dis;
-
-            kdtree_global_map_keyframes->setInputCloud(pose_keyframes_3d);            
-            kdtree_global_map_keyframes->radiusSearch(pose_point_cur, (double)GLOBALMAP_KF_RADIUS, point_search_ind, point_search_sq_dis, 0);
-
-            for (int i = 0; i < point_search_ind.size(); i++)
-                global_map_keyframes->points.push_back(pose_keyframes_3d->points[point_search_ind[i]]);
+        // the time over the budget is paid back in the next periods
+        time_credit = std::min(time_credit + time_budget, time_budget);
+        if (time_credit > 0) time_credit -= global_map.update(time_credit);
 
-            down_size_filter_global_map_keyframes.setInputCloud(global_map_keyframes);
-            down_size_filter_global_map_keyframes.filter(*global_map_keyframes_ds);
-
-            PointICovCloud::Ptr laser_cloud_map(new PointICovCloud());
-            PointICovCloud::Ptr laser_cloud_map_ds(new PointICovCloud());
-            for (int i = 0; i < global_map_keyframes_ds->size(); i++)
+        if (pub_laser_cloud_map_delta.getNumSubscribers() != 0)
+        {
+            GlobalMapBuilder::TileClouds tiles;
+            std::vector<GlobalMapBuilder::TileKey> evicted;
+            if (global_map.getDelta(tiles, evicted) != 0)
             {
-                int key_ind = (int)global_map_keyframes_ds->points[i].intensity;
-                PointICovCloud surf_trans;
-                cloudUCTAssociateToMap(*surf_cloud_keyframes_cov[key_ind], surf_trans, pose_keyframes_6d[key_ind].second, pose_ext);
-                *laser_cloud_map += surf_trans;
-
-                PointICovCloud corner_trans;
-                cloudUCTAssociateToMap(*corner_cloud_keyframes_cov[key_ind], corner_trans, pose_keyframes_6d[key_ind].second, pose_ext);
-                *laser_cloud_map += corner_trans;
-
-                PointICovCloud outlier_trans;
-                cloudUCTAssociateToMap(*outlier_cloud_keyframes_cov[key_ind], outlier_trans, pose_keyframes_6d[key_ind].second, pose_ext);
-                *laser_cloud_map += outlier_trans;
+                mloam_msgs::MapDelta laser_cloud_delta_msg;
+                laser_cloud_delta_msg.header.stamp = ros::Time().fromSec(time_laser_odometry);
+                laser_cloud_delta_msg.header.frame_id = "/world";
+                laser_cloud_delta_msg.tile_size = global_map.tileSize();
+                auto tileMsg = [](const GlobalMapBuilder::TileKey &key)
+                {
+                    mloam_msgs::MapTile tile_msg;
+                    tile_msg.x = std::get<0>(key);
+                    tile_msg.y = std::get<1>(key);
+                    tile_msg.z = std::get<2>(key);
+                    return tile_msg;
+                };
+                for (const auto &tile : tiles)
+                {
+                    laser_cloud_delta_msg.tiles.push_back(tileMsg(tile.first));
+                    pcl::toROSMsg(*tile.second, laser_cloud_delta_msg.tiles.back().cloud);
+                    laser_cloud_delta_msg.tiles.back().cloud.header = laser_cloud_delta_msg.header;
+                }
+                for (const GlobalMapBuilder::TileKey &key : evicted) laser_cloud_delta_msg.evicted.push_back(tileMsg(key));
+                pub_laser_cloud_map_delta.publish(laser_cloud_delta_msg);
             }
+        }
 
-            // if ((abs(pose_wmap_curr.t_.x()) >= 1000) || (abs(pose_wmap_curr.t_.y()) >= 1000) || (abs(pose_wmap_curr.t_.z()) >= 1000))
-            // {
-            //     down_size_filter_global_map_cov.setLeafSize(2.0, 2.0, 2.0);
-            //     down_size_filter_global_map_cov.setTraceThreshold(TRACE_THRESHOLD_MAPPING);
-            // } else
-            // {
-            //     down_size_filter_global_map_cov.setLeafSize(0.8, 0.8, 0.8);
-            //     down_size_filter_global_map_cov.setTraceThreshold(TRACE_THRESHOLD_MAPPING);
-            // }
-            down_size_filter_global_map_cov.setLeafSize(MAP_SURF_RES, MAP_SURF_RES, MAP_SURF_RES);
-            down_size_filter_global_map_cov.setTraceThreshold(TRACE_THRESHOLD_MAPPING);
-            down_size_filter_global_map_cov.setInputCloud(laser_cloud_map);
-            down_size_filter_global_map_cov.filter(*laser_cloud_map_ds);
-
+        // only when the map has changed or someone new subscribed
+        size_t num_subscribers = pub_laser_cloud_map.getNumSubscribers();
+        if ((num_subscribers != 0) && ((time_now - time_pub_map).toSec() >= 2.0) &&
+            ((global_map.revision() != revision_pub) || (num_subscribers > num_map_subscribers)))
+        {
+            PointICovCloud::Ptr laser_cloud_map(new PointICovCloud());
+            global_map.getMap(global_map.lastKeyframePosition(), GLOBALMAP_KF_RADIUS, *laser_cloud_map);
             sensor_msgs::PointCloud2 laser_cloud_msg;
-            pcl::toROSMsg(*laser_cloud_map_ds, laser_cloud_msg);
+            pcl::toROSMsg(*laser_cloud_map, laser_cloud_msg);
             laser_cloud_msg.header.stamp = ros::Time().fromSec(time_laser_odometry);
             laser_cloud_msg.header.frame_id = "/world";
             pub_laser_cloud_map.publish(laser_cloud_msg);
+            printf("global map tiles: %lu (evicted: %lu), points: %lu, queued keyframes: %lu\n",
+                   global_map.numTiles(), global_map.numEvicted(), laser_cloud_map->size(), global_map.numQueued());
+            revision_pub = global_map.revision();
+            time_pub_map = time_now;
         }
+        num_map_subscribers = num_subscribers;
     }
 }
 
@@ -876,12 +1052,6 @@ void saveGlobalMap()
 {
     std::cout << common::YELLOW << "Saving keyframe poses & map cloud (corner + surf) /tmp/mloam_*.pcd" << common::RESET << std::endl;
     pcd_writer.write("/tmp/mloam_mapping_keyframes.pcd", *pose_keyframes_3d);
-    
-    PointICovCloud::Ptr laser_cloud_map(new PointICovCloud());
-    PointICovCloud::Ptr laser_cloud_surf_map(new PointICovCloud());
-    PointICovCloud::Ptr laser_cloud_surf_map_ds(new PointICovCloud());
-    PointICovCloud::Ptr laser_cloud_corner_map(new PointICovCloud());
-    PointICovCloud::Ptr laser_cloud_corner_map_ds(new PointICovCloud());
 
     printf("global keyframes num: %lu\n", pose_keyframes_3d->size());
     for (size_t i = 0; i < pose_keyframes_3d->size(); i++)
@@ -889,21 +1059,10 @@ void saveGlobalMap()
 
     down_size_filter_global_map_keyframes.setInputCloud(global_map_keyframes);
     down_size_filter_global_map_keyframes.filter(*global_map_keyframes_ds);
+    std::vector<int> global_keyframes_id;
     for (int i = 0; i < global_map_keyframes_ds->size(); i++)
-    {
-        int key_ind = (int)global_map_keyframes_ds->points[i].intensity;
-        PointICovCloud surf_trans;
-        cloudUCTAssociateToMap(*surf_cloud_keyframes_cov[key_ind], surf_trans, pose_keyframes_6d[key_ind].second, pose_ext);
-        *laser_cloud_surf_map += surf_trans;
-
-        PointICovCloud outlier_trans;
-        cloudUCTAssociateToMap(*outlier_cloud_keyframes_cov[key_ind], outlier_trans, pose_keyframes_6d[key_ind].second, pose_ext);
-        *laser_cloud_surf_map += outlier_trans;
-
-        PointICovCloud corner_trans;
-        cloudUCTAssociateToMap(*corner_cloud_keyframes_cov[key_ind], corner_trans, pose_keyframes_6d[key_ind].second, pose_ext);
-        *laser_cloud_corner_map += corner_trans;
-    }
+        global_keyframes_id.push_back((int)global_map_keyframes_ds->points[i].intensity);
+    keyframe_store.sortByTile(global_keyframes_id);
 
     // adpatively change the resolution of the global map by checking the range
     // if ((abs(pose_wmap_curr.t_.x()) >= 1000) || (abs(pose_wmap_curr.t_.y()) >= 1000) || (abs(pose_wmap_curr.t_.z()) >= 1000))
@@ -918,27 +1077,27 @@ void saveGlobalMap()
     // }
     down_size_filter_global_map_cov.setLeafSize(MAP_SURF_RES * 2, MAP_SURF_RES * 2, MAP_SURF_RES * 2);
     down_size_filter_global_map_cov.setTraceThreshold(TRACE_THRESHOLD_MAPPING);
-    down_size_filter_global_map_cov.setInputCloud(laser_cloud_surf_map);
-    down_size_filter_global_map_cov.filter(*laser_cloud_surf_map_ds);
-    down_size_filter_global_map_cov.setInputCloud(laser_cloud_corner_map);
-    down_size_filter_global_map_cov.filter(*laser_cloud_corner_map_ds);
 
-    if (with_ua_flag)
+    // stream the keyframes into map tiles, then downsample and write the map tile by tile
+    std::string spill_path = KEYFRAME_STORE_PATH.empty() ? "/tmp/mloam_mapping_tiles" : KEYFRAME_STORE_PATH + "/map_tiles";
+    MapTileStream surf_map_tiles(spill_path + "/surf", MAP_SURF_RES * 2, KEYFRAME_TILE_SIZE);
+    MapTileStream corner_map_tiles(spill_path + "/corner", MAP_SURF_RES * 2, KEYFRAME_TILE_SIZE);
+    for (const int &key_ind : global_keyframes_id)
     {
-        pcd_writer.write("/tmp/mloam_mapping_surf_cloud.pcd", *laser_cloud_surf_map_ds);
-        pcd_writer.write("/tmp/mloam_mapping_corner_cloud.pcd", *laser_cloud_corner_map_ds);
-        *laser_cloud_map += *laser_cloud_surf_map_ds;
-        *laser_cloud_map += *laser_cloud_corner_map_ds;
-        pcd_writer.write("/tmp/mloam_mapping_cloud.pcd", *laser_cloud_map);
-    }
-    else
-    {
-        pcd_writer.write("/tmp/mloam_mapping_surf_cloud_wo_ua.pcd", *laser_cloud_surf_map_ds);
-        pcd_writer.write("/tmp/mloam_mapping_corner_cloud_wo_ua.pcd", *laser_cloud_corner_map_ds);
-        *laser_cloud_map += *laser_cloud_surf_map_ds;
-        *laser_cloud_map += *laser_cloud_corner_map_ds;
-        pcd_writer.write("/tmp/mloam_mapping_cloud_wo_ua.pcd", *laser_cloud_map);
+        KeyframeStore::Keyframe keyframe = keyframe_store.get(key_ind);
+        surf_map_tiles.add(*getKeyframeCloudMap(key_ind, keyframe, 's'));
+        surf_map_tiles.add(*getKeyframeCloudMap(key_ind, keyframe, 'o'));
+        corner_map_tiles.add(*getKeyframeCloudMap(key_ind, keyframe, 'c'));
     }
+
+    std::string suffix = with_ua_flag ? "" : "_wo_ua";
+    PCDCovStreamWriter surf_map_writer, corner_map_writer, map_writer;
+    surf_map_writer.open("/tmp/mloam_mapping_surf_cloud" + suffix + ".pcd");
+    corner_map_writer.open("/tmp/mloam_mapping_corner_cloud" + suffix + ".pcd");
+    map_writer.open("/tmp/mloam_mapping_cloud" + suffix + ".pcd");
+    surf_map_tiles.flush(down_size_filter_global_map_cov, {&surf_map_writer, &map_writer});
+    corner_map_tiles.flush(down_size_filter_global_map_cov, {&corner_map_writer, &map_writer});
+    printf("global map points, corner/surf: %lu, %lu\n", corner_map_writer.size(), surf_map_writer.size());
 }
 
 void clearCloud()
@@ -961,7 +1120,7 @@ void process()
 			//********************* * 100******************************************************
 			// step 1: pop up subscribed data
 			m_buf.lock();
-			while (!corner_last_buf.empty() && corner_last_buf.front()->header.stamp.toSec() < surf_last_buf.front()->header.stamp.toSec())
+			while (!corner_last_buf.empty() && cloudTime(corner_last_buf.front()) < cloudTime(surf_last_buf.front()))
 				corner_last_buf.pop();
 			if (corner_last_buf.empty())
 			{
@@ -969,7 +1128,7 @@ void process()
 				break;
 			}
 
-			while (!full_res_buf.empty() && full_res_buf.front()->header.stamp.toSec() < surf_last_buf.front()->header.stamp.toSec())
+			while (!full_res_buf.empty() && cloudTime(full_res_buf.front()) < cloudTime(surf_last_buf.front()))
 				full_res_buf.pop();
 			if (full_res_buf.empty())
 			{
@@ -977,7 +1136,7 @@ void process()
 				break;
 			}
 
-			while (!outlier_buf.empty() && outlier_buf.front()->header.stamp.toSec() < surf_last_buf.front()->header.stamp.toSec())
+			while (!outlier_buf.empty() && cloudTime(outlier_buf.front()) < cloudTime(surf_last_buf.front()))
 				outlier_buf.pop();
 			if (outlier_buf.empty())
 			{
@@ -985,7 +1144,7 @@ void process()
 				break;
 			}            
 
-			while (!odometry_buf.empty() && odometry_buf.front()->header.stamp.toSec() < surf_last_buf.front()->header.stamp.toSec())
+			while (!odometry_buf.empty() && odometry_buf.front()->header.stamp.toSec() < cloudTime(surf_last_buf.front()))
 				odometry_buf.pop();
 			if (odometry_buf.empty())
 			{
@@ -993,7 +1152,7 @@ void process()
 				break;
 			}
 
-			while (!ext_buf.empty() && ext_buf.front()->header.stamp.toSec() < surf_last_buf.front()->header.stamp.toSec())
+			while (!ext_buf.empty() && ext_buf.front()->header.stamp.toSec() < cloudTime(surf_last_buf.front()))
 				ext_buf.pop();
 			if (ext_buf.empty())
 			{
@@ -1001,10 +1160,10 @@ void process()
 				break;
 			}
 
-			time_laser_cloud_surf_last = surf_last_buf.front()->header.stamp.toSec();
-			time_laser_cloud_corner_last = corner_last_buf.front()->header.stamp.toSec();
-			time_laser_cloud_full_res = full_res_buf.front()->header.stamp.toSec();
-            time_laser_cloud_outlier = outlier_buf.front()->header.stamp.toSec();
+			time_laser_cloud_surf_last = cloudTime(surf_last_buf.front());
+			time_laser_cloud_corner_last = cloudTime(corner_last_buf.front());
+			time_laser_cloud_full_res = cloudTime(full_res_buf.front());
+            time_laser_cloud_outlier = cloudTime(outlier_buf.front());
             time_laser_odometry = odometry_buf.front()->header.stamp.toSec();
 			time_ext = ext_buf.front()->header.stamp.toSec();
 
@@ -1025,20 +1184,16 @@ void process()
 
             //消息是同步的
 
-			laser_cloud_surf_last->clear();
-			pcl::fromROSMsg(*surf_last_buf.front(), *laser_cloud_surf_last);
+			laser_cloud_surf_last = surf_last_buf.front();
 			surf_last_buf.pop();
 
-			laser_cloud_corner_last->clear();
-			pcl::fromROSMsg(*corner_last_buf.front(), *laser_cloud_corner_last);
+			laser_cloud_corner_last = corner_last_buf.front();
 			corner_last_buf.pop();
 
-			laser_cloud_full_res->clear();
-			pcl::fromROSMsg(*full_res_buf.front(), *laser_cloud_full_res);
+			laser_cloud_full_res = full_res_buf.front();
 			full_res_buf.pop();
 
-            laser_cloud_outlier->clear();
-            pcl::fromROSMsg(*outlier_buf.front(), *laser_cloud_outlier);
+            laser_cloud_outlier = outlier_buf.front();
             outlier_buf.pop();
 
             pose_wodom_curr.q_ = Eigen::Quaterniond(odometry_buf.front()->pose.pose.orientation.w,
@@ -1124,7 +1279,7 @@ void process()
 
             pubOdometry();
 
-            if (save_new_keyframe) clearCloud(); // if save new keyframe, clear the map point cloud
+            if (save_new_keyframe && !INCREMENTAL_LOCAL_MAP) clearCloud(); // if save new keyframe, clear the map point cloud
 
             double process_time = process_timer.Stop() * 1000;
             std::cout << common::RED << "frame: " << frame_cnt
@@ -1146,45 +1301,69 @@ void cloudUCTAssociateToMap(const PointICovCloud &cloud_local, //关键帧points
                             const Pose &pose_global,  //关键帧位姿
                             const vector<Pose> &pose_ext) //外参
 {
-    // the compound pose: pose_global * pose_ext with uncertainty
-    std::vector<Pose> pose_compound(NUM_OF_LASER);
+    // the compound pose: pose_global * pose_ext with uncertainty, only its pose-dependent terms are needed per point
+    std::vector<PointUncertaintyTerms> uct_terms;
+    uct_terms.reserve(NUM_OF_LASER);
     for (size_t n = 0; n < NUM_OF_LASER; n++) 
     {
-        compoundPoseWithCov(pose_global, pose_ext[n], pose_compound[n]); //pose_compound[n]：计算关键帧时刻n号雷达的位姿和cov
-        // if (n == IDX_REF) continue;
-        // std::cout << "pose global: " << pose_global << std::endl;
-        // std::cout << pose_global.cov_ << std::endl;
-        // std::cout << "pose ext: " << pose_ext[n] << std::endl;
-        // std::cout << pose_ext[n].cov_ << std::endl;
-        // std::cout << "pose compound: " << pose_compound[n] << ", "
-        //           << pose_compound[n].cov_.trace() << std::endl;
-        // std::cout << pose_compound[n].cov_ << std::endl;
-        // std::cout << std::endl;
+        Pose pose_compound;
+        compoundPoseWithCov(pose_global, pose_ext[n], pose_compound); //计算关键帧时刻n号雷达的位姿和cov
+        uct_terms.emplace_back(pose_compound);
     }
-    // exit(EXIT_FAILURE);
+    const Eigen::Matrix3d R_global = pose_global.q_.toRotationMatrix();
+    const Eigen::Vector3d &t_global = pose_global.t_;
 
+    // pose_compound[n] * (pose_ext[n].inverse() * p) == pose_global * p: the point in the map is transformed only once
+    const int cloud_local_size = static_cast<int>(cloud_local.size());
     cloud_global.clear();
-    cloud_global.resize(cloud_local.size());
-    size_t cloud_size = 0;
-    for (const PointIWithCov &point_ori : cloud_local)
+    cloud_global.resize(cloud_local_size);
+    std::vector<char> valid(cloud_local_size, 1);
+    #pragma omp parallel for schedule(static) if (cloud_local_size >= MIN_PARALLEL_UCT_SIZE)
+    for (int i = 0; i < cloud_local_size; i++)
     {
+        const PointIWithCov &point_ori = cloud_local.points[i];
         int ind = (int)point_ori.intensity; //雷达index, 见downsampleCurrentScan()
-        PointIWithCov point_sel, point_cov;
+        Eigen::Vector3d point_map = R_global * Eigen::Vector3d(point_ori.x, point_ori.y, point_ori.z) + t_global;
         Eigen::Matrix3d cov_point = Eigen::Matrix3d::Zero();
         if (with_ua_flag) //true
         {
-            pointAssociateToMap(point_ori, point_sel, pose_ext[ind].inverse()); //point_sel: 在n雷达下
-            evalPointUncertainty(point_sel, cov_point, pose_compound[ind]); //根据点的cov和雷达位姿的cov，计算转到map下point的cov
-            if (cov_point.trace() > TRACE_THRESHOLD_MAPPING) continue;
+            uct_terms[ind].evalTransformed(point_map, cov_point); //根据点的cov和雷达位姿的cov，计算转到map下point的cov
+            if (cov_point.trace() > TRACE_THRESHOLD_MAPPING)
+            {
+                valid[i] = 0;
+                continue;
+            }
         }
-        pointAssociateToMap(point_ori, point_cov, pose_global);//point_cov：关键帧在map下points
+        PointIWithCov &point_cov = cloud_global.points[i]; //关键帧在map下points
+        point_cov = point_ori;
+        point_cov.x = point_map.x();
+        point_cov.y = point_map.y();
+        point_cov.z = point_map.z();
         updateCov(point_cov, cov_point); //把计算的cov赋给point_cov
-        cloud_global[cloud_size] = point_cov;
+    }
+
+    int cloud_size = 0;
+    for (int i = 0; i < cloud_local_size; i++)
+    {
+        if (!valid[i]) continue;
+        if (cloud_size != i) cloud_global.points[cloud_size] = cloud_global.points[i];
         cloud_size++;
     }
     cloud_global.resize(cloud_size);
 }
 
+// keyframe cloud in the map frame, only the keyframes kept in memory are cached
+PointICovCloud::ConstPtr getKeyframeCloudMap(const int &key_ind, const KeyframeStore::Keyframe &keyframe, const char &type)
+{
+    const PointICovCloud &cloud_local = (type == 's') ? *keyframe.surf_ : ((type == 'c') ? *keyframe.corner_ : *keyframe.outlier_);
+    const Pose &pose_local = pose_keyframes_6d[key_ind].second;
+    if (keyframe_store.isResident(key_ind))
+        return uct_cache.get(key_ind, type, cloud_local, pose_local, pose_ext);
+    PointICovCloud::Ptr cloud_map(new PointICovCloud());
+    cloudUCTAssociateToMap(cloud_local, *cloud_map, pose_local, pose_ext);
+    return cloud_map;
+}
+
 void evalHessian(const ceres::CRSMatrix &jaco, Eigen::Matrix<double, 6, 6> &mat_H)
 {
 	// printf("jacob: %d constraints, %d parameters\n", jaco.num_rows, jaco.num_cols); // 2000+, 6
@@ -1254,21 +1433,10 @@ void sigintHandler(int sig)
     ros::shutdown();
 }
 
-int main(int argc, char **argv)
+// subscribers, publishers and threads of the mapping, the parameters are read before
+// called by main() or by the odometry node in mloam_node_composed (same process, same spinner)
+void startMapper(ros::NodeHandle &nh)
 {
-	// if (argc < 5)
-	// {
-	// 	printf("please intput: rosrun mloam lidar_mapper [args] \n"
-	// 		   "for example: "
-	// 		   "rosrun mloam lidar_mapper config_file 1 output_path 1 \n");
-	// 	return 1;
-	// }
-	google::InitGoogleLogging(argv[0]);
-	google::ParseCommandLineFlags(&argc, &argv, true);
-
-	ros::init(argc, argv, "lidar_mapper");
-	ros::NodeHandle nh;
-
     MLOAM_RESULT_SAVE = FLAGS_result_save;
     OUTPUT_FOLDER = FLAGS_output_path;
 	with_ua_flag = FLAGS_with_ua;
@@ -1282,23 +1450,23 @@ int main(int argc, char **argv)
     else
         MLOAM_MAP_PATH = OUTPUT_FOLDER + "traj/stamped_mloam_map_wo_ua_estimate_" + FLAGS_gf_method + "_" + to_string(FLAGS_gf_ratio_ini) + ".txt";
 
-    std::cout << "config file: " << FLAGS_config_file << std::endl;
-	readParameters(FLAGS_config_file);
 	printf("Mapping as %fhz\n", 1.0 / (SCAN_PERIOD * SKIP_NUM_ODOM_PUB));
 
-	ros::Subscriber sub_laser_cloud_full_res = nh.subscribe<sensor_msgs::PointCloud2>("/laser_cloud", 10, laserCloudFullResHandler); //所有雷达curr points, 转到主雷达下 
-    ros::Subscriber sub_laser_cloud_outlier = nh.subscribe<sensor_msgs::PointCloud2>("/laser_cloud_outlier", 10, laserCloudOutlierResHandler); //所有雷达curr outlier points, 包含没有形成聚类的points, 转到主雷达下 
-    ros::Subscriber sub_laser_cloud_surf_last = nh.subscribe<sensor_msgs::PointCloud2>("/surf_points_less_flat", 10, laserCloudSurfLastHandler); //所有雷达curr surf_less_flat points, 转到主雷达下 
-	ros::Subscriber sub_laser_cloud_corner_last = nh.subscribe<sensor_msgs::PointCloud2>("/corner_points_less_sharp", 10, laserCloudCornerLastHandler); //所有雷达curr corner_less_sharp points, 转到主雷达下
-	ros::Subscriber sub_laser_odometry = nh.subscribe<nav_msgs::Odometry>("/laser_odom", 10, laserOdometryHandler); //remapped, "laser_odom_0"
-	ros::Subscriber sub_extrinsic = nh.subscribe<mloam_msgs::Extrinsics>("/extrinsics", 10, extrinsicsHandler); //外参
-    ros::Subscriber sub_loop_info = nh.subscribe<mloam_msgs::Keyframes>("/loop_info", 10, loopInfoHandler); //mloam_loop模块
+    // the clouds are subscribed as PointICloud: no serialization from the odometry in the same process, no fromROSMsg otherwise
+	sub_mapper.push_back(nh.subscribe<PointICloud>("/laser_cloud", 10, laserCloudFullResHandler)); //所有雷达curr points, 转到主雷达下 
+    sub_mapper.push_back(nh.subscribe<PointICloud>("/laser_cloud_outlier", 10, laserCloudOutlierResHandler)); //所有雷达curr outlier points, 包含没有形成聚类的points, 转到主雷达下 
+    sub_mapper.push_back(nh.subscribe<PointICloud>("/surf_points_less_flat", 10, laserCloudSurfLastHandler)); //所有雷达curr surf_less_flat points, 转到主雷达下 
+	sub_mapper.push_back(nh.subscribe<PointICloud>("/corner_points_less_sharp", 10, laserCloudCornerLastHandler)); //所有雷达curr corner_less_sharp points, 转到主雷达下
+	sub_mapper.push_back(nh.subscribe<nav_msgs::Odometry>("/laser_odom", 10, laserOdometryHandler)); //remapped, "laser_odom_0"
+	sub_mapper.push_back(nh.subscribe<mloam_msgs::Extrinsics>("/extrinsics", 10, extrinsicsHandler)); //外参
+    sub_mapper.push_back(nh.subscribe<mloam_msgs::Keyframes>("/loop_info", 10, loopInfoHandler)); //mloam_loop模块
 
 	pub_laser_cloud_full_res = nh.advertise<sensor_msgs::PointCloud2>("/laser_cloud_registered", 5); //每一帧在map下points，包含了outliers(未聚类的points)
 	pub_laser_cloud_surf_last_res = nh.advertise<sensor_msgs::PointCloud2>("/laser_cloud_surf_registered", 5); //每一帧surf在map下points
 	pub_laser_cloud_corner_last_res = nh.advertise<sensor_msgs::PointCloud2>("/laser_cloud_corner_registered", 5);//每一帧corner在map下points
 	pub_laser_cloud_surrounding = nh.advertise<sensor_msgs::PointCloud2>("/laser_cloud_surround", 5); //local map
 	pub_laser_cloud_map = nh.advertise<sensor_msgs::PointCloud2>("/laser_cloud_map", 5); //发布的是距离当前帧GLOBALMAP_KF_RADIUS以内的所有关键帧组成的map
+	pub_laser_cloud_map_delta = nh.advertise<mloam_msgs::MapDelta>("/laser_cloud_map_delta", 5); // tiles of the global map changed and released since the last message
     pub_good_surf_feature = nh.advertise<sensor_msgs::PointCloud2>("/laser_cloud_surf_good", 5);
 
 	pub_odom_aft_mapped = nh.advertise<nav_msgs::Odometry>("/laser_map", 5); // raw pose from odometry in the world   curr主雷达在map下位姿
@@ -1323,6 +1491,24 @@ int main(int argc, char **argv)
     down_size_filter_surrounding_keyframes.setLeafSize(MAP_SUR_KF_RES, MAP_SUR_KF_RES, MAP_SUR_KF_RES);
     down_size_filter_global_map_keyframes.setLeafSize(10, 10, 10);
 
+    if (!keyframe_store.setParameters(KEYFRAME_STORE_PATH, KEYFRAME_TILE_SIZE, KEYFRAME_EVICT_RADIUS))
+    {
+        std::cout << common::YELLOW << "keyframe_store_path: " << KEYFRAME_STORE_PATH
+                  << " must be empty, not exist, or be a keyframe store" << common::RESET << std::endl;
+        ROS_BREAK();
+        return;
+    }
+    global_map.setParameters(MAP_SURF_RES, GLOBAL_MAP_TILE_SIZE, 10, TRACE_THRESHOLD_MAPPING, GLOBALMAP_KF_RADIUS);
+
+    if (INCREMENTAL_LOCAL_MAP)
+    {
+        // the matching only uses neighbors closer than sqrt(MIN_MATCH_SQ_DIS)
+        surf_voxel_map.setParameters(MAP_SURF_RES, sqrt(MIN_MATCH_SQ_DIS), TRACE_THRESHOLD_MAPPING);
+        corner_voxel_map.setParameters(MAP_CORNER_RES, sqrt(MIN_MATCH_SQ_DIS), TRACE_THRESHOLD_MAPPING);
+        kdtree_surf_from_map.reset(new VoxelMapCovSearch(&surf_voxel_map));
+        kdtree_corner_from_map.reset(new VoxelMapCovSearch(&corner_voxel_map));
+    }
+
     cov_mapping.setZero();
 
     pose_ext.resize(NUM_OF_LASER);
@@ -1343,8 +1529,35 @@ int main(int argc, char **argv)
 
     signal(SIGINT, sigintHandler);
 
-    std::thread mapping_process{process}; //入口
-    std::thread pub_map_process{pubGlobalMap};
+    mapping_process = std::thread(process); //入口
+    pub_map_process = std::thread(pubGlobalMap);
+}
+
+void stopMapper()
+{
+    pub_map_process.detach();
+    mapping_process.join();
+}
+
+#ifndef MLOAM_COMPOSED
+int main(int argc, char **argv)
+{
+	// if (argc < 5)
+	// {
+	// 	printf("please intput: rosrun mloam lidar_mapper [args] \n"
+	// 		   "for example: "
+	// 		   "rosrun mloam lidar_mapper config_file 1 output_path 1 \n");
+	// 	return 1;
+	// }
+	google::InitGoogleLogging(argv[0]);
+	google::ParseCommandLineFlags(&argc, &argv, true);
+
+	ros::init(argc, argv, "lidar_mapper");
+	ros::NodeHandle nh;
+
+    std::cout << "config file: " << FLAGS_config_file << std::endl;
+	readParameters(FLAGS_config_file);
+    startMapper(nh);
 
     ros::Rate loop_rate(100);
 	while (ros::ok()) 
@@ -1353,10 +1566,10 @@ int main(int argc, char **argv)
 		loop_rate.sleep();
     }
 
-    pub_map_process.detach();
-    mapping_process.join();
+    stopMapper();
     return 0;
 }
+#endif
 
 
 
@@ -0,0 +1,366 @@
+/*******************************************************
+ * Copyright (C) 2020, RAM-LAB, Hong Kong University of Science and Technology
+ *
+ * This file is part of M-LOAM (https://ram-lab.com/file/jjiao/m-loam).
+ * If you use this code, please cite the respective publications as
+ * listed on the above websites.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *
+ * Author: Jianhao JIAO (jiaojh1994@gmail.com)
+ *******************************************************/
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <pcl/point_cloud.h>
+#include <pcl/kdtree/kdtree_flann.h>
+
+#include "mloam_pcl/point_with_cov.hpp"
+
+// persistent local map of the mapper, stored in the world frame
+// keyframes are inserted and removed one by one, each voxel keeps the weighted sums of its points
+// so that both operations only touch the voxels of that keyframe;
+// the voxel points are the same as pcl::VoxelGridCovarianceMLOAM over the union of the keyframes:
+// w = trace_threshold - trace(cov), mu = sum(w * p) / sum(w), cov = sum(w^2 * cov) / sum(w)^2
+// the intensity is the one of the point with the largest weight, it is not restored when that point is removed
+// the centroids are also registered in a coarse grid (cell >= max_range) for the nearest neighbor search
+class VoxelMapCov
+{
+public:
+    VoxelMapCov(const float &leaf_size = 0.4, const float &max_range = 1.0, const float &trace_threshold = 10.0)
+        : cloud_(new common::PointICovCloud())
+    {
+        setParameters(leaf_size, max_range, trace_threshold);
+    }
+
+    // max_range: neighbors farther than it are not reported by nearestKSearch; the map is cleared
+    void setParameters(const float &leaf_size, const float &max_range, const float &trace_threshold)
+    {
+        leaf_size_ = leaf_size;
+        max_range_ = max_range;
+        trace_threshold_ = trace_threshold;
+        cell_ratio_ = std::max(1, static_cast<int>(std::ceil(max_range / leaf_size)));
+        clear();
+    }
+
+    void clear()
+    {
+        voxels_.clear();
+        cells_.clear();
+        keyframes_.clear();
+        point_key_.clear();
+        cloud_->clear();
+    }
+
+    // cloud_w: points of the keyframe in the world frame
+    bool insertKeyframe(const int &id, const common::PointICovCloud &cloud_w)
+    {
+        if (keyframes_.find(id) != keyframes_.end()) return false;
+        mergeCloud(cloud_w, &keyframes_[id]);
+        return true;
+    }
+
+    // points that are never removed, their contribution is not kept
+    void insertCloud(const common::PointICovCloud &cloud_w)
+    {
+        mergeCloud(cloud_w, nullptr);
+    }
+
+    bool removeKeyframe(const int &id)
+    {
+        auto kf_iter = keyframes_.find(id);
+        if (kf_iter == keyframes_.end()) return false;
+        for (const auto &v : kf_iter->second)
+        {
+            auto iter = voxels_.find(v.first);
+            if (iter == voxels_.end()) continue;
+            Voxel &voxel = iter->second;
+            voxel.sum_.cnt_ -= v.second.cnt_;
+            if (voxel.sum_.cnt_ <= 0)
+            {
+                removePoint(voxel.idx_);
+                voxels_.erase(iter);
+                continue;
+            }
+            voxel.sum_.subtract(v.second);
+            updatePoint(voxel);
+        }
+        keyframes_.erase(kf_iter);
+        return true;
+    }
+
+    bool hasKeyframe(const int &id) const { return keyframes_.find(id) != keyframes_.end(); }
+
+    std::vector<int> getKeyframeIds() const
+    {
+        std::vector<int> ids;
+        ids.reserve(keyframes_.size());
+        for (const auto &kf : keyframes_) ids.push_back(kf.first);
+        std::sort(ids.begin(), ids.end());
+        return ids;
+    }
+
+    // one point per voxel, the indices returned by the searches refer to this cloud
+    const common::PointICovCloud::Ptr &getCloud() const { return cloud_; }
+    size_t size() const { return cloud_->size(); }
+    size_t numKeyframes() const { return keyframes_.size(); }
+
+    // exact k nearest neighbors within max_range, sorted by distance
+    int nearestKSearch(const common::PointIWithCov &point, int k,
+                       std::vector<int> &k_indices, std::vector<float> &k_sqr_distances) const
+    {
+        return radiusSearch(point, max_range_, k_indices, k_sqr_distances, k > 0 ? k : 0);
+    }
+
+    // max_nn = 0: all neighbors within radius
+    int radiusSearch(const common::PointIWithCov &point, const double &radius,
+                     std::vector<int> &k_indices, std::vector<float> &k_sqr_distances,
+                     const unsigned int &max_nn = 0) const
+    {
+        static thread_local std::vector<std::pair<float, int> > candidates;
+        candidates.clear();
+        k_indices.clear();
+        k_sqr_distances.clear();
+
+        const float sqr_radius = static_cast<float>(radius * radius);
+        int64_t cell_min[3], cell_max[3];
+        const float p[3] = {point.x, point.y, point.z};
+        for (size_t i = 0; i < 3; i++)
+        {
+            cell_min[i] = floorDiv(voxelIndex(p[i] - radius), cell_ratio_);
+            cell_max[i] = floorDiv(voxelIndex(p[i] + radius), cell_ratio_);
+        }
+        for (int64_t cx = cell_min[0]; cx <= cell_max[0]; cx++)
+            for (int64_t cy = cell_min[1]; cy <= cell_max[1]; cy++)
+                for (int64_t cz = cell_min[2]; cz <= cell_max[2]; cz++)
+                {
+                    auto iter = cells_.find(packKey(cx, cy, cz));
+                    if (iter == cells_.end()) continue;
+                    for (const int &idx : iter->second)
+                    {
+                        const common::PointIWithCov &point_map = cloud_->points[idx];
+                        float sqr_dis = (point_map.x - point.x) * (point_map.x - point.x) +
+                                        (point_map.y - point.y) * (point_map.y - point.y) +
+                                        (point_map.z - point.z) * (point_map.z - point.z);
+                        if (sqr_dis <= sqr_radius) candidates.emplace_back(sqr_dis, idx);
+                    }
+                }
+
+        size_t num = candidates.size();
+        if ((max_nn > 0) && (max_nn < num))
+        {
+            num = max_nn;
+            std::partial_sort(candidates.begin(), candidates.begin() + num, candidates.end());
+        }
+        else
+        {
+            std::sort(candidates.begin(), candidates.end());
+        }
+        k_indices.resize(num);
+        k_sqr_distances.resize(num);
+        for (size_t i = 0; i < num; i++)
+        {
+            k_sqr_distances[i] = candidates[i].first;
+            k_indices[i] = candidates[i].second;
+        }
+        return static_cast<int>(num);
+    }
+
+private:
+    struct VoxelSum
+    {
+        VoxelSum() : w_(0), w_max_(0), intensity_(0), cnt_(0)
+        {
+            std::fill(p_, p_ + 3, 0.0);
+            std::fill(cov_, cov_ + 6, 0.0);
+        }
+
+        void add(const common::PointIWithCov &point, const float &w)
+        {
+            p_[0] += w * point.x;
+            p_[1] += w * point.y;
+            p_[2] += w * point.z;
+            for (size_t i = 0; i < 6; i++) cov_[i] += w * w * point.cov_vec[i];
+            w_ += w;
+            if (w > w_max_)
+            {
+                w_max_ = w;
+                intensity_ = point.intensity;
+            }
+            cnt_++;
+        }
+
+        void merge(const VoxelSum &sum)
+        {
+            for (size_t i = 0; i < 3; i++) p_[i] += sum.p_[i];
+            for (size_t i = 0; i < 6; i++) cov_[i] += sum.cov_[i];
+            w_ += sum.w_;
+            if (sum.w_max_ > w_max_)
+            {
+                w_max_ = sum.w_max_;
+                intensity_ = sum.intensity_;
+            }
+            cnt_ += sum.cnt_;
+        }
+
+        void subtract(const VoxelSum &sum)
+        {
+            for (size_t i = 0; i < 3; i++) p_[i] -= sum.p_[i];
+            for (size_t i = 0; i < 6; i++) cov_[i] -= sum.cov_[i];
+            w_ -= sum.w_;
+        }
+
+        double p_[3], cov_[6], w_;
+        float w_max_, intensity_;
+        int cnt_;
+    };
+
+    struct Voxel
+    {
+        Voxel() : idx_(-1) {}
+        VoxelSum sum_;
+        int idx_; // index in cloud_
+    };
+
+    int64_t voxelIndex(const double &x) const { return static_cast<int64_t>(std::floor(x / leaf_size_)); }
+
+    static int64_t floorDiv(const int64_t &a, const int64_t &b) { return (a >= 0) ? a / b : -((-a + b - 1) / b); }
+
+    // 21 bits per axis
+    static uint64_t packKey(const int64_t &ix, const int64_t &iy, const int64_t &iz)
+    {
+        const int64_t offset = 1 << 20;
+        return ((static_cast<uint64_t>(ix + offset) & 0x1FFFFF) << 42) |
+               ((static_cast<uint64_t>(iy + offset) & 0x1FFFFF) << 21) |
+               (static_cast<uint64_t>(iz + offset) & 0x1FFFFF);
+    }
+
+    static int64_t unpackIndex(const uint64_t &key, const int &shift)
+    {
+        const int64_t offset = 1 << 20;
+        return static_cast<int64_t>((key >> shift) & 0x1FFFFF) - offset;
+    }
+
+    uint64_t voxelKey(const float &x, const float &y, const float &z) const
+    {
+        return packKey(voxelIndex(x), voxelIndex(y), voxelIndex(z));
+    }
+
+    // the cell containing a voxel
+    uint64_t cellKey(const uint64_t &voxel_key) const
+    {
+        return packKey(floorDiv(unpackIndex(voxel_key, 42), cell_ratio_),
+                       floorDiv(unpackIndex(voxel_key, 21), cell_ratio_),
+                       floorDiv(unpackIndex(voxel_key, 0), cell_ratio_));
+    }
+
+    void mergeCloud(const common::PointICovCloud &cloud_w, std::vector<std::pair<uint64_t, VoxelSum> > *contribution)
+    {
+        std::unordered_map<uint64_t, VoxelSum> frame_voxels;
+        for (const common::PointIWithCov &point : cloud_w.points)
+        {
+            float w = trace_threshold_ - (point.cov_vec[0] + point.cov_vec[3] + point.cov_vec[5]);
+            if (w <= 0) continue;
+            VoxelSum &sum = frame_voxels.emplace(voxelKey(point.x, point.y, point.z), VoxelSum()).first->second;
+            sum.add(point, w);
+        }
+
+        if (contribution) contribution->reserve(frame_voxels.size());
+        for (const auto &v : frame_voxels)
+        {
+            auto iter = voxels_.find(v.first);
+            if (iter == voxels_.end())
+            {
+                iter = voxels_.emplace(v.first, Voxel()).first;
+                iter->second.idx_ = static_cast<int>(cloud_->size());
+                cloud_->push_back(common::PointIWithCov());
+                point_key_.push_back(v.first);
+                cells_[cellKey(v.first)].push_back(iter->second.idx_);
+            }
+            Voxel &voxel = iter->second;
+            voxel.sum_.merge(v.second);
+            updatePoint(voxel);
+            if (contribution) contribution->push_back(v);
+        }
+    }
+
+    void updatePoint(const Voxel &voxel)
+    {
+        const VoxelSum &sum = voxel.sum_;
+        common::PointIWithCov &point = cloud_->points[voxel.idx_];
+        point.x = static_cast<float>(sum.p_[0] / sum.w_);
+        point.y = static_cast<float>(sum.p_[1] / sum.w_);
+        point.z = static_cast<float>(sum.p_[2] / sum.w_);
+        point.intensity = sum.intensity_;
+        for (size_t i = 0; i < 6; i++) point.cov_vec[i] = static_cast<float>(sum.cov_[i] / (sum.w_ * sum.w_));
+        point.cov_trace = point.cov_vec[0] + point.cov_vec[3] + point.cov_vec[5];
+    }
+
+    // the last point is moved into the slot of the removed one
+    void removePoint(const int &idx)
+    {
+        std::vector<int> &cell = cells_[cellKey(point_key_[idx])];
+        cell.erase(std::find(cell.begin(), cell.end(), idx));
+        if (cell.empty()) cells_.erase(cellKey(point_key_[idx]));
+
+        const int last = static_cast<int>(cloud_->size()) - 1;
+        if (idx != last)
+        {
+            std::vector<int> &cell_last = cells_[cellKey(point_key_[last])];
+            *std::find(cell_last.begin(), cell_last.end(), last) = idx;
+            voxels_.find(point_key_[last])->second.idx_ = idx;
+            cloud_->points[idx] = cloud_->points[last];
+            point_key_[idx] = point_key_[last];
+        }
+        cloud_->points.pop_back();
+        cloud_->width = cloud_->points.size();
+        cloud_->height = 1;
+        point_key_.pop_back();
+    }
+
+    float leaf_size_, max_range_, trace_threshold_;
+    int cell_ratio_; // cell size in voxels
+
+    std::unordered_map<uint64_t, Voxel> voxels_;
+    std::unordered_map<uint64_t, std::vector<int> > cells_;
+    std::unordered_map<int, std::vector<std::pair<uint64_t, VoxelSum> > > keyframes_; // contribution of each keyframe
+    std::vector<uint64_t> point_key_; // voxel of each point of cloud_
+    common::PointICovCloud::Ptr cloud_;
+};
+
+// exposes the map through the pcl::KdTreeFLANN interface used by FeatureExtract::match*PointFromMap,
+// no tree is built: setInputCloud must not be called, the queries go to the map
+class VoxelMapCovSearch : public pcl::KdTreeFLANN<common::PointIWithCov>
+{
+public:
+    explicit VoxelMapCovSearch(const VoxelMapCov *voxel_map) : voxel_map_(voxel_map) {}
+
+    using pcl::KdTreeFLANN<common::PointIWithCov>::nearestKSearch;
+    using pcl::KdTreeFLANN<common::PointIWithCov>::radiusSearch;
+
+    int nearestKSearch(const common::PointIWithCov &point, int k,
+                       std::vector<int> &k_indices, std::vector<float> &k_sqr_distances) const override
+    {
+        return voxel_map_->nearestKSearch(point, k, k_indices, k_sqr_distances);
+    }
+
+    int radiusSearch(const common::PointIWithCov &point, double radius,
+                     std::vector<int> &k_indices, std::vector<float> &k_sqr_distances,
+                     unsigned int max_nn = 0) const override
+    {
+        return voxel_map_->radiusSearch(point, radius, k_indices, k_sqr_distances, max_nn);
+    }
+
+private:
+    const VoxelMapCov *voxel_map_;
+};
+
+//
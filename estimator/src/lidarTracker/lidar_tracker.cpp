@@ -20,22 +20,30 @@ LidarTracker::LidarTracker()
     std::cout << "Tracker begin" << std::endl;
 }
 
-Pose LidarTracker::trackCloud(const cloudFeature &prev_cloud_feature,
-                              const cloudFeature &cur_cloud_feature,
+Pose LidarTracker::trackCloud(const FeatureFrame &prev_cloud_feature,
+                              const FeatureFrame &cur_cloud_feature,
                               const Pose &pose_ini)
 {
-    pcl::KdTreeFLANN<PointI>::Ptr kdtree_corner_last(new pcl::KdTreeFLANN<PointI>());
-    pcl::KdTreeFLANN<PointI>::Ptr kdtree_surf_last(new pcl::KdTreeFLANN<PointI>());
-
-    // step 1: prev feature
-    PointICloudPtr corner_points_last = boost::make_shared<PointICloud>(prev_cloud_feature.find("corner_points_less_sharp")->second);
-    PointICloudPtr surf_points_last = boost::make_shared<PointICloud>(prev_cloud_feature.find("surf_points_less_flat")->second);
-    kdtree_corner_last->setInputCloud(corner_points_last);
-    kdtree_surf_last->setInputCloud(surf_points_last);
+    // step 1: prev feature, the KD-trees are built when the frame becomes the previous frame
+    pcl::KdTreeFLANN<PointI>::Ptr kdtree_corner_last, kdtree_surf_last;
+    const PointICloud &corner_points_last = prev_cloud_feature.cloud_[CORNER_POINTS_LESS_SHARP];
+    const PointICloud &surf_points_last = prev_cloud_feature.cloud_[SURF_POINTS_LESS_FLAT];
+    if (prev_cloud_feature.kdtree_built_)
+    {
+        kdtree_corner_last = prev_cloud_feature.kdtree_corner_less_sharp_;
+        kdtree_surf_last = prev_cloud_feature.kdtree_surf_less_flat_;
+    } 
+    else
+    {
+        kdtree_corner_last.reset(new pcl::KdTreeFLANN<PointI>());
+        kdtree_surf_last.reset(new pcl::KdTreeFLANN<PointI>());
+        kdtree_corner_last->setInputCloud(PointICloudConstPtr(&corner_points_last, [](const PointICloud *) {}));
+        kdtree_surf_last->setInputCloud(PointICloudConstPtr(&surf_points_last, [](const PointICloud *) {}));
+    }
 
     // step 2: current feature
-    PointICloudPtr corner_points_sharp = boost::make_shared<PointICloud>(cur_cloud_feature.find("corner_points_sharp")->second);
-    PointICloudPtr surf_points_flat = boost::make_shared<PointICloud>(cur_cloud_feature.find("surf_points_flat")->second);
+    const PointICloud &corner_points_sharp = cur_cloud_feature.cloud_[CORNER_POINTS_SHARP];
+    const PointICloud &surf_points_flat = cur_cloud_feature.cloud_[SURF_POINTS_FLAT];
 
     // step 3: set initial pose
     double para_pose[SIZE_POSE] = {pose_ini.t_(0), pose_ini.t_(1), pose_ini.t_(2), 
@@ -43,23 +51,17 @@ Pose LidarTracker::trackCloud(const cloudFeature &prev_cloud_feature,
 
     for (size_t iter_cnt = 0; iter_cnt < 2; iter_cnt++) //TODO(jxl): 前端里程计迭代两个周期ceres
     {
-        ceres::Problem problem;
-        ceres::LossFunction *loss_function = new ceres::HuberLoss(0.1);
-        PoseLocalParameterization *local_parameterization = new PoseLocalParameterization();      
-        local_parameterization->setParameter();
-        problem.AddParameterBlock(para_pose, SIZE_POSE, local_parameterization);
-
         // prepare feature data
         TicToc t_prepare;
-        std::vector<PointPlaneFeature> corner_scan_features, surf_scan_features;
+        std::vector<PointPlaneFeature, Eigen::aligned_allocator<PointPlaneFeature> > corner_scan_features, surf_scan_features;
         Pose pose_local = Pose(Eigen::Quaterniond(para_pose[6], para_pose[3], para_pose[4], para_pose[5]),
                                Eigen::Vector3d(para_pose[0], para_pose[1], para_pose[2]));
         
         //利用之前主雷达相邻两scan的delta_T作为初值，把k+1帧feature points转换到k+1帧start下，(k帧feature points已经在上次结束末尾转换到k帧end下)
         //然后在k帧feature kd-tree points中找最近邻points
         //corner correspondace(i: j, l)； surf correspondace(i: j, l, m)平面方程系数；
-        f_extract_.matchCornerFromScan(kdtree_corner_last, *corner_points_last, *corner_points_sharp, pose_local, corner_scan_features);
-        f_extract_.matchSurfFromScan(kdtree_surf_last, *surf_points_last, *surf_points_flat, pose_local, surf_scan_features);
+        f_extract_.matchCornerFromScan(kdtree_corner_last, corner_points_last, corner_points_sharp, pose_local, corner_scan_features);
+        f_extract_.matchSurfFromScan(kdtree_surf_last, surf_points_last, surf_points_flat, pose_local, surf_scan_features);
         
         size_t corner_num = corner_scan_features.size();
         size_t surf_num = surf_scan_features.size();
@@ -70,34 +72,57 @@ Pose LidarTracker::trackCloud(const cloudFeature &prev_cloud_feature,
             continue;
         }
 
-        for (const PointPlaneFeature &feature : surf_scan_features)
+        // 6-DoF problem with one residual block: solve the normal equation directly
+        if (TRACKER_SOLVER == 2)
         {
-            double s = 1.0;
-            // if (DISTORTION)
-            //     s = (surf_points_flat->points[idx].intensity - int(surf_points_flat->points[idx].intensity)) / SCAN_PERIOD;
-            // else
-            //     s = 1.0;
-            LidarScanPlaneNormFactor *f = new LidarScanPlaneNormFactor(feature.point_, feature.coeffs_, s);
-            problem.AddResidualBlock(f, loss_function, para_pose); //平移在前，旋转在后
+            LidarScanBatchFactor f(surf_scan_features, corner_scan_features, 0.1);
+            solveGaussNewton(f, para_pose, 4);
+            continue;
         }
 
-        CHECK_JACOBIAN = 0;
-        for (const PointPlaneFeature &feature : corner_scan_features)
+        ceres::Problem problem;
+        PoseLocalParameterization *local_parameterization = new PoseLocalParameterization();      
+        local_parameterization->setParameter();
+        problem.AddParameterBlock(para_pose, SIZE_POSE, local_parameterization);
+
+        if (TRACKER_SOLVER == 1)
         {
-            double s = 1.0;
-            // if (DISTORTION)
-            //     s = (corner_points_sharp->points[feature.idx_].intensity - int(corner_points_sharp->points[idx].intensity)) / SCAN_PERIOD;
-            // else
-            //     s = 1.0;
-            LidarScanEdgeFactorVector *f = new LidarScanEdgeFactorVector(feature.point_, feature.coeffs_, s);
-            problem.AddResidualBlock(f, loss_function, para_pose);
-            if (CHECK_JACOBIAN)
+            // all correspondences in one block, the huber loss is applied inside the factor
+            LidarScanBatchFactor *f = new LidarScanBatchFactor(surf_scan_features, corner_scan_features, 0.1);
+            problem.AddResidualBlock(f, nullptr, para_pose);
+        } 
+        else
+        {
+            ceres::LossFunction *loss_function = new ceres::HuberLoss(0.1);
+            for (const PointPlaneFeature &feature : surf_scan_features)
             {
-                double **tmp_param = new double *[1];
-                tmp_param[0] = para_pose;
-                f->check(tmp_param);
-                CHECK_JACOBIAN = 0;
-                // delete[] tmp_param;
+                double s = 1.0;
+                // if (DISTORTION)
+                //     s = (surf_points_flat->points[idx].intensity - int(surf_points_flat->points[idx].intensity)) / SCAN_PERIOD;
+                // else
+                //     s = 1.0;
+                LidarScanPlaneNormFactor *f = new LidarScanPlaneNormFactor(feature.point_, feature.coeffs_.head<4>(), s);
+                problem.AddResidualBlock(f, loss_function, para_pose); //平移在前，旋转在后
+            }
+
+            CHECK_JACOBIAN = 0;
+            for (const PointPlaneFeature &feature : corner_scan_features)
+            {
+                double s = 1.0;
+                // if (DISTORTION)
+                //     s = (corner_points_sharp->points[feature.idx_].intensity - int(corner_points_sharp->points[idx].intensity)) / SCAN_PERIOD;
+                // else
+                //     s = 1.0;
+                LidarScanEdgeFactorVector *f = new LidarScanEdgeFactorVector(feature.point_, feature.coeffs_, s);
+                problem.AddResidualBlock(f, loss_function, para_pose);
+                if (CHECK_JACOBIAN)
+                {
+                    double **tmp_param = new double *[1];
+                    tmp_param[0] = para_pose;
+                    f->check(tmp_param);
+                    CHECK_JACOBIAN = 0;
+                    // delete[] tmp_param;
+                }
             }
         }
 
@@ -131,6 +156,35 @@ Pose LidarTracker::trackCloud(const cloudFeature &prev_cloud_feature,
     return pose_prev_cur;
 }
 
+// Gauss-Newton on the 6-dim tangent space of the pose, with the same update rule as PoseLocalParameterization
+// the huber loss is already folded into the residuals and jacobians of the factor
+void LidarTracker::solveGaussNewton(const LidarScanBatchFactor &factor, double *para_pose, const int &max_iter)
+{
+    const int num_residuals = factor.num_residuals();
+    std::vector<double> residuals(num_residuals);
+    std::vector<double> jacobian(num_residuals * SIZE_POSE);
+    double *jacobians[1] = {jacobian.data()};
+    for (int iter = 0; iter < max_iter; iter++)
+    {
+        factor.Evaluate(&para_pose, residuals.data(), jacobians);
+        Eigen::Map<const Eigen::Matrix<double, Eigen::Dynamic, SIZE_POSE, Eigen::RowMajor> > J(jacobian.data(), num_residuals, SIZE_POSE);
+        Eigen::Map<const Eigen::VectorXd> r(residuals.data(), num_residuals);
+        Eigen::Matrix<double, 6, 6> H = J.leftCols<6>().transpose() * J.leftCols<6>();
+        Eigen::Matrix<double, 6, 1> g = J.leftCols<6>().transpose() * r;
+
+        Eigen::LDLT<Eigen::Matrix<double, 6, 6> > ldlt(H);
+        if (ldlt.info() != Eigen::Success) break;
+        Eigen::Matrix<double, 6, 1> dx = -ldlt.solve(g);
+        if (!dx.allFinite()) break;
+
+        Eigen::Map<Eigen::Vector3d> t(para_pose);
+        Eigen::Map<Eigen::Quaterniond> q(para_pose + 3);
+        t += dx.head<3>();
+        q = (q * Utility::deltaQ(dx.tail<3>())).normalized();
+        if (dx.norm() < 1e-6) break;
+    }
+}
+
 void LidarTracker::evalDegenracy(PoseLocalParameterization *local_parameterization, const ceres::CRSMatrix &jaco)
 {
     // printf("jacob: %d constraints, %d parameters\n", jaco.num_rows, jaco.num_cols); // 2000+, 6
@@ -37,6 +37,7 @@
 #include "../featureExtract/feature_extract.hpp"
 #include "../factor/pose_local_parameterization.h"
 #include "../factor/lidar_scan_factor.hpp"
+#include "../factor/lidar_scan_batch_factor.hpp"
 #include "../factor/impl_loss_function.hpp"
 #include "../utility/tic_toc.h"
 #include "../utility/utility.h"
@@ -45,7 +46,8 @@ class LidarTracker
 {
 public:
     LidarTracker();
-    Pose trackCloud(const cloudFeature &prev_cloud_feature, const cloudFeature &cur_cloud_feature, const Pose &pose_ini);
+    Pose trackCloud(const FeatureFrame &prev_cloud_feature, const FeatureFrame &cur_cloud_feature, const Pose &pose_ini);
+    void solveGaussNewton(const LidarScanBatchFactor &factor, double *para_pose, const int &max_iter);
     void evalDegenracy(PoseLocalParameterization *local_parameterization, const ceres::CRSMatrix &jaco);
 
     FeatureExtract f_extract_;
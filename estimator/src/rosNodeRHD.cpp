@@ -36,8 +36,6 @@
 #include <sensor_msgs/NavSatFix.h>
 #include <sensor_msgs/PointCloud2.h>
 #include <sensor_msgs/Imu.h>
-#include <message_filters/sync_policies/approximate_time.h>
-#include <message_filters/subscriber.h>
 
 #include "save_statistics.hpp"
 #include "common/common.hpp"
@@ -46,6 +44,7 @@
 #include "utility/utility.h"
 #include "utility/visualization.h"
 #include "utility/cloud_visualizer.h"
+#include "utility/lidar_sync.hpp"
 
 using namespace std;
 
@@ -57,80 +56,33 @@ Estimator estimator;
 
 SaveStatistics save_statistics;
 
-// message buffer
-std::vector<std::queue<sensor_msgs::PointCloud2ConstPtr>> all_cloud_buf(2);
-std::mutex m_buf;
+// message buffer: one ring per lidar, synchronized by LASER_SYNC_THRESHOLD
+LidarSynchronizer<pcl::PointXYZ> lidar_sync;
 
 // laser path groundtruth
 nav_msgs::Path laser_gt_path;
 ros::Publisher pub_laser_gt_path;
 Pose pose_world_ref_ini;
 
-int frame_drop_cnt = 0;
-
-void dataProcessCallback(const sensor_msgs::PointCloud2ConstPtr &cloud0_msg,
-                         const sensor_msgs::PointCloud2ConstPtr &cloud1_msg)
-{
-    m_buf.lock();
-    all_cloud_buf[0].push(cloud0_msg);
-    all_cloud_buf[1].push(cloud1_msg);
-    m_buf.unlock();
-}
-
-pcl::PointCloud<pcl::PointXYZ> getCloudFromMsg(const sensor_msgs::PointCloud2ConstPtr &cloud_msg)
-{
-    pcl::PointCloud<pcl::PointXYZ> laser_cloud;
-    pcl::fromROSMsg(*cloud_msg, laser_cloud);
-    std::vector<int> indices;
-    pcl::removeNaNFromPointCloud(laser_cloud, laser_cloud, indices);
-    return laser_cloud;
-}
-
-// extract images with same timestamp from two topics
+// extract clouds with the same timestamp from all the topics
 // independent from ros::spin()
 void sync_process()
 {
-    while(1)
+    lidar_sync.spin([](const double &time, std::vector<pcl::PointCloud<pcl::PointXYZ> > &v_laser_cloud)
     {
-        std::vector<pcl::PointCloud<pcl::PointXYZ> > v_laser_cloud(NUM_OF_LASER);
-        std_msgs::Header header;
-        double time = 0;
-        m_buf.lock();
-        if (!all_cloud_buf[0].empty() && !all_cloud_buf[1].empty())
-        {
-            time = all_cloud_buf[0].front()->header.stamp.toSec();
-            header = all_cloud_buf[0].front()->header;
-            stringstream ss;
-            for (size_t i = 0; i < NUM_OF_LASER; i++)
-            {
-                v_laser_cloud[i] = getCloudFromMsg(all_cloud_buf[i].front());
-                ss << v_laser_cloud[i].size() << " ";
-            }
-            for (size_t i = 0; i < all_cloud_buf.size(); i++) all_cloud_buf[i].pop();
-            printf("size of finding laser_cloud: %s\n", ss.str().c_str());
-        }
-        while (!all_cloud_buf[0].empty()) //TODO(jxl): 把当前队列中，缓冲两个雷达的所有数据全部删除；不是每帧scan都会处理
-        {
-            frame_drop_cnt++;
-            for (size_t i = 0; i < all_cloud_buf.size(); i++)
-            {
-                if (!all_cloud_buf[i].empty())
-                {
-                    all_cloud_buf[i].pop();
-                }
-            }
-            std::cout << common::GREEN << "drop lidar frame in odometry for real time performance"
-                      << common::RESET << std::endl;
-        }
-        m_buf.unlock();
-
+        stringstream ss;
         bool empty_check = false;
         for (size_t i = 0; i < NUM_OF_LASER; i++)
-            if (v_laser_cloud[i].size() == 0) empty_check = true;
-
-        if (!empty_check) estimator.inputCloud(time, v_laser_cloud); //前端入口：不断地把两个雷达的数据送进estimator中
-        std::this_thread::sleep_for(std::chrono::milliseconds(2));
-    }
+        {
+            std::vector<int> indices;
+            pcl::removeNaNFromPointCloud(v_laser_cloud[i], v_laser_cloud[i], indices);
+            ss << v_laser_cloud[i].size() << " ";
+            if (v_laser_cloud[i].empty()) empty_check = true;
+        }
+        printf("size of finding laser_cloud: %s\n", ss.str().c_str());
+        if (empty_check) return; // only NaN points
+        estimator.inputCloud(time, v_laser_cloud); //前端入口：不断地把雷达的数据送进estimator中
+    });
 }
 
 void restart_callback(const std_msgs::BoolConstPtr &restart_msg)
@@ -203,20 +155,14 @@ int main(int argc, char **argv)
     std::cout << common::YELLOW << "waiting for cloud..." << common::RESET << std::endl;
 
     // ******************************************
-    typedef sensor_msgs::PointCloud2 LidarMsgType;
-    typedef message_filters::sync_policies::ApproximateTime<LidarMsgType, LidarMsgType> LidarSyncPolicy;
-    typedef message_filters::Subscriber<LidarMsgType> LidarSubType;
-
-    std::vector<LidarSubType *> sub_lidar(2);
-    NUM_OF_LASER = NUM_OF_LASER < 2 ? NUM_OF_LASER : 2; //TODO(jxl): 雷达数量超过2个时强制为2个雷达
-    for (size_t i = 0; i < NUM_OF_LASER; i++) sub_lidar[i] = new LidarSubType(nh, CLOUD_TOPIC[i], 1);
-    for (size_t i = NUM_OF_LASER; i < 2; i++) sub_lidar[i] = new LidarSubType(nh, CLOUD_TOPIC[0], 1);
-     //不是多余的，当雷达个数为1时，阻止下一行语句segment，使得sub_lidar[1]有效。
-
-    message_filters::Synchronizer<LidarSyncPolicy> *lidar_synchronizer =
-        new message_filters::Synchronizer<LidarSyncPolicy>(
-            LidarSyncPolicy(10), *sub_lidar[0], *sub_lidar[1]);
-    lidar_synchronizer->registerCallback(boost::bind(&dataProcessCallback, _1, _2)); //两个雷达的callback
+    // the estimator pipeline keeps its own bounded queues, otherwise only the latest frame is processed
+    lidar_sync.setParameters(NUM_OF_LASER, LASER_SYNC_THRESHOLD, !MULTIPLE_THREAD);
+    std::vector<ros::Subscriber> sub_lidar(NUM_OF_LASER); // 每个雷达一个callback
+    for (size_t i = 0; i < NUM_OF_LASER; i++)
+    {
+        sub_lidar[i] = nh.subscribe<sensor_msgs::PointCloud2>(CLOUD_TOPIC[i], 5,
+            boost::bind(&LidarSynchronizer<pcl::PointXYZ>::push, &lidar_sync, i, _1));
+    }
 
     ros::Subscriber sub_restart = nh.subscribe("/mlod_restart", 5, restart_callback);
     ros::Subscriber sub_pose_gt = nh.subscribe("/base_pose_gt", 5, pose_gt_callback); //前端ground truth轨迹
@@ -234,8 +180,9 @@ int main(int argc, char **argv)
         ros::spinOnce();
         loop_rate.sleep();
     }
+    lidar_sync.stop();
 
-    std::cout << common::YELLOW << "odometry drop frame: " << frame_drop_cnt << common::RESET << std::endl;
+    std::cout << common::YELLOW << "odometry drop frame: " << lidar_sync.dropCnt() << common::RESET << std::endl;
     if (MLOAM_RESULT_SAVE)
     {
         std::cout << common::RED << "saving odometry results" << common::RESET << std::endl;
@@ -176,7 +176,8 @@ void sync_process()
             printf("size of finding laser_cloud: %lu\n", v_laser_cloud[0].size());
             cloud_buf.pop();
         }
-        while (!cloud_buf.empty())
+        // the estimator pipeline keeps its own bounded queues and drops the oldest frames
+        while (!MULTIPLE_THREAD && !cloud_buf.empty())
         {
             frame_drop_cnt++;
             cloud_buf.pop();
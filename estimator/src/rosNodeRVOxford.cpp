@@ -40,8 +40,6 @@
 #include <sensor_msgs/NavSatFix.h>
 #include <sensor_msgs/PointCloud2.h>
 #include <sensor_msgs/Imu.h>
-#include <message_filters/sync_policies/approximate_time.h>
-#include <message_filters/subscriber.h>
 
 #include "save_statistics.hpp"
 #include "common/common.hpp"
@@ -51,6 +49,7 @@
 #include "utility/utility.h"
 #include "utility/visualization.h"
 #include "utility/cloud_visualizer.h"
+#include "utility/lidar_sync.hpp"
 #include "mloam_pcl/point_with_time.hpp"
 
 #define MAX_BUF_LENGTH 5
@@ -71,8 +70,7 @@ Estimator estimator;
 
 SaveStatistics save_statistics;
 
-std::vector<std::queue<sensor_msgs::PointCloud2ConstPtr> > all_cloud_buf(5);
-std::mutex m_buf;
+LidarSynchronizer<pcl::PointXYZIWithTime> lidar_sync;
 
 nav_msgs::Path laser_gt_path;
 Pose pose_world_ref_ini;
@@ -84,23 +82,6 @@ ros::Publisher pub_laser_gt_odom, pub_laser_gt_path;
 
 bool b_pause = false;
 
-int frame_drop_cnt = 0;
-
-void dataProcessCallback(const sensor_msgs::PointCloud2ConstPtr &cloud0_msg,
-                         const sensor_msgs::PointCloud2ConstPtr &cloud1_msg,
-                         const sensor_msgs::PointCloud2ConstPtr &cloud2_msg,
-                         const sensor_msgs::PointCloud2ConstPtr &cloud3_msg,
-                         const sensor_msgs::PointCloud2ConstPtr &cloud4_msg)
-{
-    m_buf.lock();
-    all_cloud_buf[0].push(cloud0_msg);
-    all_cloud_buf[1].push(cloud1_msg);
-    all_cloud_buf[2].push(cloud2_msg);
-    all_cloud_buf[3].push(cloud3_msg);
-    all_cloud_buf[4].push(cloud4_msg);
-    m_buf.unlock();
-}
-
 void gtCallback(const nav_msgs::OdometryConstPtr &gt_odom_msg)
 {
     Pose pose_world_stereo_gt(*gt_odom_msg);
@@ -167,59 +148,23 @@ void pauseCallback(std_msgs::StringConstPtr msg)
     b_pause = !b_pause;
 }
 
-pcl::PointCloud<pcl::PointXYZIWithTime> getCloudFromMsg(const sensor_msgs::PointCloud2ConstPtr &cloud_msg)
-{
-    pcl::PointCloud<pcl::PointXYZIWithTime> laser_cloud;
-    pcl::fromROSMsg(*cloud_msg, laser_cloud);
-    std::vector<int> indices;
-    pcl::removeNaNFromPointCloud(laser_cloud, laser_cloud, indices);
-    return laser_cloud;
-}
-
 void sync_process()
 {
-    while (1)
+    lidar_sync.spin([](const double &time, std::vector<pcl::PointCloud<pcl::PointXYZIWithTime> > &v_laser_cloud)
     {
-        std::vector<pcl::PointCloud<pcl::PointXYZIWithTime> > v_laser_cloud(NUM_OF_LASER);
-        std_msgs::Header header;
-        double time = 0;
-        m_buf.lock();
-        if (!all_cloud_buf[0].empty() && !all_cloud_buf[1].empty() && !all_cloud_buf[2].empty() 
-         && !all_cloud_buf[3].empty() && !all_cloud_buf[4].empty())
-        {
-            time = all_cloud_buf[0].front()->header.stamp.toSec();
-            header = all_cloud_buf[0].front()->header;
-            stringstream ss;
-            for (size_t i = 0; i < NUM_OF_LASER; i++) 
-            {
-                v_laser_cloud[i] = getCloudFromMsg(all_cloud_buf[i].front());
-                ss << v_laser_cloud[i].size() << " ";
-            }
-            for (size_t i = 0; i < all_cloud_buf.size(); i++) all_cloud_buf[i].pop();
-            printf("size of finding laser_cloud: %s\n", ss.str().c_str());
-        }
-        while (!all_cloud_buf[0].empty())
-        {
-            frame_drop_cnt++;
-            for (size_t i = 0; i < all_cloud_buf.size(); i++)
-            {
-                if (!all_cloud_buf[i].empty())
-                {
-                    all_cloud_buf[i].pop();
-                }
-            }
-            std::cout << common::GREEN << "drop lidar frame in odometry for real time performance"
-                      << common::RESET << std::endl;
-        }
-        m_buf.unlock();
-
+        stringstream ss;
         bool empty_check = false;
         for (size_t i = 0; i < NUM_OF_LASER; i++)
-            if (v_laser_cloud[i].size() == 0) empty_check = true;
-
-        if (!empty_check) estimator.inputCloud(time, v_laser_cloud);
-        std::this_thread::sleep_for(std::chrono::milliseconds(2));
-    }
+        {
+            std::vector<int> indices;
+            pcl::removeNaNFromPointCloud(v_laser_cloud[i], v_laser_cloud[i], indices);
+            ss << v_laser_cloud[i].size() << " ";
+            if (v_laser_cloud[i].empty()) empty_check = true;
+        }
+        printf("size of finding laser_cloud: %s\n", ss.str().c_str());
+        if (empty_check) return; // only NaN points
+        estimator.inputCloud(time, v_laser_cloud);
+    });
 }
 
 int main(int argc, char **argv)
@@ -262,18 +207,13 @@ int main(int argc, char **argv)
     // use bag as the data source
     if (!data_source.compare("bag"))
     {
-        typedef sensor_msgs::PointCloud2 LidarMsgType;
-        typedef message_filters::sync_policies::ApproximateTime<LidarMsgType, LidarMsgType, LidarMsgType, LidarMsgType, LidarMsgType> LidarSyncPolicy;
-        typedef message_filters::Subscriber<LidarMsgType> LidarSubType;
-
-        std::vector<LidarSubType *> sub_lidar(5);
-        NUM_OF_LASER = NUM_OF_LASER < 5 ? NUM_OF_LASER : 5;
-        for (size_t i = 0; i < NUM_OF_LASER; i++) sub_lidar[i] = new LidarSubType(nh, CLOUD_TOPIC[i], 5);
-        for (size_t i = NUM_OF_LASER; i < 5; i++) sub_lidar[i] = new LidarSubType(nh, CLOUD_TOPIC[0], 5);
-        message_filters::Synchronizer<LidarSyncPolicy> *lidar_synchronizer =
-            new message_filters::Synchronizer<LidarSyncPolicy>(
-                LidarSyncPolicy(10), *sub_lidar[0], *sub_lidar[1], *sub_lidar[2], *sub_lidar[3], *sub_lidar[4]);
-        lidar_synchronizer->registerCallback(boost::bind(&dataProcessCallback, _1, _2, _3, _4, _5));
+        lidar_sync.setParameters(NUM_OF_LASER, LASER_SYNC_THRESHOLD, !MULTIPLE_THREAD);
+        std::vector<ros::Subscriber> sub_lidar(NUM_OF_LASER);
+        for (size_t i = 0; i < NUM_OF_LASER; i++)
+        {
+            sub_lidar[i] = nh.subscribe<sensor_msgs::PointCloud2>(CLOUD_TOPIC[i], 5,
+                boost::bind(&LidarSynchronizer<pcl::PointXYZIWithTime>::push, &lidar_sync, i, _1));
+        }
 
         ros::Subscriber sub_gt = nh.subscribe<nav_msgs::Odometry>("/base_pose_gt", 10, gtCallback);
         ros::Subscriber sub_gps = nh.subscribe<sensor_msgs::NavSatFix>("/novatel718d/pos", 10, gpsCallback);
@@ -288,9 +228,9 @@ int main(int argc, char **argv)
             ros::spinOnce();
             loop_rate.sleep();
         }
+        lidar_sync.stop();
 
-        // std::cout << common::YELLOW << "odometry drop frame: " << frame_drop_cnt << common::RESET << std::endl;
-        LOG(INFO) << "odometry drop frame: " << frame_drop_cnt;
+        LOG(INFO) << "odometry drop frame: " << lidar_sync.dropCnt();
         if (MLOAM_RESULT_SAVE)
         {
             std::cout << common::RED << "saving odometry results" << common::RESET << std::endl;
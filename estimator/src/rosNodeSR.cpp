@@ -33,8 +33,6 @@
 #include <nav_msgs/Odometry.h>
 #include <nav_msgs/Path.h>
 #include <sensor_msgs/PointCloud2.h>
-#include <message_filters/sync_policies/approximate_time.h>
-#include <message_filters/subscriber.h>
 
 #include "save_statistics.hpp"
 #include "common/common.hpp"
@@ -44,6 +42,7 @@
 #include "utility/utility.h"
 #include "utility/visualization.h"
 #include "utility/cloud_visualizer.h"
+#include "utility/lidar_sync.hpp"
 
 using namespace std;
 
@@ -54,102 +53,56 @@ DEFINE_string(output_path, "/home/zh/zh_ws/src/mloam-iplus/results/", "the path
 DEFINE_bool(inject_meas_noise, false, "inject measurement noise on the raw data");
 DEFINE_int32(mc_trial, 0, "monte carlo trial number");
 
+#ifdef MLOAM_COMPOSED
+// lidar_mapper_keyframe.cpp: the mapping runs in this process and receives the feature clouds without serialization
+void startMapper(ros::NodeHandle &nh);
+void stopMapper();
+#endif
+
+// the state of the node has internal linkage, the mapper has its own in mloam_node_composed
+namespace
+{
+
 Estimator estimator;
 SaveStatistics save_statistics;
 
-// message buffer
-std::vector<std::queue<sensor_msgs::PointCloud2ConstPtr>> all_cloud_buf(2);
-std::mutex m_buf;
+// message buffer: one ring per lidar, synchronized by LASER_SYNC_THRESHOLD
+LidarSynchronizer<common::Point> lidar_sync;
 
 // laser path groundtruth
 nav_msgs::Path laser_gt_path;
 ros::Publisher pub_laser_gt_path;
 Pose pose_world_ref_ini;
 
-int frame_drop_cnt = 0;
-
 common::RandomGeneratorFloat<float> rgi;
 
-void dataProcessCallback(const sensor_msgs::PointCloud2ConstPtr &cloud0_msg,
-                         const sensor_msgs::PointCloud2ConstPtr &cloud1_msg)
-{
-    m_buf.lock();
-    all_cloud_buf[0].push(cloud0_msg);
-    all_cloud_buf[1].push(cloud1_msg);
-    m_buf.unlock();
-}
-
-pcl::PointCloud<pcl::PointXYZ> getCloudFromMsg(const sensor_msgs::PointCloud2ConstPtr &cloud_msg)
-{
-    pcl::PointCloud<pcl::PointXYZ> laser_cloud;
-    pcl::fromROSMsg(*cloud_msg, laser_cloud);
-    // roiCloudFilter(laser_cloud, ROI_RANGE);
-    return laser_cloud;
 }
 
 void sync_process()
 {
-    while (1)
+    lidar_sync.spin([](const double &time, std::vector<common::PointCloud> &v_laser_cloud)
     {
-        std::vector<pcl::PointCloud<pcl::PointXYZ>> v_laser_cloud(NUM_OF_LASER);
-        std_msgs::Header header;
-        double time = 0;
-        m_buf.lock();
-        if (!all_cloud_buf[0].empty() && !all_cloud_buf[1].empty())
-        {
-            time = all_cloud_buf[0].front()->header.stamp.toSec();
-            header = all_cloud_buf[0].front()->header;
-            stringstream ss;
-            for (size_t i = 0; i < NUM_OF_LASER; i++)
-            {
-                v_laser_cloud[i] = getCloudFromMsg(all_cloud_buf[i].front());
-                ss << v_laser_cloud[i].size() << " ";
-            }
-            for (size_t i = 0; i < all_cloud_buf.size(); i++)
-                all_cloud_buf[i].pop();
-            printf("size of finding laser_cloud: %s\n", ss.str().c_str());
-        }
-        while (!all_cloud_buf[0].empty())
-        {
-            frame_drop_cnt++;
-            for (size_t i = 0; i < all_cloud_buf.size(); i++)
-            {
-                if (!all_cloud_buf[i].empty())
-                {
-                    all_cloud_buf[i].pop();
-                }
-            }
-            std::cout << common::GREEN << "drop lidar frame in odometry for real time performance"
-                      << common::RESET << std::endl;
-        }
-        m_buf.unlock();
-
-        bool empty_check = false;
-        for (size_t i = 0; i < NUM_OF_LASER; i++)
-            empty_check = (v_laser_cloud[i].size() == 0);
-
-        if (!empty_check)
-        {
-            // if (FLAGS_inject_meas_noise)
-            // {
-            //     std::cout << "Injecting measurement noise" << std::endl;
-            //     for (size_t i = 0; i < NUM_OF_LASER; i++)
-            //     {
-            //         for (pcl::PointXYZ &point : v_laser_cloud[i])
-            //         {
-            //             // add measurement noise
-            //             float *n_xyz = rgi.geneRandUniformArray(0, 0.05, 3);
-            //             point.x += n_xyz[0];
-            //             point.y += n_xyz[1];
-            //             point.z += n_xyz[2];
-            //             delete n_xyz;
-            //         }
-            //     }
-            // }
-            estimator.inputCloud(time, v_laser_cloud);
-        }
-        std::this_thread::sleep_for(std::chrono::milliseconds(2));
-    }
+        stringstream ss;
+        for (size_t i = 0; i < NUM_OF_LASER; i++) ss << v_laser_cloud[i].size() << " ";
+        printf("size of finding laser_cloud: %s\n", ss.str().c_str());
+        // if (FLAGS_inject_meas_noise)
+        // {
+        //     std::cout << "Injecting measurement noise" << std::endl;
+        //     for (size_t i = 0; i < NUM_OF_LASER; i++)
+        //     {
+        //         for (pcl::PointXYZ &point : v_laser_cloud[i])
+        //         {
+        //             // add measurement noise
+        //             float *n_xyz = rgi.geneRandUniformArray(0, 0.05, 3);
+        //             point.x += n_xyz[0];
+        //             point.y += n_xyz[1];
+        //             point.z += n_xyz[2];
+        //             delete n_xyz;
+        //         }
+        //     }
+        // }
+        estimator.inputCloud(time, v_laser_cloud);
+    });
 }
 
 void restart_callback(const std_msgs::BoolConstPtr &restart_msg)
@@ -210,6 +163,10 @@ int main(int argc, char **argv)
     readParameters(FLAGS_config_file);
     estimator.setParameter();
     registerPub(nh);
+#ifdef MLOAM_COMPOSED
+    ros::NodeHandle nh_mapper;
+    startMapper(nh_mapper);
+#endif
 
     MLOAM_RESULT_SAVE = FLAGS_result_save;
     OUTPUT_FOLDER = FLAGS_output_path;
@@ -221,18 +178,14 @@ int main(int argc, char **argv)
     std::cout << common::YELLOW << "waiting for cloud..." << common::RESET << std::endl;
 
     // ******************************************
-    typedef sensor_msgs::PointCloud2 LidarMsgType;
-    typedef message_filters::sync_policies::ApproximateTime<LidarMsgType, LidarMsgType> LidarSyncPolicy;
-    typedef message_filters::Subscriber<LidarMsgType> LidarSubType;
-
-    std::vector<LidarSubType *> sub_lidar(2);
-    NUM_OF_LASER = NUM_OF_LASER < 2 ? NUM_OF_LASER : 2;
-    for (size_t i = 0; i < NUM_OF_LASER; i++) sub_lidar[i] = new LidarSubType(nh, CLOUD_TOPIC[i], 1);
-    for (size_t i = NUM_OF_LASER; i < 2; i++) sub_lidar[i] = new LidarSubType(nh, CLOUD_TOPIC[0], 1);
-    message_filters::Synchronizer<LidarSyncPolicy> *lidar_synchronizer =
-        new message_filters::Synchronizer<LidarSyncPolicy>(
-            LidarSyncPolicy(10), *sub_lidar[0], *sub_lidar[1]);
-    lidar_synchronizer->registerCallback(boost::bind(&dataProcessCallback, _1, _2));
+    // the estimator pipeline keeps its own bounded queues, otherwise only the latest frame is processed
+    lidar_sync.setParameters(NUM_OF_LASER, LASER_SYNC_THRESHOLD, !MULTIPLE_THREAD);
+    std::vector<ros::Subscriber> sub_lidar(NUM_OF_LASER);
+    for (size_t i = 0; i < NUM_OF_LASER; i++)
+    {
+        sub_lidar[i] = nh.subscribe<sensor_msgs::PointCloud2>(CLOUD_TOPIC[i], 5,
+            boost::bind(&LidarSynchronizer<common::Point>::push, &lidar_sync, i, _1));
+    }
 
     ros::Subscriber sub_restart = nh.subscribe("/mlod_restart", 5, restart_callback);
     ros::Subscriber sub_odom_gt = nh.subscribe("/base_odom_gt", 5, odom_gt_callback);
@@ -250,8 +203,13 @@ int main(int argc, char **argv)
         ros::spinOnce();
         loop_rate.sleep();
     }
+#ifdef MLOAM_COMPOSED
+    stopMapper();
+#endif
+    lidar_sync.stop();
 
-    std::cout << common::YELLOW << "odometry drop frame: " << frame_drop_cnt << common::RESET << std::endl;
+    std::cout << common::YELLOW << "odometry drop frame: " << lidar_sync.dropCnt()
+              << ", pipeline drop frame: " << estimator.cloud_drop_cnt_ + estimator.feature_drop_cnt_ << common::RESET << std::endl;
     if (MLOAM_RESULT_SAVE)
     {
         std::cout << common::RED << "saving odometry results" << common::RESET << std::endl;
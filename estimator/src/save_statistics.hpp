@@ -42,7 +42,7 @@ public:
     void saveMapTimeStatistics(const string &map_time_filename);
 };
 
-void SaveStatistics::saveSensorPath(const string &filename, const nav_msgs::Path &sensor_path)
+inline void SaveStatistics::saveSensorPath(const string &filename, const nav_msgs::Path &sensor_path)
 {
     if (sensor_path.poses.size() == 0)
         return;
@@ -65,7 +65,7 @@ void SaveStatistics::saveSensorPath(const string &filename, const nav_msgs::Path
 }
 
 // odom format: timestamp tx ty tz qx qy qz qw
-void SaveStatistics::saveOdomStatistics(const string &calib_eig_filename, 
+inline void SaveStatistics::saveOdomStatistics(const string &calib_eig_filename, 
                                         const string &calib_result_filename, 
                                         const string &odom_filename,
                                         const Estimator &estimator)
@@ -119,7 +119,7 @@ void SaveStatistics::saveOdomStatistics(const string &calib_eig_filename,
     fout.close();
 }
 
-void SaveStatistics::saveOdomTimeStatistics(const string &filename, const Estimator &estimator)
+inline void SaveStatistics::saveOdomTimeStatistics(const string &filename, const Estimator &estimator)
 {
     std::ofstream fout(filename.c_str(), std::ios::out);
     fout.precision(15);
@@ -133,10 +133,13 @@ void SaveStatistics::saveOdomTimeStatistics(const string &filename, const Estima
     fout << common::timing::Timing::GetNumSamples("odom_solver") << ", " << common::timing::Timing::GetMeanSeconds("odom_solver") * 1000 << ", " << common::timing::Timing::GetSTDSeconds("odom_solver") * 1000 << std::endl;
     fout << common::timing::Timing::GetNumSamples("odom_marg") << ", " << common::timing::Timing::GetMeanSeconds("odom_marg") * 1000 << ", " << common::timing::Timing::GetSTDSeconds("odom_marg") * 1000 << std::endl;
     fout << common::timing::Timing::GetNumSamples("odom_process") << ", " << common::timing::Timing::GetMeanSeconds("odom_process") * 1000 << ", " << common::timing::Timing::GetSTDSeconds("odom_process") * 1000 << std::endl;
+    fout << "pipeline: frame, ingest_time, cloud_drop, feature_drop" << std::endl;
+    fout << common::timing::Timing::GetNumSamples("odom_ingest") << ", " << common::timing::Timing::GetMeanSeconds("odom_ingest") * 1000 << ", " 
+         << estimator.cloud_drop_cnt_ << ", " << estimator.feature_drop_cnt_ << std::endl;
     fout.close();
 }
 
-void SaveStatistics::saveMapStatistics(const string &map_filename,
+inline void SaveStatistics::saveMapStatistics(const string &map_filename,
                                        const string &gf_deg_factor_filename,
                                        const string &gf_logdet_filename,
                                        const nav_msgs::Path &laser_aft_mapped_path,
@@ -176,7 +179,7 @@ void SaveStatistics::saveMapStatistics(const string &map_filename,
     fout.close();
 }
 
-void SaveStatistics::saveMapTimeStatistics(const string &map_time_filename)
+inline void SaveStatistics::saveMapTimeStatistics(const string &map_time_filename)
 {
     std::ofstream fout(map_time_filename.c_str(), std::ios::out);
     fout.precision(15);
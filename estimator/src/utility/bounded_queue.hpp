@@ -0,0 +1,137 @@
+/*******************************************************
+ * Copyright (C) 2020, RAM-LAB, Hong Kong University of Science and Technology
+ *
+ * This file is part of M-LOAM (https://ram-lab.com/file/jjiao/m-loam).
+ * If you use this code, please cite the respective publications as
+ * listed on the above websites.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *
+ * Author: Jianhao JIAO (jiaojh1994@gmail.com)
+ *******************************************************/
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <cstddef>
+
+// bounded lock-free MPMC ring with one sequence number per slot (D. Vyukov), both ends are claimed with a CAS
+// used between two pipeline stages: a full ring is handled by the producer with pushDropOldest(), which evicts the
+// oldest item through tryPop(), so the producer is a second consumer of the ring
+// the ring does not block, a consumer that waits for items is woken by the producer (condition variable)
+template <typename T>
+class BoundedQueue
+{
+public:
+    explicit BoundedQueue(const size_t &capacity = 2)
+    {
+        reset(capacity);
+    }
+
+    // not thread-safe, call before the stages start
+    void reset(const size_t &capacity)
+    {
+        size_t size = 2;
+        while (size < capacity) size <<= 1;
+        mask_ = size - 1;
+        cells_.reset(new Cell[size]);
+        for (size_t i = 0; i < size; i++) cells_[i].seq_.store(i, std::memory_order_relaxed);
+        push_pos_.store(0, std::memory_order_relaxed);
+        pop_pos_.store(0, std::memory_order_relaxed);
+    }
+
+    bool tryPush(T &&item)
+    {
+        size_t pos = push_pos_.load(std::memory_order_relaxed);
+        Cell *cell;
+        while (true)
+        {
+            cell = &cells_[pos & mask_];
+            size_t seq = cell->seq_.load(std::memory_order_acquire);
+            std::ptrdiff_t dif = (std::ptrdiff_t)seq - (std::ptrdiff_t)pos;
+            if (dif == 0)
+            {
+                if (push_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            }
+            else if (dif < 0)
+            {
+                return false; // full
+            }
+            else
+            {
+                pos = push_pos_.load(std::memory_order_relaxed);
+            }
+        }
+        cell->data_ = std::move(item);
+        cell->seq_.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool tryPop(T &item)
+    {
+        size_t pos = pop_pos_.load(std::memory_order_relaxed);
+        Cell *cell;
+        while (true)
+        {
+            cell = &cells_[pos & mask_];
+            size_t seq = cell->seq_.load(std::memory_order_acquire);
+            std::ptrdiff_t dif = (std::ptrdiff_t)seq - (std::ptrdiff_t)(pos + 1);
+            if (dif == 0)
+            {
+                if (pop_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            }
+            else if (dif < 0)
+            {
+                return false; // empty
+            }
+            else
+            {
+                pos = pop_pos_.load(std::memory_order_relaxed);
+            }
+        }
+        item = std::move(cell->data_);
+        cell->seq_.store(pos + mask_ + 1, std::memory_order_release);
+        return true;
+    }
+
+    // push the newest item, evict the oldest ones while the ring is full; return the number of evicted items
+    size_t pushDropOldest(T &&item)
+    {
+        size_t drop_cnt = 0;
+        T oldest;
+        while (!tryPush(std::move(item)))
+        {
+            if (tryPop(oldest)) drop_cnt++;
+        }
+        return drop_cnt;
+    }
+
+    // approximate when the stages are running
+    size_t size() const
+    {
+        size_t push_pos = push_pos_.load(std::memory_order_relaxed);
+        size_t pop_pos = pop_pos_.load(std::memory_order_relaxed);
+        return push_pos > pop_pos ? push_pos - pop_pos : 0;
+    }
+
+    size_t capacity() const { return mask_ + 1; }
+
+private:
+    struct Cell
+    {
+        std::atomic<size_t> seq_;
+        T data_;
+    };
+
+    std::unique_ptr<Cell[]> cells_;
+    size_t mask_;
+    // keep the producer and consumer positions on separate cache lines
+    char pad0_[64];
+    std::atomic<size_t> push_pos_;
+    char pad1_[64];
+    std::atomic<size_t> pop_pos_;
+};
+
+//
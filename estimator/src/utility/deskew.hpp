@@ -0,0 +1,131 @@
+/*******************************************************
+ * Copyright (C) 2020, RAM-LAB, Hong Kong University of Science and Technology
+ *
+ * This file is part of M-LOAM (https://ram-lab.com/file/jjiao/m-loam).
+ * If you use this code, please cite the respective publications as
+ * listed on the above websites.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *
+ * Author: Jianhao JIAO (jiaojh1994@gmail.com)
+ *******************************************************/
+
+#pragma once
+
+#include <omp.h>
+#include <algorithm>
+#include <vector>
+
+#include <pcl/point_cloud.h>
+#include <eigen3/Eigen/Dense>
+
+#include "../estimator/pose.h"
+
+#define DESKEW_NUM_BINS 256
+#define DESKEW_CHUNK_SIZE 256
+#define MIN_PARALLEL_DESKEW_SIZE 8192
+
+// batch version of TransformToEnd: project the points of a scan on the end of the scan
+// the point at the ratio s of the scan (fractional part of the intensity / scan_period) is moved by
+// T_end^-1 * T(s), T(s) = (slerp(I, q, s), s * t) as in TransformToStart
+// T_end^-1 * T(s) is tabulated on DESKEW_NUM_BINS + 1 ratios and linearly interpolated between the bins,
+// the points are processed in chunks copied to SoA buffers so that the inner loops are vectorized
+class ScanDeskewer
+{
+public:
+    ScanDeskewer() : scan_period_(0.1f) {}
+
+    // pose: motion from the start to the end of the scan
+    void setMotion(const Pose &pose, const float &scan_period)
+    {
+        scan_period_ = scan_period;
+        table_.resize(DESKEW_NUM_BINS + 1);
+        const Eigen::Quaterniond q_inv = pose.q_.inverse();
+        for (size_t b = 0; b <= DESKEW_NUM_BINS; b++)
+        {
+            const double s = 1.0 * b / DESKEW_NUM_BINS;
+            Eigen::Matrix3d R = (q_inv * Eigen::Quaterniond::Identity().slerp(s, pose.q_)).toRotationMatrix();
+            Eigen::Vector3d t = q_inv * ((s - 1.0) * pose.t_);
+            for (size_t i = 0; i < 3; i++)
+            {
+                for (size_t j = 0; j < 3; j++) table_[b].m_[4 * i + j] = static_cast<float>(R(i, j));
+                table_[b].m_[4 * i + 3] = static_cast<float>(t(i));
+            }
+        }
+        for (size_t b = 0; b < DESKEW_NUM_BINS; b++)
+            for (size_t k = 0; k < 12; k++) table_[b].d_[k] = table_[b + 1].m_[k] - table_[b].m_[k];
+        for (size_t k = 0; k < 12; k++) table_[DESKEW_NUM_BINS].d_[k] = table_[DESKEW_NUM_BINS - 1].d_[k];
+    }
+
+    // in place, the intensity is kept
+    template <typename PointType>
+    void apply(pcl::PointCloud<PointType> &cloud) const
+    {
+        const size_t num_points = cloud.size();
+        const size_t num_chunks = (num_points + DESKEW_CHUNK_SIZE - 1) / DESKEW_CHUNK_SIZE;
+        #pragma omp parallel for schedule(static) if (num_points >= MIN_PARALLEL_DESKEW_SIZE && !omp_in_parallel())
+        for (size_t c = 0; c < num_chunks; c++)
+        {
+            const size_t start_idx = c * DESKEW_CHUNK_SIZE;
+            applyChunk(&cloud.points[start_idx], std::min<size_t>(DESKEW_CHUNK_SIZE, num_points - start_idx));
+        }
+    }
+
+private:
+    // row-major [R | t] of a bin and its difference to the next bin
+    struct Affine
+    {
+        float m_[12];
+        float d_[12];
+    };
+
+    template <typename PointType>
+    void applyChunk(PointType *points, const size_t &num) const
+    {
+        float x[DESKEW_CHUNK_SIZE], y[DESKEW_CHUNK_SIZE], z[DESKEW_CHUNK_SIZE], u[DESKEW_CHUNK_SIZE];
+        int bin[DESKEW_CHUNK_SIZE];
+        const float bins_per_sec = DESKEW_NUM_BINS / scan_period_;
+        for (size_t i = 0; i < num; i++)
+        {
+            x[i] = points[i].x;
+            y[i] = points[i].y;
+            z[i] = points[i].z;
+            u[i] = (points[i].intensity - int(points[i].intensity)) * bins_per_sec;
+        }
+
+        // bin and position in the bin, the ratios beyond the scan are extrapolated from the last bin
+        #pragma omp simd
+        for (size_t i = 0; i < num; i++)
+        {
+            int b = std::min(std::max(static_cast<int>(u[i]), 0), DESKEW_NUM_BINS - 1);
+            bin[i] = b;
+            u[i] -= b;
+        }
+
+        const Affine *table = table_.data();
+        #pragma omp simd
+        for (size_t i = 0; i < num; i++)
+        {
+            const float *m = table[bin[i]].m_;
+            const float *d = table[bin[i]].d_;
+            const float f = u[i];
+            const float px = x[i], py = y[i], pz = z[i];
+            x[i] = (m[0] + f * d[0]) * px + (m[1] + f * d[1]) * py + (m[2] + f * d[2]) * pz + (m[3] + f * d[3]);
+            y[i] = (m[4] + f * d[4]) * px + (m[5] + f * d[5]) * py + (m[6] + f * d[6]) * pz + (m[7] + f * d[7]);
+            z[i] = (m[8] + f * d[8]) * px + (m[9] + f * d[9]) * py + (m[10] + f * d[10]) * pz + (m[11] + f * d[11]);
+        }
+
+        for (size_t i = 0; i < num; i++)
+        {
+            points[i].x = x[i];
+            points[i].y = y[i];
+            points[i].z = z[i];
+        }
+    }
+
+    float scan_period_;
+    std::vector<Affine> table_;
+};
+
+//
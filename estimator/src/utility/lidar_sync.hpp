@@ -0,0 +1,232 @@
+/*******************************************************
+ * Copyright (C) 2020, RAM-LAB, Hong Kong University of Science and Technology
+ *
+ * This file is part of M-LOAM (https://ram-lab.com/file/jjiao/m-loam).
+ * If you use this code, please cite the respective publications as
+ * listed on the above websites.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *
+ * Author: Jianhao JIAO (jiaojh1994@gmail.com)
+ *******************************************************/
+
+#pragma once
+
+#include <omp.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <sensor_msgs/PointCloud2.h>
+#include <sensor_msgs/PointField.h>
+#include <pcl_conversions/pcl_conversions.h>
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+#include "common/color.hpp"
+
+#include "bounded_queue.hpp"
+
+#define LIDAR_SYNC_QUEUE_SIZE 4
+
+// x, y, z (float32) of the message copied straight into the cloud, the other fields are skipped
+// pcl::fromROSMsg copies the data twice: into a PCLPointCloud2, then into the cloud with a generic field mapping
+inline void parseCloudMsg(const sensor_msgs::PointCloud2 &msg, pcl::PointCloud<pcl::PointXYZ> &cloud)
+{
+    static const char *names[3] = {"x", "y", "z"};
+    int offset[3] = {-1, -1, -1};
+    for (const sensor_msgs::PointField &field : msg.fields)
+        for (size_t k = 0; k < 3; k++)
+            if ((field.name == names[k]) && (field.datatype == sensor_msgs::PointField::FLOAT32) && (field.count == 1))
+                offset[k] = field.offset;
+    // the fields and the rows must fit into the point and the data, otherwise the generic conversion reports the error
+    bool valid = !msg.is_bigendian && (size_t(msg.point_step) * msg.width <= msg.row_step) &&
+                 (size_t(msg.row_step) * msg.height <= msg.data.size());
+    for (size_t k = 0; k < 3; k++) valid = valid && (offset[k] >= 0) && (size_t(offset[k]) + sizeof(float) <= msg.point_step);
+    if (!valid)
+    {
+        pcl::fromROSMsg(msg, cloud);
+        return;
+    }
+
+    pcl_conversions::toPCL(msg.header, cloud.header);
+    cloud.width = msg.width;
+    cloud.height = msg.height;
+    cloud.is_dense = msg.is_dense;
+    cloud.points.resize(size_t(msg.width) * msg.height);
+    size_t i = 0;
+    for (size_t row = 0; row < msg.height; row++)
+    {
+        const uint8_t *data = &msg.data[row * msg.row_step];
+        for (size_t col = 0; col < msg.width; col++, i++, data += msg.point_step)
+        {
+            memcpy(&cloud.points[i].x, data + offset[0], sizeof(float));
+            memcpy(&cloud.points[i].y, data + offset[1], sizeof(float));
+            memcpy(&cloud.points[i].z, data + offset[2], sizeof(float));
+        }
+    }
+}
+
+// other point types: generic conversion
+template <typename PointType>
+inline void parseCloudMsg(const sensor_msgs::PointCloud2 &msg, pcl::PointCloud<PointType> &cloud)
+{
+    pcl::fromROSMsg(msg, cloud);
+}
+
+// time synchronization of the clouds of num_laser lidars
+// push(): subscriber of each lidar, the only producer of the ring of the lidar; when the ring is full, pushDropOldest()
+// pops the oldest cloud from the producer side, so each ring has two consumers (push() and spin()): the rings are the
+// lock-free MPMC BoundedQueue
+// spin(): the only reader of the clouds, sleeps until a cloud is pushed (no polling)
+// the heads of the rings are matched when they are all within sync_threshold of the newest one, the older heads are dropped;
+// a matched frame is parsed in parallel (one thread per lidar) and stamped with the time of the first lidar
+template <typename PointType>
+class LidarSynchronizer
+{
+public:
+    typedef std::function<void(const double &, std::vector<pcl::PointCloud<PointType> > &)> FrameCallback;
+
+    LidarSynchronizer()
+        : num_laser_(0), sync_threshold_(0), latest_only_(false), stop_(false), num_push_(0), drop_cnt_(0) {}
+
+    // not thread-safe, call before push() and spin()
+    // latest_only: drop the clouds received while a frame is processed (odometry in a single thread)
+    void setParameters(const size_t &num_laser, const double &sync_threshold, const bool &latest_only)
+    {
+        num_laser_ = num_laser;
+        sync_threshold_ = sync_threshold;
+        latest_only_ = latest_only;
+        rings_.reset(new BoundedQueue<sensor_msgs::PointCloud2ConstPtr>[num_laser]);
+        for (size_t i = 0; i < num_laser; i++) rings_[i].reset(LIDAR_SYNC_QUEUE_SIZE);
+        heads_.assign(num_laser, sensor_msgs::PointCloud2ConstPtr());
+    }
+
+    void push(const size_t &idx, const sensor_msgs::PointCloud2ConstPtr &msg)
+    {
+        drop_cnt_ += rings_[idx].pushDropOldest(sensor_msgs::PointCloud2ConstPtr(msg));
+        {
+            std::lock_guard<std::mutex> lock(m_wait_);
+            num_push_++;
+        }
+        cv_wait_.notify_one();
+    }
+
+    // frames with an empty cloud are skipped
+    void spin(const FrameCallback &callback)
+    {
+        size_t num_push_seen = 0;
+        std::vector<sensor_msgs::PointCloud2ConstPtr> v_msg(num_laser_);
+        std::vector<pcl::PointCloud<PointType> > v_laser_cloud(num_laser_);
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(m_wait_);
+                cv_wait_.wait(lock, [&] { return stop_ || (num_push_ != num_push_seen); });
+                if (stop_) break;
+                num_push_seen = num_push_;
+            }
+
+            double time;
+            while (match(v_msg, time))
+            {
+                #pragma omp parallel for num_threads(num_laser_)
+                for (size_t i = 0; i < num_laser_; i++) parseCloudMsg(*v_msg[i], v_laser_cloud[i]);
+                bool empty_check = false;
+                for (size_t i = 0; i < num_laser_; i++)
+                {
+                    v_msg[i].reset();
+                    if (v_laser_cloud[i].empty()) empty_check = true;
+                }
+                if (!empty_check) callback(time, v_laser_cloud);
+                if (latest_only_ && dropPending())
+                {
+                    std::cout << common::GREEN << "drop lidar frame in odometry for real time performance"
+                              << common::RESET << std::endl;
+                }
+            }
+        }
+    }
+
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_wait_);
+            stop_ = true;
+        }
+        cv_wait_.notify_all();
+    }
+
+    // clouds dropped: not synchronized, or not processed in time
+    size_t dropCnt() const { return drop_cnt_.load(); }
+
+private:
+    // pop the heads of all the rings if they are synchronized
+    bool match(std::vector<sensor_msgs::PointCloud2ConstPtr> &v_msg, double &time)
+    {
+        while (true)
+        {
+            double time_newest = -std::numeric_limits<double>::max();
+            for (size_t i = 0; i < num_laser_; i++)
+            {
+                if (!heads_[i] && !rings_[i].tryPop(heads_[i])) return false;
+                time_newest = std::max(time_newest, heads_[i]->header.stamp.toSec());
+            }
+            // a head older than the threshold can not be matched any more: the other rings only get newer clouds
+            bool synced = true;
+            for (size_t i = 0; i < num_laser_; i++)
+            {
+                if (time_newest - heads_[i]->header.stamp.toSec() > sync_threshold_)
+                {
+                    heads_[i].reset();
+                    drop_cnt_++;
+                    synced = false;
+                }
+            }
+            if (synced) break;
+        }
+        time = heads_[0]->header.stamp.toSec();
+        for (size_t i = 0; i < num_laser_; i++) v_msg[i].swap(heads_[i]);
+        return true;
+    }
+
+    bool dropPending()
+    {
+        size_t drop_cnt = 0;
+        sensor_msgs::PointCloud2ConstPtr msg;
+        for (size_t i = 0; i < num_laser_; i++)
+        {
+            if (heads_[i])
+            {
+                heads_[i].reset();
+                drop_cnt++;
+            }
+            while (rings_[i].tryPop(msg)) drop_cnt++;
+        }
+        drop_cnt_ += drop_cnt;
+        return drop_cnt != 0;
+    }
+
+    size_t num_laser_;
+    double sync_threshold_;
+    bool latest_only_;
+
+    std::unique_ptr<BoundedQueue<sensor_msgs::PointCloud2ConstPtr>[]> rings_;
+    std::vector<sensor_msgs::PointCloud2ConstPtr> heads_; // owned by the consumer
+
+    std::mutex m_wait_;
+    std::condition_variable cv_wait_;
+    bool stop_;
+    size_t num_push_;
+    std::atomic<size_t> drop_cnt_;
+};
+
+//
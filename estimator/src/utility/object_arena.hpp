@@ -0,0 +1,112 @@
+/*******************************************************
+ * Copyright (C) 2020, RAM-LAB, Hong Kong University of Science and Technology
+ *
+ * This file is part of M-LOAM (https://ram-lab.com/file/jjiao/m-loam).
+ * If you use this code, please cite the respective publications as
+ * listed on the above websites.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *
+ * Author: Jianhao JIAO (jiaojh1994@gmail.com)
+ *******************************************************/
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// monotonic arena for the short-lived objects of one frame (cost functions, residual infos)
+// objects are placed into large blocks and destroyed all at once by release(),
+// the blocks are kept so that a steady state frame does not touch the heap for these objects
+// not thread-safe
+class ObjectArena
+{
+public:
+    explicit ObjectArena(const size_t &block_size = 64 * 1024)
+        : block_size_(block_size), cur_block_(0), offset_(0), num_bytes_(0) {}
+
+    ~ObjectArena() { release(); }
+
+    ObjectArena(const ObjectArena &) = delete;
+    ObjectArena &operator=(const ObjectArena &) = delete;
+
+    template <typename T, typename... Args>
+    T *create(Args &&... args)
+    {
+        void *ptr = allocate(sizeof(T), alignof(T));
+        T *obj = new (ptr) T(std::forward<Args>(args)...);
+        if (!std::is_trivially_destructible<T>::value)
+            destructors_.emplace_back(static_cast<void *>(obj), &destroy<T>);
+        return obj;
+    }
+
+    // destroy the objects in the reverse order of creation
+    void release()
+    {
+        for (auto iter = destructors_.rbegin(); iter != destructors_.rend(); iter++) iter->second(iter->first);
+        destructors_.clear();
+        cur_block_ = 0;
+        offset_ = 0;
+        num_bytes_ = 0;
+    }
+
+    size_t numObjects() const { return destructors_.size(); }
+    size_t numBytes() const { return num_bytes_; }
+    size_t capacity() const
+    {
+        size_t cap = 0;
+        for (const Block &block : blocks_) cap += block.size_;
+        return cap;
+    }
+
+private:
+    struct Block
+    {
+        std::unique_ptr<char[]> data_;
+        size_t size_;
+    };
+
+    template <typename T>
+    static void destroy(void *ptr) { static_cast<T *>(ptr)->~T(); }
+
+    void *allocate(const size_t &size, const size_t &align)
+    {
+        while (true)
+        {
+            if (cur_block_ == blocks_.size())
+            {
+                Block block;
+                block.size_ = std::max(block_size_, size + align);
+                block.data_.reset(new char[block.size_]);
+                blocks_.push_back(std::move(block));
+            }
+            Block &block = blocks_[cur_block_];
+            uintptr_t base = reinterpret_cast<uintptr_t>(block.data_.get());
+            uintptr_t addr = (base + offset_ + align - 1) & ~(static_cast<uintptr_t>(align) - 1);
+            if (addr + size <= base + block.size_)
+            {
+                offset_ = addr + size - base;
+                num_bytes_ += size;
+                return reinterpret_cast<void *>(addr);
+            }
+            // the object does not fit into the rest of this block
+            cur_block_++;
+            offset_ = 0;
+        }
+    }
+
+    size_t block_size_;
+    std::vector<Block> blocks_;
+    size_t cur_block_, offset_; // position of the next allocation
+    size_t num_bytes_;
+    std::vector<std::pair<void *, void (*)(void *)> > destructors_;
+};
+
+//
@@ -37,20 +37,21 @@ std::vector<ros::Publisher> v_pub_laser_path;
 // extrinsics
 ros::Publisher pub_extrinsics;
 
-cloudFeature transformCloudFeature(const cloudFeature &cloud_feature, const Eigen::Matrix4f &trans, const int &n)
+// transform one feature cloud to the reference frame and tag its points with the lidar id
+void transformFeatureCloud(const PointICloud &cloud, PointICloud &trans_cloud, const Eigen::Matrix4f &trans, const int &n)
 {
-    cloudFeature trans_cloud_feature;
-    for (auto iter = cloud_feature.begin(); iter != cloud_feature.end(); iter ++)
-    {
-        PointICloud trans_cloud;
-        pcl::transformPointCloud(iter->second, trans_cloud, trans);
-
-        // for (auto &p: trans_cloud.points) p.intensity = n + (p.intensity - int(p.intensity));
-        for (auto &p: trans_cloud.points) p.intensity = n; //把点的强度换为雷达id号
+    pcl::transformPointCloud(cloud, trans_cloud, trans);
+    // for (auto &p: trans_cloud.points) p.intensity = n + (p.intensity - int(p.intensity));
+    for (auto &p: trans_cloud.points) p.intensity = n; //把点的强度换为雷达id号
+}
 
-        trans_cloud_feature.insert(pair<std::string, PointICloud>(iter->first, trans_cloud));
-    }
-    return trans_cloud_feature;
+// the cloud is handed over as it is to the subscribers in the same process (no serialization, see mloam_node_composed),
+// and serialized only for the other processes: it must not be modified after
+void publishSharedCloud(const ros::Publisher &publisher, const std_msgs::Header &header, const PointICloud::Ptr &cloud)
+{
+    if (cloud->empty()) return;
+    pcl_conversions::toPCL(header, cloud->header);
+    publisher.publish(cloud);
 }
 
 void clearPath()
@@ -60,10 +61,10 @@ void clearPath()
 
 void registerPub(ros::NodeHandle &nh)
 {
-    pub_laser_cloud = nh.advertise<sensor_msgs::PointCloud2>("/laser_cloud", 5);
-    pub_laser_outlier = nh.advertise<sensor_msgs::PointCloud2>("/laser_cloud_outlier", 5);
-    pub_corner_points_less_sharp = nh.advertise<sensor_msgs::PointCloud2>("/corner_points_less_sharp", 5);
-    pub_surf_points_less_flat = nh.advertise<sensor_msgs::PointCloud2>("/surf_points_less_flat", 5);
+    pub_laser_cloud = nh.advertise<PointICloud>("/laser_cloud", 5);
+    pub_laser_outlier = nh.advertise<PointICloud>("/laser_cloud_outlier", 5);
+    pub_corner_points_less_sharp = nh.advertise<PointICloud>("/corner_points_less_sharp", 5);
+    pub_surf_points_less_flat = nh.advertise<PointICloud>("/surf_points_less_flat", 5);
     pub_extrinsics = nh.advertise<mloam_msgs::Extrinsics>("/extrinsics", 5);
     for (int i = 0; i < NUM_OF_LASER; i++)
     {
@@ -88,24 +89,32 @@ void pubPointCloud(const Estimator &estimator, const double &time)
     header.frame_id = "laser_" + std::to_string(IDX_REF);
     header.stamp = ros::Time(time);
 
-    PointICloud laser_cloud, laser_cloud_proj, laser_cloud_outlier;
-    PointICloud corner_points_sharp, corner_points_less_sharp, surf_points_flat, surf_points_less_flat;
+    // new clouds for every frame, shared with the mapper and the loop closure
+    PointICloud::Ptr laser_cloud(new PointICloud()), laser_cloud_outlier(new PointICloud());
+    PointICloud::Ptr corner_points_less_sharp(new PointICloud()), surf_points_less_flat(new PointICloud());
     for (size_t n = 0; n < NUM_OF_LASER; n++)
     {
         Pose pose_ext = Pose(estimator.qbl_[n], estimator.tbl_[n]); //主雷达到n雷达的外参
-        cloudFeature cloud_feature_trans = transformCloudFeature(estimator.cur_feature_.second[n], pose_ext.T_.cast<float>(), n); //转到主雷达下
-        laser_cloud += cloud_feature_trans["laser_cloud"];
+        const Eigen::Matrix4f trans = pose_ext.T_.cast<float>();
+        const FeatureFrame &cloud_feature = *estimator.cur_feature_.second[n];
+        // only transform the clouds that are published (转到主雷达下)
+        PointICloud cloud_trans;
+        transformFeatureCloud(cloud_feature.cloud_[LASER_CLOUD], cloud_trans, trans, n);
+        *laser_cloud += cloud_trans;
         if ((ESTIMATE_EXTRINSIC == 0) || (n == IDX_REF))
         {
-            laser_cloud_outlier += cloud_feature_trans["laser_cloud_outlier"];
-            corner_points_less_sharp += cloud_feature_trans["corner_points_less_sharp"];
-            surf_points_less_flat += cloud_feature_trans["surf_points_less_flat"];
+            transformFeatureCloud(cloud_feature.cloud_[LASER_CLOUD_OUTLIER], cloud_trans, trans, n);
+            *laser_cloud_outlier += cloud_trans;
+            transformFeatureCloud(cloud_feature.cloud_[CORNER_POINTS_LESS_SHARP], cloud_trans, trans, n);
+            *corner_points_less_sharp += cloud_trans;
+            transformFeatureCloud(cloud_feature.cloud_[SURF_POINTS_LESS_FLAT], cloud_trans, trans, n);
+            *surf_points_less_flat += cloud_trans;
         }
     }
-    publishCloud(pub_laser_cloud, header, laser_cloud); //所有雷达curr points, 转到主雷达下
-    publishCloud(pub_laser_outlier, header, laser_cloud_outlier); //所有雷达curr outlier points, 包含没有形成聚类的points, 转到主雷达下
-    publishCloud(pub_corner_points_less_sharp, header, corner_points_less_sharp); //所有雷达curr corner_less_sharp points, 转到主雷达下  
-    publishCloud(pub_surf_points_less_flat, header, surf_points_less_flat); //所有雷达curr surf_less_flat points, 转到主雷达下  
+    publishSharedCloud(pub_laser_cloud, header, laser_cloud); //所有雷达curr points, 转到主雷达下
+    publishSharedCloud(pub_laser_outlier, header, laser_cloud_outlier); //所有雷达curr outlier points, 包含没有形成聚类的points, 转到主雷达下
+    publishSharedCloud(pub_corner_points_less_sharp, header, corner_points_less_sharp); //所有雷达curr corner_less_sharp points, 转到主雷达下  
+    publishSharedCloud(pub_surf_points_less_flat, header, surf_points_less_flat); //所有雷达curr surf_less_flat points, 转到主雷达下  
 
     // publish local map
     if (estimator.solver_flag_ == Estimator::SolverFlag::NON_LINEAR)
@@ -30,6 +30,7 @@
 
 #include <eigen3/Eigen/Dense>
 #include <pcl/common/transforms.h>
+#include <pcl_ros/point_cloud.h>
 
 #include "mloam_msgs/Extrinsics.h"
 #include "common/publisher.hpp"
@@ -0,0 +1,52 @@
+/*******************************************************
+ * Copyright (C) 2020, RAM-LAB, Hong Kong University of Science and Technology
+ *
+ * This file is part of M-LOAM (https://ram-lab.com/file/jjiao/m-loam).
+ * If you use this code, please cite the respective publications as
+ * listed on the above websites.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *
+ * Author: Jianhao JIAO (jiaojh1994@gmail.com)
+ *******************************************************/
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+// per-frame records of the sliding window, indexed as table[n][i]: n-th lidar, i-th frame of the window
+// reset() empties the cells but keeps them (and their capacity), so that after the first frames
+// the correspondences of a new frame are written into the memory of the previous ones
+// Alloc: Eigen::aligned_allocator<T> for the records with fixed-size Eigen members
+template <typename T, typename Alloc = std::allocator<T> >
+class WindowTable
+{
+public:
+    typedef std::vector<T, Alloc> Cell;
+
+    void reset(const size_t &num_laser, const size_t &num_frame)
+    {
+        table_.resize(num_laser);
+        for (std::vector<Cell> &frames : table_)
+        {
+            frames.resize(num_frame);
+            for (Cell &cell : frames) cell.clear();
+        }
+    }
+
+    // release the memory
+    void clear() { table_.clear(); }
+
+    size_t size() const { return table_.size(); }
+
+    std::vector<Cell> &operator[](const size_t &n) { return table_[n]; }
+    const std::vector<Cell> &operator[](const size_t &n) const { return table_[n]; }
+
+private:
+    std::vector<std::vector<Cell> > table_;
+};
+
+//
@@ -0,0 +1,171 @@
+// fixtures of test_lidar_scan_batch_factor and test_lidar_map_batch_factor:
+// synthetic point-to-plane/point-to-line features, pose helpers, numeric check of the jacobians, and the cost, gradient and
+// gauss-newton hessian of a ceres::Problem as ceres evaluates them (with the loss functions of the residual blocks)
+
+#pragma once
+
+#include <random>
+#include <vector>
+#include <algorithm>
+
+#include <ceres/ceres.h>
+
+#include "../src/estimator/parameters.h"
+#include "../src/estimator/pose.h"
+#include "../src/utility/utility.h"
+
+// features of the current scan matched to planes and lines of the target (the last scan or the map),
+// T_gt: pose of the current scan in the target frame
+// outliers are moved away from their plane or line by outlier_dis - 5 * outlier_dis, beyond the huber threshold
+inline void generateFeatures(std::mt19937 &rng, const Pose &T_gt, const size_t &num, const double &outlier_ratio,
+                             const double &outlier_dis, std::vector<PointPlaneFeature, Eigen::aligned_allocator<PointPlaneFeature> > &surf_features,
+                             std::vector<PointPlaneFeature, Eigen::aligned_allocator<PointPlaneFeature> > &corner_features)
+{
+    std::uniform_real_distribution<double> uni(-1.0, 1.0);
+    std::normal_distribution<double> noise(0.0, 0.01);
+    auto randomUnit = [&]() { return Eigen::Vector3d(uni(rng), uni(rng), uni(rng)).normalized(); };
+    auto outlier = [&]() { return (0.5 * (uni(rng) + 1.0) < outlier_ratio) ? outlier_dis * (3.0 + 2.0 * uni(rng)) : 0.0; };
+    const Pose T_inv = T_gt.inverse();
+
+    surf_features.clear();
+    corner_features.clear();
+    for (size_t i = 0; i < num; i++)
+    {
+        // plane w^T x + d = 0 through a point x0 of the target
+        Eigen::Vector3d x0 = 20.0 * Eigen::Vector3d(uni(rng), uni(rng), 0.2 * uni(rng));
+        Eigen::Vector3d w = randomUnit();
+        Eigen::Vector3d x = x0 + w.cross(randomUnit()) + w * (noise(rng) + outlier());
+        PointPlaneFeature feature;
+        feature.idx_ = i;
+        feature.type_ = 's';
+        feature.point_ = T_inv.q_ * x + T_inv.t_;
+        feature.coeffs_.setZero();
+        feature.coeffs_.head<3>() = w;
+        feature.coeffs_(3) = -w.dot(x0);
+        surf_features.push_back(feature);
+    }
+    for (size_t i = 0; i < num / 4; i++)
+    {
+        // line through lpa and lpb of the target
+        Eigen::Vector3d lpa = 20.0 * Eigen::Vector3d(uni(rng), uni(rng), 0.2 * uni(rng));
+        Eigen::Vector3d dir = randomUnit();
+        Eigen::Vector3d lpb = lpa + 0.5 * dir;
+        Eigen::Vector3d n = dir.cross(randomUnit()).normalized();
+        Eigen::Vector3d x = lpa + uni(rng) * dir + n * (noise(rng) + outlier());
+        PointPlaneFeature feature;
+        feature.idx_ = i;
+        feature.type_ = 'c';
+        feature.point_ = T_inv.q_ * x + T_inv.t_;
+        feature.coeffs_.head<3>() = lpa;
+        feature.coeffs_.tail<3>() = lpb;
+        corner_features.push_back(feature);
+    }
+}
+
+inline void poseToParam(const Pose &pose, double *para_pose)
+{
+    para_pose[0] = pose.t_(0);
+    para_pose[1] = pose.t_(1);
+    para_pose[2] = pose.t_(2);
+    para_pose[3] = pose.q_.x();
+    para_pose[4] = pose.q_.y();
+    para_pose[5] = pose.q_.z();
+    para_pose[6] = pose.q_.w();
+}
+
+inline Pose paramToPose(const double *para_pose)
+{
+    return Pose(Eigen::Quaterniond(para_pose[6], para_pose[3], para_pose[4], para_pose[5]),
+                Eigen::Vector3d(para_pose[0], para_pose[1], para_pose[2]));
+}
+
+// translation (m) and rotation (rad) between two poses
+inline std::pair<double, double> poseDiff(const Pose &pose_a, const Pose &pose_b)
+{
+    return std::make_pair((pose_a.t_ - pose_b.t_).norm(), pose_a.q_.angularDistance(pose_b.q_));
+}
+
+inline Pose randomPose(std::mt19937 &rng, const double &rot, const double &trans)
+{
+    std::uniform_real_distribution<double> uni(-1.0, 1.0);
+    return Pose(Eigen::Quaterniond(1.0, rot * uni(rng), rot * uni(rng), rot * uni(rng)).normalized(),
+                Eigen::Vector3d(trans * uni(rng), trans * uni(rng), trans * uni(rng)));
+}
+
+// update of PoseLocalParameterization (without degeneracy)
+inline void plus(const double *para_pose, const Eigen::Matrix<double, 6, 1> &delta, double *para_pose_plus)
+{
+    Pose pose = paramToPose(para_pose);
+    poseToParam(Pose((pose.q_ * Utility::deltaQ(delta.tail<3>())).normalized(), pose.t_ + delta.head<3>()), para_pose_plus);
+}
+
+// maximum error of the analytic jacobian of the factor w.r.t. its pose block idx, central differences on [t, theta]
+// the residuals smaller than min_residual are skipped: the point-to-line distance is not differentiable on the line
+inline double checkJacobian(const ceres::CostFunction &factor, double **param, const size_t &idx,
+                            const double &eps, const double &min_residual)
+{
+    const int num_residuals = factor.num_residuals();
+    const size_t num_blocks = factor.parameter_block_sizes().size();
+    std::vector<double> residuals(num_residuals), residuals_plus(num_residuals), residuals_minus(num_residuals);
+    std::vector<std::vector<double> > jacobian(num_blocks, std::vector<double>(num_residuals * SIZE_POSE));
+    std::vector<double *> jacobians(num_blocks);
+    for (size_t j = 0; j < num_blocks; j++) jacobians[j] = jacobian[j].data();
+    factor.Evaluate(param, residuals.data(), jacobians.data());
+
+    double max_err = 0.0;
+    for (int k = 0; k < 6; k++)
+    {
+        Eigen::Matrix<double, 6, 1> delta = Eigen::Matrix<double, 6, 1>::Zero();
+        delta(k) = eps;
+        double para_plus[SIZE_POSE], para_minus[SIZE_POSE];
+        std::vector<double *> param_plus(param, param + num_blocks), param_minus(param, param + num_blocks);
+        plus(param[idx], delta, para_plus);
+        plus(param[idx], -delta, para_minus);
+        param_plus[idx] = para_plus;
+        param_minus[idx] = para_minus;
+        factor.Evaluate(param_plus.data(), residuals_plus.data(), nullptr);
+        factor.Evaluate(param_minus.data(), residuals_minus.data(), nullptr);
+        for (int i = 0; i < num_residuals; i++)
+        {
+            if (std::abs(residuals[i]) < min_residual) continue;
+            double num_jaco = (residuals_plus[i] - residuals_minus[i]) / (2 * eps);
+            double err = std::abs(jacobian[idx][i * SIZE_POSE + k] - num_jaco) / std::max(1.0, std::abs(num_jaco));
+            max_err = std::max(max_err, err);
+        }
+    }
+    return max_err;
+}
+
+// cost, gradient and gauss-newton hessian J^T J on the tangent space of all the parameter blocks, evaluated by ceres:
+// the residuals and the jacobians of the blocks with a loss function are corrected as in the solver
+struct ProblemEvaluation
+{
+    double cost;
+    Eigen::VectorXd gradient;
+    Eigen::MatrixXd hessian;
+};
+
+inline ProblemEvaluation evaluateProblem(ceres::Problem &problem)
+{
+    ProblemEvaluation eval;
+    std::vector<double> gradient;
+    ceres::CRSMatrix jaco;
+    problem.Evaluate(ceres::Problem::EvaluateOptions(), &eval.cost, nullptr, &gradient, &jaco);
+    eval.gradient = Eigen::Map<Eigen::VectorXd>(gradient.data(), gradient.size());
+    Eigen::MatrixXd J = Eigen::MatrixXd::Zero(jaco.num_rows, jaco.num_cols);
+    for (int r = 0; r < jaco.num_rows; r++)
+        for (int k = jaco.rows[r]; k < jaco.rows[r + 1]; k++)
+            J(r, jaco.cols[k]) = jaco.values[k];
+    eval.hessian = J.transpose() * J;
+    return eval;
+}
+
+// relative errors of the cost, the gradient and the hessian of eval to the ones of eval_ref
+inline Eigen::Vector3d evaluationError(const ProblemEvaluation &eval_ref, const ProblemEvaluation &eval)
+{
+    return Eigen::Vector3d(std::abs(eval.cost - eval_ref.cost) / eval_ref.cost,
+                           (eval.gradient - eval_ref.gradient).norm() / eval_ref.gradient.norm(),
+                           (eval.hessian - eval_ref.hessian).norm() / eval_ref.hessian.norm());
+}
+
+//
@@ -0,0 +1,99 @@
+// rosrun mloam test_deskew [num_points] [num_motions]
+// benchmark of ScanDeskewer (tabulated interpolation of the motion) against TransformToEnd point by point,
+// the de-skewed clouds are compared over random motions of the scan
+
+#include <iostream>
+#include <string>
+#include <random>
+#include <vector>
+#include <algorithm>
+
+#include <omp.h>
+
+#include "common/types/type.h"
+
+#include "../src/utility/deskew.hpp"
+#include "../src/utility/utility.h"
+#include "../src/utility/tic_toc.h"
+#include "../src/estimator/pose.h"
+
+#define SCAN_PERIOD_TEST 0.1
+#define MAX_DESKEW_ERROR 1e-4 // m, float precision at 80m is ~1e-5m
+
+// points up to 80m away, the integer part of the intensity is the ring, the fractional part the time in the scan
+void generateScan(std::mt19937 &rng, const size_t &num_points, common::PointICloud &cloud)
+{
+    std::uniform_real_distribution<float> uni(-1.0, 1.0);
+    std::uniform_real_distribution<float> ratio(0.0, 1.0);
+    cloud.clear();
+    cloud.reserve(num_points);
+    for (size_t i = 0; i < num_points; i++)
+    {
+        common::PointI point;
+        float range = 80.0 * ratio(rng);
+        Eigen::Vector3f dir = Eigen::Vector3f(uni(rng), uni(rng), 0.3 * uni(rng)).normalized();
+        point.x = range * dir.x();
+        point.y = range * dir.y();
+        point.z = range * dir.z();
+        point.intensity = static_cast<int>(16 * ratio(rng)) + SCAN_PERIOD_TEST * 0.999 * ratio(rng);
+        cloud.push_back(point);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    const size_t num_points = argc > 1 ? std::stoi(argv[1]) : 100000;
+    const int num_motions = argc > 2 ? std::stoi(argv[2]) : 50;
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<double> uni(-1.0, 1.0);
+
+    common::PointICloud cloud, cloud_ref, cloud_deskew;
+    ScanDeskewer deskewer;
+    double max_err = 0.0, t_ref = 0.0, t_deskew = 0.0, t_deskew_single = 0.0;
+    const int num_threads = omp_get_max_threads();
+    for (int n = 0; n < num_motions; n++)
+    {
+        // motion in one scan: up to ~30deg of yaw, ~6deg of roll and pitch, 3m
+        Pose pose(Eigen::Quaterniond(1.0, 0.05 * uni(rng), 0.05 * uni(rng), 0.25 * uni(rng)).normalized(),
+                  Eigen::Vector3d(3.0 * uni(rng), 0.5 * uni(rng), 0.2 * uni(rng)));
+        generateScan(rng, num_points, cloud);
+
+        TicToc t_solve;
+        cloud_ref.resize(cloud.size());
+        for (size_t i = 0; i < cloud.size(); i++)
+            TransformToEnd(cloud.points[i], cloud_ref.points[i], pose, true, SCAN_PERIOD_TEST);
+        t_ref += t_solve.toc();
+
+        cloud_deskew = cloud;
+        t_solve.tic();
+        deskewer.setMotion(pose, SCAN_PERIOD_TEST);
+        deskewer.apply(cloud_deskew);
+        t_deskew += t_solve.toc();
+
+        omp_set_num_threads(1);
+        common::PointICloud cloud_single = cloud;
+        t_solve.tic();
+        deskewer.apply(cloud_single);
+        t_deskew_single += t_solve.toc();
+        omp_set_num_threads(num_threads);
+
+        double err = 0.0;
+        for (size_t i = 0; i < cloud.size(); i++)
+        {
+            const common::PointI &p = cloud_deskew.points[i], &q = cloud_ref.points[i], &r = cloud_single.points[i];
+            err = std::max(err, (p.getVector3fMap() - q.getVector3fMap()).cast<double>().norm());
+            err = std::max(err, (r.getVector3fMap() - q.getVector3fMap()).cast<double>().norm());
+            if (p.intensity != q.intensity) err = std::max(err, 1.0);
+        }
+        max_err = std::max(max_err, err);
+        printf("motion %d: %.1fdeg, %.2fm, max error: %.2e m\n", n,
+               2 * acos(std::min(1.0, std::abs(pose.q_.w()))) * 180 / M_PI, pose.t_.norm(), err);
+    }
+
+    printf("max error to TransformToEnd: %.2e m\n", max_err);
+    printf("time of %lu points: TransformToEnd %fms, ScanDeskewer %fms (1 thread: %fms)\n", num_points,
+           t_ref / num_motions, t_deskew / num_motions, t_deskew_single / num_motions);
+    bool pass = max_err < MAX_DESKEW_ERROR;
+    printf("%s\n", pass ? "PASS" : "FAIL");
+    return pass ? 0 : -1;
+}
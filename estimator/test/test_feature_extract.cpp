@@ -0,0 +1,219 @@
+// rosrun mloam test_feature_extract 16 scan_0.pcd scan_1.pcd ...
+// microbenchmark of FeatureExtract::extractCloud against the previous AoS + std::sort implementation,
+// the selected edge/plane features of both paths are compared point by point, FAIL if they differ in any frame
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <pcl/io/pcd_io.h>
+#include <pcl/filters/voxel_grid.h>
+
+#include "../src/featureExtract/feature_extract.hpp"
+#include "../src/utility/tic_toc.h"
+
+using namespace common;
+
+// previous implementation, kept as the reference
+void extractCloudLegacy(const PointICloud &laser_cloud, const ScanInfo &scan_info, FeatureFrame &feature_frame)
+{
+    size_t cloud_size = laser_cloud.size();
+    std::vector<float> cloud_curvature(cloud_size, 0);
+    std::vector<int> cloud_sort_ind(cloud_size, 0), cloud_neighbor_picked(cloud_size, 0), cloud_label(cloud_size, 0);
+    for (size_t i = 5; i + 5 < cloud_size; i++)
+    {
+        float diff_x = laser_cloud.points[i - 5].x + laser_cloud.points[i - 4].x + laser_cloud.points[i - 3].x + laser_cloud.points[i - 2].x + laser_cloud.points[i - 1].x - 10 * laser_cloud.points[i].x + laser_cloud.points[i + 1].x + laser_cloud.points[i + 2].x + laser_cloud.points[i + 3].x + laser_cloud.points[i + 4].x + laser_cloud.points[i + 5].x;
+        float diff_y = laser_cloud.points[i - 5].y + laser_cloud.points[i - 4].y + laser_cloud.points[i - 3].y + laser_cloud.points[i - 2].y + laser_cloud.points[i - 1].y - 10 * laser_cloud.points[i].y + laser_cloud.points[i + 1].y + laser_cloud.points[i + 2].y + laser_cloud.points[i + 3].y + laser_cloud.points[i + 4].y + laser_cloud.points[i + 5].y;
+        float diff_z = laser_cloud.points[i - 5].z + laser_cloud.points[i - 4].z + laser_cloud.points[i - 3].z + laser_cloud.points[i - 2].z + laser_cloud.points[i - 1].z - 10 * laser_cloud.points[i].z + laser_cloud.points[i + 1].z + laser_cloud.points[i + 2].z + laser_cloud.points[i + 3].z + laser_cloud.points[i + 4].z + laser_cloud.points[i + 5].z;
+        cloud_curvature[i] = diff_x * diff_x + diff_y * diff_y + diff_z * diff_z;
+        cloud_sort_ind[i] = i;
+    }
+
+    auto mark_neighbor = [&](const int &ind) {
+        for (int l = 1; l <= 5; l++)
+        {
+            float diff_x = laser_cloud.points[ind + l].x - laser_cloud.points[ind + l - 1].x;
+            float diff_y = laser_cloud.points[ind + l].y - laser_cloud.points[ind + l - 1].y;
+            float diff_z = laser_cloud.points[ind + l].z - laser_cloud.points[ind + l - 1].z;
+            if (diff_x * diff_x + diff_y * diff_y + diff_z * diff_z > 0.05) break;
+            cloud_neighbor_picked[ind + l] = 1;
+        }
+        for (int l = -1; l >= -5; l--)
+        {
+            float diff_x = laser_cloud.points[ind + l].x - laser_cloud.points[ind + l + 1].x;
+            float diff_y = laser_cloud.points[ind + l].y - laser_cloud.points[ind + l + 1].y;
+            float diff_z = laser_cloud.points[ind + l].z - laser_cloud.points[ind + l + 1].z;
+            if (diff_x * diff_x + diff_y * diff_y + diff_z * diff_z > 0.05) break;
+            cloud_neighbor_picked[ind + l] = 1;
+        }
+    };
+
+    feature_frame.clear();
+    auto comp = [&cloud_curvature](int i, int j) { return (cloud_curvature[i] < cloud_curvature[j]); };
+    for (size_t i = 0; i < N_SCANS; i++)
+    {
+        if (scan_info.scan_end_ind_[i] - scan_info.scan_start_ind_[i] < 6) continue;
+
+        PointICloud::Ptr surf_points_less_flat_scan(new PointICloud);
+        for (int j = 0; j < 6; j++)
+        {
+            int sp = scan_info.scan_start_ind_[i] + (scan_info.scan_end_ind_[i] - scan_info.scan_start_ind_[i]) * j / 6;
+            int ep = scan_info.scan_start_ind_[i] + (scan_info.scan_end_ind_[i] - scan_info.scan_start_ind_[i]) * (j + 1) / 6 - 1;
+            std::sort(cloud_sort_ind.begin() + sp, cloud_sort_ind.begin() + ep + 1, comp);
+
+            int largest_picked_num = 0;
+            for (int k = ep; k >= sp; k--)
+            {
+                int ind = cloud_sort_ind[k];
+                if (cloud_neighbor_picked[ind] == 0 && cloud_curvature[ind] > 0.1)
+                {
+                    largest_picked_num++;
+                    if (largest_picked_num <= 2)
+                    {
+                        cloud_label[ind] = 2;
+                        feature_frame.cloud_[CORNER_POINTS_SHARP].push_back(laser_cloud.points[ind]);
+                        feature_frame.cloud_[CORNER_POINTS_LESS_SHARP].push_back(laser_cloud.points[ind]);
+                    }
+                    else if (largest_picked_num <= 20)
+                    {
+                        cloud_label[ind] = 1;
+                        feature_frame.cloud_[CORNER_POINTS_LESS_SHARP].push_back(laser_cloud.points[ind]);
+                    }
+                    else
+                    {
+                        break;
+                    }
+                    cloud_neighbor_picked[ind] = 1;
+                    mark_neighbor(ind);
+                }
+            }
+
+            int smallest_picked_num = 0;
+            for (int k = sp; k <= ep; k++)
+            {
+                int ind = cloud_sort_ind[k];
+                if (cloud_neighbor_picked[ind] == 0 && cloud_curvature[ind] < 0.1)
+                {
+                    cloud_label[ind] = -1;
+                    feature_frame.cloud_[SURF_POINTS_FLAT].push_back(laser_cloud.points[ind]);
+                    smallest_picked_num++;
+                    if (smallest_picked_num >= 4) break;
+                    cloud_neighbor_picked[ind] = 1;
+                    mark_neighbor(ind);
+                }
+            }
+
+            for (int k = sp; k <= ep; k++)
+                if (cloud_label[k] <= 0) surf_points_less_flat_scan->push_back(laser_cloud.points[k]);
+        }
+        PointICloud surf_points_less_flat_scan_ds;
+        pcl::VoxelGrid<PointI> down_size_filter;
+        down_size_filter.setInputCloud(surf_points_less_flat_scan);
+        down_size_filter.setLeafSize(0.2, 0.2, 0.2);
+        down_size_filter.filter(surf_points_less_flat_scan_ds);
+        feature_frame.cloud_[SURF_POINTS_LESS_FLAT] += surf_points_less_flat_scan_ds;
+    }
+}
+
+// sort the points into rings by the vertical angle and keep the order inside each ring
+void organizeScan(const pcl::PointCloud<pcl::PointXYZ> &cloud_in, const int &n_scans,
+                  PointICloud &laser_cloud, ScanInfo &scan_info)
+{
+    float min_angle = FLT_MAX, max_angle = -FLT_MAX;
+    std::vector<float> vertical_angle(cloud_in.size());
+    for (size_t i = 0; i < cloud_in.size(); i++)
+    {
+        const pcl::PointXYZ &p = cloud_in.points[i];
+        vertical_angle[i] = atan2(p.z, sqrt(p.x * p.x + p.y * p.y));
+        min_angle = std::min(min_angle, vertical_angle[i]);
+        max_angle = std::max(max_angle, vertical_angle[i]);
+    }
+
+    std::vector<PointICloud> cloud_scan(n_scans);
+    for (size_t i = 0; i < cloud_in.size(); i++)
+    {
+        int row_id = int((vertical_angle[i] - min_angle) / (max_angle - min_angle + 1e-6) * (n_scans - 1) + 0.5);
+        PointI point;
+        point.x = cloud_in.points[i].x;
+        point.y = cloud_in.points[i].y;
+        point.z = cloud_in.points[i].z;
+        point.intensity = row_id;
+        cloud_scan[row_id].push_back(point);
+    }
+
+    laser_cloud.clear();
+    for (int i = 0; i < n_scans; i++)
+    {
+        scan_info.scan_start_ind_[i] = laser_cloud.size() + 5;
+        laser_cloud += cloud_scan[i];
+        scan_info.scan_end_ind_[i] = laser_cloud.size() - 6;
+    }
+}
+
+bool equalCloud(const PointICloud &cloud_a, const PointICloud &cloud_b)
+{
+    if (cloud_a.size() != cloud_b.size()) return false;
+    for (size_t i = 0; i < cloud_a.size(); i++)
+    {
+        if ((cloud_a.points[i].x != cloud_b.points[i].x) ||
+            (cloud_a.points[i].y != cloud_b.points[i].y) ||
+            (cloud_a.points[i].z != cloud_b.points[i].z))
+            return false;
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 3)
+    {
+        std::cout << "usage: test_feature_extract n_scans scan_0.pcd [scan_1.pcd ...]" << std::endl;
+        return -1;
+    }
+    const int n_scans = std::stoi(argv[1]);
+    const int n_trials = 20;
+    N_SCANS = n_scans;
+
+    pcl::PCDReader pcd_reader;
+    FeatureExtract f_extract;
+    double t_legacy = 0, t_new = 0;
+    int n_frame = 0, n_mismatch = 0;
+    for (int k = 2; k < argc; k++)
+    {
+        pcl::PointCloud<pcl::PointXYZ> cloud_in;
+        if (pcd_reader.read(argv[k], cloud_in) < 0) continue;
+
+        FeatureFrame frame_legacy, frame_new;
+        ScanInfo scan_info(n_scans, false);
+        organizeScan(cloud_in, n_scans, frame_new.cloud_[LASER_CLOUD], scan_info);
+        const PointICloud laser_cloud = frame_new.cloud_[LASER_CLOUD];
+
+        TicToc t_legacy_frame;
+        for (int i = 0; i < n_trials; i++) extractCloudLegacy(laser_cloud, scan_info, frame_legacy);
+        double t_legacy_avg = t_legacy_frame.toc() / n_trials;
+        t_legacy += t_legacy_avg;
+
+        TicToc t_new_frame;
+        for (int i = 0; i < n_trials; i++) f_extract.extractCloud(scan_info, frame_new);
+        double t_new_avg = t_new_frame.toc() / n_trials;
+        t_new += t_new_avg;
+
+        // the two paths only differ if points with equal curvature compete for the last selected slot
+        bool same = equalCloud(frame_legacy.cloud_[CORNER_POINTS_SHARP], frame_new.cloud_[CORNER_POINTS_SHARP]) &&
+                    equalCloud(frame_legacy.cloud_[CORNER_POINTS_LESS_SHARP], frame_new.cloud_[CORNER_POINTS_LESS_SHARP]) &&
+                    equalCloud(frame_legacy.cloud_[SURF_POINTS_FLAT], frame_new.cloud_[SURF_POINTS_FLAT]);
+        if (!same) n_mismatch++;
+        n_frame++;
+        // less flat points are downsampled by different filters, only report their sizes
+        printf("%s: points %lu, legacy %fms, new %fms, %s, less flat %lu/%lu\n", argv[k], laser_cloud.size(),
+            t_legacy_avg, t_new_avg, same ? "same" : "MISMATCH", 
+            frame_legacy.cloud_[SURF_POINTS_LESS_FLAT].size(), frame_new.cloud_[SURF_POINTS_LESS_FLAT].size());
+    }
+    if (n_frame == 0) return -1;
+    printf("%d frames, %d beams: legacy %fms, new %fms, speedup %f, mismatch %d\n",
+        n_frame, n_scans, t_legacy / n_frame, t_new / n_frame, t_legacy / t_new, n_mismatch);
+    bool pass = (n_mismatch == 0);
+    printf("%s\n", pass ? "PASS" : "FAIL");
+    return pass ? 0 : -1;
+}
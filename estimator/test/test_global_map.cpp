@@ -0,0 +1,144 @@
+// rosrun mloam test_global_map [num_points]
+// check of the delta of GlobalMapBuilder (/laser_cloud_map_delta) on a synthetic drive: out and back along x
+// a subscriber keeps its map from the deltas only (changed tiles replaced, released tiles dropped), it is compared with
+// 1. the tiles of the builder after each step: tiles added, evicted when the vehicle leaves, rebuilt when it comes back
+// 2. the tiles of a builder without eviction: a rebuilt tile is the same as the tile that was never released
+
+#include <iostream>
+#include <string>
+#include <random>
+#include <vector>
+#include <map>
+#include <algorithm>
+
+#include "common/types/type.h"
+
+#include "../src/lidarMapper/global_map.hpp"
+
+#define LEAF_SIZE_TEST 0.4
+#define TILE_SIZE_TEST 5.0
+#define KF_RES_TEST 10.0
+#define TRACE_THRESHOLD_TEST 10.0
+#define EVICT_RADIUS_TEST 60.0
+
+typedef std::map<GlobalMapBuilder::TileKey, common::PointICovCloud> SubscriberMap;
+
+bool samePoints(const common::PointICovCloud &cloud_a, const common::PointICovCloud &cloud_b)
+{
+    if (cloud_a.size() != cloud_b.size()) return false;
+    for (size_t i = 0; i < cloud_a.size(); i++)
+    {
+        const common::PointIWithCov &pa = cloud_a.points[i], &pb = cloud_b.points[i];
+        if ((pa.x != pb.x) || (pa.y != pb.y) || (pa.z != pb.z) || (pa.intensity != pb.intensity)) return false;
+        for (size_t j = 0; j < 6; j++)
+            if (pa.cov_vec[j] != pb.cov_vec[j]) return false;
+    }
+    return true;
+}
+
+// keyframe cloud in the world frame, points within 30m of the keyframe, seeded by the keyframe index
+GlobalMapBuilder::KeyframeCloudFunc keyframeCloud(const common::PointI &position, const int &kf_ind, const size_t &num_points)
+{
+    return [position, kf_ind, num_points]()
+    {
+        std::mt19937 rng(kf_ind);
+        std::uniform_real_distribution<float> uni(-1.0, 1.0);
+        std::uniform_real_distribution<float> cov(0.0, 0.5);
+        common::PointICovCloud::Ptr cloud(new common::PointICovCloud());
+        for (size_t i = 0; i < num_points; i++)
+        {
+            common::PointIWithCov point;
+            point.x = position.x + 30.0 * uni(rng);
+            point.y = position.y + 30.0 * uni(rng);
+            point.z = position.z + 3.0 * uni(rng);
+            point.intensity = kf_ind;
+            for (size_t j = 0; j < 6; j++) point.cov_vec[j] = (j == 0 || j == 3 || j == 5) ? cov(rng) : 0.0;
+            point.cov_trace = point.cov_vec[0] + point.cov_vec[3] + point.cov_vec[5];
+            cloud->push_back(point);
+        }
+        return common::PointICovCloud::ConstPtr(cloud);
+    };
+}
+
+// apply the delta of the builder to the subscriber map, false if a released tile was not in the map
+bool applyDelta(GlobalMapBuilder &global_map, SubscriberMap &sub_map)
+{
+    GlobalMapBuilder::TileClouds tiles;
+    std::vector<GlobalMapBuilder::TileKey> evicted;
+    global_map.getDelta(tiles, evicted);
+    bool valid = true;
+    for (const GlobalMapBuilder::TileKey &key : evicted) valid = (sub_map.erase(key) == 1) && valid;
+    for (const auto &tile : tiles) sub_map[tile.first] = *tile.second;
+    return valid;
+}
+
+// the subscriber map is the map of the builder: same tiles, concatenated in the order of their keys
+bool sameMap(const GlobalMapBuilder &global_map, const SubscriberMap &sub_map)
+{
+    common::PointICovCloud cloud, sub_cloud;
+    global_map.getMap(common::PointI(), 1e9, cloud);
+    for (const auto &tile : sub_map) sub_cloud += tile.second;
+    return (sub_map.size() == global_map.numTiles()) && samePoints(cloud, sub_cloud);
+}
+
+// each tile of the subscriber map is the tile of the reference
+bool sameTiles(const SubscriberMap &sub_map, const SubscriberMap &ref_map)
+{
+    for (const auto &tile : sub_map)
+    {
+        auto iter = ref_map.find(tile.first);
+        if ((iter == ref_map.end()) || !samePoints(tile.second, iter->second)) return false;
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    const size_t num_points = argc > 1 ? std::stoi(argv[1]) : 2000;
+
+    GlobalMapBuilder global_map, global_map_ref;
+    global_map.setParameters(LEAF_SIZE_TEST, TILE_SIZE_TEST, KF_RES_TEST, TRACE_THRESHOLD_TEST, EVICT_RADIUS_TEST);
+    global_map_ref.setParameters(LEAF_SIZE_TEST, TILE_SIZE_TEST, KF_RES_TEST, TRACE_THRESHOLD_TEST);
+    SubscriberMap sub_map, ref_map;
+
+    // 0 -> 100m: add, 100 -> 400m: evict the tiles around the start, 400 -> 0m: evict the far tiles, rebuild the start
+    std::vector<float> positions;
+    for (float x = 0; x <= 400; x += KF_RES_TEST) positions.push_back(x);
+    for (float x = 390; x >= 0; x -= KF_RES_TEST) positions.push_back(x);
+
+    bool pass = true;
+    size_t max_evicted = 0, num_rebuilt = 0;
+    std::vector<GlobalMapBuilder::TileKey> start_tiles;
+    for (size_t k = 0; k < positions.size(); k++)
+    {
+        common::PointI position;
+        position.x = positions[k];
+        position.y = position.z = 0;
+        // on the way back the cells already have a keyframe: only the position is updated
+        bool added = global_map.addKeyframe(position, keyframeCloud(position, k, num_points));
+        if (added) global_map_ref.addKeyframe(position, keyframeCloud(position, k, num_points));
+        do global_map.update(1e9); while (global_map.numQueued() != 0);
+        global_map_ref.update(1e9);
+
+        bool valid_delta = applyDelta(global_map, sub_map);
+        applyDelta(global_map_ref, ref_map);
+        bool valid = valid_delta && sameMap(global_map, sub_map) && sameTiles(sub_map, ref_map);
+        if (!valid) printf("keyframe %lu at %.0fm: the subscriber map differs from the map\n", k, position.x);
+        pass = pass && valid;
+
+        if (position.x == 100.0 && start_tiles.empty())
+            for (const auto &tile : sub_map) start_tiles.push_back(tile.first);
+        max_evicted = std::max(max_evicted, global_map.numEvicted());
+        num_rebuilt = std::count_if(start_tiles.begin(), start_tiles.end(),
+                                    [&](const GlobalMapBuilder::TileKey &key) { return sub_map.count(key) != 0; });
+    }
+    // back at the start: the tiles within the evict radius are rebuilt, the far ones are released
+    size_t num_far = std::count_if(sub_map.begin(), sub_map.end(),
+                                   [](const SubscriberMap::value_type &tile) { return std::get<0>(tile.first) * TILE_SIZE_TEST > 200; });
+
+    printf("tiles: %lu, %lu without eviction, at most %lu evicted, %lu of %lu tiles around the start rebuilt, %lu far tiles\n",
+           sub_map.size(), ref_map.size(), max_evicted, num_rebuilt, start_tiles.size(), num_far);
+    pass = pass && (max_evicted != 0) && (num_rebuilt != 0) && (num_far == 0) && (sub_map.size() < ref_map.size());
+    printf("%s\n", pass ? "PASS" : "FAIL");
+    return pass ? 0 : -1;
+}
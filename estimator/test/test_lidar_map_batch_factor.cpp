@@ -0,0 +1,196 @@
+// rosrun mloam test_lidar_map_batch_factor [num_features] [outlier_ratio]
+// check of LidarMapBatchFactor and LidarPureOdomBatchFactor on synthetic scan-to-map problems:
+// 1. analytic jacobians of the features (without the huber loss) against numeric differentiation on the tangent space of
+//    the poses, for the pure odometry only of T_i: the jacobians of T_pivot and T_ext are the approximations of the
+//    single-feature factors (lidar_pure_odom_factor.hpp)
+// 2. cost, gradient and gauss-newton hessian evaluated by ceres against one block per feature (lidar_map_factor.hpp,
+//    lidar_pure_odom_factor.hpp) with a ceres::HuberLoss
+// 3. poses solved with the batched blocks and with the per-feature blocks (BATCH_MAP_FACTOR 1 and 0)
+
+#include <iostream>
+#include <string>
+#include <random>
+#include <vector>
+#include <algorithm>
+
+#include <ceres/ceres.h>
+
+#include "../src/factor/lidar_map_batch_factor.hpp"
+#include "../src/factor/lidar_map_factor.hpp"
+#include "../src/factor/lidar_pure_odom_factor.hpp"
+#include "../src/factor/pose_local_parameterization.h"
+#include "batch_factor_test_utils.hpp"
+
+#define HUBER_DELTA_MAP 0.1 // lidar_mapper_keyframe.cpp
+#define HUBER_DELTA_ODOM 1.0 // optimizeMap() of the estimator
+
+void addPoseBlock(ceres::Problem &problem, double *para_pose)
+{
+    PoseLocalParameterization *local_parameterization = new PoseLocalParameterization();
+    local_parameterization->setParameter();
+    problem.AddParameterBlock(para_pose, SIZE_POSE, local_parameterization);
+}
+
+// scan-to-map registration of lidar_mapper_keyframe.cpp
+void addMapBlocks(ceres::Problem &problem, const std::vector<PointPlaneFeature, Eigen::aligned_allocator<PointPlaneFeature> > &surf_features,
+                  const std::vector<PointPlaneFeature, Eigen::aligned_allocator<PointPlaneFeature> > &corner_features, const Eigen::Matrix3d &cov_matrix,
+                  const bool &batch, double *para_pose)
+{
+    addPoseBlock(problem, para_pose);
+    if (batch)
+    {
+        FeatureBatch feature_batch(HUBER_DELTA_MAP);
+        for (const PointPlaneFeature &feature : surf_features) feature_batch.addSurf(feature, LidarMapBatchFactor::sqrtInfo(cov_matrix));
+        for (const PointPlaneFeature &feature : corner_features) feature_batch.addCorner(feature, LidarMapBatchFactor::sqrtInfo(cov_matrix));
+        problem.AddResidualBlock(new LidarMapBatchFactor(std::move(feature_batch)), nullptr, para_pose);
+    }
+    else
+    {
+        ceres::LossFunction *loss_function = new ceres::HuberLoss(HUBER_DELTA_MAP);
+        for (const PointPlaneFeature &feature : surf_features)
+            problem.AddResidualBlock(new LidarMapPlaneNormFactor(feature.point_, feature.coeffs_.head<4>(), cov_matrix), loss_function, para_pose);
+        for (const PointPlaneFeature &feature : corner_features)
+            problem.AddResidualBlock(new LidarMapEdgeFactor(feature.point_, feature.coeffs_, cov_matrix), loss_function, para_pose);
+    }
+}
+
+// pure odometry features of frame i in the window, param: [T_pivot, T_i, T_ext]
+void addPureOdomBlocks(ceres::Problem &problem, const std::vector<PointPlaneFeature, Eigen::aligned_allocator<PointPlaneFeature> > &surf_features,
+                       const std::vector<PointPlaneFeature, Eigen::aligned_allocator<PointPlaneFeature> > &corner_features, const bool &batch, double **param)
+{
+    for (size_t j = 0; j < 3; j++) addPoseBlock(problem, param[j]);
+    if (batch)
+    {
+        FeatureBatch feature_batch(HUBER_DELTA_ODOM);
+        for (const PointPlaneFeature &feature : surf_features) feature_batch.addSurf(feature);
+        for (const PointPlaneFeature &feature : corner_features) feature_batch.addCorner(feature);
+        problem.AddResidualBlock(new LidarPureOdomBatchFactor(std::move(feature_batch)), nullptr, param[0], param[1], param[2]);
+    }
+    else
+    {
+        ceres::LossFunction *loss_function = new ceres::HuberLoss(HUBER_DELTA_ODOM);
+        for (const PointPlaneFeature &feature : surf_features)
+            problem.AddResidualBlock(new LidarPureOdomPlaneNormFactor(feature.point_, feature.coeffs_.head<4>(), 1.0),
+                                     loss_function, param[0], param[1], param[2]);
+        for (const PointPlaneFeature &feature : corner_features)
+            problem.AddResidualBlock(new LidarPureOdomEdgeFactor(feature.point_, feature.coeffs_, 1.0),
+                                     loss_function, param[0], param[1], param[2]);
+    }
+}
+
+void solve(ceres::Problem &problem)
+{
+    ceres::Solver::Options options;
+    options.linear_solver_type = ceres::DENSE_SCHUR;
+    options.max_num_iterations = 100;
+    options.function_tolerance = 1e-14;
+    options.gradient_tolerance = 1e-14;
+    options.parameter_tolerance = 1e-14;
+    options.minimizer_progress_to_stdout = false;
+    ceres::Solver::Summary summary;
+    ceres::Solve(options, &problem, &summary);
+}
+
+int main(int argc, char *argv[])
+{
+    const size_t num_features = argc > 1 ? std::stoi(argv[1]) : 400;
+    const double outlier_ratio = argc > 2 ? std::stod(argv[2]) : 0.1;
+    const int num_trials = 20;
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<double> uni(-1.0, 1.0);
+
+    double max_jaco_err = 0.0, max_diff_map = 0.0, max_diff_odom = 0.0;
+    Eigen::Vector3d max_eval_err = Eigen::Vector3d::Zero(); // cost, gradient, hessian
+    for (int n = 0; n < num_trials; n++)
+    {
+        std::vector<PointPlaneFeature, Eigen::aligned_allocator<PointPlaneFeature> > surf_features, corner_features;
+
+        // ******************* scan-to-map: LidarMapBatchFactor
+        {
+            Pose T_gt = randomPose(rng, 0.2, 10.0);
+            generateFeatures(rng, T_gt, num_features, outlier_ratio, 0.2, surf_features, corner_features);
+            Eigen::Matrix3d cov_matrix = Eigen::Matrix3d::Identity() * 0.01 * (uni(rng) + 2.0);
+
+            double para_ini[SIZE_POSE];
+            double *param[1] = {para_ini};
+            poseToParam(T_gt * randomPose(rng, 0.01, 0.1), para_ini);
+
+            FeatureBatch feature_batch;
+            for (const PointPlaneFeature &feature : surf_features) feature_batch.addSurf(feature, LidarMapBatchFactor::sqrtInfo(cov_matrix));
+            for (const PointPlaneFeature &feature : corner_features) feature_batch.addCorner(feature, LidarMapBatchFactor::sqrtInfo(cov_matrix));
+            max_jaco_err = std::max(max_jaco_err, checkJacobian(LidarMapBatchFactor(std::move(feature_batch)), param, 0, 1e-7, 1e-3));
+
+            ceres::Problem problem_ref, problem_batch;
+            addMapBlocks(problem_ref, surf_features, corner_features, cov_matrix, false, para_ini);
+            addMapBlocks(problem_batch, surf_features, corner_features, cov_matrix, true, para_ini);
+            max_eval_err = max_eval_err.cwiseMax(evaluationError(evaluateProblem(problem_ref), evaluateProblem(problem_batch)));
+
+            double para_ceres[SIZE_POSE], para_batch[SIZE_POSE];
+            std::copy(para_ini, para_ini + SIZE_POSE, para_ceres);
+            std::copy(para_ini, para_ini + SIZE_POSE, para_batch);
+            ceres::Problem problem_ceres_solve, problem_batch_solve;
+            addMapBlocks(problem_ceres_solve, surf_features, corner_features, cov_matrix, false, para_ceres);
+            addMapBlocks(problem_batch_solve, surf_features, corner_features, cov_matrix, true, para_batch);
+            solve(problem_ceres_solve);
+            solve(problem_batch_solve);
+            std::pair<double, double> diff = poseDiff(paramToPose(para_ceres), paramToPose(para_batch));
+            max_diff_map = std::max(max_diff_map, std::max(diff.first, diff.second));
+            printf("trial %d map: %lu surf, %lu corner, error to gt: %.2e m\n", n, surf_features.size(), corner_features.size(),
+                   poseDiff(paramToPose(para_batch), T_gt).first);
+        }
+
+        // ******************* pure odometry: LidarPureOdomBatchFactor
+        {
+            Pose T_pivot = randomPose(rng, 0.2, 10.0);
+            Pose T_i = T_pivot * randomPose(rng, 0.05, 1.0);
+            Pose T_ext = randomPose(rng, 0.5, 1.0);
+            Pose T_pivot_inv = T_pivot.inverse();
+            Pose T_ext_pi = T_pivot_inv * T_i;
+            T_ext_pi = T_ext_pi * T_ext; // lidar at frame i in the pivot frame
+            generateFeatures(rng, T_ext_pi, num_features, outlier_ratio, 2.0, surf_features, corner_features);
+
+            double para_pivot[SIZE_POSE], para_i[SIZE_POSE], para_ext[SIZE_POSE];
+            double *param[3] = {para_pivot, para_i, para_ext};
+            poseToParam(T_pivot, para_pivot);
+            poseToParam(T_i * randomPose(rng, 0.01, 0.1), para_i);
+            poseToParam(T_ext, para_ext);
+
+            FeatureBatch feature_batch;
+            for (const PointPlaneFeature &feature : surf_features) feature_batch.addSurf(feature);
+            for (const PointPlaneFeature &feature : corner_features) feature_batch.addCorner(feature);
+            max_jaco_err = std::max(max_jaco_err, checkJacobian(LidarPureOdomBatchFactor(std::move(feature_batch)), param, 1, 1e-7, 1e-3));
+
+            ceres::Problem problem_ref, problem_batch;
+            addPureOdomBlocks(problem_ref, surf_features, corner_features, false, param);
+            addPureOdomBlocks(problem_batch, surf_features, corner_features, true, param);
+            max_eval_err = max_eval_err.cwiseMax(evaluationError(evaluateProblem(problem_ref), evaluateProblem(problem_batch)));
+
+            // the pivot pose and the extrinsics are fixed
+            double para_i_ceres[SIZE_POSE], para_i_batch[SIZE_POSE];
+            std::copy(para_i, para_i + SIZE_POSE, para_i_ceres);
+            std::copy(para_i, para_i + SIZE_POSE, para_i_batch);
+            double *param_ceres[3] = {para_pivot, para_i_ceres, para_ext};
+            double *param_batch[3] = {para_pivot, para_i_batch, para_ext};
+            ceres::Problem problem_ceres_solve, problem_batch_solve;
+            addPureOdomBlocks(problem_ceres_solve, surf_features, corner_features, false, param_ceres);
+            addPureOdomBlocks(problem_batch_solve, surf_features, corner_features, true, param_batch);
+            for (ceres::Problem *problem : {&problem_ceres_solve, &problem_batch_solve})
+            {
+                problem->SetParameterBlockConstant(para_pivot);
+                problem->SetParameterBlockConstant(para_ext);
+                solve(*problem);
+            }
+            std::pair<double, double> diff = poseDiff(paramToPose(para_i_ceres), paramToPose(para_i_batch));
+            max_diff_odom = std::max(max_diff_odom, std::max(diff.first, diff.second));
+            printf("trial %d odom: %lu surf, %lu corner, error to gt: %.2e m\n", n, surf_features.size(), corner_features.size(),
+                   poseDiff(paramToPose(para_i_batch), T_i).first);
+        }
+    }
+
+    printf("jacobian error: %.2e, cost error: %.2e, gradient error: %.2e, hessian error: %.2e\n",
+           max_jaco_err, max_eval_err(0), max_eval_err(1), max_eval_err(2));
+    printf("pose difference to the per-feature solver: map %.2e, pure odometry %.2e\n", max_diff_map, max_diff_odom);
+    bool pass = (max_jaco_err < 1e-5) && (max_eval_err.maxCoeff() < 1e-9) && (max_diff_map < 1e-6) && (max_diff_odom < 1e-6);
+    printf("%s\n", pass ? "PASS" : "FAIL");
+    return pass ? 0 : -1;
+}
@@ -0,0 +1,138 @@
+// rosrun mloam test_lidar_scan_batch_factor [num_features] [outlier_ratio]
+// check of LidarScanBatchFactor on a synthetic scan-to-scan problem:
+// 1. analytic jacobian of the features (without the huber loss) against numeric differentiation on the tangent space of the pose
+// 2. cost, gradient and gauss-newton hessian evaluated by ceres against one LidarScanPlaneNormFactor/LidarScanEdgeFactorVector
+//    block per feature with a ceres::HuberLoss
+// 3. poses solved by the three tracker solvers (TRACKER_SOLVER 0: per-feature blocks, 1: batched block, 2: gauss-newton)
+
+#include <iostream>
+#include <string>
+#include <random>
+#include <vector>
+#include <algorithm>
+
+#include <ceres/ceres.h>
+
+#include "../src/lidarTracker/lidar_tracker.h"
+#include "../src/factor/lidar_scan_batch_factor.hpp"
+#include "../src/factor/lidar_scan_factor.hpp"
+#include "../src/factor/pose_local_parameterization.h"
+#include "../src/utility/tic_toc.h"
+#include "batch_factor_test_utils.hpp"
+
+#define HUBER_DELTA 0.1
+
+void addScanBlocks(ceres::Problem &problem, const std::vector<PointPlaneFeature, Eigen::aligned_allocator<PointPlaneFeature> > &surf_features,
+                   const std::vector<PointPlaneFeature, Eigen::aligned_allocator<PointPlaneFeature> > &corner_features, const bool &batch, double *para_pose)
+{
+    PoseLocalParameterization *local_parameterization = new PoseLocalParameterization();
+    local_parameterization->setParameter();
+    problem.AddParameterBlock(para_pose, SIZE_POSE, local_parameterization);
+    if (batch)
+    {
+        problem.AddResidualBlock(new LidarScanBatchFactor(surf_features, corner_features, HUBER_DELTA), nullptr, para_pose);
+    }
+    else
+    {
+        ceres::LossFunction *loss_function = new ceres::HuberLoss(HUBER_DELTA);
+        for (const PointPlaneFeature &feature : surf_features)
+            problem.AddResidualBlock(new LidarScanPlaneNormFactor(feature.point_, feature.coeffs_.head<4>(), 1.0), loss_function, para_pose);
+        for (const PointPlaneFeature &feature : corner_features)
+            problem.AddResidualBlock(new LidarScanEdgeFactorVector(feature.point_, feature.coeffs_, 1.0), loss_function, para_pose);
+    }
+}
+
+void solveCeres(const std::vector<PointPlaneFeature, Eigen::aligned_allocator<PointPlaneFeature> > &surf_features, const std::vector<PointPlaneFeature, Eigen::aligned_allocator<PointPlaneFeature> > &corner_features,
+                const bool &batch, const int &max_iter, double *para_pose)
+{
+    ceres::Problem problem;
+    addScanBlocks(problem, surf_features, corner_features, batch, para_pose);
+    ceres::Solver::Options options;
+    options.linear_solver_type = ceres::DENSE_SCHUR;
+    options.max_num_iterations = max_iter;
+    options.function_tolerance = 1e-14;
+    options.gradient_tolerance = 1e-14;
+    options.parameter_tolerance = 1e-14;
+    options.minimizer_progress_to_stdout = false;
+    ceres::Solver::Summary summary;
+    ceres::Solve(options, &problem, &summary);
+}
+
+int main(int argc, char *argv[])
+{
+    const size_t num_features = argc > 1 ? std::stoi(argv[1]) : 400;
+    const double outlier_ratio = argc > 2 ? std::stod(argv[2]) : 0.1;
+    const int num_trials = 20;
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<double> uni(-1.0, 1.0);
+    LidarTracker lidar_tracker;
+
+    double max_jaco_err = 0.0;
+    Eigen::Vector3d max_eval_err = Eigen::Vector3d::Zero(); // cost, gradient, hessian
+    double max_diff_batch = 0.0, max_diff_gn = 0.0, max_diff_batch_4 = 0.0;
+    double t_ceres = 0.0, t_batch = 0.0, t_gn = 0.0;
+    for (int n = 0; n < num_trials; n++)
+    {
+        Pose T_gt(Eigen::Quaterniond(1.0, 0.02 * uni(rng), 0.02 * uni(rng), 0.1 * uni(rng)).normalized(),
+                  Eigen::Vector3d(uni(rng), 0.3 * uni(rng), 0.05 * uni(rng)));
+        std::vector<PointPlaneFeature, Eigen::aligned_allocator<PointPlaneFeature> > surf_features, corner_features;
+        generateFeatures(rng, T_gt, num_features, outlier_ratio, 0.2, surf_features, corner_features);
+
+        // initial pose: ground truth with an error of ~0.1m and ~1deg
+        Pose T_ini(T_gt.q_ * Utility::deltaQ(Eigen::Vector3d(0.02 * uni(rng), 0.02 * uni(rng), 0.02 * uni(rng))).normalized(),
+                   T_gt.t_ + Eigen::Vector3d(0.1 * uni(rng), 0.1 * uni(rng), 0.05 * uni(rng)));
+        double para_ini[SIZE_POSE];
+        poseToParam(T_ini, para_ini);
+
+        // 1. jacobian
+        double *param[1] = {para_ini};
+        max_jaco_err = std::max(max_jaco_err, checkJacobian(LidarScanBatchFactor(surf_features, corner_features, 0.0), param, 0, 1e-6, 0.0));
+
+        // 2. cost, gradient and hessian
+        ceres::Problem problem_ref, problem_batch;
+        addScanBlocks(problem_ref, surf_features, corner_features, false, para_ini);
+        addScanBlocks(problem_batch, surf_features, corner_features, true, para_ini);
+        max_eval_err = max_eval_err.cwiseMax(evaluationError(evaluateProblem(problem_ref), evaluateProblem(problem_batch)));
+
+        // 3. solved poses, to convergence
+        double para_ceres[SIZE_POSE], para_batch[SIZE_POSE], para_gn[SIZE_POSE];
+        std::copy(para_ini, para_ini + SIZE_POSE, para_ceres);
+        std::copy(para_ini, para_ini + SIZE_POSE, para_batch);
+        std::copy(para_ini, para_ini + SIZE_POSE, para_gn);
+        TicToc t_solve;
+        solveCeres(surf_features, corner_features, false, 100, para_ceres);
+        t_ceres += t_solve.toc();
+        t_solve.tic();
+        solveCeres(surf_features, corner_features, true, 100, para_batch);
+        t_batch += t_solve.toc();
+        t_solve.tic();
+        lidar_tracker.solveGaussNewton(LidarScanBatchFactor(surf_features, corner_features, HUBER_DELTA), para_gn, 100);
+        t_gn += t_solve.toc();
+        std::pair<double, double> diff_batch = poseDiff(paramToPose(para_ceres), paramToPose(para_batch));
+        std::pair<double, double> diff_gn = poseDiff(paramToPose(para_ceres), paramToPose(para_gn));
+        max_diff_batch = std::max(max_diff_batch, std::max(diff_batch.first, diff_batch.second));
+        max_diff_gn = std::max(max_diff_gn, std::max(diff_gn.first, diff_gn.second));
+
+        // the 4 iterations of trackCloud: the two ceres paths build the same linear systems
+        std::copy(para_ini, para_ini + SIZE_POSE, para_ceres);
+        std::copy(para_ini, para_ini + SIZE_POSE, para_batch);
+        solveCeres(surf_features, corner_features, false, 4, para_ceres);
+        solveCeres(surf_features, corner_features, true, 4, para_batch);
+        diff_batch = poseDiff(paramToPose(para_ceres), paramToPose(para_batch));
+        max_diff_batch_4 = std::max(max_diff_batch_4, std::max(diff_batch.first, diff_batch.second));
+
+        printf("trial %d: %lu surf, %lu corner, error to gt: %.2e m\n", n, surf_features.size(), corner_features.size(),
+               poseDiff(paramToPose(para_gn), T_gt).first);
+    }
+
+    printf("jacobian error: %.2e, cost error: %.2e, gradient error: %.2e, hessian error: %.2e\n",
+           max_jaco_err, max_eval_err(0), max_eval_err(1), max_eval_err(2));
+    printf("pose difference to the per-feature solver: batched %.2e, gauss-newton %.2e (4 iterations: batched %.2e)\n",
+           max_diff_batch, max_diff_gn, max_diff_batch_4);
+    printf("solver time: per-feature %fms, batched %fms, gauss-newton %fms\n",
+           t_ceres / num_trials, t_batch / num_trials, t_gn / num_trials);
+    bool pass = (max_jaco_err < 1e-5) && (max_eval_err.maxCoeff() < 1e-9) &&
+                (max_diff_batch < 1e-6) && (max_diff_gn < 1e-5) && (max_diff_batch_4 < 1e-6);
+    printf("%s\n", pass ? "PASS" : "FAIL");
+    return pass ? 0 : -1;
+}
@@ -0,0 +1,201 @@
+// rosrun mloam test_lidar_sync
+// check of the lidar ingestion (utility/lidar_sync.hpp):
+// 1. parseCloudMsg: the direct parse of x, y, z on several message layouts (padding, reordered fields, organized clouds
+//    with padded rows) against the values written, and the layouts it can not parse against pcl::fromROSMsg
+// 2. LidarSynchronizer with 3 and 4 lidars: the frames matched within the threshold, the clouds dropped when a lidar misses
+//    a frame, starts late or overflows its ring, and the frames with an empty cloud
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+#include "../src/utility/lidar_sync.hpp"
+
+#define SYNC_THRESHOLD_TEST 0.05
+
+struct FieldLayout
+{
+    std::string name;
+    uint32_t offset;
+    uint8_t datatype;
+};
+
+// cloud of width * height points, point i has x = i, y = -i, z = 0.5 * i (written as float or double)
+// row_pad: bytes after each row
+sensor_msgs::PointCloud2 makeCloudMsg(const std::vector<FieldLayout> &layout, const uint32_t &point_step,
+                                      const uint32_t &width, const uint32_t &height, const uint32_t &row_pad)
+{
+    sensor_msgs::PointCloud2 msg;
+    msg.width = width;
+    msg.height = height;
+    msg.point_step = point_step;
+    msg.row_step = point_step * width + row_pad;
+    msg.is_bigendian = false;
+    msg.is_dense = true;
+    for (const FieldLayout &fl : layout)
+    {
+        sensor_msgs::PointField field;
+        field.name = fl.name;
+        field.offset = fl.offset;
+        field.datatype = fl.datatype;
+        field.count = 1;
+        msg.fields.push_back(field);
+    }
+    msg.data.assign(size_t(msg.row_step) * height, 0xAB); // padding is garbage
+    for (uint32_t row = 0; row < height; row++)
+    {
+        for (uint32_t col = 0; col < width; col++)
+        {
+            const size_t i = row * width + col;
+            uint8_t *data = &msg.data[row * msg.row_step + col * point_step];
+            for (const FieldLayout &fl : layout)
+            {
+                double value = (fl.name == "x") ? i : (fl.name == "y") ? -double(i) : (fl.name == "z") ? 0.5 * i : 0.0;
+                if (fl.datatype == sensor_msgs::PointField::FLOAT32)
+                {
+                    float value_f = value;
+                    memcpy(data + fl.offset, &value_f, sizeof(float));
+                }
+                else if (fl.datatype == sensor_msgs::PointField::FLOAT64)
+                {
+                    memcpy(data + fl.offset, &value, sizeof(double));
+                }
+            }
+        }
+    }
+    return msg;
+}
+
+bool samePoints(const pcl::PointCloud<pcl::PointXYZ> &cloud_a, const pcl::PointCloud<pcl::PointXYZ> &cloud_b)
+{
+    if (cloud_a.size() != cloud_b.size()) return false;
+    for (size_t i = 0; i < cloud_a.size(); i++)
+    {
+        const pcl::PointXYZ &pa = cloud_a.points[i], &pb = cloud_b.points[i];
+        if ((pa.x != pb.x) || (pa.y != pb.y) || (pa.z != pb.z)) return false;
+    }
+    return true;
+}
+
+bool checkParse()
+{
+    const uint8_t F32 = sensor_msgs::PointField::FLOAT32, F64 = sensor_msgs::PointField::FLOAT64, U16 = sensor_msgs::PointField::UINT16;
+    bool pass = true;
+
+    // parsed directly
+    struct { std::string name; std::vector<FieldLayout> layout; uint32_t point_step, width, height, row_pad; } direct[] = {
+        {"xyzi", {{"x", 0, F32}, {"y", 4, F32}, {"z", 8, F32}, {"intensity", 12, F32}}, 16, 100, 1, 0},
+        {"velodyne organized", {{"x", 0, F32}, {"y", 4, F32}, {"z", 8, F32}, {"intensity", 16, F32}, {"ring", 20, U16}}, 32, 50, 4, 8},
+        {"reordered", {{"z", 0, F32}, {"t", 4, F64}, {"y", 12, F32}, {"x", 16, F32}}, 20, 64, 2, 0}};
+    for (const auto &d : direct)
+    {
+        sensor_msgs::PointCloud2 msg = makeCloudMsg(d.layout, d.point_step, d.width, d.height, d.row_pad);
+        pcl::PointCloud<pcl::PointXYZ> cloud;
+        parseCloudMsg(msg, cloud);
+        bool valid = (cloud.size() == size_t(d.width) * d.height) && (cloud.width == d.width) && (cloud.height == d.height);
+        for (size_t i = 0; valid && i < cloud.size(); i++)
+            valid = (cloud.points[i].x == float(i)) && (cloud.points[i].y == -float(i)) && (cloud.points[i].z == 0.5f * i);
+        printf("parse %s: %s\n", d.name.c_str(), valid ? "ok" : "wrong");
+        pass = pass && valid;
+    }
+
+    // the fields are not float32 x, y, z of a little-endian message: generic conversion
+    struct { std::string name; std::vector<FieldLayout> layout; uint32_t point_step; bool is_bigendian; } fallback[] = {
+        {"xyz float64", {{"x", 0, F64}, {"y", 8, F64}, {"z", 16, F64}}, 24, false},
+        {"without z", {{"x", 0, F32}, {"y", 4, F32}}, 8, false},
+        {"big endian", {{"x", 0, F32}, {"y", 4, F32}, {"z", 8, F32}}, 12, true}};
+    for (const auto &f : fallback)
+    {
+        sensor_msgs::PointCloud2 msg = makeCloudMsg(f.layout, f.point_step, 40, 1, 0);
+        msg.is_bigendian = f.is_bigendian;
+        pcl::PointCloud<pcl::PointXYZ> cloud, cloud_ref;
+        parseCloudMsg(msg, cloud);
+        pcl::fromROSMsg(msg, cloud_ref);
+        bool valid = samePoints(cloud, cloud_ref);
+        printf("parse %s: %s\n", f.name.c_str(), valid ? "ok" : "wrong");
+        pass = pass && valid;
+    }
+    return pass;
+}
+
+// cloud of lidar idx, x of its point is the lidar index; empty: without point
+sensor_msgs::PointCloud2ConstPtr makeStampedMsg(const size_t &idx, const double &stamp, const bool &empty = false)
+{
+    sensor_msgs::PointCloud2Ptr msg(new sensor_msgs::PointCloud2(
+        makeCloudMsg({{"x", 0, sensor_msgs::PointField::FLOAT32}, {"y", 4, sensor_msgs::PointField::FLOAT32},
+                      {"z", 8, sensor_msgs::PointField::FLOAT32}}, 12, empty ? 0 : 1, 1, 0)));
+    const float x = idx;
+    if (!empty) memcpy(&msg->data[0], &x, sizeof(float));
+    msg->header.stamp = ros::Time(stamp);
+    return msg;
+}
+
+struct SyncCase
+{
+    std::string name;
+    std::vector<std::vector<double> > stamps; // stamps[lidar]: pushed in order
+    std::vector<double> frame_time; // expected frames
+    size_t drop_cnt; // expected drops
+    std::vector<double> empty_stamps; // the cloud of lidar 0 at these stamps is empty
+};
+
+bool checkSync(const SyncCase &sc)
+{
+    const size_t num_laser = sc.stamps.size();
+    LidarSynchronizer<pcl::PointXYZ> lidar_sync;
+    lidar_sync.setParameters(num_laser, SYNC_THRESHOLD_TEST, false);
+    // the rings are filled before spin() starts, so that the frames do not depend on the scheduling
+    for (size_t k = 0; k < 16; k++)
+        for (size_t i = 0; i < num_laser; i++)
+            if (k < sc.stamps[i].size())
+            {
+                double stamp = sc.stamps[i][k];
+                bool empty = (i == 0) && (std::find(sc.empty_stamps.begin(), sc.empty_stamps.end(), stamp) != sc.empty_stamps.end());
+                lidar_sync.push(i, makeStampedMsg(i, stamp, empty));
+            }
+
+    std::vector<double> frame_time;
+    bool valid_cloud = true;
+    std::thread sync_thread([&]
+    {
+        lidar_sync.spin([&](const double &time, std::vector<pcl::PointCloud<pcl::PointXYZ> > &v_laser_cloud)
+        {
+            frame_time.push_back(time);
+            valid_cloud = valid_cloud && (v_laser_cloud.size() == num_laser);
+            for (size_t i = 0; valid_cloud && i < v_laser_cloud.size(); i++)
+                valid_cloud = (v_laser_cloud[i].size() == 1) && (v_laser_cloud[i].points[0].x == float(i));
+        });
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    lidar_sync.stop();
+    sync_thread.join();
+
+    bool valid = valid_cloud && (frame_time.size() == sc.frame_time.size()) && (lidar_sync.dropCnt() == sc.drop_cnt);
+    for (size_t k = 0; valid && k < frame_time.size(); k++) valid = std::abs(frame_time[k] - sc.frame_time[k]) < 1e-6;
+    printf("sync %s (%lu lidars): %lu frames, %lu dropped: %s\n", sc.name.c_str(), num_laser, frame_time.size(),
+           lidar_sync.dropCnt(), valid ? "ok" : "wrong");
+    return valid;
+}
+
+int main(int argc, char *argv[])
+{
+    bool pass = checkParse();
+
+    std::vector<SyncCase> cases = {
+        {"within the threshold", {{1.00, 1.10, 1.20}, {1.01, 1.11, 1.21}, {1.04, 1.13, 1.19}}, {1.00, 1.10, 1.20}, 0, {}},
+        {"lidar 1 misses a frame", {{1.00, 1.10, 1.20}, {1.01, 1.21}, {1.02, 1.12, 1.22}}, {1.00, 1.20}, 2, {}},
+        {"lidar 3 starts late", {{1.00, 1.10, 1.20}, {1.00, 1.10, 1.20}, {1.01, 1.11, 1.21}, {1.12, 1.22}}, {1.10, 1.20}, 3, {}},
+        {"beyond the threshold", {{1.00, 1.10}, {1.00, 1.10}, {1.06, 1.16}, {1.00, 1.10}}, {1.10}, 3, {}},
+        {"ring overflow", {{1.0, 1.1, 1.2, 1.3, 1.4, 1.5}, {1.0, 1.1, 1.2, 1.3, 1.4, 1.5}, {1.0, 1.1, 1.2, 1.3, 1.4, 1.5}},
+         {1.2, 1.3, 1.4, 1.5}, 6, {}},
+        {"empty cloud", {{1.00, 1.10, 1.20}, {1.00, 1.10, 1.20}, {1.00, 1.10, 1.20}, {1.00, 1.10, 1.20}}, {1.00, 1.20}, 0, {1.10}}};
+    for (const SyncCase &sc : cases) pass = checkSync(sc) && pass;
+
+    printf("%s\n", pass ? "PASS" : "FAIL");
+    return pass ? 0 : -1;
+}
@@ -0,0 +1,195 @@
+// rosrun mloam test_marginalization [num_frames] [num_factors]
+// check of MarginalizationInfo::marginalize (block-sparse sums, schur complement and decomposition by LDLT) against the
+// dense marginalization (A and b summed in full, Amm^{-1} and the decomposition of the prior by eigen decomposition)
+// on random windows: poses, extrinsics and a time offset, with and without huber loss, and a rank-deficient window
+// the jacobians and residuals of the prior are not unique, the prior is compared by J^T * J, J^T * r and r^T * r
+
+#include <iostream>
+#include <string>
+#include <random>
+#include <vector>
+#include <memory>
+#include <algorithm>
+
+#include <ceres/ceres.h>
+
+#include "../src/factor/marginalization_factor.h"
+
+#define SIZE_POSE_TEST 7
+#define MAX_PRIOR_ERROR 1e-8
+
+// residual and jacobians of a factor at the linearization point, the jacobian of a pose has a zero last column
+class LinearFactor : public ceres::CostFunction
+{
+public:
+    LinearFactor(const Eigen::VectorXd &residual,
+                 const std::vector<Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> > &jacobians)
+        : residual_(residual), jacobians_(jacobians)
+    {
+        set_num_residuals(residual.rows());
+        for (const auto &jacobian : jacobians) mutable_parameter_block_sizes()->push_back(jacobian.cols());
+    }
+
+    virtual bool Evaluate(double const *const *parameters, double *residuals, double **jacobians) const
+    {
+        Eigen::Map<Eigen::VectorXd>(residuals, num_residuals()) = residual_;
+        if (jacobians)
+        {
+            for (size_t i = 0; i < jacobians_.size(); i++)
+                if (jacobians[i])
+                    Eigen::Map<Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> >(
+                        jacobians[i], jacobians_[i].rows(), jacobians_[i].cols()) = jacobians_[i];
+        }
+        return true;
+    }
+
+private:
+    Eigen::VectorXd residual_;
+    std::vector<Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> > jacobians_;
+};
+
+struct Window
+{
+    Window(const size_t &num_frames) : para_pose(num_frames, std::vector<double>(SIZE_POSE_TEST, 0)), para_ex(SIZE_POSE_TEST, 0), para_td(1, 0) {}
+
+    std::vector<std::vector<double> > para_pose;
+    std::vector<double> para_ex;
+    std::vector<double> para_td;
+};
+
+// full: factors between two poses, the extrinsics and the time offset, some beyond the huber threshold, two frames marginalized
+// otherwise: relative factors between consecutive poses only (r = B * (x_i - x_j)), the prior keeps a null space
+MarginalizationInfo *marginalizeWindow(std::mt19937 &rng, Window &window, const size_t &num_factors, const bool &full,
+                                       ceres::LossFunction *loss_function)
+{
+    std::normal_distribution<double> gauss(0.0, 1.0);
+    std::uniform_int_distribution<size_t> frame(0, window.para_pose.size() - 1);
+    auto randomJacobian = [&](const int &rows, const int &cols)
+    {
+        Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> jacobian(rows, cols);
+        for (int r = 0; r < rows; r++)
+            for (int c = 0; c < cols; c++) jacobian(r, c) = (c == SIZE_POSE_TEST - 1) ? 0.0 : gauss(rng);
+        return jacobian;
+    };
+
+    MarginalizationInfo *marginalization_info = new MarginalizationInfo();
+    for (size_t k = 0; k < num_factors; k++)
+    {
+        const int num_residuals = full ? 1 + k % 3 : 3;
+        Eigen::VectorXd residual(num_residuals);
+        for (int r = 0; r < num_residuals; r++) residual(r) = 2.0 * gauss(rng);
+        // the first factors touch the marginalized frames
+        size_t i = (k < window.para_pose.size()) ? 0 : frame(rng);
+        size_t j = full ? frame(rng) : std::min(i + 1 + k % 2, window.para_pose.size() - 1);
+        if (i == j) j = (i + 1) % window.para_pose.size();
+        if (!full && i > j) std::swap(i, j);
+
+        std::vector<double *> parameter_blocks{window.para_pose[i].data(), window.para_pose[j].data()};
+        std::vector<Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> > jacobians{randomJacobian(num_residuals, SIZE_POSE_TEST)};
+        jacobians.push_back(full ? randomJacobian(num_residuals, SIZE_POSE_TEST) : Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>(-jacobians[0]));
+        if (full)
+        {
+            parameter_blocks.push_back(window.para_ex.data());
+            jacobians.push_back(randomJacobian(num_residuals, SIZE_POSE_TEST));
+            parameter_blocks.push_back(window.para_td.data());
+            jacobians.push_back(randomJacobian(num_residuals, 1));
+        }
+        std::vector<int> drop_set;
+        for (size_t n = 0; n < 2; n++)
+            if ((parameter_blocks[n] == window.para_pose[0].data()) || (full && parameter_blocks[n] == window.para_pose[1].data()))
+                drop_set.push_back(n);
+        ResidualBlockInfo *residual_block_info = new ResidualBlockInfo(new LinearFactor(residual, jacobians),
+                                                                       (full && k % 2 == 0) ? loss_function : nullptr,
+                                                                       parameter_blocks, drop_set);
+        marginalization_info->addResidualBlockInfo(residual_block_info);
+    }
+    marginalization_info->preMarginalize();
+    marginalization_info->marginalize();
+    return marginalization_info;
+}
+
+// dense marginalization with the parameter ordering of marginalization_info (the code before the block-sparse one)
+void denseMarginalize(const MarginalizationInfo &marginalization_info, Eigen::MatrixXd &linearized_jacobians,
+                      Eigen::VectorXd &linearized_residuals)
+{
+    const int m = marginalization_info.m, n = marginalization_info.n, pos = m + n;
+    const double eps = marginalization_info.eps;
+    Eigen::MatrixXd A = Eigen::MatrixXd::Zero(pos, pos);
+    Eigen::VectorXd b = Eigen::VectorXd::Zero(pos);
+    for (const ResidualBlockInfo *factor : marginalization_info.factors)
+    {
+        for (size_t i = 0; i < factor->parameter_blocks.size(); i++)
+        {
+            long addr_i = reinterpret_cast<long>(factor->parameter_blocks[i]);
+            int idx_i = marginalization_info.parameter_block_idx.at(addr_i);
+            int size_i = marginalization_info.localSize(marginalization_info.parameter_block_size.at(addr_i));
+            Eigen::MatrixXd jacobian_i = factor->jacobians[i].leftCols(size_i);
+            for (size_t j = 0; j < factor->parameter_blocks.size(); j++)
+            {
+                long addr_j = reinterpret_cast<long>(factor->parameter_blocks[j]);
+                int idx_j = marginalization_info.parameter_block_idx.at(addr_j);
+                int size_j = marginalization_info.localSize(marginalization_info.parameter_block_size.at(addr_j));
+                A.block(idx_i, idx_j, size_i, size_j) += jacobian_i.transpose() * factor->jacobians[j].leftCols(size_j);
+            }
+            b.segment(idx_i, size_i) += jacobian_i.transpose() * factor->residuals;
+        }
+    }
+
+    Eigen::MatrixXd Amm = 0.5 * (A.block(0, 0, m, m) + A.block(0, 0, m, m).transpose());
+    Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> saes(Amm);
+    Eigen::MatrixXd Amm_inv = saes.eigenvectors() *
+                              Eigen::VectorXd((saes.eigenvalues().array() > eps).select(saes.eigenvalues().array().inverse(), 0)).asDiagonal() *
+                              saes.eigenvectors().transpose();
+    Eigen::MatrixXd Arr = A.block(m, m, n, n) - A.block(m, 0, n, m) * Amm_inv * A.block(0, m, m, n);
+    Eigen::VectorXd brr = b.segment(m, n) - A.block(m, 0, n, m) * Amm_inv * b.segment(0, m);
+
+    Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> saes2(Arr);
+    Eigen::VectorXd S = Eigen::VectorXd((saes2.eigenvalues().array() > eps).select(saes2.eigenvalues().array(), 0));
+    Eigen::VectorXd S_inv = Eigen::VectorXd((saes2.eigenvalues().array() > eps).select(saes2.eigenvalues().array().inverse(), 0));
+    linearized_jacobians = S.cwiseSqrt().asDiagonal() * saes2.eigenvectors().transpose();
+    linearized_residuals = S_inv.cwiseSqrt().asDiagonal() * saes2.eigenvectors().transpose() * brr;
+}
+
+// relative errors of J^T * J, J^T * r and r^T * r
+Eigen::Vector3d priorError(const Eigen::MatrixXd &J_ref, const Eigen::VectorXd &r_ref, const Eigen::MatrixXd &J, const Eigen::VectorXd &r)
+{
+    Eigen::MatrixXd H_ref = J_ref.transpose() * J_ref;
+    Eigen::VectorXd b_ref = J_ref.transpose() * r_ref;
+    return Eigen::Vector3d((J.transpose() * J - H_ref).norm() / H_ref.norm(),
+                           (J.transpose() * r - b_ref).norm() / b_ref.norm(),
+                           std::abs(r.squaredNorm() - r_ref.squaredNorm()) / r_ref.squaredNorm());
+}
+
+int main(int argc, char *argv[])
+{
+    const size_t num_frames = argc > 1 ? std::stoi(argv[1]) : 11;
+    const size_t num_factors = argc > 2 ? std::stoi(argv[2]) : 2000;
+    const int num_trials = 10;
+    std::mt19937 rng(1);
+    ceres::HuberLoss loss_function(1.0);
+
+    Eigen::Vector3d max_err = Eigen::Vector3d::Zero(); // hessian, gradient, cost
+    int min_rank = num_frames * 6;
+    for (int n = 0; n < num_trials; n++)
+    {
+        const bool full = (n % 2 == 0);
+        Window window(num_frames);
+        std::unique_ptr<MarginalizationInfo> marginalization_info(marginalizeWindow(rng, window, num_factors, full, &loss_function));
+        Eigen::MatrixXd linearized_jacobians;
+        Eigen::VectorXd linearized_residuals;
+        denseMarginalize(*marginalization_info, linearized_jacobians, linearized_residuals);
+
+        Eigen::Vector3d err = priorError(linearized_jacobians, linearized_residuals,
+                                         marginalization_info->linearized_jacobians, marginalization_info->linearized_residuals);
+        max_err = max_err.cwiseMax(err);
+        Eigen::FullPivLU<Eigen::MatrixXd> lu(marginalization_info->linearized_jacobians);
+        min_rank = std::min(min_rank, static_cast<int>(lu.rank()));
+        printf("trial %d (%s): m: %d, n: %d, rank: %ld, error of the prior: hessian %.2e, gradient %.2e, cost %.2e\n",
+               n, full ? "full" : "rank-deficient", marginalization_info->m, marginalization_info->n, lu.rank(), err(0), err(1), err(2));
+    }
+
+    printf("max error of the prior: hessian %.2e, gradient %.2e, cost %.2e\n", max_err(0), max_err(1), max_err(2));
+    bool pass = (max_err.maxCoeff() < MAX_PRIOR_ERROR) && (min_rank < static_cast<int>(num_frames - 1) * 6);
+    printf("%s\n", pass ? "PASS" : "FAIL");
+    return pass ? 0 : -1;
+}
@@ -57,6 +57,9 @@ namespace common
         std::uniform_int_distribution< T > m_dist;
         RandomGeneratorInt(): m_random_engine( std::random_device{}() )
         {};
+        // fixed seed, reproducible sequence
+        explicit RandomGeneratorInt( const unsigned int seed ): m_random_engine( seed )
+        {};
         ~RandomGeneratorInt(){};
 
         T geneRandUniform( T low = 0, T hight = 100 )
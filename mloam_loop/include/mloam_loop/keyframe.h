@@ -26,19 +26,19 @@ public:
 	KeyFrame(const double &time_stamp,
 			 const int &index,
 			 const Pose &pose_w,
-			 const pcl::PointCloud<pcl::PointXYZI>::Ptr &surf_cloud,
-			 const pcl::PointCloud<pcl::PointXYZI>::Ptr &corner_cloud,
-			 const pcl::PointCloud<pcl::PointXYZI>::Ptr &full_cloud,
-			 const pcl::PointCloud<pcl::PointXYZI>::Ptr &outlier_cloud,
+			 const pcl::PointCloud<pcl::PointXYZI>::ConstPtr &surf_cloud,
+			 const pcl::PointCloud<pcl::PointXYZI>::ConstPtr &corner_cloud,
+			 const pcl::PointCloud<pcl::PointXYZI>::ConstPtr &full_cloud,
+			 const pcl::PointCloud<pcl::PointXYZI>::ConstPtr &outlier_cloud,
 			 const int sequence);
 
 	KeyFrame(const double &time_stamp,
 			 const int &index,
 			 const Pose &pose_w,
-			 const pcl::PointCloud<pcl::PointXYZI>::Ptr &surf_cloud,
-			 const pcl::PointCloud<pcl::PointXYZI>::Ptr &corner_cloud,
-			 const pcl::PointCloud<pcl::PointXYZI>::Ptr &full_cloud,
-			 const pcl::PointCloud<pcl::PointXYZI>::Ptr &outlier_cloud,
+			 const pcl::PointCloud<pcl::PointXYZI>::ConstPtr &surf_cloud,
+			 const pcl::PointCloud<pcl::PointXYZI>::ConstPtr &corner_cloud,
+			 const pcl::PointCloud<pcl::PointXYZI>::ConstPtr &full_cloud,
+			 const pcl::PointCloud<pcl::PointXYZI>::ConstPtr &outlier_cloud,
 			 const int &loop_index,
 			 const Pose &loop_info,
 			 const int sequence);
@@ -55,10 +55,10 @@ public:
 	Pose pose_w_;
 	Pose last_pose_w_;
 	pcl::PointXYZI pose_3d_w_;
-	pcl::PointCloud<pcl::PointXYZI>::Ptr surf_cloud_;
-	pcl::PointCloud<pcl::PointXYZI>::Ptr corner_cloud_;
-	pcl::PointCloud<pcl::PointXYZI>::Ptr full_cloud_;
-	pcl::PointCloud<pcl::PointXYZI>::Ptr outlier_cloud_;
+	pcl::PointCloud<pcl::PointXYZI>::ConstPtr surf_cloud_;
+	pcl::PointCloud<pcl::PointXYZI>::ConstPtr corner_cloud_;
+	pcl::PointCloud<pcl::PointXYZI>::ConstPtr full_cloud_;
+	pcl::PointCloud<pcl::PointXYZI>::ConstPtr outlier_cloud_;
 
 	bool has_loop_;
 	int loop_index_;
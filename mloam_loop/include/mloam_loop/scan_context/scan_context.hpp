@@ -7,12 +7,17 @@
 #include <vector>
 #include <algorithm>
 #include <cstdlib>
+#include <limits>
 #include <memory>
 #include <iostream>
 #include <fstream>
 
 #include <Eigen/Dense>
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 #include <opencv2/opencv.hpp>
 #include <opencv2/core/eigen.hpp>
 #include <opencv2/highgui/highgui.hpp>
@@ -64,6 +69,27 @@ float deg2rad(const float degrees);
 MatrixXd circshift(MatrixXd &_mat, int _num_shift);
 std::vector<float> eig2stdvec(MatrixXd _eigmat);
 
+#define MIN_PARALLEL_SC_CANDIDATES 16 // fewer candidates are compared on the calling thread
+
+// scan context prepared for the distance computation, built once when the scan context is saved:
+// float sectors stored one after another (column-major), the norm of each sector and the sector key (mean of each sector)
+// the shifted scan contexts are never built, the sectors are indexed with the shift instead
+class SCDescriptor
+{
+public:
+    SCDescriptor() {}
+    explicit SCDescriptor(const Eigen::MatrixXd &_desc)
+        : desc_(_desc.cast<float>()),
+          sector_norm_(desc_.colwise().norm()),
+          sector_key_(desc_.colwise().mean()) {}
+
+    int numSector() const { return static_cast<int>(desc_.cols()); }
+
+    Eigen::MatrixXf desc_;
+    Eigen::RowVectorXf sector_norm_;
+    Eigen::RowVectorXf sector_key_;
+};
+
 template<typename T, typename... Args>
 std::unique_ptr<T> make_unique(Args&&... args) 
 {
@@ -128,6 +154,14 @@ public:
     double distDirectSC(MatrixXd &_sc1, MatrixXd &_sc2);                           // "d" (eq 5) in the original paper (IROS 18)
     std::pair<double, int> distanceBtnScanContext(MatrixXd &_sc1, MatrixXd &_sc2); // "D" (eq 6) in the original paper (IROS 18)
 
+    // same distances on the prepared descriptors, _sc2 is shifted by _num_shift sectors (as circshift(_sc2, _num_shift))
+    int fastAlignUsingVkey(const SCDescriptor &_sc1, const SCDescriptor &_sc2) const;
+    double distDirectSC(const SCDescriptor &_sc1, const SCDescriptor &_sc2, const int &_num_shift) const;
+    std::pair<double, int> distanceBtnScanContext(const SCDescriptor &_sc1, const SCDescriptor &_sc2) const;
+    // distances between the query and all the candidates of the database
+    void distanceBtnScanContextBatch(const SCDescriptor &_query, const std::vector<size_t> &_candidate_indexes,
+                                     std::vector<std::pair<double, int> > &_results) const;
+
     // User-side API
     void makeAndSaveScancontextAndKeys(pcl::PointCloud<SCPointType> &_scan_down);
     QueryResult detectLoopClosureID(const int &query_idx); // int: nearest node index, float: relative yaw
@@ -164,6 +198,7 @@ public:
     std::vector<Eigen::MatrixXd> polarcontexts_;
     std::vector<Eigen::MatrixXd> polarcontext_invkeys_;
     std::vector<Eigen::MatrixXd> polarcontext_vkeys_;
+    std::vector<SCDescriptor> polarcontext_descs_;
 
     KeyMat polarcontext_invkeys_mat_;
     KeyMat polarcontext_invkeys_to_search_;
@@ -15,10 +15,10 @@
 KeyFrame::KeyFrame(const double &time_stamp,
 				   const int &index,
 				   const Pose &pose_w,
-				   const pcl::PointCloud<pcl::PointXYZI>::Ptr &surf_cloud,
-				   const pcl::PointCloud<pcl::PointXYZI>::Ptr &corner_cloud,
-				   const pcl::PointCloud<pcl::PointXYZI>::Ptr &full_cloud,
-				   const pcl::PointCloud<pcl::PointXYZI>::Ptr &outlier_cloud,
+				   const pcl::PointCloud<pcl::PointXYZI>::ConstPtr &surf_cloud,
+				   const pcl::PointCloud<pcl::PointXYZI>::ConstPtr &corner_cloud,
+				   const pcl::PointCloud<pcl::PointXYZI>::ConstPtr &full_cloud,
+				   const pcl::PointCloud<pcl::PointXYZI>::ConstPtr &outlier_cloud,
 				   const int sequence)
 {
 	time_stamp_ = time_stamp;
@@ -27,14 +27,11 @@ KeyFrame::KeyFrame(const double &time_stamp,
 	pose_3d_w_.x = pose_w.t_(0);
 	pose_3d_w_.y = pose_w.t_(1);
 	pose_3d_w_.z = pose_w.t_(2);
-	surf_cloud_.reset(new pcl::PointCloud<pcl::PointXYZI>());
-	corner_cloud_.reset(new pcl::PointCloud<pcl::PointXYZI>());
-	full_cloud_.reset(new pcl::PointCloud<pcl::PointXYZI>());
-	outlier_cloud_.reset(new pcl::PointCloud<pcl::PointXYZI>());
-	*surf_cloud_ = *surf_cloud;
-	*corner_cloud_ = *corner_cloud;
-	*full_cloud_ = *full_cloud;
-	*outlier_cloud_ = *outlier_cloud;
+	// the clouds are not modified, they are shared instead of copied
+	surf_cloud_ = surf_cloud;
+	corner_cloud_ = corner_cloud;
+	full_cloud_ = full_cloud;
+	outlier_cloud_ = outlier_cloud;
 	has_loop_ = false;
 	loop_index_ = -1;
 	loop_info_ = Pose(Eigen::Quaterniond::Identity(), Eigen::Vector3d::Zero());
@@ -45,10 +42,10 @@ KeyFrame::KeyFrame(const double &time_stamp,
 KeyFrame::KeyFrame(const double &time_stamp,
 				   const int &index,
 				   const Pose &pose_w,
-				   const pcl::PointCloud<pcl::PointXYZI>::Ptr &surf_cloud,
-				   const pcl::PointCloud<pcl::PointXYZI>::Ptr &corner_cloud,
-				   const pcl::PointCloud<pcl::PointXYZI>::Ptr &full_cloud,
-				   const pcl::PointCloud<pcl::PointXYZI>::Ptr &outlier_cloud,
+				   const pcl::PointCloud<pcl::PointXYZI>::ConstPtr &surf_cloud,
+				   const pcl::PointCloud<pcl::PointXYZI>::ConstPtr &corner_cloud,
+				   const pcl::PointCloud<pcl::PointXYZI>::ConstPtr &full_cloud,
+				   const pcl::PointCloud<pcl::PointXYZI>::ConstPtr &outlier_cloud,
 				   const int &loop_index,
 				   const Pose &loop_info,
 				   const int sequence)
@@ -59,14 +56,11 @@ KeyFrame::KeyFrame(const double &time_stamp,
 	pose_3d_w_.x = pose_w.t_(0);
 	pose_3d_w_.y = pose_w.t_(1);
 	pose_3d_w_.z = pose_w.t_(2);
-	surf_cloud_.reset(new pcl::PointCloud<pcl::PointXYZI>());
-	corner_cloud_.reset(new pcl::PointCloud<pcl::PointXYZI>());
-	full_cloud_.reset(new pcl::PointCloud<pcl::PointXYZI>());
-	outlier_cloud_.reset(new pcl::PointCloud<pcl::PointXYZI>());
-	*surf_cloud_ = *surf_cloud;
-	*corner_cloud_ = *corner_cloud;
-	*full_cloud_ = *full_cloud;
-	*outlier_cloud_ = *outlier_cloud;
+	// the clouds are not modified, they are shared instead of copied
+	surf_cloud_ = surf_cloud;
+	corner_cloud_ = corner_cloud;
+	full_cloud_ = full_cloud;
+	outlier_cloud_ = outlier_cloud;
 	if (loop_index != -1)
 		has_loop_ = true;
 	else
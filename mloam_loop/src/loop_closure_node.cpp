@@ -101,46 +101,58 @@ double time_laser_cloud_full_res;
 double time_laser_cloud_outlier;
 double time_laser_keyframes;
 
-std::queue<sensor_msgs::PointCloud2ConstPtr> surf_last_buf;
-std::queue<sensor_msgs::PointCloud2ConstPtr> corner_last_buf;
-std::queue<sensor_msgs::PointCloud2ConstPtr> full_res_buf;
-std::queue<sensor_msgs::PointCloud2ConstPtr> outlier_buf;
+// the clouds are deserialized by pcl_ros (no PointCloud2 in between) and shared with the keyframes, they must not be modified
+std::queue<pcl::PointCloud<pcl::PointXYZI>::ConstPtr> surf_last_buf;
+std::queue<pcl::PointCloud<pcl::PointXYZI>::ConstPtr> corner_last_buf;
+std::queue<pcl::PointCloud<pcl::PointXYZI>::ConstPtr> full_res_buf;
+std::queue<pcl::PointCloud<pcl::PointXYZI>::ConstPtr> outlier_buf;
 std::queue<mloam_msgs::KeyframesConstPtr> keyframes_buf;
 
-pcl::PointCloud<pcl::PointXYZI>::Ptr laser_cloud_surf_last(new pcl::PointCloud<pcl::PointXYZI>());
-pcl::PointCloud<pcl::PointXYZI>::Ptr laser_cloud_corner_last(new pcl::PointCloud<pcl::PointXYZI>());
-pcl::PointCloud<pcl::PointXYZI>::Ptr laser_cloud_full_res(new pcl::PointCloud<pcl::PointXYZI>());
-pcl::PointCloud<pcl::PointXYZI>::Ptr laser_cloud_outlier(new pcl::PointCloud<pcl::PointXYZI>());
+pcl::PointCloud<pcl::PointXYZI>::ConstPtr laser_cloud_surf_last(new pcl::PointCloud<pcl::PointXYZI>());
+pcl::PointCloud<pcl::PointXYZI>::ConstPtr laser_cloud_corner_last(new pcl::PointCloud<pcl::PointXYZI>());
+pcl::PointCloud<pcl::PointXYZI>::ConstPtr laser_cloud_full_res(new pcl::PointCloud<pcl::PointXYZI>());
+pcl::PointCloud<pcl::PointXYZI>::ConstPtr laser_cloud_outlier(new pcl::PointCloud<pcl::PointXYZI>());
 
 int frame_cnt = 0;
 
 PoseGraph posegraph;
 
-void laserCloudSurfLastHandler(const sensor_msgs::PointCloud2ConstPtr &laser_cloud_surf_last_msg)
+// the stamps of the pcl clouds are in microseconds, the ones of the keyframes are truncated the same way to be compared
+double cloudTime(const pcl::PointCloud<pcl::PointXYZI>::ConstPtr &cloud)
+{
+    return pcl_conversions::fromPCL(cloud->header.stamp).toSec();
+}
+
+double keyframeTime(const mloam_msgs::KeyframesConstPtr &keyframes)
+{
+    return pcl_conversions::fromPCL(pcl_conversions::toPCL(keyframes->header.stamp)).toSec();
+}
+
+void laserCloudSurfLastHandler(const pcl::PointCloud<pcl::PointXYZI>::ConstPtr &laser_cloud_surf_last)
 {
 	m_buf.lock();
-	surf_last_buf.push(laser_cloud_surf_last_msg);
+	surf_last_buf.push(laser_cloud_surf_last);
 	m_buf.unlock();
 }
 
-void laserCloudCornerLastHandler(const sensor_msgs::PointCloud2ConstPtr &laser_cloud_corner_last_msg)
+void laserCloudCornerLastHandler(const pcl::PointCloud<pcl::PointXYZI>::ConstPtr &laser_cloud_corner_last)
 {
 	m_buf.lock();
-	corner_last_buf.push(laser_cloud_corner_last_msg);
+	corner_last_buf.push(laser_cloud_corner_last);
 	m_buf.unlock();
 }
 
-void laserCloudFullResHandler(const sensor_msgs::PointCloud2ConstPtr &laser_cloud_full_res_msg)
+void laserCloudFullResHandler(const pcl::PointCloud<pcl::PointXYZI>::ConstPtr &laser_cloud_full_res)
 {
 	m_buf.lock();
-	full_res_buf.push(laser_cloud_full_res_msg);
+	full_res_buf.push(laser_cloud_full_res);
 	m_buf.unlock();
 }
 
-void laserCloudOutlierResHandler(const sensor_msgs::PointCloud2ConstPtr &laser_cloud_outlier_msg)
+void laserCloudOutlierResHandler(const pcl::PointCloud<pcl::PointXYZI>::ConstPtr &laser_cloud_outlier)
 {
     m_buf.lock();
-    outlier_buf.push(laser_cloud_outlier_msg);
+    outlier_buf.push(laser_cloud_outlier);
     m_buf.unlock();
 }
 
@@ -173,7 +185,7 @@ void process()
 			   !full_res_buf.empty() && !outlier_buf.empty() && !keyframes_buf.empty())
 		{
 			m_buf.lock();
-			while (!surf_last_buf.empty() && surf_last_buf.front()->header.stamp.toSec() < keyframes_buf.front()->header.stamp.toSec())
+			while (!surf_last_buf.empty() && cloudTime(surf_last_buf.front()) < keyframeTime(keyframes_buf.front()))
 				surf_last_buf.pop();
 			if (surf_last_buf.empty())
 			{
@@ -181,7 +193,7 @@ void process()
 				break;
 			}
 
-			while (!corner_last_buf.empty() && corner_last_buf.front()->header.stamp.toSec() < keyframes_buf.front()->header.stamp.toSec())
+			while (!corner_last_buf.empty() && cloudTime(corner_last_buf.front()) < keyframeTime(keyframes_buf.front()))
 				corner_last_buf.pop();
 			if (corner_last_buf.empty())
 			{
@@ -189,7 +201,7 @@ void process()
 				break;
 			}
 
-			while (!full_res_buf.empty() && full_res_buf.front()->header.stamp.toSec() < keyframes_buf.front()->header.stamp.toSec())
+			while (!full_res_buf.empty() && cloudTime(full_res_buf.front()) < keyframeTime(keyframes_buf.front()))
 				full_res_buf.pop();
 			if (full_res_buf.empty())
 			{
@@ -197,7 +209,7 @@ void process()
 				break;
 			}
 
-			while (!outlier_buf.empty() && outlier_buf.front()->header.stamp.toSec() < keyframes_buf.front()->header.stamp.toSec())
+			while (!outlier_buf.empty() && cloudTime(outlier_buf.front()) < keyframeTime(keyframes_buf.front()))
 				outlier_buf.pop();
 			if (outlier_buf.empty())
 			{
@@ -205,11 +217,11 @@ void process()
 				break;
 			}    
 
-			time_laser_cloud_surf_last = surf_last_buf.front()->header.stamp.toSec();
-			time_laser_cloud_corner_last = corner_last_buf.front()->header.stamp.toSec();
-			time_laser_cloud_full_res = full_res_buf.front()->header.stamp.toSec();
-            time_laser_cloud_outlier = outlier_buf.front()->header.stamp.toSec();
-			time_laser_keyframes = keyframes_buf.front()->header.stamp.toSec();
+			time_laser_cloud_surf_last = cloudTime(surf_last_buf.front());
+			time_laser_cloud_corner_last = cloudTime(corner_last_buf.front());
+			time_laser_cloud_full_res = cloudTime(full_res_buf.front());
+            time_laser_cloud_outlier = cloudTime(outlier_buf.front());
+			time_laser_keyframes = keyframeTime(keyframes_buf.front());
 
             if (std::abs(time_laser_keyframes - time_laser_cloud_surf_last) > 0.005 ||
                 std::abs(time_laser_keyframes - time_laser_cloud_corner_last) > 0.005 ||
@@ -227,20 +239,16 @@ void process()
 				break;
 			}
 
-			laser_cloud_surf_last->clear();
-			pcl::fromROSMsg(*surf_last_buf.front(), *laser_cloud_surf_last);
+			laser_cloud_surf_last = surf_last_buf.front();
 			surf_last_buf.pop();
 
-			laser_cloud_corner_last->clear();
-			pcl::fromROSMsg(*corner_last_buf.front(), *laser_cloud_corner_last);
+			laser_cloud_corner_last = corner_last_buf.front();
 			corner_last_buf.pop();
 
-			laser_cloud_full_res->clear();
-			pcl::fromROSMsg(*full_res_buf.front(), *laser_cloud_full_res);
+			laser_cloud_full_res = full_res_buf.front();
 			full_res_buf.pop();
 
-            laser_cloud_outlier->clear();
-            pcl::fromROSMsg(*outlier_buf.front(), *laser_cloud_outlier);
+            laser_cloud_outlier = outlier_buf.front();
             outlier_buf.pop();
 
             mloam_msgs::Keyframes keyframes_msg = *keyframes_buf.front();
@@ -385,10 +393,10 @@ int main(int argc, char **argv)
     }
 
     // *******************************
-    ros::Subscriber sub_laser_cloud_full_res = nh.subscribe<sensor_msgs::PointCloud2>("/laser_cloud", 2, laserCloudFullResHandler);
-    ros::Subscriber sub_laser_cloud_outlier = nh.subscribe<sensor_msgs::PointCloud2>("/laser_cloud_outlier", 2, laserCloudOutlierResHandler);
-    ros::Subscriber sub_laser_cloud_surf_last = nh.subscribe<sensor_msgs::PointCloud2>("/surf_points_less_flat", 2, laserCloudSurfLastHandler);
-	ros::Subscriber sub_laser_cloud_corner_last = nh.subscribe<sensor_msgs::PointCloud2>("/corner_points_less_sharp", 2, laserCloudCornerLastHandler);
+    ros::Subscriber sub_laser_cloud_full_res = nh.subscribe<pcl::PointCloud<pcl::PointXYZI> >("/laser_cloud", 2, laserCloudFullResHandler);
+    ros::Subscriber sub_laser_cloud_outlier = nh.subscribe<pcl::PointCloud<pcl::PointXYZI> >("/laser_cloud_outlier", 2, laserCloudOutlierResHandler);
+    ros::Subscriber sub_laser_cloud_surf_last = nh.subscribe<pcl::PointCloud<pcl::PointXYZI> >("/surf_points_less_flat", 2, laserCloudSurfLastHandler);
+	ros::Subscriber sub_laser_cloud_corner_last = nh.subscribe<pcl::PointCloud<pcl::PointXYZI> >("/corner_points_less_sharp", 2, laserCloudCornerLastHandler);
     ros::Subscriber sub_laser_keyframes = nh.subscribe<mloam_msgs::Keyframes>("/laser_map_keyframes_6d", 5, laserKeyframeHandler);
 
     // pub_laser_loop_keyframes_6d = nh.advertise<mloam_msgs::Keyframes>("/laser_loop_keyframes_6d", 5);
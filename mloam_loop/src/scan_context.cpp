@@ -83,13 +83,12 @@ double SCManager::distDirectSC(MatrixXd &_sc1, MatrixXd &_sc2)
     double sum_sector_similarity = 0;
     for (int col_idx = 0; col_idx < _sc1.cols(); col_idx++)
     {
-        VectorXd col_sc1 = _sc1.col(col_idx);
-        VectorXd col_sc2 = _sc2.col(col_idx);
-
-        if (col_sc1.norm() == 0 | col_sc2.norm() == 0)
+        double norm_sc1 = _sc1.col(col_idx).norm();
+        double norm_sc2 = _sc2.col(col_idx).norm();
+        if (norm_sc1 == 0 | norm_sc2 == 0)
             continue; // don't count this sector pair.
 
-        double sector_similarity = col_sc1.dot(col_sc2) / (col_sc1.norm() * col_sc2.norm());
+        double sector_similarity = _sc1.col(col_idx).dot(_sc2.col(col_idx)) / (norm_sc1 * norm_sc2);
 
         sum_sector_similarity = sum_sector_similarity + sector_similarity;
         num_eff_cols = num_eff_cols + 1;
@@ -103,13 +102,19 @@ double SCManager::distDirectSC(MatrixXd &_sc1, MatrixXd &_sc2)
 // shifting the matrix (i.e. go through each degree) for matching using F-norm matrix
 int SCManager::fastAlignUsingVkey(MatrixXd &_vkey1, MatrixXd &_vkey2)
 {
+    const int num_cols = _vkey1.cols();
     int argmin_vkey_shift = 0;
     double min_veky_diff_norm = 10000000;
-    for (int shift_idx = 0; shift_idx < _vkey1.cols(); shift_idx++)
+    for (int shift_idx = 0; shift_idx < num_cols; shift_idx++)
     {
-        MatrixXd vkey2_shifted = circshift(_vkey2, shift_idx);
-        MatrixXd vkey_diff = _vkey1 - vkey2_shifted;
-        double cur_diff_norm = vkey_diff.norm();
+        // circshift(_vkey2, shift_idx).col(col_idx) == _vkey2.col(col_idx - shift_idx)
+        double cur_diff_sq_norm = 0;
+        for (int col_idx = 0; col_idx < num_cols; col_idx++)
+        {
+            int shifted_idx = (col_idx < shift_idx) ? col_idx - shift_idx + num_cols : col_idx - shift_idx;
+            cur_diff_sq_norm += (_vkey1.col(col_idx) - _vkey2.col(shifted_idx)).squaredNorm();
+        }
+        double cur_diff_norm = sqrt(cur_diff_sq_norm);
         if (cur_diff_norm < min_veky_diff_norm)
         {
             argmin_vkey_shift = shift_idx;
@@ -122,35 +127,91 @@ int SCManager::fastAlignUsingVkey(MatrixXd &_vkey1, MatrixXd &_vkey2)
 // shifting the sc1 with a limitted radius to get the best matching scan context
 std::pair<double, int> SCManager::distanceBtnScanContext(MatrixXd &_sc1, MatrixXd &_sc2)
 {
-    // 1. fast align using variant key (not in original IROS18)
-    MatrixXd vkey_sc1 = makeSectorkeyFromScancontext(_sc1);
-    MatrixXd vkey_sc2 = makeSectorkeyFromScancontext(_sc2);
-    int argmin_vkey_shift = fastAlignUsingVkey(vkey_sc1, vkey_sc2);
+    return distanceBtnScanContext(SCDescriptor(_sc1), SCDescriptor(_sc2));
+} // distanceBtnScanContext
+
+int SCManager::fastAlignUsingVkey(const SCDescriptor &_sc1, const SCDescriptor &_sc2) const
+{
+    const int num_sector = _sc1.numSector();
+    const float *vkey1 = _sc1.sector_key_.data();
+    const float *vkey2 = _sc2.sector_key_.data();
+    int argmin_vkey_shift = 0;
+    float min_vkey_diff_sq_norm = std::numeric_limits<float>::max();
+    for (int shift_idx = 0; shift_idx < num_sector; shift_idx++)
+    {
+        // the two parts of the rotated vkey2, without the modulo in the loops
+        float cur_diff_sq_norm = 0;
+        for (int col_idx = 0; col_idx < shift_idx; col_idx++)
+        {
+            float diff = vkey1[col_idx] - vkey2[col_idx - shift_idx + num_sector];
+            cur_diff_sq_norm += diff * diff;
+        }
+        for (int col_idx = shift_idx; col_idx < num_sector; col_idx++)
+        {
+            float diff = vkey1[col_idx] - vkey2[col_idx - shift_idx];
+            cur_diff_sq_norm += diff * diff;
+        }
+        if (cur_diff_sq_norm < min_vkey_diff_sq_norm)
+        {
+            argmin_vkey_shift = shift_idx;
+            min_vkey_diff_sq_norm = cur_diff_sq_norm;
+        }
+    }
+    return argmin_vkey_shift;
+}
 
-    const int SEARCH_RADIUS = round(0.5 * SEARCH_RATIO * _sc1.cols()); // a half of search range 0.05 * sc1.cols()
-    std::vector<int> shift_idx_search_space{argmin_vkey_shift}; // shifting the starting col num
-    for (int ii = 1; ii < SEARCH_RADIUS + 1; ii++)
+double SCManager::distDirectSC(const SCDescriptor &_sc1, const SCDescriptor &_sc2, const int &_num_shift) const
+{
+    const int num_sector = _sc1.numSector();
+    int num_eff_cols = 0;
+    double sum_sector_similarity = 0;
+    for (int col_idx = 0; col_idx < num_sector; col_idx++)
     {
-        shift_idx_search_space.push_back((argmin_vkey_shift + ii + _sc1.cols()) % _sc1.cols());
-        shift_idx_search_space.push_back((argmin_vkey_shift - ii + _sc1.cols()) % _sc1.cols());
+        int shifted_idx = (col_idx < _num_shift) ? col_idx - _num_shift + num_sector : col_idx - _num_shift;
+        float norm_sc1 = _sc1.sector_norm_[col_idx];
+        float norm_sc2 = _sc2.sector_norm_[shifted_idx];
+        if ((norm_sc1 == 0) || (norm_sc2 == 0))
+            continue;
+        sum_sector_similarity += _sc1.desc_.col(col_idx).dot(_sc2.desc_.col(shifted_idx)) / (norm_sc1 * norm_sc2);
+        num_eff_cols++;
     }
-    std::sort(shift_idx_search_space.begin(), shift_idx_search_space.end());
+    double sc_sim = sum_sector_similarity / num_eff_cols;
+    return 1.0 - sc_sim;
+}
 
-    // 2. fast columnwise diff
+std::pair<double, int> SCManager::distanceBtnScanContext(const SCDescriptor &_sc1, const SCDescriptor &_sc2) const
+{
+    // 1. fast align using variant key (not in original IROS18)
+    const int num_sector = _sc1.numSector();
+    const int argmin_vkey_shift = fastAlignUsingVkey(_sc1, _sc2);
+
+    // 2. fast columnwise diff around the shift of the variant key
+    const int SEARCH_RADIUS = round(0.5 * SEARCH_RATIO * num_sector);
     int argmin_shift = 0;
     double min_sc_dist = 10000000;
-    for (int num_shift : shift_idx_search_space)
+    for (int ii = -SEARCH_RADIUS; ii <= SEARCH_RADIUS; ii++)
     {
-        MatrixXd sc2_shifted = circshift(_sc2, num_shift); // TODO: the yaw shoud be for sc2 (the candidate)
-        double cur_sc_dist = distDirectSC(_sc1, sc2_shifted);
-        if (cur_sc_dist < min_sc_dist)
+        int num_shift = ((argmin_vkey_shift + ii) % num_sector + num_sector) % num_sector;
+        double cur_sc_dist = distDirectSC(_sc1, _sc2, num_shift);
+        // the smallest shift wins a tie, as with the sorted search space
+        if ((cur_sc_dist < min_sc_dist) || ((cur_sc_dist == min_sc_dist) && (num_shift < argmin_shift)))
         {
             argmin_shift = num_shift;
             min_sc_dist = cur_sc_dist;
         }
     }
     return make_pair(min_sc_dist, argmin_shift);
-} // distanceBtnScanContext
+}
+
+void SCManager::distanceBtnScanContextBatch(const SCDescriptor &_query, const std::vector<size_t> &_candidate_indexes,
+                                            std::vector<std::pair<double, int> > &_results) const
+{
+    const int num_candidates = static_cast<int>(_candidate_indexes.size());
+    _results.resize(num_candidates);
+    #pragma omp parallel for schedule(dynamic) if (num_candidates >= MIN_PARALLEL_SC_CANDIDATES)
+    for (int i = 0; i < num_candidates; i++)
+        _results[i] = distanceBtnScanContext(_query, polarcontext_descs_[_candidate_indexes[i]]);
+}
 
 MatrixXd SCManager::makeScancontext(pcl::PointCloud<SCPointType> &scan_down)
 {
@@ -227,6 +288,7 @@ void SCManager::makeAndSaveScancontextAndKeys(pcl::PointCloud<SCPointType> &scan
     polarcontexts_.push_back(sc);
     polarcontext_invkeys_.push_back(ringkey);
     polarcontext_vkeys_.push_back(sectorkey);
+    polarcontext_descs_.push_back(SCDescriptor(sc));
     polarcontext_invkeys_mat_.push_back(polarcontext_invkey_vec);
     // cout << polarcontext_vkeys_.size() << endl;
 }
@@ -237,8 +299,8 @@ QueryResult SCManager::detectLoopClosureID(const int &que_index)
     assert(que_index < 0);
 
     int loop_id{-1}; // init with -1, -1 means no loop (== LeGO-LOAM's variable "closestHistoryFrameID")
-    auto curr_key = polarcontext_invkeys_mat_[que_index]; // current observation (query)
-    auto curr_desc = polarcontexts_[que_index];           // current observation (query)
+    const std::vector<float> &curr_key = polarcontext_invkeys_mat_[que_index]; // current observation (query)
+    const SCDescriptor &curr_desc = polarcontext_descs_[que_index];          // current observation (query)
 
     /* 
      * step 1: candidates from ringkey tree_
@@ -276,6 +338,7 @@ QueryResult SCManager::detectLoopClosureID(const int &que_index)
     nanoflann::KNNResultSet<float> knnsearch_result(NUM_CANDIDATES_FROM_TREE);
     knnsearch_result.init(&candidate_indexes[0], &out_dists_sqr[0]);
     polarcontext_tree_->index->findNeighbors(knnsearch_result, &curr_key[0] /* query */, nanoflann::SearchParams(10));
+    candidate_indexes.resize(knnsearch_result.size()); // fewer candidates than NUM_CANDIDATES_FROM_TREE in a small database
 
     // printf("find candidates using ringkey costs: %fms\n", t_find_candidates.toc());
 
@@ -283,10 +346,11 @@ QueryResult SCManager::detectLoopClosureID(const int &que_index)
      *  step 2: pairwise distance (find optimal columnwise best-fit using cosine distance)
      */
     TicToc t_calc_dist;
-    for (int candidate_iter_idx = 0; candidate_iter_idx < NUM_CANDIDATES_FROM_TREE; candidate_iter_idx++)
+    std::vector<std::pair<double, int> > sc_dist_results;
+    distanceBtnScanContextBatch(curr_desc, candidate_indexes, sc_dist_results);
+    for (size_t candidate_iter_idx = 0; candidate_iter_idx < candidate_indexes.size(); candidate_iter_idx++)
     {
-        MatrixXd polarcontext_candidate = polarcontexts_[candidate_indexes[candidate_iter_idx]];
-        std::pair<double, int> sc_dist_result = distanceBtnScanContext(curr_desc, polarcontext_candidate);
+        const std::pair<double, int> &sc_dist_result = sc_dist_results[candidate_iter_idx];
         double candidate_dist = sc_dist_result.first; // best align distance between reference sc and target sc
         int candidate_align = sc_dist_result.second; // best align angle
         if (candidate_dist < min_dist)
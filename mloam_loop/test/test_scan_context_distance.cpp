@@ -0,0 +1,165 @@
+// rosrun mloam_loop test_scan_context_distance [num_database] [num_query]
+// microbenchmark of the scan context distance: the circshift-based reference against SCManager (batched candidates),
+// the distances, the shifts and the best candidate of each query must be the same
+
+#include <iostream>
+#include <string>
+#include <random>
+#include <vector>
+#include <algorithm>
+
+#include "mloam_loop/utility/tic_toc.h"
+#include "mloam_loop/scan_context/scan_context.hpp"
+
+#define MAX_DIST_DIFF 1e-6 // the batched distances are computed in float
+
+// ****************** reference (before the SCDescriptor)
+double distDirectSCLegacy(MatrixXd &_sc1, MatrixXd &_sc2)
+{
+    int num_eff_cols = 0;
+    double sum_sector_similarity = 0;
+    for (int col_idx = 0; col_idx < _sc1.cols(); col_idx++)
+    {
+        VectorXd col_sc1 = _sc1.col(col_idx);
+        VectorXd col_sc2 = _sc2.col(col_idx);
+        if (col_sc1.norm() == 0 | col_sc2.norm() == 0)
+            continue;
+        double sector_similarity = col_sc1.dot(col_sc2) / (col_sc1.norm() * col_sc2.norm());
+        sum_sector_similarity = sum_sector_similarity + sector_similarity;
+        num_eff_cols = num_eff_cols + 1;
+    }
+    double sc_sim = sum_sector_similarity / num_eff_cols;
+    return 1.0 - sc_sim;
+}
+
+int fastAlignUsingVkeyLegacy(MatrixXd &_vkey1, MatrixXd &_vkey2)
+{
+    int argmin_vkey_shift = 0;
+    double min_veky_diff_norm = 10000000;
+    for (int shift_idx = 0; shift_idx < _vkey1.cols(); shift_idx++)
+    {
+        MatrixXd vkey2_shifted = circshift(_vkey2, shift_idx);
+        MatrixXd vkey_diff = _vkey1 - vkey2_shifted;
+        double cur_diff_norm = vkey_diff.norm();
+        if (cur_diff_norm < min_veky_diff_norm)
+        {
+            argmin_vkey_shift = shift_idx;
+            min_veky_diff_norm = cur_diff_norm;
+        }
+    }
+    return argmin_vkey_shift;
+}
+
+std::pair<double, int> distanceBtnScanContextLegacy(SCManager &sc_manager, MatrixXd &_sc1, MatrixXd &_sc2)
+{
+    MatrixXd vkey_sc1 = sc_manager.makeSectorkeyFromScancontext(_sc1);
+    MatrixXd vkey_sc2 = sc_manager.makeSectorkeyFromScancontext(_sc2);
+    int argmin_vkey_shift = fastAlignUsingVkeyLegacy(vkey_sc1, vkey_sc2);
+
+    const int SEARCH_RADIUS = round(0.5 * sc_manager.SEARCH_RATIO * _sc1.cols());
+    std::vector<int> shift_idx_search_space{argmin_vkey_shift};
+    for (int ii = 1; ii < SEARCH_RADIUS + 1; ii++)
+    {
+        shift_idx_search_space.push_back((argmin_vkey_shift + ii + _sc1.cols()) % _sc1.cols());
+        shift_idx_search_space.push_back((argmin_vkey_shift - ii + _sc1.cols()) % _sc1.cols());
+    }
+    std::sort(shift_idx_search_space.begin(), shift_idx_search_space.end());
+
+    int argmin_shift = 0;
+    double min_sc_dist = 10000000;
+    for (int num_shift : shift_idx_search_space)
+    {
+        MatrixXd sc2_shifted = circshift(_sc2, num_shift);
+        double cur_sc_dist = distDirectSCLegacy(_sc1, sc2_shifted);
+        if (cur_sc_dist < min_sc_dist)
+        {
+            argmin_shift = num_shift;
+            min_sc_dist = cur_sc_dist;
+        }
+    }
+    return make_pair(min_sc_dist, argmin_shift);
+}
+
+// ****************** synthetic scan contexts: a few places seen with different yaw, empty sectors included
+MatrixXd randomScanContext(std::mt19937 &rng, MatrixXd place, const int &num_shift)
+{
+    std::normal_distribution<double> noise(0.0, 0.05);
+    MatrixXd sc = circshift(place, num_shift);
+    for (int i = 0; i < sc.rows(); i++)
+        for (int j = 0; j < sc.cols(); j++)
+            if (sc(i, j) != 0) sc(i, j) = std::max(0.0, sc(i, j) + noise(rng));
+    return sc;
+}
+
+int main(int argc, char *argv[])
+{
+    const int num_database = argc > 1 ? atoi(argv[1]) : 2000;
+    const int num_query = argc > 2 ? atoi(argv[2]) : 50;
+    const int num_ring = 20, num_sector = 60;
+
+    SCManager sc_manager;
+    sc_manager.setParameter(2.0, num_ring, num_sector, 80.0, 360.0 / num_sector, 80.0 / num_ring, 50, 10, 0.1, 0.4, 10);
+
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<double> height(0.0, 8.0), prob(0.0, 1.0);
+    std::uniform_int_distribution<int> shift(0, num_sector - 1);
+    std::vector<MatrixXd> places(100);
+    for (MatrixXd &place : places)
+    {
+        place = MatrixXd::Zero(num_ring, num_sector);
+        for (int j = 0; j < num_sector; j++)
+        {
+            if (prob(rng) < 0.1) continue; // empty sector
+            for (int i = 0; i < num_ring; i++)
+                if (prob(rng) < 0.7) place(i, j) = height(rng);
+        }
+    }
+    for (int k = 0; k < num_database; k++)
+    {
+        MatrixXd sc = randomScanContext(rng, places[k % places.size()], shift(rng));
+        sc_manager.polarcontexts_.push_back(sc);
+        sc_manager.polarcontext_descs_.push_back(SCDescriptor(sc));
+    }
+
+    bool pass = true;
+    for (int num_candidates : {10, 50, 200, 1000})
+    {
+        num_candidates = std::min(num_candidates, num_database);
+        double time_legacy = 0, time_batch = 0, max_dist_diff = 0;
+        int num_shift_mismatch = 0, num_best_mismatch = 0;
+        std::vector<std::pair<double, int> > results;
+        for (int q = 0; q < num_query; q++)
+        {
+            MatrixXd query = randomScanContext(rng, places[q % places.size()], shift(rng));
+            SCDescriptor query_desc(query);
+            std::vector<size_t> candidate_indexes(num_candidates);
+            for (size_t &ind : candidate_indexes) ind = rng() % num_database;
+
+            TicToc t_legacy;
+            std::vector<std::pair<double, int> > results_legacy;
+            for (const size_t &ind : candidate_indexes)
+                results_legacy.push_back(distanceBtnScanContextLegacy(sc_manager, query, sc_manager.polarcontexts_[ind]));
+            time_legacy += t_legacy.toc();
+
+            TicToc t_batch;
+            sc_manager.distanceBtnScanContextBatch(query_desc, candidate_indexes, results);
+            time_batch += t_batch.toc();
+
+            size_t best_legacy = 0, best = 0;
+            for (size_t i = 0; i < results.size(); i++)
+            {
+                max_dist_diff = std::max(max_dist_diff, std::abs(results[i].first - results_legacy[i].first));
+                if (results[i].second != results_legacy[i].second) num_shift_mismatch++;
+                if (results_legacy[i].first < results_legacy[best_legacy].first) best_legacy = i;
+                if (results[i].first < results[best].first) best = i;
+            }
+            if (best != best_legacy) num_best_mismatch++;
+        }
+        printf("candidates: %4d, legacy: %8.3fms, batch: %8.3fms (x%.1f), max dist diff: %.2e, shift mismatch: %d, best mismatch: %d\n",
+               num_candidates, time_legacy / num_query, time_batch / num_query, time_legacy / time_batch,
+               max_dist_diff, num_shift_mismatch, num_best_mismatch);
+        pass = pass && (max_dist_diff < MAX_DIST_DIFF) && (num_shift_mismatch == 0) && (num_best_mismatch == 0);
+    }
+    printf("%s\n", pass ? "PASS" : "FAIL");
+    return pass ? 0 : -1;
+}
@@ -99,7 +99,8 @@ namespace pcl
             filter_limit_max_ (FLT_MAX),
             filter_limit_negative_ (false),
             min_points_per_voxel_ (0),
-            trace_threshold_(2.0)
+            trace_threshold_(2.0),
+            num_threads_ (0)
         {
             filter_name_ = "VoxelGridCovarianceMLOAM";
         }
@@ -351,6 +352,12 @@ namespace pcl
             trace_threshold_ = trace_threshold;
         }
 
+        /** \brief Set the number of threads used by applyFilter.
+        * \param[in] num_threads the number of threads, 0: use all the OpenMP threads
+        */
+        inline void
+        setNumberOfThreads (unsigned int num_threads) { num_threads_ = num_threads; }
+
         protected:
         /** \brief The size of a leaf. */
         Eigen::Vector4f leaf_size_;
@@ -387,6 +394,9 @@ namespace pcl
 
         float trace_threshold_;
 
+        /** \brief The number of threads of applyFilter, 0: use all the OpenMP threads */
+        unsigned int num_threads_;
+
         typedef typename pcl::traits::fieldList<PointT>::type FieldList;
 
         /** \brief Downsample a Point Cloud using a voxelized grid approach
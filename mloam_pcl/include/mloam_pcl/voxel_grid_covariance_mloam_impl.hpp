@@ -59,11 +59,82 @@
 
 #include "mloam_pcl/voxel_grid_covariance_mloam.h"
 
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 #include <pcl/filters/filter.h>
 #include <pcl/filters/impl/filter.hpp>
 #include <pcl/filters/voxel_grid.h>
 #include <pcl/filters/impl/voxel_grid.hpp>
 
+namespace pcl
+{
+    namespace voxel_grid_mloam
+    {
+        // number of bits to represent the values in [0, n)
+        inline int
+        numBits (uint64_t n)
+        {
+            int bits = 0;
+            while ((bits < 64) && ((uint64_t (1) << bits) < n)) ++bits;
+            return bits;
+        }
+
+        // stable LSD radix sort of the entries on their bits [shift, shift + bits)
+        // the entries are split into num_threads contiguous chunks, each chunk is counted and scattered by one thread,
+        // so equal keys keep the input order and the result does not depend on the number of threads
+        inline void
+        radixSort (std::vector<uint64_t> &entries, std::vector<uint64_t> &buffer, const int shift, const int bits, const int num_threads)
+        {
+            const int RADIX_BITS = 8;
+            const size_t RADIX = size_t (1) << RADIX_BITS;
+            const size_t n = entries.size ();
+            buffer.resize (n);
+            std::vector<size_t> offset (num_threads * RADIX);
+            for (int pass_shift = shift; pass_shift < shift + bits; pass_shift += RADIX_BITS)
+            {
+                std::fill (offset.begin (), offset.end (), 0);
+                #pragma omp parallel for num_threads(num_threads) schedule(static, 1)
+                for (int t = 0; t < num_threads; ++t)
+                {
+                    size_t *hist = &offset[t * RADIX];
+                    for (size_t i = n * t / num_threads; i < n * (t + 1) / num_threads; ++i)
+                        hist[(entries[i] >> pass_shift) & (RADIX - 1)]++;
+                }
+                // bucket-major, thread-minor prefix sum
+                size_t sum = 0;
+                bool single_bucket = false;
+                for (size_t d = 0; d < RADIX; ++d)
+                {
+                    size_t bucket_size = 0;
+                    for (int t = 0; t < num_threads; ++t)
+                    {
+                        size_t cnt = offset[t * RADIX + d];
+                        offset[t * RADIX + d] = sum;
+                        sum += cnt;
+                        bucket_size += cnt;
+                    }
+                    if (bucket_size == n) single_bucket = true;
+                }
+                if (single_bucket) continue; // this digit is the same for all the entries
+
+                #pragma omp parallel for num_threads(num_threads) schedule(static, 1)
+                for (int t = 0; t < num_threads; ++t)
+                {
+                    size_t *pos = &offset[t * RADIX];
+                    for (size_t i = n * t / num_threads; i < n * (t + 1) / num_threads; ++i)
+                        buffer[pos[(entries[i] >> pass_shift) & (RADIX - 1)]++] = entries[i];
+                }
+                entries.swap (buffer);
+            }
+        }
+    }
+}
+
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 template <typename PointT> void
 pcl::VoxelGridCovarianceMLOAM<PointT>::applyFilter (PointCloud &output)
@@ -81,6 +152,14 @@ pcl::VoxelGridCovarianceMLOAM<PointT>::applyFilter (PointCloud &output)
     output.height       = 1;                    // downsampling breaks the organized structure
     output.is_dense     = true;                 // we filter out invalid points
 
+    int num_threads = static_cast<int> (num_threads_);
+#ifdef _OPENMP
+    if (num_threads == 0) num_threads = omp_get_max_threads ();
+#else
+    num_threads = 1;
+#endif
+    if (num_threads <= 0) num_threads = 1;
+
     Eigen::Vector4f min_p, max_p;
     // Get the minimum and maximum dimensions
     if (!filter_field_name_.empty ()) // If we don't want to process the entire cloud...
@@ -88,18 +167,6 @@ pcl::VoxelGridCovarianceMLOAM<PointT>::applyFilter (PointCloud &output)
     else
         getMinMax3D<PointT> (*input_, *indices_, min_p, max_p);
 
-    // Check that the leaf size is not too small, given the size of the data
-    int64_t dx = static_cast<int64_t>((max_p[0] - min_p[0]) * inverse_leaf_size_[0])+1;
-    int64_t dy = static_cast<int64_t>((max_p[1] - min_p[1]) * inverse_leaf_size_[1])+1;
-    int64_t dz = static_cast<int64_t>((max_p[2] - min_p[2]) * inverse_leaf_size_[2])+1;
-
-    if ((dx*dy*dz) > static_cast<int64_t>(std::numeric_limits<int32_t>::max()))
-    {
-        PCL_WARN("[pcl::%s::applyFilter] Leaf size is too small for the input dataset. Integer indices would overflow.", getClassName().c_str());
-        output = *input_;
-        return;
-    }
-
     // Compute the minimum and maximum bounding box values
     min_b_[0] = static_cast<int> (floor (min_p[0] * inverse_leaf_size_[0]));
     max_b_[0] = static_cast<int> (floor (max_p[0] * inverse_leaf_size_[0]));
@@ -112,8 +179,29 @@ pcl::VoxelGridCovarianceMLOAM<PointT>::applyFilter (PointCloud &output)
     div_b_ = max_b_ - min_b_ + Eigen::Vector4i::Ones ();
     div_b_[3] = 0;
 
+    // the voxel keys are 64 bits: i + j * div_x + k * div_x * div_y
+    const uint64_t div_x = static_cast<uint64_t> (div_b_[0]);
+    const uint64_t div_xy = div_x * static_cast<uint64_t> (div_b_[1]);
+    if (static_cast<double> (div_b_[0]) * div_b_[1] * div_b_[2] >= static_cast<double> (std::numeric_limits<int64_t>::max ()))
+    {
+        PCL_WARN("[pcl::%s::applyFilter] Leaf size is too small for the input dataset. Integer indices would overflow.", getClassName().c_str());
+        output = *input_;
+        return;
+    }
+    const uint64_t num_voxels = div_xy * static_cast<uint64_t> (div_b_[2]);
+    // the leaf layout is indexed by int
+    if (save_leaf_layout_ && (num_voxels > static_cast<uint64_t> (std::numeric_limits<int32_t>::max ())))
+    {
+        PCL_WARN("[pcl::%s::applyFilter] Leaf size is too small for the input dataset. Integer indices would overflow.", getClassName().c_str());
+        output = *input_;
+        return;
+    }
+
     // Set up the division multiplier
-    divb_mul_ = Eigen::Vector4i (1, div_b_[0], div_b_[0] * div_b_[1], 0);
+    if (num_voxels <= static_cast<uint64_t> (std::numeric_limits<int32_t>::max ()))
+        divb_mul_ = Eigen::Vector4i (1, div_b_[0], div_b_[0] * div_b_[1], 0);
+    else
+        divb_mul_.setZero ();
 
     int centroid_size = 4;
     if (downsample_all_data_) centroid_size = boost::mpl::size<FieldList>::value; // default: true
@@ -144,12 +232,8 @@ pcl::VoxelGridCovarianceMLOAM<PointT>::applyFilter (PointCloud &output)
         cov_index = cov_fields[cov_index].offset;
     }
 
-    std::vector<cloud_point_index_idx> index_vector;
-    index_vector.reserve (indices_->size ());
-
     // If we don't want to process the entire cloud, but rather filter points far away from the viewpoint first...
-    // std::cout << "field empty ? " << filter_field_name_.empty() << std::endl;
-    // filter_field_name_ is empty
+    int distance_offset = -1;
     if (!filter_field_name_.empty ())
     {
         // Get the distance field index
@@ -157,97 +241,126 @@ pcl::VoxelGridCovarianceMLOAM<PointT>::applyFilter (PointCloud &output)
         int distance_idx = pcl::getFieldIndex (*input_, filter_field_name_, fields);
         if (distance_idx == -1)
             PCL_WARN ("[pcl::%s::applyFilter] Invalid filter field name. Index is %d.\n", getClassName ().c_str (), distance_idx);
+        else
+            distance_offset = fields[distance_idx].offset;
+    }
 
-        // First pass: go over all points and insert them into the index_vector vector
-        // with calculated idx. Points with the same idx value will contribute to the
-        // same point of resulting CloudPoint
-        for (std::vector<int>::const_iterator it = indices_->begin (); it != indices_->end (); ++it)
+    auto isPointValid = [&] (const PointT &point)
+    {
+        if (!input_->is_dense)
+            // Check if the point is invalid
+            if (!pcl_isfinite (point.x) || !pcl_isfinite (point.y) || !pcl_isfinite (point.z))
+                return false;
+        if (distance_offset >= 0)
         {
-            if (!input_->is_dense)
-                // Check if the point is invalid
-                if (!pcl_isfinite (input_->points[*it].x) ||
-                    !pcl_isfinite (input_->points[*it].y) ||
-                    !pcl_isfinite (input_->points[*it].z))
-                  continue;
-
             // Get the distance value
-            const uint8_t* pt_data = reinterpret_cast<const uint8_t*> (&input_->points[*it]);
             float distance_value = 0;
-            memcpy (&distance_value, pt_data + fields[distance_idx].offset, sizeof (float));
-
+            memcpy (&distance_value, reinterpret_cast<const uint8_t*> (&point) + distance_offset, sizeof (float));
             if (filter_limit_negative_)
             {
                 // Use a threshold for cutting out points which inside the interval
                 if ((distance_value < filter_limit_max_) && (distance_value > filter_limit_min_))
-                    continue;
+                    return false;
             }
             else
             {
                 // Use a threshold for cutting out points which are too close/far away
                 if ((distance_value > filter_limit_max_) || (distance_value < filter_limit_min_))
-                    continue;
+                    return false;
             }
+        }
+        return true;
+    };
 
-            int ijk0 = static_cast<int> (floor (input_->points[*it].x * inverse_leaf_size_[0]) - static_cast<float> (min_b_[0]));
-            int ijk1 = static_cast<int> (floor (input_->points[*it].y * inverse_leaf_size_[1]) - static_cast<float> (min_b_[1]));
-            int ijk2 = static_cast<int> (floor (input_->points[*it].z * inverse_leaf_size_[2]) - static_cast<float> (min_b_[2]));
-
-            // Compute the centroid leaf index
-            int idx = ijk0 * divb_mul_[0] + ijk1 * divb_mul_[1] + ijk2 * divb_mul_[2];
-            index_vector.push_back (cloud_point_index_idx (static_cast<unsigned int> (idx), *it));
+    auto computeVoxelKey = [&] (const PointT &point)
+    {
+        int ijk0 = static_cast<int> (floor (point.x * inverse_leaf_size_[0]) - static_cast<float> (min_b_[0]));
+        int ijk1 = static_cast<int> (floor (point.y * inverse_leaf_size_[1]) - static_cast<float> (min_b_[1]));
+        int ijk2 = static_cast<int> (floor (point.z * inverse_leaf_size_[2]) - static_cast<float> (min_b_[2]));
+        return static_cast<uint64_t> (ijk0) + static_cast<uint64_t> (ijk1) * div_x + static_cast<uint64_t> (ijk2) * div_xy;
+    };
+
+    // First pass: go over all points and compute the entries (voxel key << index_bits | point index)
+    // Points with the same key will contribute to the same point of resulting CloudPoint
+    // entries keep the order of indices_ since each thread writes a contiguous chunk
+    const int index_bits = voxel_grid_mloam::numBits (input_->points.size ());
+    const int key_bits = voxel_grid_mloam::numBits (num_voxels);
+    const uint64_t index_mask = (uint64_t (1) << index_bits) - 1;
+    const size_t num_indices = indices_->size ();
+    std::vector<uint64_t> entries, buffer;
+    if (index_bits + key_bits <= 64)
+    {
+        buffer.resize (num_indices);
+        std::vector<size_t> chunk_size (num_threads + 1, 0);
+        #pragma omp parallel for num_threads(num_threads) schedule(static, 1)
+        for (int t = 0; t < num_threads; ++t)
+        {
+            const size_t begin = num_indices * t / num_threads, end = num_indices * (t + 1) / num_threads;
+            size_t cnt = begin;
+            for (size_t i = begin; i < end; ++i)
+            {
+                const int pid = (*indices_)[i];
+                const PointT &point = input_->points[pid];
+                if (!isPointValid (point)) continue;
+                buffer[cnt++] = (computeVoxelKey (point) << index_bits) | static_cast<uint64_t> (pid);
+            }
+            chunk_size[t + 1] = cnt - begin;
         }
+        for (int t = 0; t < num_threads; ++t) chunk_size[t + 1] += chunk_size[t];
+        entries.resize (chunk_size[num_threads]);
+        #pragma omp parallel for num_threads(num_threads) schedule(static, 1)
+        for (int t = 0; t < num_threads; ++t)
+        {
+            const size_t begin = num_indices * t / num_threads;
+            std::copy (buffer.begin () + begin, buffer.begin () + begin + (chunk_size[t + 1] - chunk_size[t]), entries.begin () + chunk_size[t]);
+        }
+
+        // Second pass: sort the entries by the voxel key
+        // in effect all points belonging to the same output cell will be next to each other
+        voxel_grid_mloam::radixSort (entries, buffer, index_bits, key_bits, num_threads);
     }
-    // No distance filtering, process all data
     else
     {
-        // First pass: go over all points and insert them into the index_vector vector
-        // with calculated idx. Points with the same idx value will contribute to the
-        // same point of resulting CloudPoint
-        for (std::vector<int>::const_iterator it = indices_->begin (); it != indices_->end (); ++it)
+        // the key and the index do not fit into one word (only for huge grids without leaf layout):
+        // stable sort of (key, index) and replace the keys with their rank
+        std::vector<std::pair<uint64_t, uint32_t> > key_index;
+        key_index.reserve (num_indices);
+        for (size_t i = 0; i < num_indices; ++i)
         {
-            if (!input_->is_dense)
-                // Check if the point is invalid
-                if (!pcl_isfinite (input_->points[*it].x) ||
-                    !pcl_isfinite (input_->points[*it].y) ||
-                    !pcl_isfinite (input_->points[*it].z))
-                    continue;
-
-            int ijk0 = static_cast<int> (floor (input_->points[*it].x * inverse_leaf_size_[0]) - static_cast<float> (min_b_[0]));
-            int ijk1 = static_cast<int> (floor (input_->points[*it].y * inverse_leaf_size_[1]) - static_cast<float> (min_b_[1]));
-            int ijk2 = static_cast<int> (floor (input_->points[*it].z * inverse_leaf_size_[2]) - static_cast<float> (min_b_[2]));
-
-            // Compute the centroid leaf index (voxel idx)
-            int idx = ijk0 * divb_mul_[0] + ijk1 * divb_mul_[1] + ijk2 * divb_mul_[2];
-            index_vector.push_back (cloud_point_index_idx (static_cast<unsigned int> (idx), *it));
+            const int pid = (*indices_)[i];
+            if (!isPointValid (input_->points[pid])) continue;
+            key_index.push_back (std::make_pair (computeVoxelKey (input_->points[pid]), static_cast<uint32_t> (pid)));
+        }
+        std::stable_sort (key_index.begin (), key_index.end (),
+            [] (const std::pair<uint64_t, uint32_t> &a, const std::pair<uint64_t, uint32_t> &b) { return a.first < b.first; });
+        entries.resize (key_index.size ());
+        uint64_t rank = 0;
+        for (size_t i = 0; i < key_index.size (); ++i)
+        {
+            if ((i > 0) && (key_index[i].first != key_index[i - 1].first)) rank++;
+            entries[i] = (rank << index_bits) | key_index[i].second;
         }
     }
-
-    // Second pass: sort the index_vector vector using value representing target cell as index
-    // in effect all points belonging to the same output cell will be next to each other
-    std::sort (index_vector.begin (), index_vector.end (), std::less<cloud_point_index_idx> ());
+    std::vector<uint64_t> ().swap (buffer);
 
     // Third pass: count output cells
-    // we need to skip all the same, adjacenent idx values
-    unsigned int total = 0;
-    unsigned int index = 0;
-    // first_and_last_indices_vector[i] represents the index in index_vector of the first point in
-    // index_vector belonging to the voxel which corresponds to the i-th output point,
-    // and of the first point not belonging to.
-    std::vector<std::pair<unsigned int, unsigned int> > first_and_last_indices_vector;
-    // Worst case size
-    first_and_last_indices_vector.reserve (index_vector.size ());
-    while (index < index_vector.size ())
+    // run_begin[r] is the index in entries of the first point of the r-th voxel,
+    // only the begin of each run is stored, the run ends at the begin of the next run
+    std::vector<uint32_t> run_begin;
+    run_begin.reserve (entries.size () / 4 + 1);
+    for (size_t i = 0; i < entries.size (); ++i)
+        if ((i == 0) || ((entries[i] >> index_bits) != (entries[i - 1] >> index_bits)))
+            run_begin.push_back (static_cast<uint32_t> (i));
+    run_begin.push_back (static_cast<uint32_t> (entries.size ()));
+    std::vector<uint32_t> voxel_run; // the runs with enough points, empty if all of them are kept
+    if (min_points_per_voxel_ > 1)
     {
-        unsigned int i = index + 1;
-        while (i < index_vector.size () && index_vector[i].idx == index_vector[index].idx)
-            ++i;
-        if (i - index >= min_points_per_voxel_)
-        {
-            ++total;
-            first_and_last_indices_vector.push_back (std::pair<unsigned int, unsigned int> (index, i));
-        }
-        index = i;
+        for (uint32_t r = 0; r + 1 < run_begin.size (); ++r)
+            if (run_begin[r + 1] - run_begin[r] >= min_points_per_voxel_) voxel_run.push_back (r);
     }
+    const bool keep_all_runs = (min_points_per_voxel_ <= 1) || (voxel_run.size () + 1 == run_begin.size ());
+    if (keep_all_runs) voxel_run.clear ();
+    const int total = static_cast<int> (keep_all_runs ? run_begin.size () - 1 : voxel_run.size ());
 
     // Fourth pass: compute centroids, insert them into their final position
     output.points.resize (total);
@@ -277,181 +390,117 @@ pcl::VoxelGridCovarianceMLOAM<PointT>::applyFilter (PointCloud &output)
         }
     }
 
-    // TODO:
-    index = 0;
-    Eigen::VectorXf centroid = Eigen::VectorXf::Zero (centroid_size);
-    Eigen::VectorXf temporary = Eigen::VectorXf::Zero (centroid_size);
-    for (unsigned int cp = 0; cp < first_and_last_indices_vector.size (); ++cp)
+    // each voxel is computed by one thread from its points in the input order, the result is independent of the threads
+    #pragma omp parallel num_threads(num_threads)
     {
-        // calculate centroid - sum values from all input points, that have the same idx value in index_vector array
-        unsigned int first_index = first_and_last_indices_vector[cp].first;
-        unsigned int last_index = first_and_last_indices_vector[cp].second;
-        unsigned int valid_cnt = last_index - first_index;
-        centroid.setZero();
-
-        // https://math.stackexchange.com/questions/195911/calculation-of-the-covariance-of-gaussian-mixtures
-        if (cov_index >= 0)
+        Eigen::VectorXf centroid = Eigen::VectorXf::Zero (centroid_size);
+        Eigen::VectorXf temporary = Eigen::VectorXf::Zero (centroid_size);
+        #pragma omp for schedule(guided)
+        for (int index = 0; index < total; ++index)
         {
-            // revised version
-            Eigen::Vector3f mu = Eigen::Vector3f::Zero();
-            float ity = 0;
-            Eigen::Matrix<float, 7, 1> cov = Eigen::Matrix<float, 7, 1>::Zero();
-            float weight_total = 0;
-            float w_max = 0;
-            for (unsigned int i = first_index; i < last_index; ++i)
+            // calculate centroid - sum values from all input points, that have the same key in entries
+            const uint32_t run = keep_all_runs ? static_cast<uint32_t> (index) : voxel_run[index];
+            unsigned int first_index = run_begin[run];
+            unsigned int last_index = run_begin[run + 1];
+            unsigned int valid_cnt = last_index - first_index;
+            centroid.setZero();
+
+            // https://math.stackexchange.com/questions/195911/calculation-of-the-covariance-of-gaussian-mixtures
+            if (cov_index >= 0)
             {
-                pcl::for_each_type<FieldList>(NdCopyPointEigenFunctor<PointT>(input_->points[index_vector[i].cloud_point_index], temporary));
-                if (abs(temporary[4] + temporary[7] + temporary[9]) >= trace_threshold_) // filter the point with the trace of the covariance > 2
+                Eigen::Vector3f mu = Eigen::Vector3f::Zero();
+                float ity = 0;
+                Eigen::Matrix<float, 7, 1> cov = Eigen::Matrix<float, 7, 1>::Zero();
+                float weight_total = 0;
+                float w_max = 0;
+                for (unsigned int i = first_index; i < last_index; ++i)
                 {
-                    valid_cnt--;
-                    continue;
+                    pcl::for_each_type<FieldList>(NdCopyPointEigenFunctor<PointT>(input_->points[entries[i] & index_mask], temporary));
+                    if (abs(temporary[4] + temporary[7] + temporary[9]) >= trace_threshold_) // filter the point with the trace of the covariance > 2
+                    {
+                        valid_cnt--;
+                        continue;
+                    }
+                    float w = trace_threshold_ - (temporary[4] + temporary[7] + temporary[9]);
+                    mu.head(3) += w * temporary.head(3); // mu
+                    ity = w > w_max ? temporary[3] : ity; // intensity
+                    w_max = w > w_max ? w : w_max;
+                    cov += w * w * temporary.tail(7); // covariance
+
+                    weight_total += w;
                 }
-                float w = trace_threshold_ - (temporary[4] + temporary[7] + temporary[9]);
-                // float dis = trace_threshold_ - (temporary[4] + temporary[7] + temporary[9]);
-                // float w = dis > (trace_threshold_ / 2) ? (trace_threshold_ / 2) / dis : 1.0;
-                // float w = dis * dis;
-                mu.head(3) += w * temporary.head(3); // mu
-                ity = w > w_max ? temporary[3] : ity; // intensity
-                w_max = w > w_max ? w : w_max;
-                cov += w * w * temporary.tail(7); // covariance
-                
-                weight_total += w;
-            }
-            if (valid_cnt == 0) valid_cnt = 1;
+                if (valid_cnt == 0) valid_cnt = 1;
 
-            // index is centroid final position in resulting PointCloud
-            if (save_leaf_layout_) leaf_layout_[index_vector[first_index].idx] = index;
-
-            // compute the centroid
-            if (weight_total == 0) weight_total = 1.0;
-            mu.head(3) /= static_cast<float>(weight_total);
-            cov /= (static_cast<float>(weight_total) * static_cast<float>(weight_total));
-
-            centroid.head(3) = mu;
-            centroid[3] = ity;
-            centroid.tail(7) = cov;
-            centroid[10] = centroid[4] + centroid[7] + centroid[9];
-
-            // // old version 
-            // Eigen::VectorXf weight_vec(last_index - first_index);
-            // weight_vec.setZero();
-            // Eigen::Vector4f mu = Eigen::Vector4f::Zero();
-            // float w_max = 0;
-            // float ity = 0;
-            // for (unsigned int i = first_index; i < last_index; ++i)
-            // {
-            //     pcl::for_each_type<FieldList>(NdCopyPointEigenFunctor<PointT>(input_->points[index_vector[i].cloud_point_index], temporary));
-            //     if (abs(temporary[4] + temporary[7] + temporary[9]) >= trace_threshold_) // filter the point with the trace of the covariance > 2
-            //     {
-            //         valid_cnt--;
-            //         continue;
-            //     }
-            //     double w = trace_threshold_ - (temporary[4] + temporary[7] + temporary[9]);
-            //     // weight_vec[i - first_index] = (w < trace_threshold_ / 2.0) ? w : trace_threshold_ / 2.0;
-            //     weight_vec[i - first_index] = w;
-            //     mu.head(3) += weight_vec[i - first_index] * temporary.head(3);
-            //     mu[3] = temporary[3];
-            //     ity = w > w_max ? temporary[3] : ity; // intensity
-            //     w_max = w > w_max ? w : w_max;
-            // }
-            // if (valid_cnt == 0)
-            //     valid_cnt = 1;
-
-            // // index is centroid final position in resulting PointCloud
-            // if (save_leaf_layout_)
-            //     leaf_layout_[index_vector[first_index].idx] = index;
-
-            // // compute the centroid
-            // float weight_total = weight_vec.sum();
-            // if (weight_total == 0)
-            //     weight_total = 1.0;
-            // mu.head(3) /= static_cast<float>(weight_total);
-
-            // Eigen::Matrix3f cov = Eigen::Matrix3f::Zero();
-            // for (unsigned int i = first_index; i < last_index; ++i)
-            // {
-            //     pcl::for_each_type<FieldList>(NdCopyPointEigenFunctor<PointT>(input_->points[index_vector[i].cloud_point_index], temporary));
-            //     Eigen::Matrix3f cov_tmp;
-            //     cov_tmp << temporary[4], temporary[5], temporary[6],
-            //         temporary[5], temporary[7], temporary[8],
-            //         temporary[6], temporary[8], temporary[9];
-            //     cov += weight_vec[i - first_index] * (cov_tmp + (temporary.head(3) - mu.head(3)) * (temporary.head(3) - mu.head(3)).transpose());
-            // }
-            // cov /= static_cast<float>(weight_total);
-
-            // centroid.head(3) = mu;
-            // centroid[3] = ity;
-            // centroid[4] = cov(0, 0);
-            // centroid[5] = cov(0, 1);
-            // centroid[6] = cov(0, 2);
-            // centroid[7] = cov(1, 1);
-            // centroid[8] = cov(1, 2);
-            // centroid[9] = cov(2, 2);
-            // centroid[10] = cov(0, 0) + cov(1, 1) + cov(2, 2);
-        } 
-        else
-        {
-            for (unsigned int i = first_index; i < last_index; ++i)
+                // compute the centroid
+                if (weight_total == 0) weight_total = 1.0;
+                mu.head(3) /= static_cast<float>(weight_total);
+                cov /= (static_cast<float>(weight_total) * static_cast<float>(weight_total));
+
+                centroid.head(3) = mu;
+                centroid[3] = ity;
+                centroid.tail(7) = cov;
+                centroid[10] = centroid[4] + centroid[7] + centroid[9];
+            }
+            else
             {
-                pcl::for_each_type <FieldList> (NdCopyPointEigenFunctor <PointT> (input_->points[index_vector[i].cloud_point_index], temporary));
-                if (!downsample_all_data_)
-                {
-                    centroid[0] += input_->points[index_vector[i].cloud_point_index].x;
-                    centroid[1] += input_->points[index_vector[i].cloud_point_index].y;
-                    centroid[2] += input_->points[index_vector[i].cloud_point_index].z;
-                }
-                else
+                for (unsigned int i = first_index; i < last_index; ++i)
                 {
-                    // ---[ RGB special case
-                    if (rgba_index >= 0)
+                    const PointT &point = input_->points[entries[i] & index_mask];
+                    pcl::for_each_type <FieldList> (NdCopyPointEigenFunctor <PointT> (point, temporary));
+                    if (!downsample_all_data_)
                     {
-                        // Fill r/g/b data, assuming that the order is BGRA
-                        pcl::RGB rgb;
-                        memcpy (&rgb, reinterpret_cast<const char*> (&input_->points[index_vector[i].cloud_point_index]) + rgba_index, sizeof (RGB));
-                        temporary[centroid_size-3] = rgb.r;
-                        temporary[centroid_size-2] = rgb.g;
-                        temporary[centroid_size-1] = rgb.b;
-                    } else
+                        centroid[0] += point.x;
+                        centroid[1] += point.y;
+                        centroid[2] += point.z;
+                    }
+                    else
                     {
-                        // pcl::for_each_type <FieldList> (NdCopyPointEigenFunctor <PointT> (input_->points[index_vector[i].cloud_point_index], temporary));
-                        centroid.head(3) += temporary.head(3);
-                        if (itsy_index >= 0) centroid[3] = temporary[3];
+                        // ---[ RGB special case
+                        if (rgba_index >= 0)
+                        {
+                            // Fill r/g/b data, assuming that the order is BGRA
+                            pcl::RGB rgb;
+                            memcpy (&rgb, reinterpret_cast<const char*> (&point) + rgba_index, sizeof (RGB));
+                            temporary[centroid_size-3] = rgb.r;
+                            temporary[centroid_size-2] = rgb.g;
+                            temporary[centroid_size-1] = rgb.b;
+                        } else
+                        {
+                            centroid.head(3) += temporary.head(3);
+                            if (itsy_index >= 0) centroid[3] = temporary[3];
+                        }
                     }
                 }
+                if (valid_cnt == 0) valid_cnt = 1;
+
+                // compute the centroid
+                centroid.head(3) /= static_cast<float>(valid_cnt);
             }
-            if (valid_cnt == 0) valid_cnt = 1;
 
             // index is centroid final position in resulting PointCloud
-            if (save_leaf_layout_) leaf_layout_[index_vector[first_index].idx] = index;
+            if (save_leaf_layout_) leaf_layout_[entries[first_index] >> index_bits] = index;
 
-            // compute the centroid 
-            centroid.head(3) /= static_cast<float>(valid_cnt);
-            // float itsy;
-            // if (itsy_index >= 0) itsy = centroid[3];
-            // if (itsy_index >= 0) centroid[3] = itsy; // keep the original intensity
-        }
-
-        // store centroid
-        // Do we need to process all the fields?
-        if (!downsample_all_data_)
-        {
-            output.points[index].x = centroid[0];
-            output.points[index].y = centroid[1];
-            output.points[index].z = centroid[2];
-        }
-        else
-        {
-            pcl::for_each_type<FieldList> (pcl::NdCopyEigenPointFunctor <PointT> (centroid, output.points[index]));
-            // ---[ RGB special case
-            if (rgba_index >= 0)
+            // store centroid
+            // Do we need to process all the fields?
+            if (!downsample_all_data_)
             {
-                // pack r/g/b into rgb
-                float r = centroid[centroid_size-3], g = centroid[centroid_size-2], b = centroid[centroid_size-1];
-                int rgb = (static_cast<int> (r) << 16) | (static_cast<int> (g) << 8) | static_cast<int> (b);
-                memcpy (reinterpret_cast<char*> (&output.points[index]) + rgba_index, &rgb, sizeof (float));
+                output.points[index].x = centroid[0];
+                output.points[index].y = centroid[1];
+                output.points[index].z = centroid[2];
+            }
+            else
+            {
+                pcl::for_each_type<FieldList> (pcl::NdCopyEigenPointFunctor <PointT> (centroid, output.points[index]));
+                // ---[ RGB special case
+                if (rgba_index >= 0)
+                {
+                    // pack r/g/b into rgb
+                    float r = centroid[centroid_size-3], g = centroid[centroid_size-2], b = centroid[centroid_size-1];
+                    int rgb = (static_cast<int> (r) << 16) | (static_cast<int> (g) << 8) | static_cast<int> (b);
+                    memcpy (reinterpret_cast<char*> (&output.points[index]) + rgba_index, &rgb, sizeof (float));
+                }
             }
         }
-        ++index;
     }
     output.width = static_cast<uint32_t> (output.points.size ());
 }
@@ -0,0 +1,452 @@
+// rosrun mloam_test test_voxel_grid_cov_mloam [num_points] [leaf_size] [map.pcd]
+// benchmark of VoxelGridCovarianceMLOAM::applyFilter (radix sort, OpenMP) against the previous std::sort implementation,
+// the filtered clouds are compared point by point for different numbers of threads
+
+// Starting with PCL-1.7 you need to define PCL_NO_PRECOMPILE before you include any PCL headers to include the templated algorithms as well.
+#define PCL_NO_PRECOMPILE
+
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <omp.h>
+#include <pcl/io/pcd_io.h>
+
+#include "mloam_pcl/point_with_cov.hpp"
+#include "mloam_pcl/voxel_grid_covariance_mloam.h"
+#include "mloam_pcl/voxel_grid_covariance_mloam_impl.hpp"
+
+#include "common/tic_toc.h"
+
+typedef pcl::PointIWithCov PointType;
+typedef pcl::PointCloud<PointType> PointCloud;
+
+// previous implementation, kept as the reference
+class VoxelGridCovarianceLegacy: public pcl::VoxelGridCovarianceMLOAM<PointType>
+{
+protected:
+    void
+    applyFilter (PointCloud &output)
+    {
+        // Has the input dataset been set already?
+        if (!input_)
+        {
+            PCL_WARN ("[pcl::%s::applyFilter] No input dataset given!\n", getClassName ().c_str ());
+            output.width = output.height = 0;
+            output.points.clear ();
+            return;
+        }
+
+        // Copy the header (and thus the frame_id) + allocate enough space for points
+        output.height       = 1;                    // downsampling breaks the organized structure
+        output.is_dense     = true;                 // we filter out invalid points
+
+        Eigen::Vector4f min_p, max_p;
+        // Get the minimum and maximum dimensions
+        if (!filter_field_name_.empty ()) // If we don't want to process the entire cloud...
+            pcl::getMinMax3D<PointType> (input_, *indices_, filter_field_name_, static_cast<float> (filter_limit_min_), static_cast<float> (filter_limit_max_), min_p, max_p, filter_limit_negative_);
+        else
+            pcl::getMinMax3D<PointType> (*input_, *indices_, min_p, max_p);
+
+        // Check that the leaf size is not too small, given the size of the data
+        int64_t dx = static_cast<int64_t>((max_p[0] - min_p[0]) * inverse_leaf_size_[0])+1;
+        int64_t dy = static_cast<int64_t>((max_p[1] - min_p[1]) * inverse_leaf_size_[1])+1;
+        int64_t dz = static_cast<int64_t>((max_p[2] - min_p[2]) * inverse_leaf_size_[2])+1;
+
+        if ((dx*dy*dz) > static_cast<int64_t>(std::numeric_limits<int32_t>::max()))
+        {
+            PCL_WARN("[pcl::%s::applyFilter] Leaf size is too small for the input dataset. Integer indices would overflow.", getClassName().c_str());
+            output = *input_;
+            return;
+        }
+
+        // Compute the minimum and maximum bounding box values
+        min_b_[0] = static_cast<int> (floor (min_p[0] * inverse_leaf_size_[0]));
+        max_b_[0] = static_cast<int> (floor (max_p[0] * inverse_leaf_size_[0]));
+        min_b_[1] = static_cast<int> (floor (min_p[1] * inverse_leaf_size_[1]));
+        max_b_[1] = static_cast<int> (floor (max_p[1] * inverse_leaf_size_[1]));
+        min_b_[2] = static_cast<int> (floor (min_p[2] * inverse_leaf_size_[2]));
+        max_b_[2] = static_cast<int> (floor (max_p[2] * inverse_leaf_size_[2]));
+
+        // Compute the number of divisions needed along all axis
+        div_b_ = max_b_ - min_b_ + Eigen::Vector4i::Ones ();
+        div_b_[3] = 0;
+
+        // Set up the division multiplier
+        divb_mul_ = Eigen::Vector4i (1, div_b_[0], div_b_[0] * div_b_[1], 0);
+
+        int centroid_size = 4;
+        if (downsample_all_data_) centroid_size = boost::mpl::size<FieldList>::value; // default: true
+
+        // ---[ RGB special case
+        std::vector<pcl::PCLPointField> itsy_fields;
+        int itsy_index = -1;
+        itsy_index = pcl::getFieldIndex(*input_, "intensity", itsy_fields);
+
+        // ---[ RGB special case
+        std::vector<pcl::PCLPointField> rgb_fields;
+        int rgba_index = -1;
+        rgba_index = pcl::getFieldIndex (*input_, "rgb", rgb_fields);
+        if (rgba_index == -1)
+            rgba_index = pcl::getFieldIndex (*input_, "rgba", rgb_fields);
+        if (rgba_index >= 0)
+        {
+            rgba_index = rgb_fields[rgba_index].offset;
+            // centroid_size += 3;
+        }
+
+        // ---[ COV special case
+        std::vector<pcl::PCLPointField> cov_fields;
+        int cov_index = -1;
+        cov_index = pcl::getFieldIndex (*input_, "cov_xx", cov_fields); // offset 40
+        if (cov_index >= 0)
+        {
+            cov_index = cov_fields[cov_index].offset;
+        }
+
+        std::vector<pcl::cloud_point_index_idx> index_vector;
+        index_vector.reserve (indices_->size ());
+
+        // If we don't want to process the entire cloud, but rather filter points far away from the viewpoint first...
+        // std::cout << "field empty ? " << filter_field_name_.empty() << std::endl;
+        // filter_field_name_ is empty
+        if (!filter_field_name_.empty ())
+        {
+            // Get the distance field index
+            std::vector<pcl::PCLPointField> fields;
+            int distance_idx = pcl::getFieldIndex (*input_, filter_field_name_, fields);
+            if (distance_idx == -1)
+                PCL_WARN ("[pcl::%s::applyFilter] Invalid filter field name. Index is %d.\n", getClassName ().c_str (), distance_idx);
+
+            // First pass: go over all points and insert them into the index_vector vector
+            // with calculated idx. Points with the same idx value will contribute to the
+            // same point of resulting CloudPoint
+            for (std::vector<int>::const_iterator it = indices_->begin (); it != indices_->end (); ++it)
+            {
+                if (!input_->is_dense)
+                    // Check if the point is invalid
+                    if (!pcl_isfinite (input_->points[*it].x) ||
+                        !pcl_isfinite (input_->points[*it].y) ||
+                        !pcl_isfinite (input_->points[*it].z))
+                      continue;
+
+                // Get the distance value
+                const uint8_t* pt_data = reinterpret_cast<const uint8_t*> (&input_->points[*it]);
+                float distance_value = 0;
+                memcpy (&distance_value, pt_data + fields[distance_idx].offset, sizeof (float));
+
+                if (filter_limit_negative_)
+                {
+                    // Use a threshold for cutting out points which inside the interval
+                    if ((distance_value < filter_limit_max_) && (distance_value > filter_limit_min_))
+                        continue;
+                }
+                else
+                {
+                    // Use a threshold for cutting out points which are too close/far away
+                    if ((distance_value > filter_limit_max_) || (distance_value < filter_limit_min_))
+                        continue;
+                }
+
+                int ijk0 = static_cast<int> (floor (input_->points[*it].x * inverse_leaf_size_[0]) - static_cast<float> (min_b_[0]));
+                int ijk1 = static_cast<int> (floor (input_->points[*it].y * inverse_leaf_size_[1]) - static_cast<float> (min_b_[1]));
+                int ijk2 = static_cast<int> (floor (input_->points[*it].z * inverse_leaf_size_[2]) - static_cast<float> (min_b_[2]));
+
+                // Compute the centroid leaf index
+                int idx = ijk0 * divb_mul_[0] + ijk1 * divb_mul_[1] + ijk2 * divb_mul_[2];
+                index_vector.push_back (pcl::cloud_point_index_idx (static_cast<unsigned int> (idx), *it));
+            }
+        }
+        // No distance filtering, process all data
+        else
+        {
+            // First pass: go over all points and insert them into the index_vector vector
+            // with calculated idx. Points with the same idx value will contribute to the
+            // same point of resulting CloudPoint
+            for (std::vector<int>::const_iterator it = indices_->begin (); it != indices_->end (); ++it)
+            {
+                if (!input_->is_dense)
+                    // Check if the point is invalid
+                    if (!pcl_isfinite (input_->points[*it].x) ||
+                        !pcl_isfinite (input_->points[*it].y) ||
+                        !pcl_isfinite (input_->points[*it].z))
+                        continue;
+
+                int ijk0 = static_cast<int> (floor (input_->points[*it].x * inverse_leaf_size_[0]) - static_cast<float> (min_b_[0]));
+                int ijk1 = static_cast<int> (floor (input_->points[*it].y * inverse_leaf_size_[1]) - static_cast<float> (min_b_[1]));
+                int ijk2 = static_cast<int> (floor (input_->points[*it].z * inverse_leaf_size_[2]) - static_cast<float> (min_b_[2]));
+
+                // Compute the centroid leaf index (voxel idx)
+                int idx = ijk0 * divb_mul_[0] + ijk1 * divb_mul_[1] + ijk2 * divb_mul_[2];
+                index_vector.push_back (pcl::cloud_point_index_idx (static_cast<unsigned int> (idx), *it));
+            }
+        }
+
+        // Second pass: sort the index_vector vector using value representing target cell as index
+        // in effect all points belonging to the same output cell will be next to each other
+        std::sort (index_vector.begin (), index_vector.end (), std::less<pcl::cloud_point_index_idx> ());
+
+        // Third pass: count output cells
+        // we need to skip all the same, adjacenent idx values
+        unsigned int total = 0;
+        unsigned int index = 0;
+        // first_and_last_indices_vector[i] represents the index in index_vector of the first point in
+        // index_vector belonging to the voxel which corresponds to the i-th output point,
+        // and of the first point not belonging to.
+        std::vector<std::pair<unsigned int, unsigned int> > first_and_last_indices_vector;
+        // Worst case size
+        first_and_last_indices_vector.reserve (index_vector.size ());
+        while (index < index_vector.size ())
+        {
+            unsigned int i = index + 1;
+            while (i < index_vector.size () && index_vector[i].idx == index_vector[index].idx)
+                ++i;
+            if (i - index >= min_points_per_voxel_)
+            {
+                ++total;
+                first_and_last_indices_vector.push_back (std::pair<unsigned int, unsigned int> (index, i));
+            }
+            index = i;
+        }
+
+        // Fourth pass: compute centroids, insert them into their final position
+        output.points.resize (total);
+        if (save_leaf_layout_)
+        {
+            try
+            {
+                // Resizing won't reset old elements to -1.  If leaf_layout_ has been used previously, it needs to be re-initialized to -1
+                uint32_t new_layout_size = div_b_[0]*div_b_[1]*div_b_[2];
+                //This is the number of elements that need to be re-initialized to -1
+                uint32_t reinit_size = std::min (static_cast<unsigned int> (new_layout_size), static_cast<unsigned int> (leaf_layout_.size()));
+                for (uint32_t i = 0; i < reinit_size; i++)
+                {
+                    leaf_layout_[i] = -1;
+                }
+                leaf_layout_.resize (new_layout_size, -1);
+            }
+            catch (std::bad_alloc&)
+            {
+                throw pcl::PCLException("VoxelGridCovarianceMLOAM bin size is too low; impossible to allocate memory for layout",
+                    "voxel_grid.hpp", "applyFilter");
+            }
+            catch (std::length_error&)
+            {
+                throw pcl::PCLException("VoxelGridCovarianceMLOAM bin size is too low; impossible to allocate memory for layout",
+                  "voxel_grid.hpp", "applyFilter");
+            }
+        }
+
+        // TODO:
+        index = 0;
+        Eigen::VectorXf centroid = Eigen::VectorXf::Zero (centroid_size);
+        Eigen::VectorXf temporary = Eigen::VectorXf::Zero (centroid_size);
+        for (unsigned int cp = 0; cp < first_and_last_indices_vector.size (); ++cp)
+        {
+            // calculate centroid - sum values from all input points, that have the same idx value in index_vector array
+            unsigned int first_index = first_and_last_indices_vector[cp].first;
+            unsigned int last_index = first_and_last_indices_vector[cp].second;
+            unsigned int valid_cnt = last_index - first_index;
+            centroid.setZero();
+
+            // https://math.stackexchange.com/questions/195911/calculation-of-the-covariance-of-gaussian-mixtures
+            if (cov_index >= 0)
+            {
+                // revised version
+                Eigen::Vector3f mu = Eigen::Vector3f::Zero();
+                float ity = 0;
+                Eigen::Matrix<float, 7, 1> cov = Eigen::Matrix<float, 7, 1>::Zero();
+                float weight_total = 0;
+                float w_max = 0;
+                for (unsigned int i = first_index; i < last_index; ++i)
+                {
+                    pcl::for_each_type<FieldList>(pcl::NdCopyPointEigenFunctor<PointType>(input_->points[index_vector[i].cloud_point_index], temporary));
+                    if (abs(temporary[4] + temporary[7] + temporary[9]) >= trace_threshold_) // filter the point with the trace of the covariance > 2
+                    {
+                        valid_cnt--;
+                        continue;
+                    }
+                    float w = trace_threshold_ - (temporary[4] + temporary[7] + temporary[9]);
+                    // float dis = trace_threshold_ - (temporary[4] + temporary[7] + temporary[9]);
+                    // float w = dis > (trace_threshold_ / 2) ? (trace_threshold_ / 2) / dis : 1.0;
+                    // float w = dis * dis;
+                    mu.head(3) += w * temporary.head(3); // mu
+                    ity = w > w_max ? temporary[3] : ity; // intensity
+                    w_max = w > w_max ? w : w_max;
+                    cov += w * w * temporary.tail(7); // covariance
+                    
+                    weight_total += w;
+                }
+                if (valid_cnt == 0) valid_cnt = 1;
+
+                // index is centroid final position in resulting PointCloud
+                if (save_leaf_layout_) leaf_layout_[index_vector[first_index].idx] = index;
+
+                // compute the centroid
+                if (weight_total == 0) weight_total = 1.0;
+                mu.head(3) /= static_cast<float>(weight_total);
+                cov /= (static_cast<float>(weight_total) * static_cast<float>(weight_total));
+
+                centroid.head(3) = mu;
+                centroid[3] = ity;
+                centroid.tail(7) = cov;
+                centroid[10] = centroid[4] + centroid[7] + centroid[9];
+            } 
+            else
+            {
+                for (unsigned int i = first_index; i < last_index; ++i)
+                {
+                    pcl::for_each_type <FieldList> (pcl::NdCopyPointEigenFunctor <PointType> (input_->points[index_vector[i].cloud_point_index], temporary));
+                    if (!downsample_all_data_)
+                    {
+                        centroid[0] += input_->points[index_vector[i].cloud_point_index].x;
+                        centroid[1] += input_->points[index_vector[i].cloud_point_index].y;
+                        centroid[2] += input_->points[index_vector[i].cloud_point_index].z;
+                    }
+                    else
+                    {
+                        // ---[ RGB special case
+                        if (rgba_index >= 0)
+                        {
+                            // Fill r/g/b data, assuming that the order is BGRA
+                            pcl::RGB rgb;
+                            memcpy (&rgb, reinterpret_cast<const char*> (&input_->points[index_vector[i].cloud_point_index]) + rgba_index, sizeof (pcl::RGB));
+                            temporary[centroid_size-3] = rgb.r;
+                            temporary[centroid_size-2] = rgb.g;
+                            temporary[centroid_size-1] = rgb.b;
+                        } else
+                        {
+                            // pcl::for_each_type <FieldList> (pcl::NdCopyPointEigenFunctor <PointType> (input_->points[index_vector[i].cloud_point_index], temporary));
+                            centroid.head(3) += temporary.head(3);
+                            if (itsy_index >= 0) centroid[3] = temporary[3];
+                        }
+                    }
+                }
+                if (valid_cnt == 0) valid_cnt = 1;
+
+                // index is centroid final position in resulting PointCloud
+                if (save_leaf_layout_) leaf_layout_[index_vector[first_index].idx] = index;
+
+                // compute the centroid 
+                centroid.head(3) /= static_cast<float>(valid_cnt);
+                // float itsy;
+                // if (itsy_index >= 0) itsy = centroid[3];
+                // if (itsy_index >= 0) centroid[3] = itsy; // keep the original intensity
+            }
+
+            // store centroid
+            // Do we need to process all the fields?
+            if (!downsample_all_data_)
+            {
+                output.points[index].x = centroid[0];
+                output.points[index].y = centroid[1];
+                output.points[index].z = centroid[2];
+            }
+            else
+            {
+                pcl::for_each_type<FieldList> (pcl::NdCopyEigenPointFunctor <PointType> (centroid, output.points[index]));
+                // ---[ RGB special case
+                if (rgba_index >= 0)
+                {
+                    // pack r/g/b into rgb
+                    float r = centroid[centroid_size-3], g = centroid[centroid_size-2], b = centroid[centroid_size-1];
+                    int rgb = (static_cast<int> (r) << 16) | (static_cast<int> (g) << 8) | static_cast<int> (b);
+                    memcpy (reinterpret_cast<char*> (&output.points[index]) + rgba_index, &rgb, sizeof (float));
+                }
+            }
+            ++index;
+        }
+        output.width = static_cast<uint32_t> (output.points.size ());
+
+    }
+};
+
+bool comparePoint(const PointType &p1, const PointType &p2)
+{
+    const float EPS = 1e-4;
+    if ((fabs(p1.x - p2.x) > EPS) || (fabs(p1.y - p2.y) > EPS) || (fabs(p1.z - p2.z) > EPS)) return false;
+    if (p1.intensity != p2.intensity) return false;
+    for (size_t i = 0; i < 6; i++)
+        if (fabs(p1.cov_vec[i] - p2.cov_vec[i]) > EPS * std::max(1.0f, std::fabs(p1.cov_vec[i]))) return false;
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t num_points = argc > 1 ? std::stoi(argv[1]) : 1000000;
+    float leaf_size = argc > 2 ? std::stof(argv[2]) : 0.2;
+
+    PointCloud::Ptr cloud(new PointCloud);
+    if (argc > 3)
+    {
+        if (pcl::io::loadPCDFile(argv[3], *cloud) == -1)
+        {
+            printf("cannot load %s\n", argv[3]);
+            return -1;
+        }
+    }
+    else
+    {
+        // points on a few large planes with random covariances, similar to a surf map
+        std::mt19937 rng(0);
+        std::uniform_real_distribution<float> uni(-50.0, 50.0), uni_cov(0.0, 0.8), uni_ity(0.0, 255.0);
+        std::normal_distribution<float> noise(0.0, 0.05);
+        for (size_t i = 0; i < num_points; i++)
+        {
+            float u = uni(rng), v = uni(rng);
+            float x, y, z;
+            switch (i % 3)
+            {
+                case 0: x = u; y = v; z = noise(rng); break;
+                case 1: x = u; y = 20.0 + noise(rng); z = 0.1 * v; break;
+                default: x = -30.0 + noise(rng); y = u; z = 0.1 * v; break;
+            }
+            float cxx = uni_cov(rng), cyy = uni_cov(rng), czz = uni_cov(rng);
+            cloud->push_back(PointType(x, y, z, uni_ity(rng), cxx, 0.01, 0.01, cyy, 0.01, czz));
+        }
+    }
+    printf("points %lu, leaf size %f\n", cloud->size(), leaf_size);
+
+    const int NUM_RUNS = 5;
+    PointCloud cloud_legacy;
+    VoxelGridCovarianceLegacy filter_legacy;
+    filter_legacy.setInputCloud(cloud);
+    filter_legacy.setLeafSize(leaf_size, leaf_size, leaf_size);
+    filter_legacy.setTraceThreshold(2.0);
+    TicToc t_legacy;
+    for (int k = 0; k < NUM_RUNS; k++) filter_legacy.filter(cloud_legacy);
+    double time_legacy = t_legacy.toc() / NUM_RUNS;
+    printf("legacy: voxels %lu, %fms\n", cloud_legacy.size(), time_legacy);
+
+    std::vector<int> threads = {1, 2, 4, omp_get_max_threads()};
+    int mismatch_total = 0;
+    for (int num_threads : threads)
+    {
+        PointCloud cloud_new;
+        pcl::VoxelGridCovarianceMLOAM<PointType> filter;
+        filter.setInputCloud(cloud);
+        filter.setLeafSize(leaf_size, leaf_size, leaf_size);
+        filter.setTraceThreshold(2.0);
+        filter.setNumberOfThreads(num_threads);
+        TicToc t_new;
+        for (int k = 0; k < NUM_RUNS; k++) filter.filter(cloud_new);
+        double time_new = t_new.toc() / NUM_RUNS;
+
+        int mismatch = 0;
+        if (cloud_new.size() != cloud_legacy.size())
+        {
+            mismatch = std::max(cloud_new.size(), cloud_legacy.size());
+        }
+        else
+        {
+            for (size_t i = 0; i < cloud_new.size(); i++)
+                if (!comparePoint(cloud_new.points[i], cloud_legacy.points[i])) mismatch++;
+        }
+        mismatch_total += mismatch;
+        printf("threads %d: voxels %lu, %fms, speedup %f, mismatch %d\n",
+               num_threads, cloud_new.size(), time_new, time_legacy / time_new, mismatch);
+    }
+    return mismatch_total == 0 ? 0 : 1;
+}